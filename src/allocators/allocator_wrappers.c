@@ -1,21 +1,55 @@
+#define _GNU_SOURCE
 #include <src/lm.h>
 LM_LOG_REGISTER(allocator_wrappers);
 
 #include <src/metrics/timing.h>
+#include <src/metrics/hdr_histogram.h>
+#include <src/metrics/result_file.h>
+#include <src/utils/system_info.h>
 
 #include "u_arena.h"
 #include "karena.h"
 #include "oldkarena.h"
 #include "allocator_wrappers.h"
 
+#include <dlfcn.h>
+#include <stdio.h>
 #include <string.h>
 
-static struct alloc_tstats tstats;
-static struct alloc_tcoll tcoll = { 0, 0, NULL };
+// Each thread records into its own collection and/or histogram once it has
+// called init_alloc_tcoll or init_alloc_hist, so concurrent benchmarks don't
+// share a cursor. Threads without either fall back to the process-wide ones set
+// up by init_alloc_tcoll_dynamic and init_alloc_hist_shared, which are
+// recorded into atomically.
+static __thread struct alloc_tstats tstats;
+static __thread struct alloc_tcoll tcoll = { 0, 0, NULL };
+static __thread struct hdr_histogram *thist = NULL;
+
+// Subtracted from every sample, see get_tsc_timer_overhead
+static uint64_t timer_overhead = 0;
+
+static struct alloc_tstats shared_tstats;
+static struct alloc_tcoll shared_tcoll = { 0, 0, NULL };
+static struct hdr_histogram *shared_hist = NULL;
+
+void set_alloc_timer_overhead(uint64_t tsc)
+{
+	timer_overhead = tsc;
+}
+
+uint64_t get_alloc_timer_overhead(void)
+{
+	return timer_overhead;
+}
+
+static inline bool using_thread_timings(void)
+{
+	return tcoll.arr || thist || (!shared_tcoll.arr && !shared_hist);
+}
 
 struct alloc_tstats *get_alloc_tstats(void)
 {
-	return &tstats;
+	return using_thread_timings() ? &tstats : &shared_tstats;
 }
 
 void init_alloc_tcoll(uint64_t cap, uint64_t *arr)
@@ -27,43 +61,114 @@ void init_alloc_tcoll(uint64_t cap, uint64_t *arr)
 
 struct alloc_tcoll *get_alloc_tcoll(void)
 {
-	return &tcoll;
+	return using_thread_timings() ? &tcoll : &shared_tcoll;
+}
+
+void init_alloc_hist(struct hdr_histogram *hist)
+{
+	thist = hist;
+}
+
+void init_alloc_hist_shared(struct hdr_histogram *hist)
+{
+	shared_hist = hist;
+}
+
+struct hdr_histogram *get_alloc_hist(void)
+{
+	return using_thread_timings() ? thist : shared_hist;
+}
+
+static void add_shared_timing(uint64_t t, bool raw)
+{
+	if (raw)
+		__atomic_store_n(&shared_tstats.raw, true, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&shared_tstats.total_tsc, t, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&shared_tstats.iter, 1, __ATOMIC_RELAXED);
+	if (shared_hist)
+		hdr_record_atomic(shared_hist, t);
+	if (!shared_tcoll.arr)
+		return;
+	uint64_t i = __atomic_fetch_add(&shared_tcoll.cur, 1, __ATOMIC_RELAXED);
+	if (i < shared_tcoll.cap)
+		shared_tcoll.arr[i] = t;
 }
 
+// NOTE: (isa): Raw samples are only kept while there's room for them, so runs
+// that only need percentiles can record into a histogram with no collection,
+// or with one that is much smaller than the number of allocations
+static inline void record_timing(uint64_t t, bool raw)
+{
+	if (LM_UNLIKELY(!tcoll.arr && !thist)) {
+		add_shared_timing(t, raw);
+		return;
+	}
+
+	if (raw)
+		tstats.raw = true;
+	tstats.total_tsc += t;
+	tstats.iter += 1;
+	if (thist)
+		hdr_record(thist, t);
+	if (tcoll.cur < tcoll.cap)
+		tcoll.arr[tcoll.cur++] = t;
+}
+
+// The overhead is calibrated on an empty START/END_TSC_TIMING_LFENCE pair, so
+// it's only subtracted from samples that are one such pair around the work
 static inline void add_timing(uint64_t t)
 {
-	// Segfaulting is an OK way to discover that the array has run out
-	// of space in our case, since it's not production code
-	tcoll.arr[tcoll.cur++] = t;
+	// Saturates, since a sample can come in below the median overhead
+	record_timing(t > timer_overhead ? t - timer_overhead : 0, false);
 }
 
-void init_alloc_tcoll_dynamic(size_t cap)
+// For benchmarks that time something other than a single allocator call, but
+// want their results in the same format
+void add_alloc_timing(uint64_t tsc)
 {
-	UArena *ua = ua_create(cap, UA_CONTIGUOUS, UA_MMAPD);
-	tcoll.cap = cap;
-	tcoll.arr = (uint64_t *)(uintptr_t)ua->mem;
+	add_timing(tsc);
 }
 
-int write_alloc_timing_data_to_file(LmString filename, enum alloc_type type)
+// For intervals the calibration doesn't describe, e.g. a round trip between
+// processes or a pass over a buffer, which are recorded as they are. The
+// result file then records no overhead for them.
+void add_alloc_timing_raw(uint64_t tsc)
 {
-	FILE *file = lm_open_file_by_name(filename, "wb");
+	record_timing(tsc, true);
+}
 
-	int res;
-	if ((res = lm_write_bytes_to_file((uint8_t *)&tstats, sizeof(tstats),
-					  file)) != 0)
-		return res;
+void init_alloc_tcoll_dynamic(size_t cap)
+{
+	UArena *ua = ua_create(cap, UA_CONTIGUOUS, UA_MMAPD);
+	shared_tcoll.cur = 0;
+	shared_tcoll.cap = cap / sizeof(uint64_t);
+	shared_tcoll.arr = (uint64_t *)(uintptr_t)ua->mem;
+}
 
-	if ((res = lm_write_bytes_to_file((uint8_t *)&tcoll.cur,
-					  sizeof(tcoll.cur), file)) != 0)
-		return res;
+// Starts a result file, see result_file.h, with the raw samples as its first
+// section. The counters, memory footprint and histogram can be appended to it
+int write_timing_data_to_file(LmString filename, const struct result_info *info,
+			      struct alloc_tstats *stats,
+			      struct alloc_tcoll *coll)
+{
+	// The shared cursor keeps counting past the end of the collection
+	uint64_t count = coll->arr ? LmMin(coll->cur, coll->cap) : 0;
+	if (count < stats->iter)
+		LmLogDebug("Kept %lu of %lu raw samples for %s", count,
+			   stats->iter, filename);
 
-	if ((res = lm_write_bytes_to_file((uint8_t *)tcoll.arr,
-					  tcoll.cur * sizeof(uint64_t),
-					  file)) != 0)
-		return res;
+	int res = result_file_write(filename, info, stats->total_tsc,
+				    stats->iter, coll->arr, count, stats->raw);
+	if (res == 0)
+		LmLogInfo("Wrote timing stats and collection to %s", filename);
+	return res;
+}
 
-	LmLogInfo("Wrote timing stats and collection to %s", filename);
-	return 0;
+int write_alloc_timing_data_to_file(LmString filename,
+				    const struct result_info *info)
+{
+	return write_timing_data_to_file(filename, info, get_alloc_tstats(),
+					 get_alloc_tcoll());
 }
 
 void *oka_alloc_timed(UArena *ua, KArena *ka, size_t sz)
@@ -75,8 +180,6 @@ void *oka_alloc_timed(UArena *ua, KArena *ka, size_t sz)
 	//--------------------------------------
 	END_TSC_TIMING_LFENCE(alloc);
 	uint64_t alloc_time = alloc_end - alloc_start;
-	tstats.total_tsc += alloc_time;
-	tstats.iter += 1;
 	add_timing(alloc_time);
 	//--------------------------------------
 	return ptr;
@@ -91,8 +194,85 @@ void *ka_alloc_timed(UArena *ua, KArena *ka, size_t sz)
 	//--------------------------------------
 	END_TSC_TIMING_LFENCE(alloc);
 	uint64_t alloc_time = alloc_end - alloc_start;
-	tstats.total_tsc += alloc_time;
-	tstats.iter += 1;
+	add_timing(alloc_time);
+	//--------------------------------------
+	return ptr;
+}
+
+void *ka_zalloc_timed(UArena *ua, KArena *ka, size_t sz)
+{
+	(void)ua;
+	START_TSC_TIMING_LFENCE(alloc);
+	//--------------------------------------
+	void *ptr = ka_zalloc(ka, sz);
+	//--------------------------------------
+	END_TSC_TIMING_LFENCE(alloc);
+	uint64_t alloc_time = alloc_end - alloc_start;
+	add_timing(alloc_time);
+	//--------------------------------------
+	return ptr;
+}
+
+// NOTE: (isa): The *_talloc wrappers write to every page of the allocation
+// inside the timed region, so they measure the fault path of the backing
+// (kernel anon memory, karena or userfaultfd) and not just the arena
+static inline void touch_pages(uint8_t *ptr, size_t sz)
+{
+	// Cached, so sysconf isn't called inside the timed region
+	static size_t page_sz;
+
+	if (!ptr || sz == 0)
+		return;
+	if (!page_sz)
+		page_sz = get_page_size();
+
+	for (size_t off = 0; off < sz; off += page_sz)
+		((volatile uint8_t *)ptr)[off] = 1;
+	((volatile uint8_t *)ptr)[sz - 1] = 1;
+}
+
+void *ka_talloc_timed(UArena *ua, KArena *ka, size_t sz)
+{
+	(void)ua;
+	START_TSC_TIMING_LFENCE(alloc);
+	//--------------------------------------
+	void *ptr = ka_alloc(ka, sz);
+	touch_pages(ptr, sz);
+	//--------------------------------------
+	END_TSC_TIMING_LFENCE(alloc);
+	uint64_t alloc_time = alloc_end - alloc_start;
+	add_timing(alloc_time);
+	//--------------------------------------
+	return ptr;
+}
+
+void *ua_talloc_timed(UArena *ua, KArena *ka, size_t sz)
+{
+	(void)ka;
+	START_TSC_TIMING_LFENCE(alloc);
+	//--------------------------------------
+	void *ptr = ua_alloc(ua, sz);
+	touch_pages(ptr, sz);
+	//--------------------------------------
+	END_TSC_TIMING_LFENCE(alloc);
+	uint64_t alloc_time = alloc_end - alloc_start;
+	add_timing(alloc_time);
+	//--------------------------------------
+	return ptr;
+}
+
+// Same as ua_talloc_timed, but the arena is backed by userfaultfd. Kept as its
+// own function so the tests can tell which backing to create.
+void *uffd_talloc_timed(UArena *ua, KArena *ka, size_t sz)
+{
+	(void)ka;
+	START_TSC_TIMING_LFENCE(alloc);
+	//--------------------------------------
+	void *ptr = ua_alloc(ua, sz);
+	touch_pages(ptr, sz);
+	//--------------------------------------
+	END_TSC_TIMING_LFENCE(alloc);
+	uint64_t alloc_time = alloc_end - alloc_start;
 	add_timing(alloc_time);
 	//--------------------------------------
 	return ptr;
@@ -107,8 +287,20 @@ void *ua_alloc_timed(UArena *ua, KArena *ka, size_t sz)
 	//--------------------------------------
 	END_TSC_TIMING_LFENCE(alloc);
 	uint64_t alloc_time = alloc_end - alloc_start;
-	tstats.total_tsc += alloc_time;
-	tstats.iter += 1;
+	add_timing(alloc_time);
+	//--------------------------------------
+	return ptr;
+}
+
+void *ua_atomic_alloc_timed(UArena *ua, KArena *ka, size_t sz)
+{
+	(void)ka;
+	START_TSC_TIMING_LFENCE(alloc);
+	//--------------------------------------
+	void *ptr = ua_alloc_atomic(ua, sz);
+	//--------------------------------------
+	END_TSC_TIMING_LFENCE(alloc);
+	uint64_t alloc_time = alloc_end - alloc_start;
 	add_timing(alloc_time);
 	//--------------------------------------
 	return ptr;
@@ -123,8 +315,6 @@ void *ua_zalloc_timed(UArena *ua, KArena *ka, size_t sz)
 	//--------------------------------------
 	END_TSC_TIMING_LFENCE(alloc);
 	uint64_t alloc_time = alloc_end - alloc_start;
-	tstats.total_tsc += alloc_time;
-	tstats.iter += 1;
 	add_timing(alloc_time);
 	//--------------------------------------
 	return ptr;
@@ -139,8 +329,6 @@ void *ua_falloc_timed(UArena *ua, KArena *ka, size_t sz)
 	//--------------------------------------
 	END_TSC_TIMING_LFENCE(alloc);
 	uint64_t alloc_time = alloc_end - alloc_start;
-	tstats.total_tsc += alloc_time;
-	tstats.iter += 1;
 	add_timing(alloc_time);
 	//--------------------------------------
 	return ptr;
@@ -155,8 +343,6 @@ void *ua_fzalloc_timed(UArena *ua, KArena *ka, size_t sz)
 	//--------------------------------------
 	END_TSC_TIMING_LFENCE(alloc);
 	uint64_t alloc_time = alloc_end - alloc_start;
-	tstats.total_tsc += alloc_time;
-	tstats.iter += 1;
 	add_timing(alloc_time);
 	//--------------------------------------
 	return ptr;
@@ -166,16 +352,31 @@ void *ua_realloc_timed(UArena *ua, KArena *ka, void *ptr, size_t old_sz,
 		       size_t sz)
 {
 	(void)ka;
-	(void)ptr;
 	START_TSC_TIMING_LFENCE(alloc);
 	//--------------------------------------
 	void *new = ua_alloc(ua, sz);
-	memcpy(new, ptr, old_sz);
+	if (new && ptr)
+		memcpy(new, ptr, old_sz);
+	//--------------------------------------
+	END_TSC_TIMING_LFENCE(alloc);
+	uint64_t alloc_time = alloc_end - alloc_start;
+	add_timing(alloc_time);
+	//--------------------------------------
+	return new;
+}
+
+// Extends the allocation in place when nothing has been allocated after it,
+// unlike ua_realloc_timed which always copies
+void *ua_realloc_top_timed(UArena *ua, KArena *ka, void *ptr, size_t old_sz,
+			   size_t sz)
+{
+	(void)ka;
+	START_TSC_TIMING_LFENCE(alloc);
+	//--------------------------------------
+	void *new = ua_realloc(ua, ptr, old_sz, sz);
 	//--------------------------------------
 	END_TSC_TIMING_LFENCE(alloc);
 	uint64_t alloc_time = alloc_end - alloc_start;
-	tstats.total_tsc += alloc_time;
-	tstats.iter += 1;
 	add_timing(alloc_time);
 	//--------------------------------------
 	return new;
@@ -191,8 +392,6 @@ void *malloc_timed(UArena *ua, KArena *ka, size_t sz)
 	//--------------------------------------
 	END_TSC_TIMING_LFENCE(alloc);
 	uint64_t alloc_time = alloc_end - alloc_start;
-	tstats.total_tsc += alloc_time;
-	tstats.iter += 1;
 	add_timing(alloc_time);
 	//--------------------------------------
 	return ptr;
@@ -208,8 +407,6 @@ void *calloc_timed(UArena *ua, KArena *ka, size_t sz)
 	//--------------------------------------
 	END_TSC_TIMING_LFENCE(alloc);
 	uint64_t alloc_time = alloc_end - alloc_start;
-	tstats.total_tsc += alloc_time;
-	tstats.iter += 1;
 	add_timing(alloc_time);
 	//--------------------------------------
 	return ptr;
@@ -224,8 +421,6 @@ void free_timed(UArena *ua, void *ptr)
 	//--------------------------------------
 	END_TSC_TIMING_LFENCE(free);
 	uint64_t free_time = free_end - free_start;
-	tstats.total_tsc += free_time;
-	tstats.iter += 1;
 	add_timing(free_time);
 }
 
@@ -240,9 +435,188 @@ void *realloc_timed(UArena *ua, KArena *ka, void *ptr, size_t old_sz, size_t sz)
 	//--------------------------------------
 	END_TSC_TIMING_LFENCE(realloc);
 	uint64_t realloc_time = realloc_end - realloc_start;
-	tstats.total_tsc += realloc_time;
-	tstats.iter += 1;
 	add_timing(realloc_time);
 	//--------------------------------------
 	return new;
 }
+
+static struct alloc_plugin plugins[ALLOC_PLUGIN_MAX];
+static int plugin_count = 0;
+
+static void *plugin_malloc_timed(struct alloc_plugin *plugin, size_t sz)
+{
+	START_TSC_TIMING_LFENCE(alloc);
+	//--------------------------------------
+	void *ptr = plugin->malloc(sz);
+	//--------------------------------------
+	END_TSC_TIMING_LFENCE(alloc);
+	uint64_t alloc_time = alloc_end - alloc_start;
+	add_timing(alloc_time);
+	//--------------------------------------
+	return ptr;
+}
+
+static void *plugin_realloc_timed(struct alloc_plugin *plugin, void *ptr,
+				  size_t sz)
+{
+	START_TSC_TIMING_LFENCE(realloc);
+	//--------------------------------------
+	void *new = plugin->realloc(ptr, sz);
+	//--------------------------------------
+	END_TSC_TIMING_LFENCE(realloc);
+	uint64_t realloc_time = realloc_end - realloc_start;
+	add_timing(realloc_time);
+	//--------------------------------------
+	return new;
+}
+
+// NOTE: (isa): alloc_fn_t has no room for a context, so every plugin slot gets
+// its own pair of wrappers. The call from these into the timed function is
+// outside the timed region
+#define ALLOC_PLUGIN_WRAPPERS(n)                                               \
+	static void *plugin##n##_alloc_timed(UArena *ua, KArena *ka,          \
+					     size_t sz)                        \
+	{                                                                      \
+		(void)ua;                                                      \
+		(void)ka;                                                      \
+		return plugin_malloc_timed(&plugins[n], sz);                   \
+	}                                                                      \
+	static void *plugin##n##_realloc_timed(UArena *ua, KArena *ka,        \
+					       void *ptr, size_t old_sz,       \
+					       size_t sz)                      \
+	{                                                                      \
+		(void)ua;                                                      \
+		(void)ka;                                                      \
+		(void)old_sz;                                                  \
+		return plugin_realloc_timed(&plugins[n], ptr, sz);             \
+	}
+
+ALLOC_PLUGIN_WRAPPERS(0)
+ALLOC_PLUGIN_WRAPPERS(1)
+ALLOC_PLUGIN_WRAPPERS(2)
+ALLOC_PLUGIN_WRAPPERS(3)
+
+static const alloc_fn_t plugin_alloc_fns[ALLOC_PLUGIN_MAX] = {
+	plugin0_alloc_timed, plugin1_alloc_timed, plugin2_alloc_timed,
+	plugin3_alloc_timed
+};
+static const realloc_fn_t plugin_realloc_fns[ALLOC_PLUGIN_MAX] = {
+	plugin0_realloc_timed, plugin1_realloc_timed, plugin2_realloc_timed,
+	plugin3_realloc_timed
+};
+
+static void *plugin_symbol(void *handle, const char *prefix, const char *name,
+			   const char *path)
+{
+	char symbol[64];
+	snprintf(symbol, sizeof(symbol), "%s%s", prefix, name);
+	void *sym = dlsym(handle, symbol);
+	if (!sym) {
+		LmLogWarning("%s doesn't export %s", path, symbol);
+		return NULL;
+	}
+
+	// dlsym also searches the object's dependencies, so a library without
+	// its own malloc would quietly hand back glibc's
+	if (sym == dlsym(RTLD_DEFAULT, name)) {
+		LmLogWarning("%s in %s resolves to the process' own %s", symbol,
+			     path, name);
+		return NULL;
+	}
+	return sym;
+}
+
+// Loads a shared object that exports malloc, free and realloc, optionally
+// with a prefix, e.g. mi_ for mimalloc's own names. Returns NULL, with a
+// warning, if it can't be loaded, so a missing allocator doesn't stop the
+// suite. The plugins stay loaded until the process exits, since most
+// allocators don't support being unloaded
+const struct alloc_plugin *alloc_plugin_load(const char *name, const char *path,
+					     const char *prefix)
+{
+	if (plugin_count == ALLOC_PLUGIN_MAX) {
+		LmLogWarning("Only %d allocator plugins can be loaded, skipping %s",
+			     ALLOC_PLUGIN_MAX, name);
+		return NULL;
+	}
+	if (alloc_plugin_find(name)) {
+		LmLogWarning("Allocator plugin %s is already loaded", name);
+		return NULL;
+	}
+
+	// NOTE: (isa): RTLD_LOCAL keeps the plugin from interposing malloc for
+	// the rest of the process, and RTLD_DEEPBIND makes the plugin's own
+	// calls to malloc and free resolve to itself rather than to glibc
+	void *handle = dlopen(path, RTLD_NOW | RTLD_LOCAL | RTLD_DEEPBIND);
+	if (!handle) {
+		LmLogWarning("Unable to load allocator plugin %s: %s", name,
+			     dlerror());
+		return NULL;
+	}
+
+	const char *pre = prefix ? prefix : "";
+	struct alloc_plugin *plugin = &plugins[plugin_count];
+	*plugin = (struct alloc_plugin){ .handle = handle };
+	snprintf(plugin->name, sizeof(plugin->name), "%s", name);
+	*(void **)&plugin->malloc = plugin_symbol(handle, pre, "malloc", path);
+	*(void **)&plugin->free = plugin_symbol(handle, pre, "free", path);
+	*(void **)&plugin->realloc = plugin_symbol(handle, pre, "realloc", path);
+	if (!plugin->malloc || !plugin->free || !plugin->realloc) {
+		LmLogWarning("Skipping allocator plugin %s", name);
+		dlclose(handle);
+		*plugin = (struct alloc_plugin){ 0 };
+		return NULL;
+	}
+
+	plugin->alloc_fn = plugin_alloc_fns[plugin_count];
+	plugin->realloc_fn = plugin_realloc_fns[plugin_count];
+	++plugin_count;
+	LmLogInfo("Loaded allocator plugin %s from %s", name, path);
+	return plugin;
+}
+
+int alloc_plugin_count(void)
+{
+	return plugin_count;
+}
+
+const struct alloc_plugin *alloc_plugin_get(int i)
+{
+	return (i >= 0 && i < plugin_count) ? &plugins[i] : NULL;
+}
+
+const struct alloc_plugin *alloc_plugin_find(const char *name)
+{
+	for (int i = 0; i < plugin_count; ++i)
+		if (strcmp(plugins[i].name, name) == 0)
+			return &plugins[i];
+	return NULL;
+}
+
+const struct alloc_plugin *alloc_plugin_of(alloc_fn_t alloc_fn)
+{
+	for (int i = 0; i < plugin_count; ++i)
+		if (plugins[i].alloc_fn == alloc_fn)
+			return &plugins[i];
+	return NULL;
+}
+
+// Frees memory from malloc_timed, calloc_timed or a plugin's alloc_fn with the
+// free that goes with it
+void alloc_fn_free(alloc_fn_t alloc_fn, void *ptr)
+{
+	const struct alloc_plugin *plugin = alloc_plugin_of(alloc_fn);
+	if (plugin)
+		plugin->free(ptr);
+	else
+		free(ptr);
+}
+
+// Plugins are named after themselves rather than their alloc_type
+const char *alloc_fn_string(alloc_fn_t alloc_fn)
+{
+	const struct alloc_plugin *plugin = alloc_plugin_of(alloc_fn);
+	if (plugin)
+		return plugin->name;
+	return alloct_string(get_alloc_type(alloc_fn));
+}
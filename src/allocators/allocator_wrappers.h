@@ -3,6 +3,8 @@
 
 #include <src/lm.h>
 #include <src/metrics/timing.h>
+#include <src/metrics/hdr_histogram.h>
+#include <src/metrics/result_file.h>
 
 #include "u_arena.h"
 #include "karena.h"
@@ -16,11 +18,18 @@ enum alloc_type {
 	FREE,
 	OKA_ALLOC,
 	KA_ALLOC,
+	KA_ZALLOC,
+	KA_TALLOC,
 	UA_ALLOC,
 	UA_ZALLOC,
 	UA_FALLOC,
 	UA_FZALLOC,
 	UA_REALLOC,
+	UA_REALLOC_TOP,
+	UA_TALLOC,
+	UFFD_TALLOC,
+	UA_ATOMIC_ALLOC,
+	PLUGIN_ALLOC,
 	UNKNOWN
 };
 
@@ -40,6 +49,10 @@ static inline const char *alloct_string(enum alloc_type type)
 		return "oka_alloc";
 	case KA_ALLOC:
 		return "ka_alloc";
+	case KA_ZALLOC:
+		return "ka_zalloc";
+	case KA_TALLOC:
+		return "ka_talloc";
 	case UA_ALLOC:
 		return "ua_alloc";
 	case UA_ZALLOC:
@@ -50,6 +63,16 @@ static inline const char *alloct_string(enum alloc_type type)
 		return "ua_fzalloc";
 	case UA_REALLOC:
 		return "ua_realloc";
+	case UA_REALLOC_TOP:
+		return "ua_realloc_top";
+	case UA_TALLOC:
+		return "ua_talloc";
+	case UFFD_TALLOC:
+		return "uffd_talloc";
+	case UA_ATOMIC_ALLOC:
+		return "ua_atomic_alloc";
+	case PLUGIN_ALLOC:
+		return "plugin";
 	default:
 		return "unknown";
 	}
@@ -64,6 +87,15 @@ struct alloc_tcoll {
 struct alloc_tstats {
 	uint64_t total_tsc;
 	uint64_t iter;
+	bool raw; // Recorded with add_alloc_timing_raw, nothing was subtracted
+};
+
+// How the benchmarks keep their timings. The histogram is always cheap to
+// record into, while raw samples are needed for distribution plots
+struct alloc_timing_params {
+	bool raw_samples;
+	bool histogram;
+	int significant_digits;
 };
 
 struct alloc_timing_data {
@@ -76,22 +108,44 @@ typedef void (*free_fn_t)(UArena *ua, KArena *ka, void *ptr);
 typedef void *(*realloc_fn_t)(UArena *ua, KArena *ka, void *ptr, size_t old_sz,
 			      size_t sz);
 
+// The thread's own stats and collection once it has set up either of them, or
+// when nothing shared has been set up, and the shared ones otherwise. A thread
+// resets its stats after init_alloc_tcoll, so it zeroes its own rather than
+// the shared ones.
 struct alloc_tstats *get_alloc_tstats(void);
 void init_alloc_tcoll(uint64_t cap, uint64_t *arr);
 void init_alloc_tcoll_dynamic(size_t cap);
+void add_alloc_timing(uint64_t tsc);
+void add_alloc_timing_raw(uint64_t tsc);
 struct alloc_tcoll *get_alloc_tcoll(void);
-
-int write_alloc_timing_data_to_file(LmString filename, enum alloc_type type);
+void init_alloc_hist(struct hdr_histogram *hist);
+void init_alloc_hist_shared(struct hdr_histogram *hist);
+struct hdr_histogram *get_alloc_hist(void);
+void set_alloc_timer_overhead(uint64_t tsc);
+uint64_t get_alloc_timer_overhead(void);
+
+int write_timing_data_to_file(LmString filename, const struct result_info *info,
+			      struct alloc_tstats *stats,
+			      struct alloc_tcoll *coll);
+int write_alloc_timing_data_to_file(LmString filename,
+				    const struct result_info *info);
 
 void *oka_alloc_timed(UArena *ua, KArena *ka, size_t sz);
 void *ka_alloc_timed(UArena *ua, KArena *ka, size_t sz);
+void *ka_zalloc_timed(UArena *ua, KArena *ka, size_t sz);
+void *ka_talloc_timed(UArena *ua, KArena *ka, size_t sz);
 
 void *ua_alloc_timed(UArena *ua, KArena *ka, size_t sz);
 void *ua_zalloc_timed(UArena *ua, KArena *ka, size_t sz);
 void *ua_falloc_timed(UArena *ua, KArena *ka, size_t sz);
 void *ua_fzalloc_timed(UArena *ua, KArena *ka, size_t sz);
+void *ua_talloc_timed(UArena *ua, KArena *ka, size_t sz);
+void *uffd_talloc_timed(UArena *ua, KArena *ka, size_t sz);
+void *ua_atomic_alloc_timed(UArena *ua, KArena *ka, size_t sz);
 void *ua_realloc_timed(UArena *ua, KArena *ka, void *ptr, size_t old_sz,
 		       size_t sz);
+void *ua_realloc_top_timed(UArena *ua, KArena *ka, void *ptr, size_t old_sz,
+			   size_t sz);
 
 void *malloc_timed(UArena *ua, KArena *ka, size_t sz);
 void *calloc_timed(UArena *ua, KArena *ka, size_t sz);
@@ -99,6 +153,32 @@ void *realloc_timed(UArena *ua, KArena *ka, void *ptr, size_t old_sz,
 		    size_t sz);
 void free_timed(UArena *ua, void *ptr);
 
+#define ALLOC_PLUGIN_MAX 4
+#define ALLOC_PLUGIN_NAME_MAX 32
+
+// A malloc implementation loaded from a shared object at runtime, so it can be
+// benchmarked next to glibc's without preloading it for the whole process.
+// alloc_fn and realloc_fn are timed like malloc_timed and realloc_timed, and
+// what they return is given back with free, see alloc_fn_free
+struct alloc_plugin {
+	char name[ALLOC_PLUGIN_NAME_MAX];
+	void *handle;
+	void *(*malloc)(size_t sz);
+	void (*free)(void *ptr);
+	void *(*realloc)(void *ptr, size_t sz);
+	alloc_fn_t alloc_fn;
+	realloc_fn_t realloc_fn;
+};
+
+const struct alloc_plugin *alloc_plugin_load(const char *name, const char *path,
+					     const char *prefix);
+int alloc_plugin_count(void);
+const struct alloc_plugin *alloc_plugin_get(int i);
+const struct alloc_plugin *alloc_plugin_find(const char *name);
+const struct alloc_plugin *alloc_plugin_of(alloc_fn_t alloc_fn);
+void alloc_fn_free(alloc_fn_t alloc_fn, void *ptr);
+const char *alloc_fn_string(alloc_fn_t alloc_fn);
+
 static enum alloc_type get_alloc_type(alloc_fn_t alloc_fn)
 {
 	enum alloc_type type = UNKNOWN;
@@ -106,6 +186,10 @@ static enum alloc_type get_alloc_type(alloc_fn_t alloc_fn)
 		type = OKA_ALLOC;
 	else if (alloc_fn == ka_alloc_timed)
 		type = KA_ALLOC;
+	else if (alloc_fn == ka_zalloc_timed)
+		type = KA_ZALLOC;
+	else if (alloc_fn == ka_talloc_timed)
+		type = KA_TALLOC;
 	else if (alloc_fn == ua_alloc_timed)
 		type = UA_ALLOC;
 	else if (alloc_fn == ua_zalloc_timed)
@@ -114,10 +198,18 @@ static enum alloc_type get_alloc_type(alloc_fn_t alloc_fn)
 		type = UA_FALLOC;
 	else if (alloc_fn == ua_fzalloc_timed)
 		type = UA_FZALLOC;
+	else if (alloc_fn == ua_talloc_timed)
+		type = UA_TALLOC;
+	else if (alloc_fn == uffd_talloc_timed)
+		type = UFFD_TALLOC;
+	else if (alloc_fn == ua_atomic_alloc_timed)
+		type = UA_ATOMIC_ALLOC;
 	else if (alloc_fn == malloc_timed)
 		type = MALLOC;
 	else if (alloc_fn == calloc_timed)
 		type = CALLOC;
+	else if (alloc_plugin_of(alloc_fn))
+		type = PLUGIN_ALLOC;
 
 	return type;
 }
@@ -1,3 +1,5 @@
+#define _GNU_SOURCE
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <fcntl.h>
@@ -8,38 +10,149 @@
 
 #include "karena.h"
 
-static int fd = 0;
+static int fd = -1;
+static pid_t fd_pid = 0;
 
-KArena *ka_create(size_t size)
+// NOTE: (isa): Arena handles are indices into the module's arena table, so the
+// flags each arena was created with can be kept in a table of the same size
+static unsigned long ka_flags[KARENA_MAX_ARENAS];
+
+// Kept next to the user flags. Bootstrapped arenas live inside the mapping of
+// the arena they were made from, so they can neither be grown nor unmapped.
+#define KA__BOOTSTRAPPED__ (1UL << (sizeof(unsigned long) * 8 - 1))
+// Imported arenas are mapped at a different address than in the owner, so the
+// local mapping is kept here
+#define KA__IMPORTED__ (1UL << (sizeof(unsigned long) * 8 - 2))
+
+static void *ka_import_base[KARENA_MAX_ARENAS];
+static size_t ka_import_size[KARENA_MAX_ARENAS];
+
+static unsigned long ka_get_flags(KArena *arena)
+{
+	unsigned long index = (unsigned long)arena;
+	return (index < KARENA_MAX_ARENAS) ? ka_flags[index] : 0;
+}
+
+// NOTE: (isa): A forked child opens the device again, so that the arenas it
+// creates or imports are tied to its own file and released when it exits
+static int ka_open_device(void)
+{
+	if (fd >= 0 && fd_pid == getpid())
+		return 0;
+
+	fd = open("/dev/karena", O_RDWR);
+	if (fd < 0) {
+		perror("Failed to open device");
+		return -1;
+	}
+
+	fd_pid = getpid();
+	return 0;
+}
+
+KArena *ka_create(size_t size, unsigned long flags)
 {
 	struct ka_data alloc = {
 		.size = size,
+		.flags = flags,
 	};
 
-	if (!fd) {
-		fd = open("/dev/karena", O_RDWR);
-		if (fd < 0) {
-			perror("Failed to open device");
-			return NULL;
-		}
-	}
+	if (ka_open_device() != 0)
+		return NULL;
 
+	// NOTE: (isa): The device is shared by every arena of the process, so
+	// it stays open when a single arena can not be created
 	if (ioctl(fd, KARENA_CREATE, &alloc) < 0) {
 		perror("Memory allocation failed");
-		close(fd);
 		return NULL;
 	}
 
-	if (mmap(NULL, alloc.size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) ==
-	    MAP_FAILED) {
+	// Each arena is mapped through its own window of the device's offsets
+	if (mmap(NULL, alloc.size, PROT_READ | PROT_WRITE, MAP_SHARED, fd,
+		 (off_t)alloc.arena << KARENA_MMAP_SHIFT) == MAP_FAILED) {
 		perror("mmap failed");
-		close(fd);
+		// Nothing was mapped, but the module has made the arena
+		if (ioctl(fd, KARENA_DESTROY, &alloc))
+			perror("Destroy failed");
 		return NULL;
 	}
 
+	if (alloc.arena < KARENA_MAX_ARENAS)
+		ka_flags[alloc.arena] = flags;
+
 	return (KArena *)alloc.arena;
 }
 
+// NOTE: (isa): ka_alloc grows behind the caller's back, so it passes no
+// mremap flags and the mapping stays where it is or the growth fails. Only
+// ka_grow lets it move, since its callers rebase on the returned base.
+static void *ka_grow_mapping(KArena *arena, size_t size, int mremap_flags)
+{
+	struct ka_data alloc = {
+		.arena = (unsigned long)arena,
+		.size = size,
+	};
+	size_t old_size;
+	void *old_base;
+	void *base;
+
+	if (ka_get_flags(arena) & (KA__BOOTSTRAPPED__ | KA__IMPORTED__)) {
+		fprintf(stderr, "Bootstrapped and imported arenas can not grow\n");
+		return NULL;
+	}
+
+	old_size = ka_size(arena);
+	old_base = ka_base(arena);
+	if (old_size == (size_t)-1 || !old_base)
+		return NULL;
+
+	if (size <= old_size)
+		return old_base;
+
+	// The mapping is grown first so that the arena never hands out memory
+	// outside of it. With MREMAP_MAYMOVE mremap moves the mapping (which
+	// the module follows) when it can not grow in place.
+	base = mremap(old_base, old_size, size, mremap_flags);
+	if (base == MAP_FAILED) {
+		if (mremap_flags & MREMAP_MAYMOVE)
+			perror("mremap failed");
+		return NULL;
+	}
+
+	if (ioctl(fd, KARENA_GROW, &alloc)) {
+		perror("Grow failed");
+		if (mremap(base, size, old_size, 0) == MAP_FAILED)
+			perror("mremap failed");
+		return NULL;
+	}
+
+	return base;
+}
+
+void *ka_grow(KArena *arena, size_t size)
+{
+	return ka_grow_mapping(arena, size, MREMAP_MAYMOVE);
+}
+
+// Doubles the arena in place until there is room for size more bytes
+static int ka_grow_for(KArena *arena, size_t size)
+{
+	size_t old_size = ka_size(arena);
+	size_t new_size = old_size;
+
+	if (old_size == (size_t)-1 || old_size == 0 ||
+	    (ka_get_flags(arena) & (KA__BOOTSTRAPPED__ | KA__IMPORTED__)))
+		return 0;
+
+	while (new_size < old_size + size) {
+		if (new_size > KARENA_MAX_SIZE / 2)
+			return 0;
+		new_size *= 2;
+	}
+
+	return ka_grow_mapping(arena, new_size, 0) != NULL;
+}
+
 void *ka_alloc(KArena *arena, size_t size)
 {
 	struct ka_data alloc = {
@@ -47,18 +160,63 @@ void *ka_alloc(KArena *arena, size_t size)
 		.size = size,
 	};
 
-	if (ioctl(fd, KARENA_ALLOC, &alloc)) {
-		perror("Arena allocation failed");
+	if (ka_get_flags(arena) & KA__IMPORTED__) {
+		fprintf(stderr, "Imported arenas can not be allocated from\n");
 		return 0;
 	}
 
+	if (ioctl(fd, KARENA_ALLOC, &alloc)) {
+		// NOTE: (isa): The ioctl does not write back on failure, so
+		// alloc can be reused for the retry
+		if (errno != ENOMEM || !ka_grow_for(arena, size) ||
+		    ioctl(fd, KARENA_ALLOC, &alloc)) {
+			perror("Arena allocation failed");
+			return 0;
+		}
+	}
+
 	return (void *)alloc.arena;
 }
 
+int ka_nop(void)
+{
+	if (ka_open_device() != 0)
+		return -1;
+	return ioctl(fd, KARENA_NOP);
+}
+
+int ka_echo(KArena *arena)
+{
+	struct ka_data alloc = {
+		.arena = (unsigned long)arena,
+	};
+
+	return ioctl(fd, KARENA_ECHO, &alloc);
+}
+
+void *ka_alloc_stamped(KArena *arena, size_t size,
+		       unsigned long long tsc[KA_STAMP_COUNT])
+{
+	struct ka_stamped_data stamped = {
+		.data = { .arena = (unsigned long)arena, .size = size },
+	};
+
+	if (ioctl(fd, KARENA_ALLOC_STAMPED, &stamped)) {
+		perror("Stamped arena allocation failed");
+		return 0;
+	}
+
+	memcpy(tsc, stamped.tsc, sizeof(stamped.tsc));
+	return (void *)stamped.data.arena;
+}
+
 void *ka_zalloc(KArena *arena, size_t size)
 {
 	void *ptr = ka_alloc(arena, size);
-	explicit_bzero(ptr, size);
+	// With KA_ZERO_ON_REUSE the kernel guarantees that everything above
+	// the arena's position is zero
+	if (ptr && !(ka_get_flags(arena) & KA_ZERO_ON_REUSE))
+		explicit_bzero(ptr, size);
 	return ptr;
 }
 
@@ -129,6 +287,9 @@ void *ka_base(KArena *arena)
 		.arena = (unsigned long)arena,
 	};
 
+	if (ka_get_flags(arena) & KA__IMPORTED__)
+		return ka_import_base[(unsigned long)arena];
+
 	if (ioctl(fd, KARENA_BASE, &alloc)) {
 		perror("Base failed");
 		return NULL;
@@ -143,6 +304,10 @@ size_t ka_size(KArena *arena)
 		.arena = (unsigned long)arena,
 	};
 
+	// The owner might have grown the arena past our mapping
+	if (ka_get_flags(arena) & KA__IMPORTED__)
+		return ka_import_size[(unsigned long)arena];
+
 	if (ioctl(fd, KARENA_SIZE, &alloc)) {
 		perror("Size failed");
 		return (size_t)-1;
@@ -151,18 +316,117 @@ size_t ka_size(KArena *arena)
 	return alloc.size;
 }
 
+size_t ka_decommit(KArena *arena, size_t watermark)
+{
+	struct ka_data alloc = {
+		.arena = (unsigned long)arena,
+		.size = watermark,
+	};
+
+	if (ioctl(fd, KARENA_DECOMMIT, &alloc)) {
+		perror("Decommit failed");
+		return 0;
+	}
+
+	return alloc.size;
+}
+
 void ka_destroy(KArena *arena)
 {
 	struct ka_data alloc = {
 		.arena = (unsigned long)arena,
 	};
+	void *base = NULL;
+	size_t size = 0;
+
+	if (ka_get_flags(arena) & KA__IMPORTED__) {
+		ka_unimport(arena);
+		return;
+	}
+
+	// The mapping might have been moved by ka_grow, so look it up before
+	// the arena is gone
+	if (!(ka_get_flags(arena) & KA__BOOTSTRAPPED__)) {
+		base = ka_base(arena);
+		size = ka_size(arena);
+	}
 
 	if (ioctl(fd, KARENA_DESTROY, &alloc)) {
 		perror("Destroy failed");
 	}
 
-	if (alloc.size > 0)
-		munmap((void *)arena, alloc.size);
+	if ((unsigned long)arena < KARENA_MAX_ARENAS)
+		ka_flags[(unsigned long)arena] = 0;
+
+	if (base && size > 0 && size != (size_t)-1)
+		munmap(base, size);
+}
+
+unsigned long ka_export(KArena *arena)
+{
+	struct ka_data alloc = {
+		.arena = (unsigned long)arena,
+	};
+
+	if (ioctl(fd, KARENA_EXPORT, &alloc)) {
+		perror("Export failed");
+		return 0;
+	}
+
+	return alloc.token;
+}
+
+KArena *ka_import(unsigned long token)
+{
+	struct ka_data alloc = {
+		.token = token,
+	};
+	void *base;
+
+	if (ka_open_device() != 0)
+		return NULL;
+
+	if (ioctl(fd, KARENA_IMPORT, &alloc)) {
+		perror("Import failed");
+		return NULL;
+	}
+
+	base = mmap(NULL, alloc.size, PROT_READ | PROT_WRITE, MAP_SHARED, fd,
+		    (off_t)alloc.arena << KARENA_MMAP_SHIFT);
+	if (base == MAP_FAILED) {
+		perror("mmap failed");
+		ioctl(fd, KARENA_UNIMPORT, &alloc);
+		return NULL;
+	}
+
+	ka_flags[alloc.arena] = alloc.flags | KA__IMPORTED__;
+	ka_import_base[alloc.arena] = base;
+	ka_import_size[alloc.arena] = alloc.size;
+
+	return (KArena *)alloc.arena;
+}
+
+void ka_unimport(KArena *arena)
+{
+	unsigned long index = (unsigned long)arena;
+	struct ka_data alloc = {
+		.arena = index,
+	};
+
+	if (!(ka_get_flags(arena) & KA__IMPORTED__)) {
+		fprintf(stderr, "Arena %lu is not imported\n", index);
+		return;
+	}
+
+	// The module gives the pages back when the last reference is dropped,
+	// so the mapping has to go first
+	munmap(ka_import_base[index], ka_import_size[index]);
+	if (ioctl(fd, KARENA_UNIMPORT, &alloc))
+		perror("Unimport failed");
+
+	ka_flags[index] = 0;
+	ka_import_base[index] = NULL;
+	ka_import_size[index] = 0;
 }
 
 KArena *ka_bootstrap(KArena *arena, size_t size)
@@ -177,6 +441,10 @@ KArena *ka_bootstrap(KArena *arena, size_t size)
 		return NULL;
 	}
 
+	if (alloc.arena < KARENA_MAX_ARENAS)
+		ka_flags[alloc.arena] = ka_get_flags(arena) |
+					KA__BOOTSTRAPPED__;
+
 	return (KArena *)alloc.arena;
 }
 
@@ -13,12 +13,58 @@
 #define KARENA_SIZE _IOWR(KARENA_MAGIC, 9, struct ka_data)
 #define KARENA_BOOTSTRAP _IOWR(KARENA_MAGIC, 10, struct ka_data)
 #define KARENA_BASE _IOWR(KARENA_MAGIC, 11, struct ka_data)
+#define KARENA_DECOMMIT _IOWR(KARENA_MAGIC, 12, struct ka_data)
+#define KARENA_GROW _IOWR(KARENA_MAGIC, 13, struct ka_data)
+#define KARENA_EXPORT _IOWR(KARENA_MAGIC, 14, struct ka_data)
+#define KARENA_IMPORT _IOWR(KARENA_MAGIC, 15, struct ka_data)
+#define KARENA_UNIMPORT _IOWR(KARENA_MAGIC, 16, struct ka_data)
+// For measuring the ioctl path itself. NOP returns before anything is copied,
+// ECHO copies struct ka_data in and back out without touching an arena
+#define KARENA_NOP _IO(KARENA_MAGIC, 17)
+#define KARENA_ECHO _IOWR(KARENA_MAGIC, 18, struct ka_data)
+#define KARENA_ALLOC_STAMPED _IOWR(KARENA_MAGIC, 19, struct ka_stamped_data)
+
+#define KARENA_MAX_ARENAS 100
+
+// Arena n is mapped at offset n << KARENA_MMAP_SHIFT of /dev/karena, which also
+// bounds how large an arena can grow
+#define KARENA_MMAP_SHIFT 40
+#define KARENA_MAX_SIZE (1UL << KARENA_MMAP_SHIFT)
+
+// ka_create flags
+// Memory given back with seek/pop/free is zeroed by the kernel, and whole pages
+// are decommitted, so ka_zalloc does not have to memset
+#define KA_ZERO_ON_REUSE (1UL << 0)
+// Backing pages are taken from the NUMA node of the CPU calling ka_create
+#define KA_NODE_LOCAL (1UL << 1)
+// Backing pages are taken from NUMA node n. Without KA_NODE_LOCAL or
+// KA_NODE(n) pages come from the node of the CPU that first touches them.
+#define KA_NODE_SHIFT 16
+#define KA_NODE_MASK (0xffffUL << KA_NODE_SHIFT)
+#define KA_NODE(n) ((((unsigned long)(n) + 1) << KA_NODE_SHIFT) & KA_NODE_MASK)
+#define KA_NODE_OF(flags) ((int)(((flags) & KA_NODE_MASK) >> KA_NODE_SHIFT) - 1)
 
 typedef unsigned long KArena;
 
 struct ka_data {
 	size_t size;
 	unsigned long arena;
+	unsigned long flags;
+	unsigned long token;
+};
+
+// Where KARENA_ALLOC_STAMPED reads the TSC on its way through the module
+enum ka_stamp {
+	KA_STAMP_ENTRY, // First thing in the ioctl handler
+	KA_STAMP_COPIED_IN, // After copy_from_user
+	KA_STAMP_LOOKED_UP, // After finding the arena in karenas[]
+	KA_STAMP_BUMPED, // After the bump, before copy_to_user
+	KA_STAMP_COUNT
+};
+
+struct ka_stamped_data {
+	struct ka_data data;
+	unsigned long long tsc[KA_STAMP_COUNT];
 };
 
 typedef struct {
@@ -77,7 +123,7 @@ struct ka__thread_arenas__ {
 #define KaPushStruct(a, type) KaPushArray(a, type, 1)
 #define KaPushStructZero(a, type) KaPushArrayZero(a, type, 1)
 
-KArena *ka_create(size_t size);
+KArena *ka_create(size_t size, unsigned long flags);
 void *ka_alloc(KArena *arena, size_t size);
 void *ka_zalloc(KArena *arena, size_t size);
 void *ka_seek(KArena *arena, size_t pos);
@@ -87,7 +133,28 @@ size_t ka_pos(KArena *arena);
 size_t ka_reserve(KArena *arena, size_t sz);
 size_t ka_size(KArena *arena);
 void *ka_base(KArena *arena);
+size_t ka_decommit(KArena *arena, size_t watermark);
+// Grows the arena to size bytes. The mapping may move, so pointers into the
+// arena (and its bootstrapped arenas) have to be rebased on the returned base.
+// ka_alloc also grows an arena that runs out, but only in place, and returns
+// NULL when the mapping can not grow where it is.
+void *ka_grow(KArena *arena, size_t size);
+// Sharing an arena with another process. The exporter hands the token to the
+// importer, which maps the same pages with ka_import. Pointers are not valid
+// across processes, so share offsets from ka_base instead. The pages live
+// until the owner has destroyed the arena and every importer has unimported
+// it (or exited). Imported arenas can not be allocated from.
+unsigned long ka_export(KArena *arena);
+KArena *ka_import(unsigned long token);
+void ka_unimport(KArena *arena);
 void ka_destroy(KArena *arena);
+// Benchmarking the module, see KARENA_NOP and KARENA_ECHO. ka_alloc_stamped
+// is ka_alloc with the module's TSC stamps of the call, and never grows the
+// arena
+int ka_nop(void);
+int ka_echo(KArena *arena);
+void *ka_alloc_stamped(KArena *arena, size_t size,
+		       unsigned long long tsc[KA_STAMP_COUNT]);
 KArena *ka_bootstrap(KArena *arena, size_t size);
 void ka__thread_arenas_init__(KArena *ta_buf[], struct ka__thread_arenas__ *tas,
 			      struct ka__thread_arenas__ **ta_instance);
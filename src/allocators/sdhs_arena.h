@@ -2,6 +2,8 @@
 #define SDHS_ARENA_H
 
 #include <src/lm.h>
+#include <src/metrics/alloc_trace.h>
+#include <src/metrics/mem_footprint.h>
 
 #ifndef SDHS_TEST_ARENA
 #define SDHS_TEST_ARENA 2
@@ -21,21 +23,27 @@ typedef KAScratch SdhsArenaScratch;
 
 #define SDHS_ALLOC_FN ka_alloc_timed
 
-#define ArenaCreate(cap, contiguous, mallocd) ka_create((cap))
-#define ArenaDestroy(kap) ka_destroy((*kap))
+#define ArenaCreate(cap, contiguous, mallocd) ka_create((cap), 0)
+#define ArenaDestroy(kap) sdhs_arena_destroy((*kap))
 #define ArenaBootstrap(ka, new_existing, cap) ka_bootstrap((ka), (cap))
-#define ArenaAlloc(ka, size) SDHS_ALLOC_FN(NULL, (ka), (size))
-#define ArenaFree(ka) ka_free((ka))
-#define ArenaPop(ka, size) ka_pop((ka), (size))
+#define ArenaAlloc(ka, size) \
+	sdhs_arena_traced((ka), SDHS_ALLOC_FN(NULL, (ka), (size)), (size))
+#define ArenaFree(ka) sdhs_arena_free((ka))
+#define ArenaPop(ka, size) sdhs_arena_pop((ka), (size))
 #define ArenaPos(ka) ka_pos((ka))
-#define ArenaSeek(ka, pos) ka_seek((ka), (pos))
+#define ArenaSeek(ka, pos) sdhs_arena_seek((ka), (pos))
 #define ArenaCap(ka) ka_size((ka))
 #define ArenaBase(ka) ka_base((ka))
 #define ArenaReserve(ka, sz) ka_reserve((ka), (sz))
-#define ArenaPushArray(a, type, count) KaPushArray(a, type, count)
-#define ArenaPushArrayZero(a, type, count) KaPushArrayZero(a, type, count)
-#define ArenaPushStruct(a, type) KaPushStruct(a, type)
-#define ArenaPushStructZero(a, type) KaPushStructZero(a, type)
+#define ArenaPushArray(a, type, count) \
+	sdhs_arena_traced(a, KaPushArray(a, type, count), sizeof(type) * (count))
+#define ArenaPushArrayZero(a, type, count)                 \
+	sdhs_arena_traced(a, KaPushArrayZero(a, type, count), \
+			  sizeof(type) * (count))
+#define ArenaPushStruct(a, type) \
+	sdhs_arena_traced(a, KaPushStruct(a, type), sizeof(type))
+#define ArenaPushStructZero(a, type) \
+	sdhs_arena_traced(a, KaPushStructZero(a, type), sizeof(type))
 #define THREAD_ARENAS_REGISTER(thread_name, count) \
 	KA_THREAD_ARENAS_REGISTER(thread_name, count)
 #define THREAD_ARENAS_EXTERN(thread_name) KA_THREAD_ARENAS_EXTERN(thread_name)
@@ -46,7 +54,47 @@ typedef KAScratch SdhsArenaScratch;
 #define ScratchBegin(arena) ka_scratch_begin(arena)
 #define ScratchGet(conflicts, conflict_count) \
 	KaScratchGet(conflicts, conflict_count)
-#define ScratchRelease(scratch) ka_scratch_release(scratch)
+#define ScratchRelease(scratch) sdhs_scratch_release(scratch)
+
+static inline void *sdhs_arena_traced(SdhsArena *a, void *ptr, size_t size)
+{
+	mem_count_request(a, ptr, size);
+	if (LM_UNLIKELY(alloc_trace_active))
+		alloc_trace_arena_alloc(a, ArenaBase(a), ptr, size);
+	return ptr;
+}
+
+static inline void sdhs_arena_destroy(SdhsArena *a)
+{
+	mem_request_forget_arena(a);
+	ka_destroy(a);
+}
+
+static inline void *sdhs_arena_free(SdhsArena *a)
+{
+	void *ptr = ka_free(a);
+	alloc_trace_arena_seek(a, 0);
+	return ptr;
+}
+
+static inline void sdhs_arena_pop(SdhsArena *a, size_t size)
+{
+	ka_pop(a, size);
+	alloc_trace_arena_seek(a, ka_pos(a));
+}
+
+static inline void *sdhs_arena_seek(SdhsArena *a, size_t pos)
+{
+	void *ptr = ka_seek(a, pos);
+	alloc_trace_arena_seek(a, pos);
+	return ptr;
+}
+
+static inline void sdhs_scratch_release(SdhsArenaScratch scratch)
+{
+	ka_scratch_release(scratch);
+	alloc_trace_arena_seek(scratch.ua, scratch.f5);
+}
 
 #endif
 
@@ -66,21 +114,27 @@ typedef UAScratch SdhsArenaScratch;
 
 #define ArenaCreate(cap, contiguous, mallocd) \
 	ua_create(cap, contiguous, mallocd)
-#define ArenaDestroy(uap) ua_destroy(uap)
+#define ArenaDestroy(uap) sdhs_arena_destroy(uap)
 #define ArenaBootstrap(ua, new_existing, cap) \
 	ua_bootstrap(ua, new_existing, cap)
-#define ArenaAlloc(ua, size) SDHS_ALLOC_FN(ua, NULL, size)
-#define ArenaFree(ua) ua_free(ua)
-#define ArenaPop(ua, size) ua_pop(ua, size)
+#define ArenaAlloc(ua, size) \
+	sdhs_arena_traced(ua, SDHS_ALLOC_FN(ua, NULL, size), size)
+#define ArenaFree(ua) sdhs_arena_free(ua)
+#define ArenaPop(ua, size) sdhs_arena_pop(ua, size)
 #define ArenaPos(ua) ua_pos(ua)
-#define ArenaSeek(ua, pos) ua_seek(ua, pos)
+#define ArenaSeek(ua, pos) sdhs_arena_seek(ua, pos)
 #define ArenaCap(ua) (ua)->cap
 #define ArenaBase(ua) (ua)->mem
 #define ArenaReserve(ua, sz) ua_reserve(ua, sz)
-#define ArenaPushArray(a, type, count) UaPushArray(a, type, count)
-#define ArenaPushArrayZero(a, type, count) UaPushArrayZero(a, type, count)
-#define ArenaPushStruct(a, type) UaPushStruct(a, type)
-#define ArenaPushStructZero(a, type) UaPushStruct(a, type)
+#define ArenaPushArray(a, type, count) \
+	sdhs_arena_traced(a, UaPushArray(a, type, count), sizeof(type) * (count))
+#define ArenaPushArrayZero(a, type, count)                 \
+	sdhs_arena_traced(a, UaPushArrayZero(a, type, count), \
+			  sizeof(type) * (count))
+#define ArenaPushStruct(a, type) \
+	sdhs_arena_traced(a, UaPushStruct(a, type), sizeof(type))
+#define ArenaPushStructZero(a, type) \
+	sdhs_arena_traced(a, UaPushStruct(a, type), sizeof(type))
 #define THREAD_ARENAS_REGISTER(thread_name, count) \
 	UA_THREAD_ARENAS_REGISTER(thread_name, count)
 #define THREAD_ARENAS_EXTERN(thread_name) UA_THREAD_ARENAS_EXTERN(thread_name)
@@ -91,7 +145,46 @@ typedef UAScratch SdhsArenaScratch;
 #define ScratchBegin(arena) ua_scratch_begin(arena)
 #define ScratchGet(conflicts, conflict_count) \
 	UaScratchGet(conflicts, conflict_count)
-#define ScratchRelease(scratch) ua_scratch_release(scratch)
+#define ScratchRelease(scratch) sdhs_scratch_release(scratch)
+
+static inline void *sdhs_arena_traced(SdhsArena *a, void *ptr, size_t size)
+{
+	mem_count_request(a, ptr, size);
+	if (LM_UNLIKELY(alloc_trace_active))
+		alloc_trace_arena_alloc(a, ArenaBase(a), ptr, size);
+	return ptr;
+}
+
+static inline void sdhs_arena_destroy(SdhsArena **ap)
+{
+	mem_request_forget_arena(*ap);
+	ua_destroy(ap);
+}
+
+static inline void sdhs_arena_free(SdhsArena *a)
+{
+	ua_free(a);
+	alloc_trace_arena_seek(a, 0);
+}
+
+static inline void sdhs_arena_pop(SdhsArena *a, size_t size)
+{
+	ua_pop(a, size);
+	alloc_trace_arena_seek(a, ua_pos(a));
+}
+
+static inline void *sdhs_arena_seek(SdhsArena *a, size_t pos)
+{
+	void *ptr = ua_seek(a, pos);
+	alloc_trace_arena_seek(a, pos);
+	return ptr;
+}
+
+static inline void sdhs_scratch_release(SdhsArenaScratch scratch)
+{
+	ua_scratch_release(scratch);
+	alloc_trace_arena_seek(scratch.ua, scratch.f5);
+}
 
 #endif // SDHS_TEST_U_ARENA
 #endif
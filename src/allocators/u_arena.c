@@ -7,6 +7,7 @@ LM_LOG_REGISTER(u_arena);
 #include <src/metrics/timing.h>
 
 #include "u_arena.h"
+#include "u_arena_uffd.h"
 
 #include <stdbool.h>
 #include <stdio.h>
@@ -81,6 +82,11 @@ void ua_destroy(UArena **uap)
 		UArena *ua = *uap;
 		if (UaIsBootstrapped(ua->flags))
 			return;
+		if (UaIsUffd(ua->flags)) {
+			ua_uffd_destroy(ua);
+			*uap = NULL;
+			return;
+		}
 		if (!ua->mem) {
 			LmLogWarning("Arena memory was NULL");
 			return;
@@ -133,6 +139,17 @@ void *ua_alloc(UArena *ua, size_t size)
 	return ptr;
 }
 
+// For arenas shared between threads. A failed allocation still moves cur past
+// cap, so every later call on the arena fails as well.
+void *ua_alloc_atomic(UArena *ua, size_t size)
+{
+	size_t cur = __atomic_fetch_add(&ua->cur, size, __ATOMIC_RELAXED);
+	if (LM_UNLIKELY(cur + size > ua->cap))
+		return NULL;
+
+	return ua->mem + cur;
+}
+
 // NOTE: (isa): See 'poc/page_zalloc/u_arena.c' for a short
 // discussion on why zeroing individual allocations is better
 // than pre-zeroing larger chunks
@@ -162,6 +179,28 @@ void *ua_fzalloc(UArena *ua, size_t size)
 	return ptr;
 }
 
+// Grows or shrinks ptr in place when it's the last allocation on the arena,
+// like LmString does, and otherwise falls back to a new allocation and a copy
+void *ua_realloc(UArena *ua, void *ptr, size_t old_size, size_t size)
+{
+	if (ptr && (uint8_t *)ptr + old_size == ua->mem + ua->cur) {
+		if (size <= old_size) {
+			ua->cur -= old_size - size;
+			return ptr;
+		}
+		if (LM_LIKELY(ua->cur + (size - old_size) <= ua->cap)) {
+			ua->cur += size - old_size;
+			return ptr;
+		}
+		return NULL;
+	}
+
+	void *new = ua_alloc(ua, size);
+	if (new && ptr)
+		memcpy(new, ptr, LmMin(old_size, size));
+	return new;
+}
+
 void ua_free(UArena *ua)
 {
 	if (ua)
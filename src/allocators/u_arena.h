@@ -18,14 +18,17 @@
 #define UA_CONTIGUOUS_BIT 0
 #define UA_MALLOCD_BIT 1
 #define UA_BOOTSTRAPPED_BIT 2
+#define UA_UFFD_BIT 3
 
 #define UaIsContiguous(flags) (!!((flags >> 0) & 1))
 #define UaIsMallocd(flags) (!!((flags >> 1) & 1))
 #define UaIsBootstrapped(flags) (!!((flags >> 2) & 1))
+#define UaIsUffd(flags) (!!((flags >> 3) & 1))
 
 #define UaSetIsContiguous(flags) (flags |= 1)
 #define UaSetIsMallocd(flags) (flags |= (1 << 1))
 #define UaSetIsBootstrapped(flags) (flags |= (1 << 2))
+#define UaSetIsUffd(flags) (flags |= (1 << 3))
 
 typedef struct {
 	uint_least64_t flags;
@@ -83,8 +86,8 @@ struct ua__thread_arenas__ {
 	ua__scratch_get__(conflicts, conflict_count, \
 			  ua__thread_arenas_instance__)
 
-#define UaPushArray(a, type, count) ua_alloc(a, sizeof(type) * count)
-#define UaPushArrayZero(a, type, count) ua_zalloc(a, sizeof(type) * count)
+#define UaPushArray(a, type, count) ua_alloc(a, sizeof(type) * (count))
+#define UaPushArrayZero(a, type, count) ua_zalloc(a, sizeof(type) * (count))
 
 #define UaPushStruct(a, type) UaPushArray(a, type, 1)
 #define UaPushStructZero(a, type) UaPushArrayZero(a, type, 1)
@@ -100,12 +103,16 @@ UArena *ua_bootstrap(UArena *ua, UArena *new_existing, size_t cap);
 
 void *ua_alloc(UArena *ua, size_t size);
 
+void *ua_alloc_atomic(UArena *ua, size_t size);
+
 void *ua_zalloc(UArena *ua, size_t size);
 
 void *ua_falloc(UArena *ua, size_t size);
 
 void *ua_fzalloc(UArena *ua, size_t size);
 
+void *ua_realloc(UArena *ua, void *ptr, size_t old_size, size_t size);
+
 void ua_free(UArena *ua);
 
 void ua_pop(UArena *ua, size_t size);
@@ -0,0 +1,315 @@
+#include <src/lm.h>
+LM_LOG_REGISTER(u_arena_uffd);
+
+#include <src/utils/system_info.h>
+#include <src/metrics/timing.h>
+
+#include "u_arena.h"
+#include "u_arena_uffd.h"
+
+#include <fcntl.h>
+#include <linux/userfaultfd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#ifndef UFFD_USER_MODE_ONLY
+#define UFFD_USER_MODE_ONLY 1
+#endif
+
+// NOTE: (isa): The UArena is the first member, so ua_destroy can get back to
+// the backing state from the arena pointer
+struct ua_uffd {
+	UArena ua;
+	struct ua_uffd_params params;
+	int uffd;
+	int stop_fds[2];
+	pthread_t handler;
+	size_t page_sz;
+	uintptr_t start;
+	uintptr_t end;
+	// Source for UFFDIO_COPY, batch_pages zeroed pages
+	uint8_t *zero_buf;
+	// Adaptive prefetch state, only touched by the handler
+	uintptr_t next_expected;
+	size_t window;
+	struct ua_uffd_stats stats;
+};
+
+static struct ua_uffd *ua_uffd_from_arena(UArena *ua)
+{
+	return (struct ua_uffd *)ua;
+}
+
+static size_t uffd_window(struct ua_uffd *u, uintptr_t page)
+{
+	switch (u->params.prefetch) {
+	case UA_UFFD_PREFETCH_FIXED:
+		return u->params.batch_pages;
+	case UA_UFFD_PREFETCH_ADAPTIVE:
+		if (page == u->next_expected)
+			u->window = LmMin(u->window * 2, u->params.batch_pages);
+		else
+			u->window = 1;
+		return u->window;
+	case UA_UFFD_PREFETCH_NONE:
+	default:
+		return 1;
+	}
+}
+
+// Returns the number of bytes populated, or -errno if nothing was
+static long uffd_populate_once(struct ua_uffd *u, uintptr_t start, size_t len)
+{
+	if (u->params.zeropage) {
+		struct uffdio_zeropage zp = {
+			.range = { .start = start, .len = len },
+			.mode = 0,
+		};
+		ioctl(u->uffd, UFFDIO_ZEROPAGE, &zp);
+		return (long)zp.zeropage;
+	}
+
+	struct uffdio_copy copy = {
+		.dst = start,
+		.src = (uintptr_t)u->zero_buf,
+		.len = len,
+		.mode = 0,
+	};
+	ioctl(u->uffd, UFFDIO_COPY, &copy);
+	return (long)copy.copy;
+}
+
+static long uffd_populate(struct ua_uffd *u, uintptr_t start, size_t len)
+{
+	long done;
+
+	// EAGAIN means the address space changed under us, and the faulting
+	// thread stays asleep until the range is populated
+	do {
+		done = uffd_populate_once(u, start, len);
+	} while (done == -EAGAIN);
+
+	return done;
+}
+
+static void uffd_resolve(struct ua_uffd *u, uintptr_t addr)
+{
+	uintptr_t page = addr & ~(u->page_sz - 1);
+	size_t window = uffd_window(u, page);
+	uintptr_t end = LmMin(page + window * u->page_sz, u->end);
+
+	// A batch that runs into populated pages stops short of them, which is
+	// fine as long as the faulting page (the first one) was populated
+	long done = uffd_populate(u, page, end - page);
+	if (done == -EEXIST && end - page > u->page_sz)
+		done = uffd_populate(u, page, u->page_sz);
+
+	if (done == -EEXIST) {
+		// Populated by an earlier batch after the fault was queued
+		struct uffdio_range range = { .start = page,
+					      .len = u->page_sz };
+		ioctl(u->uffd, UFFDIO_WAKE, &range);
+		u->stats.wakes++;
+		return;
+	} else if (done < 0) {
+		LmLogError("Unable to populate %#lx: %s", page,
+			   strerror((int)-done));
+		return;
+	}
+
+	u->stats.pages += (uint64_t)done / u->page_sz;
+	u->next_expected = page + (uintptr_t)done;
+}
+
+static void *uffd_handler(void *arg)
+{
+	struct ua_uffd *u = arg;
+	struct pollfd pfds[2] = {
+		{ .fd = u->uffd, .events = POLLIN },
+		{ .fd = u->stop_fds[0], .events = POLLIN },
+	};
+
+	for (;;) {
+		if (poll(pfds, 2, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			LmLogError("poll failed: %s", strerror(errno));
+			break;
+		}
+
+		if (pfds[1].revents)
+			break;
+
+		struct uffd_msg msg;
+		if (read(u->uffd, &msg, sizeof(msg)) != sizeof(msg))
+			continue;
+
+		if (msg.event != UFFD_EVENT_PAGEFAULT)
+			continue;
+
+		START_TSC_TIMING_LFENCE(fault);
+		uffd_resolve(u, (uintptr_t)msg.arg.pagefault.address);
+		END_TSC_TIMING_LFENCE(fault);
+
+		uint64_t fault_tsc = fault_end - fault_start;
+		u->stats.faults++;
+		u->stats.total_tsc += fault_tsc;
+		if (fault_tsc > u->stats.max_tsc)
+			u->stats.max_tsc = fault_tsc;
+	}
+
+	return NULL;
+}
+
+static int uffd_open(void)
+{
+	// User mode only works without vm.unprivileged_userfaultfd, and is
+	// all we need since the arena is only touched from user space
+	int uffd = (int)syscall(SYS_userfaultfd,
+				O_CLOEXEC | O_NONBLOCK | UFFD_USER_MODE_ONLY);
+	if (uffd < 0 && errno == EINVAL)
+		uffd = (int)syscall(SYS_userfaultfd, O_CLOEXEC | O_NONBLOCK);
+
+	return uffd;
+}
+
+UArena *ua_create_uffd(size_t cap, struct ua_uffd_params params)
+{
+	struct ua_uffd *u = calloc(1, sizeof(struct ua_uffd));
+	if (!u) {
+		LmLogError("Unable to allocate the uffd arena");
+		return NULL;
+	}
+
+	if (params.batch_pages == 0)
+		params.batch_pages = 1;
+
+	u->params = params;
+	u->uffd = -1;
+	u->stop_fds[0] = -1;
+	u->stop_fds[1] = -1;
+	u->page_sz = get_page_size();
+	u->window = 1;
+	cap = cap + LmPaddingToAlign(cap, u->page_sz);
+
+	uint8_t *mem = mmap(NULL, cap, PROT_READ | PROT_WRITE,
+			    MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1,
+			    0);
+	if (mem == MAP_FAILED) {
+		LmLogError("mmap failed: %s", strerror(errno));
+		free(u);
+		return NULL;
+	}
+
+	ua_init(&u->ua, false, false, false, cap, mem);
+	UaSetIsUffd(u->ua.flags);
+	u->start = (uintptr_t)mem;
+	u->end = u->start + cap;
+
+	u->zero_buf = mmap(NULL, params.batch_pages * u->page_sz, PROT_READ,
+			   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (u->zero_buf == MAP_FAILED) {
+		LmLogError("mmap failed: %s", strerror(errno));
+		u->zero_buf = NULL;
+		goto err;
+	}
+
+	u->uffd = uffd_open();
+	if (u->uffd < 0) {
+		LmLogError("userfaultfd failed: %s", strerror(errno));
+		goto err;
+	}
+
+	struct uffdio_api api = { .api = UFFD_API, .features = 0 };
+	if (ioctl(u->uffd, UFFDIO_API, &api) != 0) {
+		LmLogError("UFFDIO_API failed: %s", strerror(errno));
+		goto err;
+	}
+
+	struct uffdio_register reg = {
+		.range = { .start = u->start, .len = cap },
+		.mode = UFFDIO_REGISTER_MODE_MISSING,
+	};
+	if (ioctl(u->uffd, UFFDIO_REGISTER, &reg) != 0) {
+		LmLogError("UFFDIO_REGISTER failed: %s", strerror(errno));
+		goto err;
+	}
+
+	if (pipe(u->stop_fds) != 0) {
+		LmLogError("pipe failed: %s", strerror(errno));
+		goto err;
+	}
+
+	int ret = pthread_create(&u->handler, NULL, uffd_handler, u);
+	if (ret != 0) {
+		LmLogError("Unable to start the fault handler: %s",
+			   strerror(ret));
+		goto err;
+	}
+
+	return &u->ua;
+
+err:
+	if (u->stop_fds[0] >= 0) {
+		close(u->stop_fds[0]);
+		close(u->stop_fds[1]);
+	}
+	if (u->uffd >= 0)
+		close(u->uffd);
+	if (u->zero_buf)
+		munmap(u->zero_buf, params.batch_pages * u->page_sz);
+	munmap(mem, cap);
+	free(u);
+	return NULL;
+}
+
+struct ua_uffd_stats ua_uffd_get_stats(UArena *ua)
+{
+	return ua_uffd_from_arena(ua)->stats;
+}
+
+void ua_uffd_destroy(UArena *ua)
+{
+	struct ua_uffd *u = ua_uffd_from_arena(ua);
+
+	char stop = 1;
+	if (write(u->stop_fds[1], &stop, 1) != 1)
+		LmLogError("Unable to stop the fault handler: %s",
+			   strerror(errno));
+	pthread_join(u->handler, NULL);
+
+	close(u->stop_fds[0]);
+	close(u->stop_fds[1]);
+	close(u->uffd);
+	munmap(u->zero_buf, u->params.batch_pages * u->page_sz);
+	munmap(u->ua.mem, u->ua.cap);
+	free(u);
+}
+
+enum ua_uffd_prefetch ua_uffd_prefetch_from_string(const char *str)
+{
+	if (str && strcmp(str, "fixed") == 0)
+		return UA_UFFD_PREFETCH_FIXED;
+	else if (str && strcmp(str, "adaptive") == 0)
+		return UA_UFFD_PREFETCH_ADAPTIVE;
+
+	return UA_UFFD_PREFETCH_NONE;
+}
+
+const char *ua_uffd_prefetch_string(enum ua_uffd_prefetch prefetch)
+{
+	switch (prefetch) {
+	case UA_UFFD_PREFETCH_FIXED:
+		return "fixed";
+	case UA_UFFD_PREFETCH_ADAPTIVE:
+		return "adaptive";
+	case UA_UFFD_PREFETCH_NONE:
+	default:
+		return "none";
+	}
+}
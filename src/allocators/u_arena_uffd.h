@@ -0,0 +1,61 @@
+/**
+ * @file u_arena_uffd.h
+ * @brief UArena backing where page faults are serviced in user space
+ *
+ * The arena's memory is registered with userfaultfd, and missing pages are
+ * populated by a handler thread, in batches set by the prefetch policy. This
+ * gives karena style lazy population and fault accounting without loading
+ * the karena module.
+ */
+
+#ifndef U_ARENA_UFFD_H
+#define U_ARENA_UFFD_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "u_arena.h"
+
+enum ua_uffd_prefetch {
+	// Only the faulting page is populated
+	UA_UFFD_PREFETCH_NONE,
+	// batch_pages pages are populated from the faulting page and up
+	UA_UFFD_PREFETCH_FIXED,
+	// The batch doubles (up to batch_pages) while faults are sequential,
+	// and drops back to one page when they are not
+	UA_UFFD_PREFETCH_ADAPTIVE,
+};
+
+struct ua_uffd_params {
+	enum ua_uffd_prefetch prefetch;
+	size_t batch_pages;
+	// Map the shared zero page with UFFDIO_ZEROPAGE instead of copying in
+	// zeroed pages with UFFDIO_COPY. The first write to such a page takes
+	// a second (ordinary) fault.
+	bool zeropage;
+};
+
+struct ua_uffd_stats {
+	uint64_t faults;
+	uint64_t pages;
+	// Faults on pages that were populated by an earlier batch after the
+	// fault was queued
+	uint64_t wakes;
+	// Time spent in the handler per fault, from reading the message to
+	// the faulting thread being woken
+	uint64_t total_tsc;
+	uint64_t max_tsc;
+};
+
+UArena *ua_create_uffd(size_t cap, struct ua_uffd_params params);
+
+struct ua_uffd_stats ua_uffd_get_stats(UArena *ua);
+
+void ua_uffd_destroy(UArena *ua);
+
+enum ua_uffd_prefetch ua_uffd_prefetch_from_string(const char *str);
+
+const char *ua_uffd_prefetch_string(enum ua_uffd_prefetch prefetch);
+
+#endif /* U_ARENA_UFFD_H */
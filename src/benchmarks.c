@@ -6,6 +6,7 @@ LM_LOG_GLOBAL_REGISTER();
 LM_LOG_REGISTER(validation);
 
 #include <src/metrics/timing.h>
+#include <src/metrics/compare.h>
 #include <src/allocators/u_arena.h>
 #include <src/tests/tests.h>
 #include <src/utils/system_info.h>
@@ -13,6 +14,7 @@ LM_LOG_REGISTER(validation);
 
 #include <src/cJSON/cJSON.h>
 
+#include <getopt.h>
 #include <stdlib.h>
 #include <stddef.h>
 
@@ -40,10 +42,73 @@ void cjson_free(void *ptr)
 	(void)ptr;
 }
 
+static void print_usage(const char *program)
+{
+	fprintf(stderr,
+		"Usage: %s [--baseline DIR] [--current DIR] [--threshold PCT]\n"
+		"          [--alpha P] [--max-samples N]\n"
+		"Runs the tests enabled in ./configs/benchmark_config.json. With\n"
+		"--baseline, the newest results in --current (./logs) are then\n"
+		"compared against DIR, and the exit status is nonzero if any of\n"
+		"them is significantly slower by more than PCT percent (5)\n",
+		program);
+}
+
+// Returns false on a malformed command line
+static bool parse_args(int argc, char **argv, struct compare_params *compare)
+{
+	*compare = (struct compare_params){ .current_dir = "./logs",
+					    .alpha = 0.01,
+					    .threshold = 5.0,
+					    .max_samples = 100000 };
+	static const struct option options[] = {
+		{ "baseline", required_argument, NULL, 'b' },
+		{ "current", required_argument, NULL, 'c' },
+		{ "threshold", required_argument, NULL, 't' },
+		{ "alpha", required_argument, NULL, 'a' },
+		{ "max-samples", required_argument, NULL, 'n' },
+		{ "help", no_argument, NULL, 'h' },
+		{ NULL, 0, NULL, 0 },
+	};
+
+	int opt;
+	while ((opt = getopt_long(argc, argv, "b:c:t:a:n:h", options, NULL)) !=
+	       -1) {
+		switch (opt) {
+		case 'b':
+			compare->baseline_dir = optarg;
+			break;
+		case 'c':
+			compare->current_dir = optarg;
+			break;
+		case 't':
+			compare->threshold = strtod(optarg, NULL);
+			break;
+		case 'a':
+			compare->alpha = strtod(optarg, NULL);
+			break;
+		case 'n':
+			compare->max_samples = strtoull(optarg, NULL, 10);
+			break;
+		default:
+			return false;
+		}
+	}
+
+	return optind == argc && compare->alpha > 0 && compare->alpha < 1 &&
+	       compare->threshold >= 0;
+}
+
 int main(int argc, char **argv)
 {
 	int result = EXIT_SUCCESS;
 
+	struct compare_params compare;
+	if (!parse_args(argc, argv, &compare)) {
+		print_usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
 	size_t main_ua_sz = LmGibiByte(4);
 	main_ua = ua_create(main_ua_sz, UA_CONTIGUOUS, UA_MMAPD);
 
@@ -60,5 +125,21 @@ int main(int argc, char **argv)
 	cJSON *test_config_json = cJSON_Parse((char *)test_config_file);
 	result = run_tests(test_config_json);
 
+	// NOTE: (isa): Runs even when the suite is disabled, so results that are
+	// already in the logs can be checked against a baseline on their own,
+	// and then the disabled suite isn't what decides the exit status. A
+	// test that failed always does.
+	if (result == RUN_TESTS_DISABLED)
+		result = compare.baseline_dir ? EXIT_SUCCESS : 1;
+	if (compare.baseline_dir) {
+		int failures = compare_against_baseline(&compare);
+		if (failures != 0) {
+			LmLogError("%s", failures < 0 ?
+						 "Baseline comparison failed" :
+						 "Performance regressed against the baseline, or results are missing");
+			return EXIT_FAILURE;
+		}
+	}
+
 	return result;
 }
@@ -338,6 +338,18 @@ bool lm_strings_are_equal(LmString lhs, LmString rhs);
 //            MEM TRACE               //
 ////////////////////////////////////////
 
+enum lm_mem_trace_op {
+	LM_MEM_TRACE_ALLOC,
+	LM_MEM_TRACE_FREE,
+	LM_MEM_TRACE_REALLOC,
+};
+
+// Called for every traced call when LM_MEM_TRACE is 1, e.g. to record an
+// allocation trace. old_ptr is only set for realloc
+typedef void (*lm_mem_trace_hook)(enum lm_mem_trace_op op, void *ptr,
+				  void *old_ptr, size_t size);
+void lm_set_mem_trace_hook(lm_mem_trace_hook hook);
+
 void *lm__malloc_trace__(size_t size, int line, const char *func,
 			 lm__log_module__ *module);
 void *lm__calloc_trace__(size_t ElementCount, size_t Elementsize, int line,
@@ -831,12 +843,21 @@ bool lm_strings_are_equal(LmString lhs, LmString rhs)
 //            MEM TRACE               //
 ////////////////////////////////////////
 
+static lm_mem_trace_hook lm__mem_trace_hook__ = NULL;
+
+void lm_set_mem_trace_hook(lm_mem_trace_hook hook)
+{
+	lm__mem_trace_hook__ = hook;
+}
+
 void *lm__malloc_trace__(size_t size, int line, const char *func,
 			 lm__log_module__ *module)
 {
 	void *ptr = malloc(size);
 	lm__write_log__(module, false, "DBG", "MALLOC (%s,%d): %p (%zd B)",
 			func, line, ptr, size);
+	if (lm__mem_trace_hook__ && ptr)
+		lm__mem_trace_hook__(LM_MEM_TRACE_ALLOC, ptr, NULL, size);
 	return ptr;
 }
 
@@ -847,9 +868,18 @@ void *lm__calloc_trace__(size_t count, size_t size, int line, const char *func,
 	lm__write_log__(module, false, "DBG",
 			"CALLOC (%s,%d): %p (%lu * %luB = %zd B)", func, line,
 			ptr, count, size, (count * size));
+	if (lm__mem_trace_hook__ && ptr)
+		lm__mem_trace_hook__(LM_MEM_TRACE_ALLOC, ptr, NULL,
+				     count * size);
 	return ptr;
 }
 
+// NOTE: (isa): The old pointer is only logged and passed on as an address
+// after the realloc, but GCC 12+ still flags it
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 12
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wuse-after-free"
+#endif
 void *lm__realloc_trace__(void *ptr, size_t size, int line, const char *func,
 			  lm__log_module__ *module)
 {
@@ -861,8 +891,14 @@ void *lm__realloc_trace__(void *ptr, size_t size, int line, const char *func,
 	lm__write_log__(module, false, "DBG",
 			"REALLOC (%s,%d): %p -> %p (%zd B)", func, line,
 			original, reallocd, size);
+	if (lm__mem_trace_hook__ && reallocd)
+		lm__mem_trace_hook__(LM_MEM_TRACE_REALLOC, reallocd, original,
+				     size);
 	return reallocd;
 }
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 12
+#pragma GCC diagnostic pop
+#endif
 
 void lm__free_trace__(void *ptr, int line, const char *func,
 		      lm__log_module__ *module)
@@ -870,6 +906,8 @@ void lm__free_trace__(void *ptr, int line, const char *func,
 	lm__write_log__(module, false, "DBG", "FREE (%s,%d): %p", func, line,
 			ptr);
 	if (ptr != NULL) {
+		if (lm__mem_trace_hook__)
+			lm__mem_trace_hook__(LM_MEM_TRACE_FREE, ptr, NULL, 0);
 		free(ptr);
 	}
 }
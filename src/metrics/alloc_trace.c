@@ -0,0 +1,194 @@
+#include <src/lm.h>
+LM_LOG_REGISTER(alloc_trace);
+
+#include "alloc_trace.h"
+
+#include <string.h>
+
+bool alloc_trace_active = false;
+
+static UArena *trace_ua = NULL;
+static struct alloc_trace_event *trace_events = NULL;
+static uint64_t trace_cap = 0;
+static uint64_t trace_cur = 0;
+static uint64_t trace_dropped = 0;
+static uint32_t trace_threads = 0;
+static __thread uint32_t trace_tid = 0;
+
+const char *alloc_trace_op_string(enum alloc_trace_op op)
+{
+	switch (op) {
+	case TRACE_ALLOC:
+		return "alloc";
+	case TRACE_FREE:
+		return "free";
+	case TRACE_REALLOC:
+		return "realloc";
+	case TRACE_ARENA_ALLOC:
+		return "arena_alloc";
+	case TRACE_ARENA_SEEK:
+		return "arena_seek";
+	default:
+		return "unknown";
+	}
+}
+
+static inline uint64_t trace_tsc(void)
+{
+	uint32_t low, high;
+	__asm__ volatile("rdtsc" : "=a"(low), "=d"(high));
+	return ((uint64_t)high << 32) | low;
+}
+
+void alloc_trace_record(enum alloc_trace_op op, const void *addr,
+			const void *arg, size_t size, size_t pos)
+{
+	if (!alloc_trace_active)
+		return;
+
+	if (LM_UNLIKELY(trace_tid == 0))
+		trace_tid = __atomic_add_fetch(&trace_threads, 1,
+					       __ATOMIC_RELAXED);
+
+	uint64_t i = __atomic_fetch_add(&trace_cur, 1, __ATOMIC_RELAXED);
+	if (LM_UNLIKELY(i >= trace_cap)) {
+		__atomic_fetch_add(&trace_dropped, 1, __ATOMIC_RELAXED);
+		return;
+	}
+
+	struct alloc_trace_event *e = &trace_events[i];
+	e->tsc = trace_tsc();
+	e->addr = (uint64_t)(uintptr_t)addr;
+	e->arg = (uint64_t)(uintptr_t)arg;
+	e->size = size;
+	e->pos = pos;
+	e->tid = trace_tid;
+	e->op = op;
+}
+
+static void mem_trace_hook(enum lm_mem_trace_op op, void *ptr, void *old_ptr,
+			   size_t size)
+{
+	switch (op) {
+	case LM_MEM_TRACE_ALLOC:
+		alloc_trace_record(TRACE_ALLOC, ptr, NULL, size, 0);
+		break;
+	case LM_MEM_TRACE_FREE:
+		alloc_trace_record(TRACE_FREE, ptr, NULL, 0, 0);
+		break;
+	case LM_MEM_TRACE_REALLOC:
+		alloc_trace_record(TRACE_REALLOC, ptr, old_ptr, size, 0);
+		break;
+	}
+}
+
+// NOTE: (isa): The buffer is mmap'd up front so recording never allocates,
+// which would otherwise end up in the trace through the LM_MEM_TRACE hooks
+int alloc_trace_start(size_t max_events)
+{
+	LmAssert(!alloc_trace_active, "An allocation trace is already running");
+
+	trace_ua = ua_create(max_events * sizeof(struct alloc_trace_event),
+			     UA_CONTIGUOUS, UA_MMAPD);
+	if (!trace_ua) {
+		LmLogError("Unable to create the trace buffer for %zd events",
+			   max_events);
+		return -1;
+	}
+
+	trace_events =
+		UaPushArray(trace_ua, struct alloc_trace_event, max_events);
+	trace_cap = max_events;
+	trace_cur = 0;
+	trace_dropped = 0;
+	trace_threads = 0;
+
+	lm_set_mem_trace_hook(mem_trace_hook);
+	__atomic_store_n(&alloc_trace_active, true, __ATOMIC_RELEASE);
+	if (!LM_MEM_TRACE)
+		LmLogInfo(
+			"Built without MEM_TRACE=1, only arena allocations will be traced");
+	return 0;
+}
+
+int alloc_trace_stop(const char *filename)
+{
+	__atomic_store_n(&alloc_trace_active, false, __ATOMIC_RELEASE);
+	lm_set_mem_trace_hook(NULL);
+
+	struct alloc_trace_header header = { 0 };
+	header.magic = ALLOC_TRACE_MAGIC;
+	header.version = ALLOC_TRACE_VERSION;
+	header.event_size = sizeof(struct alloc_trace_event);
+	header.count = LmMin(trace_cur, trace_cap);
+	header.dropped = trace_dropped;
+	header.threads = trace_threads;
+
+	if (header.dropped > 0)
+		LmLogWarning(
+			"The trace buffer was full, %lu events were dropped. Increase max_events",
+			header.dropped);
+
+	int res = 0;
+	FILE *file = lm_open_file_by_name(filename, "wb");
+	if (!file) {
+		res = -1;
+		goto out;
+	}
+
+	if ((res = lm_write_bytes_to_file((uint8_t *)&header, sizeof(header),
+					  file)) != 0)
+		goto out_close;
+
+	if (header.count > 0 &&
+	    (res = lm_write_bytes_to_file(
+		     (uint8_t *)trace_events,
+		     header.count * sizeof(struct alloc_trace_event), file)) !=
+		    0)
+		goto out_close;
+
+	LmLogInfo("Wrote %lu events from %u threads to %s", header.count,
+		  header.threads, filename);
+
+out_close:
+	lm_close_file(file);
+out:
+	ua_destroy(&trace_ua);
+	trace_events = NULL;
+	trace_cap = 0;
+	return res;
+}
+
+struct alloc_trace_event *alloc_trace_load(const char *filename,
+					   struct alloc_trace_header *header,
+					   UArena *ua)
+{
+	size_t file_sz = 0;
+	uint8_t *data = lm_load_file_into_memory(filename, &file_sz, ua);
+	if (!data)
+		return NULL;
+
+	if (file_sz < sizeof(*header)) {
+		LmLogError("%s is too small to be an allocation trace",
+			   filename);
+		return NULL;
+	}
+
+	memcpy(header, data, sizeof(*header));
+	if (header->magic != ALLOC_TRACE_MAGIC ||
+	    header->version != ALLOC_TRACE_VERSION ||
+	    header->event_size != sizeof(struct alloc_trace_event)) {
+		LmLogError("%s is not a version %d allocation trace", filename,
+			   ALLOC_TRACE_VERSION);
+		return NULL;
+	}
+
+	if (file_sz - sizeof(*header) <
+	    header->count * sizeof(struct alloc_trace_event)) {
+		LmLogError("%s is truncated, expected %lu events", filename,
+			   header->count);
+		return NULL;
+	}
+
+	return (struct alloc_trace_event *)(void *)(data + sizeof(*header));
+}
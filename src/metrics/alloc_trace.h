@@ -0,0 +1,71 @@
+#ifndef ALLOC_TRACE_H
+#define ALLOC_TRACE_H
+
+#include <src/lm.h>
+
+// File layout: struct alloc_trace_header followed by header.count events
+#define ALLOC_TRACE_MAGIC 0x45434152544d4cULL // "LMTRACE"
+#define ALLOC_TRACE_VERSION 1
+
+enum alloc_trace_op {
+	TRACE_ALLOC, // Heap allocation: addr, size
+	TRACE_FREE, // Heap free: addr
+	TRACE_REALLOC, // Heap realloc: addr, arg = old addr, size
+	TRACE_ARENA_ALLOC, // addr, arg = arena, size = bytes, pos = offset
+	TRACE_ARENA_SEEK, // arg = arena, pos = new position
+};
+
+struct alloc_trace_event {
+	uint64_t tsc;
+	uint64_t addr;
+	uint64_t arg;
+	uint64_t size;
+	uint64_t pos;
+	uint32_t tid;
+	uint32_t op;
+};
+
+struct alloc_trace_header {
+	uint64_t magic;
+	uint32_t version;
+	uint32_t event_size;
+	uint64_t count;
+	uint64_t dropped;
+	uint32_t threads;
+	uint32_t reserved;
+};
+
+extern bool alloc_trace_active;
+
+int alloc_trace_start(size_t max_events);
+int alloc_trace_stop(const char *filename);
+
+void alloc_trace_record(enum alloc_trace_op op, const void *addr,
+			const void *arg, size_t size, size_t pos);
+
+// Loads a trace written by alloc_trace_stop. Returns the events, which live in
+// ua, or NULL if the file is missing or isn't a trace
+struct alloc_trace_event *alloc_trace_load(const char *filename,
+					   struct alloc_trace_header *header,
+					   UArena *ua);
+
+const char *alloc_trace_op_string(enum alloc_trace_op op);
+
+// Called by the sdhs arena macros, so tracing only costs a branch when it's off
+static inline void *alloc_trace_arena_alloc(void *arena, const void *base,
+					    void *ptr, size_t size)
+{
+	if (LM_UNLIKELY(alloc_trace_active) && ptr)
+		alloc_trace_record(TRACE_ARENA_ALLOC, ptr, arena, size,
+				   (size_t)((const uint8_t *)ptr -
+					    (const uint8_t *)base));
+	return ptr;
+}
+
+static inline void alloc_trace_arena_seek(void *arena, size_t pos)
+{
+	if (LM_UNLIKELY(alloc_trace_active))
+		alloc_trace_record(TRACE_ARENA_SEEK, NULL, arena, 0, pos);
+}
+
+#endif
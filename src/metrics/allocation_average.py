@@ -7,6 +7,8 @@ import matplotlib.pyplot as plt
 from dataclasses import dataclass
 from typing import List, BinaryIO
 
+from result_file import load_result, tsc_frequencies
+
 # Using the functions you provided
 # (AllocTimingStats, AllocTimingCollection, etc.)
 
@@ -18,50 +20,11 @@ class AllocTimingStats:
 @dataclass
 class AllocTimingCollection:
     count: int = 0
-    arr: List[int] = None
-
-def parse_timing_data(file_handle: BinaryIO):
-    tstats_bytes = file_handle.read(16)
-    fields = struct.unpack('Q' * 2, tstats_bytes)
-
-    stats = AllocTimingStats(
-        total_tsc=fields[0],
-        iter=fields[1]
-    )
-   
-    count_bytes = file_handle.read(8)
-    count = struct.unpack('Q', count_bytes)[0]
-    
-    arr_bytes = file_handle.read(count * 8)
-    arr = list(struct.unpack('Q' * count, arr_bytes))
-    
-    collection = AllocTimingCollection(
-        count=count,
-        arr=arr
-    )
-    
-    return stats, collection
-
-def parse_tsc_frequency(dir):
-    filename = dir + "tsc_freq.bin"
-    with open(filename, 'rb') as f:
-        tsc_freq_bytes = f.read(8)
-        tsc_freq: double = struct.unpack('d', tsc_freq_bytes)[0]
-    return tsc_freq
+    arr: np.ndarray = None
 
 def load_all_tsc_frequencies(test_dir: str) -> float:
-    """Load all TSC frequency files and return the mean."""
-    tsc_files = glob.glob(os.path.join(test_dir, "*-tsc_freq.bin"))
-    frequencies = []
-    
-    for tsc_file in tsc_files:
-        try:
-            with open(tsc_file, 'rb') as f:
-                tsc_freq_bytes = f.read(8)
-                tsc_freq = struct.unpack('d', tsc_freq_bytes)[0]
-                frequencies.append(tsc_freq)
-        except Exception as e:
-            print(f"Warning: Couldn't parse {tsc_file}: {str(e)}")
+    """Load the TSC frequencies recorded for the test's runs and return the mean."""
+    frequencies = tsc_frequencies(test_dir)
     
     if frequencies:
         mean_freq = np.mean(frequencies)
@@ -78,9 +41,10 @@ def average_tsc(stats: AllocTimingStats):
     return stats.total_tsc / stats.iter
 
 def load_timing_data(filename):
-    with open(filename, 'rb') as f:
-        stats, collection = parse_timing_data(f)
-    return stats, collection
+    result = load_result(filename)
+    stats = AllocTimingStats(total_tsc=result.total_tsc, iter=result.iter)
+    samples = result.samples()
+    return stats, AllocTimingCollection(count=len(samples), arr=samples)
 
 def parse_timing_directory(dirpath):
     """Extract allocator function and size from directory name."""
@@ -122,12 +86,14 @@ def load_aggregate_timing_data(dirpath):
     for run_file in run_files:
         try:
             stats, collection = load_timing_data(run_file)
-            all_timings.extend(collection.arr)
+            all_timings.append(collection.arr)
             total_stats.total_tsc += stats.total_tsc
             total_stats.iter += stats.iter
         except Exception as e:
             print(f"Warning: Couldn't load {run_file}: {str(e)}")
     
+    all_timings = (np.concatenate(all_timings) if all_timings
+                   else np.empty(0, dtype=np.uint64))
     return total_stats, all_timings, len(run_files)
 
 def main():
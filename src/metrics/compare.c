@@ -0,0 +1,317 @@
+#include <src/lm.h>
+LM_LOG_REGISTER(compare);
+
+#include <src/allocators/allocator_wrappers.h>
+
+#include "compare.h"
+#include "result_file.h"
+
+#include <dirent.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+extern UArena *main_ua;
+
+static int compare_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a;
+	uint64_t y = *(const uint64_t *)b;
+	return (x > y) - (x < y);
+}
+
+static double sorted_median(const uint64_t *arr, uint64_t n)
+{
+	if (n % 2)
+		return (double)arr[n / 2];
+	return ((double)arr[n / 2 - 1] + (double)arr[n / 2]) / 2.0;
+}
+
+// NOTE: (isa): Mann-Whitney U with the normal approximation, which is what
+// the sample counts here call for. Both sides are sorted and walked together,
+// so ties get their average rank without sorting the combined samples. The
+// TSC samples are heavily tied, so the variance is tie corrected
+int compare_samples(uint64_t *baseline, uint64_t n_baseline,
+		    uint64_t *current, uint64_t n_current,
+		    struct compare_result *res)
+{
+	*res = (struct compare_result){ 0 };
+	if (n_baseline < 2 || n_current < 2)
+		return -1;
+
+	qsort(baseline, n_baseline, sizeof(uint64_t), compare_u64);
+	qsort(current, n_current, sizeof(uint64_t), compare_u64);
+
+	double rank_sum = 0.0; // Of the current samples
+	double tie_term = 0.0;
+	uint64_t i = 0;
+	uint64_t j = 0;
+	uint64_t rank = 0;
+	while (i < n_baseline || j < n_current) {
+		uint64_t value;
+		if (j >= n_current ||
+		    (i < n_baseline && baseline[i] <= current[j]))
+			value = baseline[i];
+		else
+			value = current[j];
+
+		uint64_t a = 0;
+		uint64_t b = 0;
+		while (i < n_baseline && baseline[i] == value) {
+			++i;
+			++a;
+		}
+		while (j < n_current && current[j] == value) {
+			++j;
+			++b;
+		}
+
+		double t = (double)(a + b);
+		double avg_rank = (double)rank + (t + 1.0) / 2.0;
+		rank_sum += (double)b * avg_rank;
+		tie_term += t * t * t - t;
+		rank += a + b;
+	}
+
+	double n1 = (double)n_current;
+	double n2 = (double)n_baseline;
+	double n = n1 + n2;
+	double u = rank_sum - n1 * (n1 + 1.0) / 2.0;
+	double mean = n1 * n2 / 2.0;
+	double var = n1 * n2 / 12.0 * ((n + 1.0) - tie_term / (n * (n - 1.0)));
+
+	res->n_baseline = n_baseline;
+	res->n_current = n_current;
+	res->baseline_median = sorted_median(baseline, n_baseline);
+	res->current_median = sorted_median(current, n_current);
+	res->effect = 2.0 * u / (n1 * n2) - 1.0;
+	if (res->baseline_median > 0)
+		res->change = (res->current_median - res->baseline_median) /
+			      res->baseline_median * 100.0;
+	if (var <= 0) {
+		// Every sample on both sides is the same value
+		res->p = 1.0;
+		return 0;
+	}
+
+	double diff = fabs(u - mean);
+	double z = (diff > 0.5 ? diff - 0.5 : 0.0) / sqrt(var);
+	res->p = erfc(z / sqrt(2.0));
+	return 0;
+}
+
+// The newest run in a result directory, i.e. the largest <n> of the <n>.bin
+// files. Returns 0 if there are none
+static int latest_run_nr(const char *directory)
+{
+	DIR *dir = opendir(directory);
+	if (!dir)
+		return 0;
+
+	int latest = 0;
+	struct dirent *entry;
+	while ((entry = readdir(dir)) != NULL) {
+		char *end;
+		long nr = strtol(entry->d_name, &end, 10);
+		if (end != entry->d_name && strcmp(end, ".bin") == 0 &&
+		    nr > latest)
+			latest = (int)nr;
+	}
+
+	closedir(dir);
+	return latest;
+}
+
+// Reads the samples section of a result file, see result_file.h, evenly
+// subsampled down to max_samples. Returns -1 if the file can't be read, and 0
+// with no samples if it has none
+static int load_samples(const char *filename, uint64_t max_samples, UArena *ua,
+			uint64_t **samples_out, uint64_t *count_out)
+{
+	*samples_out = NULL;
+	*count_out = 0;
+	FILE *file = fopen(filename, "rb");
+	if (!file) {
+		LmLogError("Unable to open %s: %s", filename, strerror(errno));
+		return -1;
+	}
+
+	struct result_header header;
+	if (result_file_read_header(file, &header) != 0) {
+		LmLogError("%s is not a result file this version can read",
+			   filename);
+		fclose(file);
+		return -1;
+	}
+
+	const struct result_section *section =
+		result_find_section(&header, RESULT_SECTION_SAMPLES);
+	if (!section || section->count == 0) {
+		fclose(file);
+		return 0;
+	}
+
+	uint64_t count = section->count;
+	uint64_t *samples = UaPushArray(ua, uint64_t, count);
+	if (!samples || fseek(file, (long)section->offset, SEEK_SET) != 0 ||
+	    fread(samples, sizeof(uint64_t), count, file) != count) {
+		LmLogError("Unable to read the %lu samples in %s", count,
+			   filename);
+		fclose(file);
+		return -1;
+	}
+	fclose(file);
+
+	if (max_samples && count > max_samples) {
+		double stride = (double)count / (double)max_samples;
+		for (uint64_t i = 0; i < max_samples; ++i)
+			samples[i] = samples[(uint64_t)((double)i * stride)];
+		count = max_samples;
+	}
+
+	*samples_out = samples;
+	*count_out = count;
+	return 0;
+}
+
+// NOTE: (isa): A baseline entry without raw samples has nothing to compare
+// against and is skipped. One that has them but can't be read, or that the
+// current logs lack, is missing, which fails the gate like a regression
+// rather than passing it silently
+enum compare_verdict {
+	COMPARE_SAME,
+	COMPARE_REGRESSION,
+	COMPARE_IMPROVEMENT,
+	COMPARE_SKIPPED,
+	COMPARE_MISSING,
+};
+
+static enum compare_verdict compare_entry(struct compare_params *params,
+					  const char *test, const char *entry)
+{
+	UAScratch uas = ua_scratch_begin(main_ua);
+	enum compare_verdict verdict = COMPARE_SAME;
+
+	LmString baseline_dir = lm_string_make(params->baseline_dir, uas.ua);
+	lm_string_append_fmt(baseline_dir, "/%s/%s/", test, entry);
+	LmString current_dir = lm_string_make(params->current_dir, uas.ua);
+	lm_string_append_fmt(current_dir, "/%s/%s/", test, entry);
+
+	int baseline_nr = latest_run_nr(baseline_dir);
+	if (!baseline_nr) {
+		verdict = COMPARE_SKIPPED;
+		LmLogInfoR("%-8s %-30s skipped, no baseline run\n", test, entry);
+		goto out;
+	}
+
+	LmString baseline_file = lm_string_make(baseline_dir, uas.ua);
+	lm_string_append_fmt(baseline_file, "%d.bin", baseline_nr);
+	uint64_t *baseline, n_baseline;
+	if (load_samples(baseline_file, params->max_samples, uas.ua, &baseline,
+			 &n_baseline) != 0) {
+		verdict = COMPARE_MISSING;
+		LmLogInfoR("%-8s %-30s MISSING, the baseline can't be read\n",
+			   test, entry);
+		goto out;
+	}
+	if (n_baseline == 0) {
+		verdict = COMPARE_SKIPPED;
+		LmLogInfoR("%-8s %-30s skipped, no raw samples in the baseline\n",
+			   test, entry);
+		goto out;
+	}
+
+	int current_nr = latest_run_nr(current_dir);
+	LmString current_file = lm_string_make(current_dir, uas.ua);
+	lm_string_append_fmt(current_file, "%d.bin", current_nr);
+	uint64_t *current, n_current;
+	struct compare_result res;
+	if (!current_nr ||
+	    load_samples(current_file, params->max_samples, uas.ua, &current,
+			 &n_current) != 0 ||
+	    compare_samples(baseline, n_baseline, current, n_current, &res) !=
+		    0) {
+		verdict = COMPARE_MISSING;
+		LmLogInfoR("%-8s %-30s MISSING, no current samples to compare\n",
+			   test, entry);
+		goto out;
+	}
+
+	bool significant = res.p < params->alpha;
+	if (significant && res.change > params->threshold)
+		verdict = COMPARE_REGRESSION;
+	else if (significant && res.change < -params->threshold)
+		verdict = COMPARE_IMPROVEMENT;
+
+	LmLogInfoR("%-8s %-30s %9.1f %9.1f %+8.2f%% %9.2e %+7.3f  %s\n", test,
+		   entry, res.baseline_median, res.current_median, res.change,
+		   res.p, res.effect,
+		   verdict == COMPARE_REGRESSION  ? "REGRESSION" :
+		   verdict == COMPARE_IMPROVEMENT ? "improvement" :
+		   significant			  ? "~ (significant)" :
+						    "~");
+
+out:
+	ua_scratch_release(uas);
+	return verdict;
+}
+
+static int is_result_dir(const struct dirent *entry)
+{
+	return entry->d_type == DT_DIR && entry->d_name[0] != '.';
+}
+
+// NOTE: (isa): scandir sorts the entries, so the table comes out grouped by
+// allocator in the same order every time
+int compare_against_baseline(struct compare_params *params)
+{
+	struct dirent **tests;
+	int test_count = scandir(params->baseline_dir, &tests, is_result_dir,
+				 alphasort);
+	if (test_count < 0) {
+		LmLogError("Unable to open baseline directory %s: %s",
+			   params->baseline_dir, strerror(errno));
+		return -1;
+	}
+
+	LmLogInfoR(
+		"\nComparing %s against the baseline in %s (alpha %.3g, threshold %.1f%%)\n"
+		"%-8s %-30s %9s %9s %9s %9s %7s\n",
+		params->current_dir, params->baseline_dir, params->alpha,
+		params->threshold, "test", "entry", "base TSC", "curr TSC",
+		"median", "p", "effect");
+
+	int regressions = 0;
+	int improvements = 0;
+	int skipped = 0;
+	int missing = 0;
+	for (int t = 0; t < test_count; ++t) {
+		const char *test = tests[t]->d_name;
+		UAScratch uas = ua_scratch_begin(main_ua);
+		LmString test_path = lm_string_make(params->baseline_dir, uas.ua);
+		lm_string_append_fmt(test_path, "/%s/", test);
+
+		struct dirent **entries;
+		int entry_count =
+			scandir(test_path, &entries, is_result_dir, alphasort);
+		for (int e = 0; e < entry_count; ++e) {
+			enum compare_verdict verdict =
+				compare_entry(params, test, entries[e]->d_name);
+			regressions += verdict == COMPARE_REGRESSION;
+			improvements += verdict == COMPARE_IMPROVEMENT;
+			skipped += verdict == COMPARE_SKIPPED;
+			missing += verdict == COMPARE_MISSING;
+			free(entries[e]);
+		}
+		if (entry_count >= 0)
+			free(entries);
+
+		ua_scratch_release(uas);
+		free(tests[t]);
+	}
+	free(tests);
+
+	LmLogInfoR("%d regressions, %d improvements, %d skipped, %d missing\n",
+		   regressions, improvements, skipped, missing);
+	return regressions + missing;
+}
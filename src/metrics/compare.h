@@ -0,0 +1,36 @@
+#ifndef COMPARE_H
+#define COMPARE_H
+
+#include <src/lm.h>
+
+// Compares the newest run of every <test>/<entry>/<n>.bin found in both a
+// stored baseline and the current logs, e.g. arena/ua_alloc-small/
+struct compare_params {
+	const char *baseline_dir;
+	const char *current_dir;
+	double alpha; // Two sided significance level of the Mann-Whitney U test
+	double threshold; // Median change in percent needed for a regression
+	uint64_t max_samples; // Per side, larger runs are subsampled evenly
+};
+
+struct compare_result {
+	uint64_t n_baseline;
+	uint64_t n_current;
+	double baseline_median; // TSC
+	double current_median;
+	double change; // Median change in percent, positive is slower
+	double p;
+	// Rank biserial correlation in [-1, 1], positive when the current
+	// samples tend to be larger than the baseline's
+	double effect;
+};
+
+int compare_samples(uint64_t *baseline, uint64_t n_baseline,
+		    uint64_t *current, uint64_t n_current,
+		    struct compare_result *res);
+
+// Returns the number of significant regressions plus the baseline entries
+// that couldn't be compared, or -1 if the baseline directory can't be read
+int compare_against_baseline(struct compare_params *params);
+
+#endif
@@ -11,6 +11,9 @@ from typing import List, BinaryIO, Tuple
 from collections import Counter
 import glob
 
+from result_file import (load_result, tsc_frequencies, SECTION_SAMPLES,
+                         SECTION_HISTOGRAM, SECTION_PERF, SECTION_MEM)
+
 @dataclass
 class AllocTimingStats:
     total_tsc: int = 0
@@ -19,7 +22,87 @@ class AllocTimingStats:
 @dataclass
 class AllocTimingCollection:
     count: int = 0
-    arr: List[int] = None
+    arr: np.ndarray = None
+
+PERF_TRAILER_MAGIC = 0x464552504d4c
+PERF_COUNTER_NAMES = ["instructions", "cycles", "l1d_misses", "llc_misses",
+                      "dtlb_misses", "branch_misses", "page_faults"]
+
+@dataclass
+class PerfCounters:
+    """Counter totals for the phase, and optionally per allocation deltas"""
+    time_enabled: int = 0
+    time_running: int = 0
+    totals: dict = None
+    per_alloc: dict = None
+
+MEM_TRAILER_MAGIC = 0x4d454d4d4c
+MEM_SNAPSHOT_FIELDS = ["minor_faults", "major_faults", "rss", "pss",
+                       "anon_huge", "consumed"]
+
+@dataclass
+class MemFootprint:
+    """Process memory before and after a phase, see mem_footprint.c"""
+    allocs: int = 0
+    requested: int = 0
+    begin: dict = None
+    end: dict = None
+
+    def delta(self, field):
+        return self.end[field] - self.begin[field]
+
+    def consumed_overhead_per_alloc(self):
+        if self.allocs == 0:
+            return 0.0
+        return (self.delta("consumed") - self.requested) / self.allocs
+
+    def rss_overhead_per_alloc(self):
+        if self.allocs == 0:
+            return 0.0
+        return (self.delta("rss") - self.requested) / self.allocs
+
+HDR_FILE_MAGIC = 0x5244484d4c
+
+@dataclass
+class HdrHistogram:
+    """Histogram section of a run's .bin file, see hdr_histogram.c"""
+    sub_bucket_bits: int = 0
+    significant_digits: int = 0
+    total_count: int = 0
+    min: int = 0
+    max: int = 0
+    sum: int = 0
+    counts: dict = None  # bucket index -> count
+
+    def value_from_index(self, idx):
+        bits = self.sub_bucket_bits
+        if idx < (1 << bits):
+            return idx
+        shift = (idx >> (bits - 1)) - 1
+        lower = (idx - (shift << (bits - 1))) << shift
+        return lower + (1 << shift) - 1
+
+    def value_at_percentile(self, percentile):
+        if self.total_count == 0:
+            return 0
+        if percentile >= 100.0:
+            return self.max
+        target = max(1, int(np.ceil(percentile / 100.0 * self.total_count)))
+        seen = 0
+        for idx in sorted(self.counts):
+            seen += self.counts[idx]
+            if seen >= target:
+                return min(self.value_from_index(idx), self.max)
+        return self.max
+
+    def merge(self, other):
+        assert self.sub_bucket_bits == other.sub_bucket_bits
+        for idx, count in other.counts.items():
+            self.counts[idx] = self.counts.get(idx, 0) + count
+        self.total_count += other.total_count
+        self.sum += other.sum
+        self.min = min(self.min, other.min)
+        self.max = max(self.max, other.max)
 
 @dataclass
 class ProcessedResult:
@@ -35,42 +118,104 @@ class ProcessedResult:
     p99_ns: float
     total_samples: int
     
-def parse_timing_data(file_handle: BinaryIO):
-    tstats_bytes = file_handle.read(16)
-    fields = struct.unpack('Q' * 2, tstats_bytes)
+def parse_perf_counters(file_handle: BinaryIO, count: int):
+    """Reads the counter section, or the trailer that follows the samples in
+    legacy files. Returns None for files written without counters."""
+    magic_bytes = file_handle.read(8)
+    if len(magic_bytes) < 8 or struct.unpack('Q', magic_bytes)[0] != PERF_TRAILER_MAGIC:
+        file_handle.seek(-len(magic_bytes), os.SEEK_CUR)
+        return None
 
-    stats = AllocTimingStats(
-        total_tsc=fields[0],
-        iter=fields[1]
-    )
-   
-    count_bytes = file_handle.read(8)
-    count = struct.unpack('Q', count_bytes)[0]
-    
-    arr_bytes = file_handle.read(count * 8)
-    arr = list(struct.unpack('Q' * count, arr_bytes))
-    
-    collection = AllocTimingCollection(
-        count=count,
-        arr=arr
-    )
-    
-    return stats, collection
+    version, n, available, per_alloc_mask = struct.unpack('4I', file_handle.read(16))
+    time_enabled, time_running = struct.unpack('2Q', file_handle.read(16))
+    values = struct.unpack('Q' * n, file_handle.read(8 * n))
+    names = [PERF_COUNTER_NAMES[i] if i < len(PERF_COUNTER_NAMES) else f"counter{i}"
+             for i in range(n)]
+
+    perf = PerfCounters(time_enabled=time_enabled, time_running=time_running)
+    perf.totals = {names[i]: values[i] for i in range(n) if available & (1 << i)}
+
+    if per_alloc_mask and count > 0:
+        rows = np.frombuffer(file_handle.read(8 * n * count), dtype=np.uint64)
+        rows = rows.reshape(count, n)
+        perf.per_alloc = {names[i]: rows[:, i] for i in range(n)
+                          if per_alloc_mask & (1 << i)}
+
+    return perf
+
+def parse_mem_footprint(file_handle: BinaryIO):
+    """Reads the memory section, or the trailer that follows the counter
+    trailer in legacy files. Returns None for files written without it."""
+    magic_bytes = file_handle.read(8)
+    if len(magic_bytes) < 8 or struct.unpack('Q', magic_bytes)[0] != MEM_TRAILER_MAGIC:
+        file_handle.seek(-len(magic_bytes), os.SEEK_CUR)
+        return None
+
+    version, _ = struct.unpack('2I', file_handle.read(8))
+    allocs, requested = struct.unpack('2Q', file_handle.read(16))
+    n = len(MEM_SNAPSHOT_FIELDS)
+    snapshots = struct.unpack('Q' * 2 * n, file_handle.read(16 * n))
+    return MemFootprint(allocs=allocs, requested=requested,
+                        begin=dict(zip(MEM_SNAPSHOT_FIELDS, snapshots[:n])),
+                        end=dict(zip(MEM_SNAPSHOT_FIELDS, snapshots[n:])))
+
+def load_trailers(filename):
+    """Returns the counter and memory sections of a run file, either of which
+    can be None"""
+    result = load_result(filename)
+    if result.trailer_offset is not None:
+        with open(filename, 'rb') as f:
+            f.seek(result.trailer_offset)
+            perf = parse_perf_counters(f, result.sections[SECTION_SAMPLES].count)
+            mem = parse_mem_footprint(f)
+        return perf, mem
+
+    perf = mem = None
+    f = result.open_section(SECTION_PERF)
+    if f:
+        with f:
+            perf = parse_perf_counters(f, result.sections[SECTION_PERF].count)
+    f = result.open_section(SECTION_MEM)
+    if f:
+        with f:
+            mem = parse_mem_footprint(f)
+    return perf, mem
+
+def load_fragmentation_series(filename):
+    """Reads a lifetime test's -frag.bin file. Returns a dict of arrays with the
+    allocation count, live bytes, allocator footprint and RSS at each sample,
+    and the fragmentation ratio derived from them"""
+    with open(filename, 'rb') as f:
+        count = struct.unpack('Q', f.read(8))[0]
+        rows = np.frombuffer(f.read(32 * count), dtype=np.uint64).reshape(count, 4)
+    series = {"allocs": rows[:, 0], "live": rows[:, 1],
+              "footprint": rows[:, 2], "rss": rows[:, 3]}
+    footprint = series["footprint"].astype(np.float64)
+    with np.errstate(divide='ignore', invalid='ignore'):
+        series["fragmentation"] = np.where(
+            footprint > 0, 1.0 - series["live"] / footprint, 0.0)
+    return series
+
+def load_hdr_histogram(filename):
+    """Reads the histogram section of a run file, or a legacy .hdr file"""
+    f = None
+    if filename.endswith(".bin"):
+        f = load_result(filename).open_section(SECTION_HISTOGRAM)
+        if f is None:
+            raise ValueError(f"{filename} has no histogram")
+    with f or open(filename, 'rb') as f:
+        magic, version, bits, digits, _ = struct.unpack('Q4I', f.read(24))
+        if magic != HDR_FILE_MAGIC:
+            raise ValueError(f"{filename} is not a histogram file")
+        total_count, min_v, max_v, sum_v, nonzero = struct.unpack('5Q', f.read(40))
+        pairs = struct.unpack('Q' * 2 * nonzero, f.read(16 * nonzero))
+    counts = {pairs[2 * i]: pairs[2 * i + 1] for i in range(nonzero)}
+    return HdrHistogram(bits, digits, total_count, min_v, max_v, sum_v, counts)
 
 def load_all_tsc_frequencies(allocator_dir: str) -> float:
-    """Load all TSC frequency files from the allocator directory and return the mean."""
-    # Look for tsc_freq.bin files directly in the allocator directory
-    tsc_files = glob.glob(os.path.join(allocator_dir, "*-tsc_freq.bin"))
-    frequencies = []
-    
-    for tsc_file in tsc_files:
-        try:
-            with open(tsc_file, 'rb') as f:
-                tsc_freq_bytes = f.read(8)
-                tsc_freq = struct.unpack('d', tsc_freq_bytes)[0]
-                frequencies.append(tsc_freq)
-        except Exception as e:
-            print(f"Warning: Couldn't parse {tsc_file}: {str(e)}")
+    """Load the TSC frequencies recorded for the allocator directory's runs and
+    return the mean."""
+    frequencies = tsc_frequencies(allocator_dir)
     
     if frequencies:
         mean_freq = np.mean(frequencies)
@@ -87,16 +232,19 @@ def average_tsc(stats: AllocTimingStats):
     return stats.total_tsc / stats.iter
 
 def load_timing_data(filename):
-    with open(filename, 'rb') as f:
-        stats, collection = parse_timing_data(f)
-    return stats, collection
+    """The run's stats and its samples, memory mapped rather than read"""
+    result = load_result(filename)
+    stats = AllocTimingStats(total_tsc=result.total_tsc, iter=result.iter)
+    samples = result.samples()
+    return stats, AllocTimingCollection(count=len(samples), arr=samples)
 
 def parse_allocator_directory(dirpath):
     """Extract allocator function and size from directory name."""
     dirname = os.path.basename(dirpath)
     
-    # Split by the last hyphen to separate function name and size
-    parts = dirname.rsplit('-', 1)
+    # Split by the first hyphen to separate function name and workload, since
+    # the allocator names have none and threaded workloads end in -<n>t
+    parts = dirname.split('-', 1)
     
     if len(parts) < 2:
         # No hyphen in filename - this might be a SDHS directory
@@ -114,9 +262,10 @@ def parse_allocator_directory(dirpath):
 
 def should_process_directory(allocator_type, alloc_fn, size):
     """Check if this allocator/size combination should be processed."""
-    # For arena and malloc, we want small, medium, large sizes
+    # For arena and malloc, we want the workloads (small, medium, large and
+    # the ones from the config) rather than the single sizes, named like 64B
     if allocator_type in ['arena', 'malloc']:
-        return size in ['small', 'medium', 'large']
+        return size is not None and re.fullmatch(r'\d+B', size) is None
     
     # For sdhs, we process all directories (size will be None)
     if allocator_type == 'sdhs':
@@ -135,12 +284,14 @@ def load_aggregate_timing_data(dirpath):
     for run_file in run_files:
         try:
             stats, collection = load_timing_data(run_file)
-            all_timings.extend(collection.arr)
+            all_timings.append(collection.arr)
             total_stats.total_tsc += stats.total_tsc
             total_stats.iter += stats.iter
         except Exception as e:
             print(f"Warning: Couldn't load {run_file}: {str(e)}")
     
+    all_timings = (np.concatenate(all_timings) if all_timings
+                   else np.empty(0, dtype=np.uint64))
     return total_stats, all_timings, len(run_files)
 
 def get_next_output_dir(base_dir):
@@ -457,10 +608,8 @@ def analyze_all_timing_data(logs_dir="./logs", ignore_files=["tsc_freq.bin"], **
     ./logs/malloc/{alloc_fn}-{size}/ (where size is small, medium, large)  
     ./logs/sdhs/{alloc_fn}/
     
-    TSC frequency files are located directly in the allocator directories:
-    ./logs/arena/*-tsc_freq.bin
-    ./logs/malloc/*-tsc_freq.bin
-    ./logs/sdhs/*-tsc_freq.bin
+    The TSC frequency is read from the header of each run file, or from the
+    *-tsc_freq.bin files older runs left in the allocator directories
     
     Args:
         logs_dir: Root directory containing timing data
@@ -0,0 +1,253 @@
+#include <src/lm.h>
+LM_LOG_REGISTER(hdr_histogram);
+
+#include <src/utils/system_info.h>
+
+#include "hdr_histogram.h"
+#include "result_file.h"
+
+#include <math.h>
+#include <string.h>
+
+static const double log_percentiles[] = { 50.0, 90.0, 99.0, 99.9 };
+
+// Number of bits needed so that neighbouring buckets differ by less than one
+// unit in the given number of significant decimal digits
+static uint32_t sub_bucket_bits_for(int significant_digits)
+{
+	return (uint32_t)ceil((double)significant_digits * log2(10.0)) + 1;
+}
+
+static uint64_t counts_len_for(uint32_t bits)
+{
+	return (uint64_t)(66 - bits) << (bits - 1);
+}
+
+// Returns the largest value that maps to the same bucket as idx
+static uint64_t hdr_value_from_index(const struct hdr_histogram *h,
+				     uint64_t idx)
+{
+	uint32_t bits = h->sub_bucket_bits;
+	if (idx < (1ULL << bits))
+		return idx;
+
+	uint64_t shift = (idx >> (bits - 1)) - 1;
+	uint64_t lower = (idx - (shift << (bits - 1))) << shift;
+	return lower + ((1ULL << shift) - 1);
+}
+
+size_t hdr_mem_size(int significant_digits)
+{
+	return counts_len_for(sub_bucket_bits_for(significant_digits)) *
+	       sizeof(uint64_t);
+}
+
+int hdr_init(struct hdr_histogram *h, int significant_digits, UArena *ua)
+{
+	if (significant_digits < HDR_MIN_DIGITS ||
+	    significant_digits > HDR_MAX_DIGITS) {
+		LmLogError("Histogram precision must be %d to %d digits, got %d",
+			   HDR_MIN_DIGITS, HDR_MAX_DIGITS, significant_digits);
+		return -1;
+	}
+
+	*h = (struct hdr_histogram){ 0 };
+	h->significant_digits = (uint32_t)significant_digits;
+	h->sub_bucket_bits = sub_bucket_bits_for(significant_digits);
+	h->counts_len = counts_len_for(h->sub_bucket_bits);
+	h->counts = UaPushArrayZero(ua, uint64_t, h->counts_len);
+	if (!h->counts) {
+		LmLogError("Unable to allocate %lu histogram buckets",
+			   h->counts_len);
+		return -1;
+	}
+
+	h->min = UINT64_MAX;
+	return 0;
+}
+
+void hdr_reset(struct hdr_histogram *h)
+{
+	memset(h->counts, 0, h->counts_len * sizeof(uint64_t));
+	h->total_count = 0;
+	h->sum = 0;
+	h->min = UINT64_MAX;
+	h->max = 0;
+}
+
+int hdr_merge(struct hdr_histogram *dst, const struct hdr_histogram *src)
+{
+	if (dst->sub_bucket_bits != src->sub_bucket_bits) {
+		LmLogError(
+			"Unable to merge histograms with %u and %u significant digits",
+			dst->significant_digits, src->significant_digits);
+		return -1;
+	}
+
+	for (uint64_t i = 0; i < src->counts_len; ++i)
+		dst->counts[i] += src->counts[i];
+	dst->total_count += src->total_count;
+	dst->sum += src->sum;
+	dst->min = LmMin(dst->min, src->min);
+	dst->max = LmMax(dst->max, src->max);
+	return 0;
+}
+
+uint64_t hdr_value_at_percentile(const struct hdr_histogram *h,
+				 double percentile)
+{
+	if (h->total_count == 0)
+		return 0;
+	if (percentile >= 100.0)
+		return h->max;
+
+	uint64_t target =
+		(uint64_t)ceil(percentile / 100.0 * (double)h->total_count);
+	target = LmMax(target, 1);
+
+	uint64_t seen = 0;
+	for (uint64_t i = 0; i < h->counts_len; ++i) {
+		seen += h->counts[i];
+		if (seen >= target)
+			return LmMin(hdr_value_from_index(h, i), h->max);
+	}
+
+	return h->max;
+}
+
+double hdr_mean(const struct hdr_histogram *h)
+{
+	return h->total_count ? (double)h->sum / (double)h->total_count : 0.0;
+}
+
+void hdr_log_percentiles(const struct hdr_histogram *h, const char *description,
+			 lm_log_module *log_module)
+{
+	if (h->total_count == 0)
+		return;
+
+	double ns_per_tsc = 1e9 / get_tsc_freq();
+	LmLogManual(log_module, true, INF, "%s%lu samples, mean %.1f ns,",
+		    description, h->total_count, hdr_mean(h) * ns_per_tsc);
+	for (int i = 0; i < (int)LmArrayLen(log_percentiles); ++i)
+		LmLogManual(
+			log_module, true, INF, " p%g %.1f", log_percentiles[i],
+			(double)hdr_value_at_percentile(h, log_percentiles[i]) *
+				ns_per_tsc);
+	LmLogManual(log_module, true, INF, " max %.1f ns\n",
+		    (double)h->max * ns_per_tsc);
+}
+
+// Layout: magic, version, sub bucket bits, significant digits, a reserved
+// word, total count, min, max, sum, the number of non-empty buckets, and then
+// an { index, count } pair for each of them
+int hdr_write_to_file(const struct hdr_histogram *h, FILE *file)
+{
+	uint64_t nonzero = 0;
+	for (uint64_t i = 0; i < h->counts_len; ++i)
+		nonzero += (h->counts[i] != 0);
+
+	uint64_t magic = HDR_FILE_MAGIC;
+	uint32_t header[4] = { HDR_FILE_VERSION, h->sub_bucket_bits,
+			       h->significant_digits, 0 };
+	uint64_t summary[5] = { h->total_count, h->min, h->max, h->sum,
+				nonzero };
+
+	int res;
+	if ((res = lm_write_bytes_to_file((uint8_t *)&magic, sizeof(magic),
+					  file)) != 0 ||
+	    (res = lm_write_bytes_to_file((uint8_t *)header, sizeof(header),
+					  file)) != 0 ||
+	    (res = lm_write_bytes_to_file((uint8_t *)summary, sizeof(summary),
+					  file)) != 0)
+		return res;
+
+	for (uint64_t i = 0; i < h->counts_len; ++i) {
+		if (h->counts[i] == 0)
+			continue;
+		uint64_t pair[2] = { i, h->counts[i] };
+		if ((res = lm_write_bytes_to_file((uint8_t *)pair, sizeof(pair),
+						  file)) != 0)
+			return res;
+	}
+
+	return 0;
+}
+
+// Adds the histogram as a section of a result file, see result_file.h
+int hdr_append_to_file(const struct hdr_histogram *h, const char *filename)
+{
+	struct result_section_writer w;
+	if (result_section_begin(&w, filename, RESULT_SECTION_HISTOGRAM) != 0)
+		return -1;
+
+	if (hdr_write_to_file(h, w.file) != 0) {
+		lm_close_file(w.file);
+		return -1;
+	}
+	return result_section_end(&w, 0, h->total_count);
+}
+
+// Loads the histogram section of a result file, e.g. to merge the results of
+// several runs. The counts are pushed on ua
+int hdr_load_from_file(struct hdr_histogram *h, const char *filename,
+		       UArena *ua)
+{
+	FILE *file = lm_open_file_by_name(filename, "rb");
+	if (!file)
+		return -1;
+
+	int res = -1;
+	struct result_header result;
+	const struct result_section *section;
+	if (result_file_read_header(file, &result) != 0 ||
+	    !(section = result_find_section(&result,
+					    RESULT_SECTION_HISTOGRAM)) ||
+	    fseek(file, (long)section->offset, SEEK_SET) != 0) {
+		LmLogError("%s has no histogram section", filename);
+		goto out;
+	}
+
+	uint64_t magic;
+	uint32_t header[4];
+	uint64_t summary[5];
+	if (fread(&magic, sizeof(magic), 1, file) != 1 ||
+	    fread(header, sizeof(header), 1, file) != 1 ||
+	    fread(summary, sizeof(summary), 1, file) != 1 ||
+	    magic != HDR_FILE_MAGIC || header[0] != HDR_FILE_VERSION) {
+		LmLogError("%s is not a version %d histogram file", filename,
+			   HDR_FILE_VERSION);
+		goto out;
+	}
+
+	if (hdr_init(h, (int)header[2], ua) != 0)
+		goto out;
+	if (h->sub_bucket_bits != header[1]) {
+		LmLogError("%s has an inconsistent precision", filename);
+		goto out;
+	}
+
+	for (uint64_t i = 0; i < summary[4]; ++i) {
+		uint64_t pair[2];
+		if (fread(pair, sizeof(pair), 1, file) != 1) {
+			LmLogError("%s is truncated", filename);
+			goto out;
+		}
+		if (pair[0] >= h->counts_len) {
+			LmLogError("%s has a bucket index out of range",
+				   filename);
+			goto out;
+		}
+		h->counts[pair[0]] = pair[1];
+	}
+
+	h->total_count = summary[0];
+	h->min = summary[1];
+	h->max = summary[2];
+	h->sum = summary[3];
+	res = 0;
+
+out:
+	lm_close_file(file);
+	return res;
+}
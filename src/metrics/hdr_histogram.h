@@ -0,0 +1,91 @@
+#ifndef HDR_HISTOGRAM_H
+#define HDR_HISTOGRAM_H
+
+#include <src/lm.h>
+#include <src/allocators/u_arena.h>
+
+#define HDR_FILE_MAGIC 0x5244484d4cULL // "LMHDR"
+#define HDR_FILE_VERSION 1
+
+#define HDR_MIN_DIGITS 1
+#define HDR_MAX_DIGITS 4
+
+// Log-linear histogram in the style of HdrHistogram. Values below
+// 2^sub_bucket_bits are counted exactly, and every power of two above that is
+// split into 2^(sub_bucket_bits - 1) linear buckets, so the relative error of
+// a recorded value is at most 2^-(sub_bucket_bits - 1). Recording is a couple
+// of shifts and an increment regardless of how many values have been
+// recorded.
+struct hdr_histogram {
+	uint32_t sub_bucket_bits;
+	uint32_t significant_digits;
+	uint64_t counts_len;
+	uint64_t total_count;
+	uint64_t min;
+	uint64_t max;
+	uint64_t sum;
+	uint64_t *counts;
+};
+
+static inline uint64_t hdr_index_of(const struct hdr_histogram *h,
+				    uint64_t value)
+{
+	uint32_t bits = h->sub_bucket_bits;
+	if (value < (1ULL << bits))
+		return value;
+
+	uint32_t msb = 63 - (uint32_t)__builtin_clzll(value);
+	uint32_t shift = msb - bits + 1;
+	return ((uint64_t)shift << (bits - 1)) + (value >> shift);
+}
+
+static inline void hdr_record(struct hdr_histogram *h, uint64_t value)
+{
+	h->counts[hdr_index_of(h, value)] += 1;
+	h->total_count += 1;
+	h->sum += value;
+	if (LM_UNLIKELY(value < h->min))
+		h->min = value;
+	if (LM_UNLIKELY(value > h->max))
+		h->max = value;
+}
+
+// For histograms that several threads record into at once. Prefer one
+// histogram per thread merged with hdr_merge when possible
+static inline void hdr_record_atomic(struct hdr_histogram *h, uint64_t value)
+{
+	__atomic_fetch_add(&h->counts[hdr_index_of(h, value)], 1,
+			   __ATOMIC_RELAXED);
+	__atomic_fetch_add(&h->total_count, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&h->sum, value, __ATOMIC_RELAXED);
+
+	uint64_t cur = __atomic_load_n(&h->min, __ATOMIC_RELAXED);
+	while (value < cur &&
+	       !__atomic_compare_exchange_n(&h->min, &cur, value, true,
+					    __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		;
+	cur = __atomic_load_n(&h->max, __ATOMIC_RELAXED);
+	while (value > cur &&
+	       !__atomic_compare_exchange_n(&h->max, &cur, value, true,
+					    __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		;
+}
+
+size_t hdr_mem_size(int significant_digits);
+int hdr_init(struct hdr_histogram *h, int significant_digits, UArena *ua);
+void hdr_reset(struct hdr_histogram *h);
+int hdr_merge(struct hdr_histogram *dst, const struct hdr_histogram *src);
+
+uint64_t hdr_value_at_percentile(const struct hdr_histogram *h,
+				 double percentile);
+double hdr_mean(const struct hdr_histogram *h);
+
+void hdr_log_percentiles(const struct hdr_histogram *h, const char *description,
+			 lm_log_module *log_module);
+
+int hdr_write_to_file(const struct hdr_histogram *h, FILE *file);
+int hdr_append_to_file(const struct hdr_histogram *h, const char *filename);
+int hdr_load_from_file(struct hdr_histogram *h, const char *filename,
+		       UArena *ua);
+
+#endif
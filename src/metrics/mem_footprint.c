@@ -0,0 +1,264 @@
+#include <src/lm.h>
+LM_LOG_REGISTER(mem_footprint);
+
+#include <src/utils/system_info.h>
+
+#include "mem_footprint.h"
+#include "result_file.h"
+
+#include <fcntl.h>
+#include <malloc.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+static struct mem_requests mem_request_slots[MEM_REQUEST_THREADS];
+static int mem_request_slot_count = 0;
+// Threads past MEM_REQUEST_THREADS count into a slot of their own that is
+// never summed
+static __thread struct mem_requests mem_uncounted_requests;
+__thread struct mem_requests *mem_thread_requests = NULL;
+
+struct mem_requests *mem_requests_register(void)
+{
+	int slot = __atomic_fetch_add(&mem_request_slot_count, 1,
+				      __ATOMIC_RELAXED);
+	if (slot < MEM_REQUEST_THREADS) {
+		mem_thread_requests = &mem_request_slots[slot];
+	} else {
+		LmLogWarning("More than %d threads allocate through the sdhs "
+			     "arenas, the rest aren't counted",
+			     MEM_REQUEST_THREADS);
+		mem_thread_requests = &mem_uncounted_requests;
+	}
+	return mem_thread_requests;
+}
+
+void mem_request_peak(struct mem_requests *r, const void *arena,
+		      const void *ptr, size_t size)
+{
+	uintptr_t end = (uintptr_t)ptr + size;
+	int free_slot = -1;
+	for (int i = 0; i < MEM_REQUEST_ARENAS; ++i) {
+		if (r->peaks[i].used && r->peaks[i].arena == arena) {
+			if (end > r->peaks[i].end) {
+				uintptr_t start = (uintptr_t)ptr;
+				if (start < r->peaks[i].end)
+					start = r->peaks[i].end;
+				__atomic_store_n(&r->totals.consumed,
+						 r->totals.consumed +
+							 (end - start),
+						 __ATOMIC_RELAXED);
+				r->peaks[i].end = end;
+			}
+			return;
+		}
+		if (free_slot < 0 && !r->peaks[i].used)
+			free_slot = i;
+	}
+
+	// An arena seen for the first time is counted from its first
+	// allocation, and once the table is full the requests themselves are
+	if (free_slot >= 0) {
+		r->peaks[free_slot].arena = arena;
+		r->peaks[free_slot].end = end;
+		r->peaks[free_slot].used = true;
+	}
+	__atomic_store_n(&r->totals.consumed, r->totals.consumed + size,
+			 __ATOMIC_RELAXED);
+}
+
+// A new arena may be created at the address of a destroyed one. Only the
+// calling thread's table is cleared, the sdhs threads destroy their own arenas
+void mem_request_forget_arena(const void *arena)
+{
+	struct mem_requests *r = mem_thread_requests;
+	if (!r)
+		return;
+	for (int i = 0; i < MEM_REQUEST_ARENAS; ++i)
+		if (r->peaks[i].used && r->peaks[i].arena == arena)
+			r->peaks[i].used = false;
+}
+
+void mem_requests_sum(struct mem_request_totals *sum)
+{
+	*sum = (struct mem_request_totals){ 0 };
+	int slots = __atomic_load_n(&mem_request_slot_count, __ATOMIC_RELAXED);
+	if (slots > MEM_REQUEST_THREADS)
+		slots = MEM_REQUEST_THREADS;
+
+	for (int i = 0; i < slots; ++i) {
+		struct mem_request_totals *t = &mem_request_slots[i].totals;
+		sum->allocs += __atomic_load_n(&t->allocs, __ATOMIC_RELAXED);
+		sum->bytes += __atomic_load_n(&t->bytes, __ATOMIC_RELAXED);
+		sum->consumed +=
+			__atomic_load_n(&t->consumed, __ATOMIC_RELAXED);
+	}
+}
+
+// Returns the value of a "Key:   1234 kB" line in bytes, or 0 if the key
+// isn't in buf
+static uint64_t smaps_value(const char *buf, const char *key)
+{
+	const char *line = buf;
+	size_t key_len = strlen(key);
+	while (line && *line) {
+		if (strncmp(line, key, key_len) == 0 && line[key_len] == ':')
+			return strtoull(line + key_len + 1, NULL, 10) * 1024;
+
+		line = strchr(line, '\n');
+		if (line)
+			++line;
+	}
+	return 0;
+}
+
+// NOTE: (isa): smaps_rollup is read with open and read rather than stdio, since
+// fopen mallocs its buffer and would show up in the malloc numbers
+void mem_snapshot_take(struct mem_snapshot *s, uint64_t consumed)
+{
+	*s = (struct mem_snapshot){ 0 };
+	s->consumed = consumed;
+
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) == 0) {
+		s->minor_faults = (uint64_t)usage.ru_minflt;
+		s->major_faults = (uint64_t)usage.ru_majflt;
+	} else {
+		LmLogWarning("getrusage failed: %s", strerror(errno));
+	}
+
+	int fd = open("/proc/self/smaps_rollup", O_RDONLY);
+	if (fd == -1) {
+		LmLogDebug("Unable to open smaps_rollup: %s", strerror(errno));
+		return;
+	}
+
+	char buf[4096];
+	ssize_t len = read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+	if (len <= 0)
+		return;
+
+	buf[len] = '\0';
+	s->rss = smaps_value(buf, "Rss");
+	s->pss = smaps_value(buf, "Pss");
+	s->anon_huge = smaps_value(buf, "AnonHugePages");
+}
+
+// Resident bytes from statm, which is much cheaper to read than smaps_rollup
+// and fine for sampling during a run
+uint64_t mem_current_rss(void)
+{
+	int fd = open("/proc/self/statm", O_RDONLY);
+	if (fd == -1)
+		return 0;
+
+	char buf[128];
+	ssize_t len = read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+	if (len <= 0)
+		return 0;
+
+	buf[len] = '\0';
+	char *resident = strchr(buf, ' ');
+	if (!resident)
+		return 0;
+	return strtoull(resident + 1, NULL, 10) * get_page_size();
+}
+
+// Bytes in chunks malloc has handed out, including its chunk headers and
+// rounding, and the ones it mmap'd directly
+uint64_t malloc_consumed_bytes(void)
+{
+	struct mallinfo2 mi = mallinfo2();
+	return mi.uordblks + mi.hblkhd;
+}
+
+double mem_consumed_overhead_per_alloc(const struct mem_footprint *fp)
+{
+	if (fp->allocs == 0)
+		return 0.0;
+
+	double consumed = (double)fp->end.consumed - (double)fp->begin.consumed;
+	return (consumed - (double)fp->requested) / (double)fp->allocs;
+}
+
+// Counts everything the process faulted in during the phase, so page
+// granularity and anything the allocator touches besides the returned memory
+// is included
+double mem_rss_overhead_per_alloc(const struct mem_footprint *fp)
+{
+	if (fp->allocs == 0)
+		return 0.0;
+
+	double rss = (double)fp->end.rss - (double)fp->begin.rss;
+	return (rss - (double)fp->requested) / (double)fp->allocs;
+}
+
+static double delta(uint64_t end, uint64_t begin)
+{
+	return (double)end - (double)begin;
+}
+
+void mem_footprint_log(const struct mem_footprint *fp,
+		       lm_log_module *log_module)
+{
+	const struct mem_snapshot *b = &fp->begin;
+	const struct mem_snapshot *e = &fp->end;
+	LmLogManual(log_module, true, INF,
+		    "\tfaults: %.0f minor, %.0f major\n"
+		    "\trss %.1f KiB (%+.1f), pss %.1f KiB (%+.1f),"
+		    " anon huge %.1f KiB (%+.1f)\n",
+		    delta(e->minor_faults, b->minor_faults),
+		    delta(e->major_faults, b->major_faults),
+		    (double)e->rss / 1024.0, delta(e->rss, b->rss) / 1024.0,
+		    (double)e->pss / 1024.0, delta(e->pss, b->pss) / 1024.0,
+		    (double)e->anon_huge / 1024.0,
+		    delta(e->anon_huge, b->anon_huge) / 1024.0);
+	LmLogManual(log_module, true, INF,
+		    "\t%lu allocations of %lu bytes, allocator consumed %.0f,"
+		    " overhead per allocation %.2f B (allocator), %.2f B (rss)\n",
+		    fp->allocs, fp->requested, delta(e->consumed, b->consumed),
+		    mem_consumed_overhead_per_alloc(fp),
+		    mem_rss_overhead_per_alloc(fp));
+}
+
+// Layout: magic, version, a reserved word, allocations, requested bytes, and
+// then the begin and end snapshots as six words each, in struct order
+int mem_footprint_write_to_file(FILE *file, const struct mem_footprint *fp)
+{
+	uint64_t magic = MEM_TRAILER_MAGIC;
+	uint32_t header[2] = { MEM_TRAILER_VERSION, 0 };
+	uint64_t totals[2] = { fp->allocs, fp->requested };
+	struct mem_snapshot snapshots[2] = { fp->begin, fp->end };
+
+	int res;
+	if ((res = lm_write_bytes_to_file((uint8_t *)&magic, sizeof(magic),
+					  file)) != 0 ||
+	    (res = lm_write_bytes_to_file((uint8_t *)header, sizeof(header),
+					  file)) != 0 ||
+	    (res = lm_write_bytes_to_file((uint8_t *)totals, sizeof(totals),
+					  file)) != 0 ||
+	    (res = lm_write_bytes_to_file((uint8_t *)snapshots,
+					  sizeof(snapshots), file)) != 0)
+		return res;
+
+	return 0;
+}
+
+// Adds the footprint as a section of a result file, see result_file.h
+int mem_footprint_append_to_file(const char *filename,
+				 const struct mem_footprint *fp)
+{
+	struct result_section_writer w;
+	if (result_section_begin(&w, filename, RESULT_SECTION_MEM) != 0)
+		return -1;
+
+	if (mem_footprint_write_to_file(w.file, fp) != 0) {
+		lm_close_file(w.file);
+		return -1;
+	}
+	return result_section_end(&w, 0, 1);
+}
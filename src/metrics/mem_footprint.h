@@ -0,0 +1,95 @@
+#ifndef MEM_FOOTPRINT_H
+#define MEM_FOOTPRINT_H
+
+#include <src/lm.h>
+
+// The RESULT_SECTION_MEM section of a result file, see
+// mem_footprint_write_to_file for the layout
+#define MEM_TRAILER_MAGIC 0x4d454d4d4cULL // "LMMEM"
+#define MEM_TRAILER_VERSION 1
+
+// Process memory at one point in a run. The sizes are in bytes
+struct mem_snapshot {
+	uint64_t minor_faults;
+	uint64_t major_faults;
+	uint64_t rss;
+	uint64_t pss;
+	uint64_t anon_huge;
+	uint64_t consumed; // Bytes the allocator reports as handed out
+};
+
+// Snapshots taken right before and after a phase, and what the phase asked
+// the allocator for
+struct mem_footprint {
+	struct mem_snapshot begin;
+	struct mem_snapshot end;
+	uint64_t allocs;
+	uint64_t requested;
+};
+
+// NOTE: (isa): Counted by the sdhs arena wrappers, which have no single arena
+// to ask. Every thread counts into a slot of its own that only it writes, so
+// the pipeline's threads don't share a cache line while they're measured, and
+// the slots are summed once the threads are done.
+#define MEM_REQUEST_THREADS 64
+#define MEM_REQUEST_ARENAS 16
+
+struct mem_request_totals {
+	uint64_t allocs;
+	uint64_t bytes; // Requested
+	// The sum of how far the allocations pushed each arena, i.e. what the
+	// arenas have committed. Memory reused after a seek or free is counted
+	// once, and padding or rounding by the arena would be counted too.
+	uint64_t consumed;
+};
+
+struct mem_requests {
+	struct mem_request_totals totals;
+	// The furthest any allocation has reached in each arena, by address, so
+	// karena's position doesn't have to be asked for with an ioctl. karena's
+	// handles are indices, so the first arena's is NULL.
+	struct {
+		const void *arena;
+		uintptr_t end;
+		bool used;
+	} peaks[MEM_REQUEST_ARENAS];
+} __attribute__((aligned(64)));
+
+extern __thread struct mem_requests *mem_thread_requests;
+
+struct mem_requests *mem_requests_register(void);
+void mem_request_peak(struct mem_requests *r, const void *arena,
+		      const void *ptr, size_t size);
+void mem_request_forget_arena(const void *arena);
+void mem_requests_sum(struct mem_request_totals *sum);
+
+static inline void mem_count_request(const void *arena, const void *ptr,
+				     size_t size)
+{
+	struct mem_requests *r = mem_thread_requests;
+	if (LM_UNLIKELY(!r))
+		r = mem_requests_register();
+
+	// Relaxed stores rather than adds, the owner is the only writer
+	__atomic_store_n(&r->totals.allocs, r->totals.allocs + 1,
+			 __ATOMIC_RELAXED);
+	__atomic_store_n(&r->totals.bytes, r->totals.bytes + size,
+			 __ATOMIC_RELAXED);
+	if (ptr)
+		mem_request_peak(r, arena, ptr, size);
+}
+
+void mem_snapshot_take(struct mem_snapshot *s, uint64_t consumed);
+uint64_t mem_current_rss(void);
+uint64_t malloc_consumed_bytes(void);
+
+double mem_consumed_overhead_per_alloc(const struct mem_footprint *fp);
+double mem_rss_overhead_per_alloc(const struct mem_footprint *fp);
+
+void mem_footprint_log(const struct mem_footprint *fp,
+		       lm_log_module *log_module);
+int mem_footprint_write_to_file(FILE *file, const struct mem_footprint *fp);
+int mem_footprint_append_to_file(const char *filename,
+				 const struct mem_footprint *fp);
+
+#endif
@@ -0,0 +1,262 @@
+#include <src/lm.h>
+LM_LOG_REGISTER(perf_counters);
+
+#include <src/utils/system_info.h>
+
+#include "perf_counters.h"
+
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#define HW_CACHE_MISS(cache)                                \
+	((cache) | (PERF_COUNT_HW_CACHE_OP_READ << 8) | \
+	 (PERF_COUNT_HW_CACHE_RESULT_MISS << 16))
+
+static const struct {
+	uint32_t type;
+	uint64_t config;
+	const char *name;
+} counter_defs[PERF_COUNTER_COUNT] = {
+	[PERF_INSTRUCTIONS] = { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS,
+				"instructions" },
+	[PERF_CYCLES] = { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES,
+			  "cycles" },
+	[PERF_L1D_MISSES] = { PERF_TYPE_HW_CACHE,
+			      HW_CACHE_MISS(PERF_COUNT_HW_CACHE_L1D),
+			      "l1d_misses" },
+	[PERF_LLC_MISSES] = { PERF_TYPE_HW_CACHE,
+			      HW_CACHE_MISS(PERF_COUNT_HW_CACHE_LL),
+			      "llc_misses" },
+	[PERF_DTLB_MISSES] = { PERF_TYPE_HW_CACHE,
+			       HW_CACHE_MISS(PERF_COUNT_HW_CACHE_DTLB),
+			       "dtlb_misses" },
+	[PERF_BRANCH_MISSES] = { PERF_TYPE_HARDWARE,
+				 PERF_COUNT_HW_BRANCH_MISSES,
+				 "branch_misses" },
+	[PERF_PAGE_FAULTS] = { PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS,
+			       "page_faults" },
+};
+
+const char *perf_counter_string(enum perf_counter counter)
+{
+	if (counter >= PERF_COUNTER_COUNT)
+		return "unknown";
+	return counter_defs[counter].name;
+}
+
+static int perf_event_open(struct perf_event_attr *attr, pid_t pid, int cpu,
+			   int group_fd, unsigned long flags)
+{
+	return (int)syscall(SYS_perf_event_open, attr, pid, cpu, group_fd,
+			    flags);
+}
+
+static int read_perf_event_paranoid(void)
+{
+	int level = -1;
+	FILE *file = fopen("/proc/sys/kernel/perf_event_paranoid", "r");
+	if (file) {
+		if (fscanf(file, "%d", &level) != 1)
+			level = -1;
+		fclose(file);
+	}
+	return level;
+}
+
+bool perf_group_open(struct perf_group *group, bool rdpmc)
+{
+	*group = (struct perf_group){ 0 };
+	group->leader = -1;
+	for (int i = 0; i < PERF_COUNTER_COUNT; ++i)
+		group->fds[i] = -1;
+
+	int first_err = 0;
+	for (int i = 0; i < PERF_COUNTER_COUNT; ++i) {
+		struct perf_event_attr attr = { 0 };
+		attr.size = sizeof(attr);
+		attr.type = counter_defs[i].type;
+		attr.config = counter_defs[i].config;
+		attr.disabled = (group->leader == -1);
+		attr.exclude_kernel = 0;
+		attr.exclude_hv = 1;
+		attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_ID |
+				   PERF_FORMAT_TOTAL_TIME_ENABLED |
+				   PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+		int group_fd = (group->leader == -1) ? -1 :
+						       group->fds[group->leader];
+		int fd = perf_event_open(&attr, 0, -1, group_fd, 0);
+		if (fd == -1 && attr.exclude_kernel == 0 &&
+		    (errno == EACCES || errno == EPERM)) {
+			// perf_event_paranoid 2 only allows user space counting
+			attr.exclude_kernel = 1;
+			fd = perf_event_open(&attr, 0, -1, group_fd, 0);
+		}
+
+		if (fd == -1) {
+			if (!first_err)
+				first_err = errno;
+			LmLogDebug("Unable to open %s: %s", counter_defs[i].name,
+				   strerror(errno));
+			continue;
+		}
+
+		group->fds[i] = fd;
+		group->available |= 1u << i;
+		if (group->leader == -1)
+			group->leader = i;
+		if (ioctl(fd, PERF_EVENT_IOC_ID, &group->ids[i]) != 0)
+			LmLogWarning("Unable to get the id of %s: %s",
+				     counter_defs[i].name, strerror(errno));
+
+		if (!rdpmc || counter_defs[i].type == PERF_TYPE_SOFTWARE)
+			continue;
+
+		void *page = mmap(NULL, get_page_size(), PROT_READ, MAP_SHARED,
+				  fd, 0);
+		if (page == MAP_FAILED)
+			continue;
+
+		group->pages[i] = page;
+		if (group->pages[i]->cap_user_rdpmc)
+			group->rdpmc_mask |= 1u << i;
+	}
+
+	if (group->leader == -1) {
+		LmLogWarning(
+			"No performance counters available (%s, perf_event_paranoid is %d), running without them",
+			strerror(first_err), read_perf_event_paranoid());
+		return false;
+	}
+
+	if (rdpmc && !group->rdpmc_mask)
+		LmLogWarning(
+			"rdpmc is not permitted, per allocation counters are disabled");
+	return true;
+}
+
+void perf_group_close(struct perf_group *group)
+{
+	for (int i = 0; i < PERF_COUNTER_COUNT; ++i) {
+		if (group->pages[i])
+			munmap(group->pages[i], get_page_size());
+		if (group->fds[i] != -1)
+			close(group->fds[i]);
+	}
+	*group = (struct perf_group){ 0 };
+	group->leader = -1;
+}
+
+// Opens and closes a group, so callers can turn counters off up front instead
+// of warning in every forked test
+bool perf_counters_probe(void)
+{
+	struct perf_group group;
+	if (!perf_group_open(&group, false))
+		return false;
+
+	LmLogInfo("Performance counters available: 0x%x", group.available);
+	perf_group_close(&group);
+	return true;
+}
+
+void perf_group_start(struct perf_group *group)
+{
+	int fd = group->fds[group->leader];
+	ioctl(fd, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+	ioctl(fd, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+}
+
+void perf_group_stop(struct perf_group *group, struct perf_sample *sample)
+{
+	int fd = group->fds[group->leader];
+	ioctl(fd, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+
+	*sample = (struct perf_sample){ 0 };
+	sample->per_alloc_mask = group->rdpmc_mask;
+
+	// nr, time_enabled, time_running, then { value, id } per counter
+	uint64_t buf[3 + 2 * PERF_COUNTER_COUNT];
+	ssize_t bytes = read(fd, buf, sizeof(buf));
+	if (bytes < (ssize_t)(3 * sizeof(uint64_t))) {
+		LmLogWarning("Unable to read performance counters: %s",
+			     strerror(errno));
+		return;
+	}
+
+	uint64_t nr = LmMin(buf[0], (uint64_t)PERF_COUNTER_COUNT);
+	sample->time_enabled = buf[1];
+	sample->time_running = buf[2];
+	for (uint64_t i = 0; i < nr; ++i) {
+		uint64_t value = buf[3 + 2 * i];
+		uint64_t id = buf[4 + 2 * i];
+		for (int j = 0; j < PERF_COUNTER_COUNT; ++j) {
+			if ((group->available & (1u << j)) &&
+			    group->ids[j] == id) {
+				sample->values[j] = value;
+				sample->available |= 1u << j;
+			}
+		}
+	}
+
+	// NOTE: (isa): A group that never got scheduled, e.g. because it needs
+	// more counters than the PMU has, reads as all zeros
+	if (sample->time_running == 0) {
+		LmLogWarning(
+			"Performance counter group was never scheduled, discarding it");
+		sample->available = 0;
+	}
+}
+
+void perf_log_sample(struct perf_sample *sample, uint64_t ops,
+		     lm_log_module *log_module)
+{
+	if (!sample->available)
+		return;
+
+	for (int i = 0; i < PERF_COUNTER_COUNT; ++i) {
+		if (!(sample->available & (1u << i)))
+			continue;
+		LmLogManual(log_module, true, INF, "\t%-14s %14lu (%.3f per op)\n",
+			    counter_defs[i].name, sample->values[i],
+			    ops ? (double)sample->values[i] / (double)ops : 0.0);
+	}
+
+	if (sample->values[PERF_CYCLES] && sample->values[PERF_INSTRUCTIONS])
+		LmLogManual(log_module, true, INF, "\t%-14s %14.3f\n", "ipc",
+			    (double)sample->values[PERF_INSTRUCTIONS] /
+				    (double)sample->values[PERF_CYCLES]);
+}
+
+// Layout: magic, version, counter count, available mask, per allocation mask,
+// time enabled, time running, the phase totals, and then, if the per
+// allocation mask is set, count rows of per allocation deltas
+int perf_write_to_file(FILE *file, struct perf_sample *sample,
+		       uint64_t *per_alloc, uint64_t count)
+{
+	uint64_t magic = PERF_TRAILER_MAGIC;
+	uint32_t header[4] = { PERF_TRAILER_VERSION, PERF_COUNTER_COUNT,
+			       sample->available,
+			       per_alloc ? sample->per_alloc_mask : 0 };
+
+	int res;
+	if ((res = lm_write_bytes_to_file((uint8_t *)&magic, sizeof(magic),
+					  file)) != 0 ||
+	    (res = lm_write_bytes_to_file((uint8_t *)header, sizeof(header),
+					  file)) != 0 ||
+	    (res = lm_write_bytes_to_file((uint8_t *)&sample->time_enabled,
+					  2 * sizeof(uint64_t), file)) != 0 ||
+	    (res = lm_write_bytes_to_file((uint8_t *)sample->values,
+					  sizeof(sample->values), file)) != 0)
+		return res;
+
+	if (per_alloc && sample->per_alloc_mask && count > 0)
+		res = lm_write_bytes_to_file((uint8_t *)per_alloc,
+					     count * PERF_COUNTER_COUNT *
+						     sizeof(uint64_t),
+					     file);
+	return res;
+}
@@ -0,0 +1,97 @@
+#ifndef PERF_COUNTERS_H
+#define PERF_COUNTERS_H
+
+#include <src/lm.h>
+
+#include <linux/perf_event.h>
+
+// The RESULT_SECTION_PERF section of a result file, see perf_write_to_file
+// for the layout
+#define PERF_TRAILER_MAGIC 0x464552504d4cULL // "LMPERF"
+#define PERF_TRAILER_VERSION 1
+
+enum perf_counter {
+	PERF_INSTRUCTIONS,
+	PERF_CYCLES,
+	PERF_L1D_MISSES,
+	PERF_LLC_MISSES,
+	PERF_DTLB_MISSES,
+	PERF_BRANCH_MISSES,
+	PERF_PAGE_FAULTS,
+	PERF_COUNTER_COUNT
+};
+
+struct perf_params {
+	bool enabled;
+	bool per_alloc;
+};
+
+// Counter totals for one benchmark phase. Counters that could not be opened
+// are left out of available and read as 0
+struct perf_sample {
+	uint32_t available;
+	uint32_t per_alloc_mask;
+	uint64_t time_enabled;
+	uint64_t time_running;
+	uint64_t values[PERF_COUNTER_COUNT];
+};
+
+struct perf_group {
+	int fds[PERF_COUNTER_COUNT];
+	uint64_t ids[PERF_COUNTER_COUNT];
+	struct perf_event_mmap_page *pages[PERF_COUNTER_COUNT];
+	uint32_t available;
+	uint32_t rdpmc_mask;
+	int leader;
+};
+
+const char *perf_counter_string(enum perf_counter counter);
+
+bool perf_counters_probe(void);
+bool perf_group_open(struct perf_group *group, bool rdpmc);
+void perf_group_close(struct perf_group *group);
+void perf_group_start(struct perf_group *group);
+void perf_group_stop(struct perf_group *group, struct perf_sample *sample);
+
+void perf_log_sample(struct perf_sample *sample, uint64_t ops,
+		     lm_log_module *log_module);
+int perf_write_to_file(FILE *file, struct perf_sample *sample,
+		       uint64_t *per_alloc, uint64_t count);
+
+static inline uint64_t perf_rdpmc(uint32_t counter)
+{
+	uint32_t low, high;
+	__asm__ volatile("rdpmc" : "=a"(low), "=d"(high) : "c"(counter));
+	return ((uint64_t)high << 32) | low;
+}
+
+// Reads a counter from user space, following the sequence described in
+// linux/perf_event.h. Only valid for counters in rdpmc_mask
+static inline uint64_t perf_read_counter(struct perf_event_mmap_page *pc)
+{
+	uint32_t seq, idx;
+	uint64_t count;
+	do {
+		seq = pc->lock;
+		__asm__ volatile("" ::: "memory");
+		idx = pc->index;
+		count = (uint64_t)pc->offset;
+		if (LM_LIKELY(pc->cap_user_rdpmc && idx)) {
+			uint32_t shift = 64 - pc->pmc_width;
+			int64_t pmc = (int64_t)(perf_rdpmc(idx - 1) << shift);
+			count += (uint64_t)(pmc >> shift);
+		}
+		__asm__ volatile("" ::: "memory");
+	} while (pc->lock != seq);
+
+	return count;
+}
+
+static inline void perf_read_all(struct perf_group *group, uint64_t *values)
+{
+	for (int i = 0; i < PERF_COUNTER_COUNT; ++i)
+		if (group->rdpmc_mask & (1u << i))
+			values[i] = perf_read_counter(group->pages[i]);
+}
+
+#endif
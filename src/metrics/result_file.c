@@ -0,0 +1,226 @@
+#include <src/lm.h>
+LM_LOG_REGISTER(result_file);
+
+#include <src/allocators/allocator_wrappers.h>
+#include <src/utils/system_info.h>
+#include <src/utils/noise_control.h>
+
+#include "result_file.h"
+
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+// Set by the Makefile
+#ifndef LM_CFLAGS
+#define LM_CFLAGS "unknown"
+#endif
+
+#ifdef __clang__
+#define LM_COMPILER "clang " __clang_version__
+#else
+#define LM_COMPILER "gcc " __VERSION__
+#endif
+
+_Static_assert(sizeof(struct result_header) % RESULT_ALIGN == 0,
+	       "The samples have to start aligned right after the header");
+
+static void copy_field(char *dst, size_t len, const char *src)
+{
+	snprintf(dst, len, "%s", src ? src : "");
+}
+
+// NOTE: (isa): The CPU model and kernel don't change during a run, so they're
+// read once rather than for each of the hundreds of files a suite writes
+static void fill_environment(struct result_header *header)
+{
+	static char cpu_model[sizeof(header->cpu_model)];
+	static char kernel[sizeof(header->kernel)];
+	if (!cpu_model[0]) {
+		get_cpu_model(cpu_model, sizeof(cpu_model));
+		get_kernel_version(kernel, sizeof(kernel));
+	}
+
+	header->page_size = get_page_size();
+	header->tsc_freq = get_tsc_freq();
+	header->timer_overhead = get_alloc_timer_overhead();
+	memcpy(header->cpu_model, cpu_model, sizeof(cpu_model));
+	memcpy(header->kernel, kernel, sizeof(kernel));
+	copy_field(header->compiler, sizeof(header->compiler), LM_COMPILER);
+	copy_field(header->cflags, sizeof(header->cflags), LM_CFLAGS);
+
+	const struct noise_env *env = noise_env_get();
+	header->pinned_cpu = env->pinned_cpu;
+	header->sched_policy = env->sched_policy;
+	header->sched_priority = env->sched_priority;
+	header->env_flags = env->flags;
+	header->warmup = env->warmup;
+	header->smt_siblings = env->smt_siblings;
+	header->freq_min_khz = env->freq_min_khz;
+	header->freq_max_khz = env->freq_max_khz;
+	copy_field(header->governor, sizeof(header->governor), env->governor);
+	copy_field(header->isolated_cpus, sizeof(header->isolated_cpus),
+		   env->isolated_cpus);
+}
+
+static int pad_to_alignment(FILE *file, uint64_t *offset)
+{
+	static const uint8_t zeros[RESULT_ALIGN] = { 0 };
+	long pos = ftell(file);
+	if (pos < 0)
+		return -1;
+
+	uint64_t padding = LmPaddingToAlign((uint64_t)pos, RESULT_ALIGN);
+	if (padding && fwrite(zeros, padding, 1, file) != 1)
+		return -1;
+
+	*offset = (uint64_t)pos + padding;
+	return 0;
+}
+
+// Writes the header and, if there are any, the samples as the first section
+int result_file_write(const char *filename, const struct result_info *info,
+		      uint64_t total_tsc, uint64_t iter, uint64_t *samples,
+		      uint64_t count, bool raw_timings)
+{
+	struct result_header header = { 0 };
+	header.magic = RESULT_MAGIC;
+	header.version = RESULT_VERSION;
+	header.header_size = sizeof(header);
+	header.thread_count = info->thread_count ? info->thread_count : 1;
+	header.total_tsc = total_tsc;
+	header.iter = iter;
+	copy_field(header.allocator, sizeof(header.allocator), info->allocator);
+	copy_field(header.size_class, sizeof(header.size_class),
+		   info->size_class);
+	fill_environment(&header);
+	if (raw_timings)
+		header.timer_overhead = 0;
+
+	if (count > 0) {
+		header.section_count = 1;
+		header.sections[0] = (struct result_section){
+			.type = RESULT_SECTION_SAMPLES,
+			.elem_size = sizeof(uint64_t),
+			.offset = sizeof(header),
+			.size = count * sizeof(uint64_t),
+			.count = count,
+		};
+	}
+
+	FILE *file = lm_open_file_by_name(filename, "wb");
+	if (!file)
+		return -1;
+
+	int res = lm_write_bytes_to_file((uint8_t *)&header, sizeof(header),
+					 file);
+	if (res == 0 && count > 0)
+		res = lm_write_bytes_to_file((uint8_t *)samples,
+					     count * sizeof(uint64_t), file);
+
+	lm_close_file(file);
+	return res;
+}
+
+// NOTE: (isa): Version 1 headers are version 2 without the environment block,
+// so the section table follows cflags directly. They are read into the
+// current header with the environment left unknown, like result_file.py does
+#define RESULT_ENV_OFFSET offsetof(struct result_header, pinned_cpu)
+#define RESULT_ENV_SIZE \
+	(offsetof(struct result_header, sections) - RESULT_ENV_OFFSET)
+#define RESULT_V1_HEADER_SIZE (sizeof(struct result_header) - RESULT_ENV_SIZE)
+
+int result_file_read_header(FILE *file, struct result_header *header)
+{
+	*header = (struct result_header){ 0 };
+	if (fread(header, RESULT_ENV_OFFSET, 1, file) != 1 ||
+	    header->magic != RESULT_MAGIC)
+		return -1;
+
+	if (header->version == 1 &&
+	    header->header_size == RESULT_V1_HEADER_SIZE) {
+		header->pinned_cpu = -1;
+		if (fread(header->sections, sizeof(header->sections), 1,
+			  file) != 1)
+			return -1;
+	} else if (header->version != RESULT_VERSION ||
+		   header->header_size != sizeof(*header) ||
+		   fread((uint8_t *)header + RESULT_ENV_OFFSET,
+			 sizeof(*header) - RESULT_ENV_OFFSET, 1, file) != 1) {
+		return -1;
+	}
+
+	if (header->section_count > RESULT_MAX_SECTIONS)
+		return -1;
+	return 0;
+}
+
+const struct result_section *
+result_find_section(const struct result_header *header,
+		    enum result_section_type type)
+{
+	for (uint32_t i = 0; i < header->section_count; ++i)
+		if (header->sections[i].type == (uint32_t)type)
+			return &header->sections[i];
+	return NULL;
+}
+
+// Opens the file for another section, leaving w->file at the aligned end of
+// it. Whatever is written there until result_section_end makes up the section
+int result_section_begin(struct result_section_writer *w, const char *filename,
+			 enum result_section_type type)
+{
+	*w = (struct result_section_writer){ 0 };
+	w->file = lm_open_file_by_name(filename, "r+b");
+	if (!w->file)
+		return -1;
+
+	// The header is written back as it was read, so older versions can't
+	// be appended to
+	if (result_file_read_header(w->file, &w->header) != 0 ||
+	    w->header.version != RESULT_VERSION ||
+	    w->header.section_count == RESULT_MAX_SECTIONS) {
+		LmLogError("%s is not a result file with room for a section",
+			   filename);
+		goto err;
+	}
+
+	if (fseek(w->file, 0, SEEK_END) != 0 ||
+	    pad_to_alignment(w->file, &w->offset) != 0)
+		goto err;
+
+	w->type = (uint32_t)type;
+	return 0;
+
+err:
+	lm_close_file(w->file);
+	w->file = NULL;
+	return -1;
+}
+
+int result_section_end(struct result_section_writer *w, uint32_t elem_size,
+		       uint64_t count)
+{
+	long end = ftell(w->file);
+	int res = -1;
+	if (end < 0)
+		goto out;
+
+	w->header.sections[w->header.section_count++] =
+		(struct result_section){
+			.type = w->type,
+			.elem_size = elem_size,
+			.offset = w->offset,
+			.size = (uint64_t)end - w->offset,
+			.count = count,
+		};
+
+	if (fseek(w->file, 0, SEEK_SET) == 0)
+		res = lm_write_bytes_to_file((uint8_t *)&w->header,
+					     sizeof(w->header), w->file);
+
+out:
+	lm_close_file(w->file);
+	w->file = NULL;
+	return res;
+}
@@ -0,0 +1,99 @@
+#ifndef RESULT_FILE_H
+#define RESULT_FILE_H
+
+#include <src/lm.h>
+
+// NOTE: (isa): A run's result file starts with a fixed size header that
+// describes the run and holds a table of sections. Every section starts on a
+// RESULT_ALIGN boundary, so the samples, and the rest of the u64 arrays, can
+// be memory mapped (e.g. numpy.memmap) at the offset in the table without
+// copying. The sections are appended one at a time, each filling in its slot
+// of the table, so the samples are written first and the counters, memory
+// footprint and histogram follow when the test has them
+#define RESULT_MAGIC 0x544c555345524d4cULL // "LMRESULT"
+#define RESULT_VERSION 2
+#define RESULT_ALIGN 64
+#define RESULT_MAX_SECTIONS 8
+
+enum result_section_type {
+	RESULT_SECTION_NONE,
+	RESULT_SECTION_SAMPLES, // count u64 TSC samples
+	RESULT_SECTION_HISTOGRAM, // See hdr_write_to_file
+	RESULT_SECTION_PERF, // See perf_write_to_file
+	RESULT_SECTION_MEM, // See mem_footprint_write_to_file
+	RESULT_SECTION_PIPELINE, // count pb_step_result, see PbReport
+	RESULT_SECTION_SCHEDULE, // See schedule_header in interleaved_test.h
+	RESULT_SECTION_TYPE_COUNT
+};
+
+struct result_section {
+	uint32_t type;
+	uint32_t elem_size; // 0 if the section isn't a plain array
+	uint64_t offset; // From the start of the file
+	uint64_t size; // Bytes
+	uint64_t count;
+};
+
+struct result_header {
+	uint64_t magic;
+	uint32_t version;
+	uint32_t header_size;
+	uint32_t section_count;
+	uint32_t thread_count;
+	uint64_t page_size;
+	double tsc_freq;
+	uint64_t timer_overhead; // Subtracted from every sample, in TSC
+	uint64_t total_tsc; // The run's alloc_tstats
+	uint64_t iter;
+	char allocator[64];
+	char size_class[64];
+	char cpu_model[64];
+	char kernel[64];
+	char compiler[64];
+	char cflags[256];
+	// See struct noise_env
+	int32_t pinned_cpu;
+	int32_t sched_policy;
+	int32_t sched_priority;
+	uint32_t env_flags;
+	uint64_t warmup;
+	uint32_t smt_siblings;
+	uint32_t freq_min_khz;
+	uint32_t freq_max_khz;
+	uint32_t reserved;
+	char governor[24];
+	char isolated_cpus[64];
+	struct result_section sections[RESULT_MAX_SECTIONS];
+};
+
+// What the header records about the run besides the environment
+struct result_info {
+	const char *allocator;
+	const char *size_class;
+	uint32_t thread_count;
+};
+
+struct result_section_writer {
+	FILE *file;
+	struct result_header header;
+	uint32_t type;
+	uint64_t offset;
+};
+
+// raw_timings is set when the timer overhead wasn't subtracted from the
+// samples, and the header then records no overhead
+int result_file_write(const char *filename, const struct result_info *info,
+		      uint64_t total_tsc, uint64_t iter, uint64_t *samples,
+		      uint64_t count, bool raw_timings);
+
+int result_section_begin(struct result_section_writer *w, const char *filename,
+			 enum result_section_type type);
+int result_section_end(struct result_section_writer *w, uint32_t elem_size,
+		       uint64_t count);
+
+int result_file_read_header(FILE *file, struct result_header *header);
+const struct result_section *
+result_find_section(const struct result_header *header,
+		    enum result_section_type type);
+
+#endif
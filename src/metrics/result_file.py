@@ -0,0 +1,216 @@
+"""Reads the result files the benchmarks write, see result_file.h.
+
+A result file starts with a fixed size header describing the run, followed by
+sections at 64 byte aligned offsets. The samples are mapped with np.memmap
+rather than read, so large runs don't have to fit in memory twice. Files from
+before the header existed (tstats, count, samples, then the trailers) are
+still read, with the metadata they don't have left empty.
+"""
+import glob
+import os
+import struct
+from dataclasses import dataclass, field
+
+import numpy as np
+
+RESULT_MAGIC = 0x544c555345524d4c
+RESULT_VERSION = 2
+
+SECTION_SAMPLES = 1
+SECTION_HISTOGRAM = 2
+SECTION_PERF = 3
+SECTION_MEM = 4
+SECTION_PIPELINE = 5
+SECTION_SCHEDULE = 6
+
+# See pb_step_result, the latencies are p50, p90, p99, p99.9 and max in ns for
+# the receive, handoff, commit and end-to-end stages
+PIPELINE_STAGES = ('receive', 'handoff', 'commit', 'end-to-end')
+PIPELINE_STEP = np.dtype([('offered_rate', '<u8'), ('packet_count', '<u8'),
+                          ('sent_rate', '<f8'), ('committed_rate', '<f8'),
+                          ('saturated', '<u8'),
+                          ('latency_ns', '<u8', (len(PIPELINE_STAGES), 5))])
+
+# See schedule_header and schedule_trial, the header holds the schedule's seed
+# and is followed by one row per trial of an interleaved run's tuple
+SCHEDULE_HEADER = struct.Struct('<Q')
+SCHEDULE_TRIAL = np.dtype([('trial', '<u8'), ('position', '<u8'),
+                           ('start_tsc', '<u8'), ('total_tsc', '<u8'),
+                           ('allocs', '<u8')])
+
+# See enum noise_env_flag
+ENV_MLOCKED = 1 << 0
+ENV_TURBO_KNOWN = 1 << 1
+ENV_TURBO = 1 << 2
+ENV_SMT_ACTIVE = 1 << 3
+ENV_CPU_ISOLATED = 1 << 4
+ENV_FREQ_SCALING = 1 << 5
+
+# Must match struct result_header. Version 2 added the noise control block
+_HEADER = struct.Struct('<QIIIIQdQQQ64s64s64s64s64s256s')
+_ENV = struct.Struct('<iiiIQIIII24s64s')
+_SECTION = struct.Struct('<IIQQQ')
+_MAX_SECTIONS = 8
+_TABLE_SIZE = _MAX_SECTIONS * _SECTION.size
+HEADER_SIZES = {1: _HEADER.size + _TABLE_SIZE,
+                2: _HEADER.size + _ENV.size + _TABLE_SIZE}
+HEADER_SIZE = HEADER_SIZES[RESULT_VERSION]
+
+@dataclass
+class Section:
+    type: int
+    elem_size: int
+    offset: int
+    size: int
+    count: int
+
+@dataclass
+class ResultFile:
+    path: str
+    version: int = 0  # 0 for the legacy format
+    thread_count: int = 1
+    page_size: int = 0
+    tsc_freq: float = None
+    timer_overhead: int = 0
+    total_tsc: int = 0
+    iter: int = 0
+    allocator: str = ""
+    size_class: str = ""
+    cpu_model: str = ""
+    kernel: str = ""
+    compiler: str = ""
+    cflags: str = ""
+    # How noisy the host was, see struct noise_env. Unknown before version 2
+    pinned_cpu: int = -1
+    sched_policy: int = 0
+    sched_priority: int = 0
+    env_flags: int = 0
+    warmup: int = 0
+    smt_siblings: int = 0
+    freq_min_khz: int = 0
+    freq_max_khz: int = 0
+    governor: str = ""
+    isolated_cpus: str = ""
+    sections: dict = field(default_factory=dict)  # type -> Section
+    # Legacy files have no section table, the trailers follow the samples
+    # back to back and are told apart by their magics
+    trailer_offset: int = None
+
+    def samples(self):
+        """The raw TSC samples as a read only uint64 memmap, or an empty
+        array if the run kept none"""
+        s = self.sections.get(SECTION_SAMPLES)
+        if s is None or s.count == 0:
+            return np.empty(0, dtype=np.uint64)
+        return np.memmap(self.path, dtype=np.uint64, mode='r',
+                         offset=s.offset, shape=(s.count,))
+
+    def pipeline_steps(self):
+        """The sdhs pipeline benchmark's results, one PIPELINE_STEP per
+        offered load, or an empty array if the run wasn't one"""
+        s = self.sections.get(SECTION_PIPELINE)
+        if s is None or s.count == 0:
+            return np.empty(0, dtype=PIPELINE_STEP)
+        return np.fromfile(self.path, dtype=PIPELINE_STEP, count=s.count,
+                           offset=s.offset)
+
+    def schedule_trials(self):
+        """The trials of an interleaved run, in the order the tuple ran
+        them, or an empty array if the run wasn't one"""
+        s = self.sections.get(SECTION_SCHEDULE)
+        if s is None or s.count == 0:
+            return np.empty(0, dtype=SCHEDULE_TRIAL)
+        return np.fromfile(self.path, dtype=SCHEDULE_TRIAL, count=s.count,
+                           offset=s.offset + SCHEDULE_HEADER.size)
+
+    def schedule_seed(self):
+        """The seed an interleaved run's schedule was drawn from, or None if
+        the run wasn't one"""
+        s = self.sections.get(SECTION_SCHEDULE)
+        if s is None:
+            return None
+        with open(self.path, 'rb') as f:
+            f.seek(s.offset)
+            return SCHEDULE_HEADER.unpack(f.read(SCHEDULE_HEADER.size))[0]
+
+    def open_section(self, section_type):
+        """Returns the file positioned at the start of a section, or None if
+        the run doesn't have it. The caller closes the file"""
+        s = self.sections.get(section_type)
+        if s is None:
+            return None
+        f = open(self.path, 'rb')
+        f.seek(s.offset)
+        return f
+
+def _string(raw):
+    return raw.split(b'\0', 1)[0].decode(errors='replace')
+
+def _load_legacy(path, f):
+    f.seek(0)
+    total_tsc, iters, count = struct.unpack('<3Q', f.read(24))
+    result = ResultFile(path=path, total_tsc=total_tsc, iter=iters,
+                        trailer_offset=24 + 8 * count)
+    result.sections[SECTION_SAMPLES] = Section(SECTION_SAMPLES, 8, 24,
+                                               8 * count, count)
+    return result
+
+def load_result(path):
+    with open(path, 'rb') as f:
+        raw = f.read(max(HEADER_SIZES.values()))
+        if len(raw) < 8 or struct.unpack_from('<Q', raw)[0] != RESULT_MAGIC:
+            return _load_legacy(path, f)
+        if len(raw) < _HEADER.size:
+            raise ValueError(f"{path} has a truncated header")
+
+    (_, version, header_size, section_count, thread_count, page_size,
+     tsc_freq, timer_overhead, total_tsc, iters, allocator, size_class,
+     cpu_model, kernel, compiler, cflags) = _HEADER.unpack_from(raw)
+    if HEADER_SIZES.get(version) != header_size:
+        raise ValueError(f"{path} is result format version {version} with a "
+                         f"{header_size} byte header, this reads versions "
+                         f"up to {RESULT_VERSION}")
+    if len(raw) < header_size:
+        raise ValueError(f"{path} has a truncated header")
+
+    result = ResultFile(path=path, version=version, thread_count=thread_count,
+                        page_size=page_size, tsc_freq=tsc_freq,
+                        timer_overhead=timer_overhead, total_tsc=total_tsc,
+                        iter=iters, allocator=_string(allocator),
+                        size_class=_string(size_class),
+                        cpu_model=_string(cpu_model), kernel=_string(kernel),
+                        compiler=_string(compiler), cflags=_string(cflags))
+    table = _HEADER.size
+    if version >= 2:
+        (result.pinned_cpu, result.sched_policy, result.sched_priority,
+         result.env_flags, result.warmup, result.smt_siblings,
+         result.freq_min_khz, result.freq_max_khz, _, governor,
+         isolated_cpus) = _ENV.unpack_from(raw, _HEADER.size)
+        result.governor = _string(governor)
+        result.isolated_cpus = _string(isolated_cpus)
+        table += _ENV.size
+    for i in range(min(section_count, _MAX_SECTIONS)):
+        s = Section(*_SECTION.unpack_from(raw, table + i * _SECTION.size))
+        result.sections[s.type] = s
+    return result
+
+def tsc_frequencies(directory):
+    """The TSC frequencies recorded by the runs under a test directory, e.g.
+    ./logs/arena/, from the result headers or the legacy *-tsc_freq.bin files"""
+    frequencies = []
+    for path in glob.glob(os.path.join(directory, "**", "[0-9]*.bin"),
+                          recursive=True):
+        if path.endswith("-tsc_freq.bin"):
+            continue
+        try:
+            result = load_result(path)
+        except (OSError, ValueError, struct.error) as e:
+            print(f"Warning: Couldn't parse {path}: {str(e)}")
+            continue
+        if result.tsc_freq:
+            frequencies.append(result.tsc_freq)
+
+    for path in glob.glob(os.path.join(directory, "*-tsc_freq.bin")):
+        with open(path, 'rb') as f:
+            frequencies.append(struct.unpack('d', f.read(8))[0])
+    return frequencies
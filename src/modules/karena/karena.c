@@ -8,32 +8,101 @@
 #include <linux/kernel.h>
 #include <linux/mm.h>
 #include <linux/slab.h>
-#include <linux/vmalloc.h>
+#include <linux/highmem.h>
+#include <linux/pagemap.h>
+#include <linux/mutex.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/random.h>
+#include <linux/bitmap.h>
+#include <linux/timex.h>
+#ifdef CONFIG_X86
+#include <asm/tsc.h>
+#endif
 #include "../../allocators/karena.h"
 
+#define CREATE_TRACE_POINTS
+#include "karena_trace.h"
+
 MODULE_LICENSE("GPL");
 
 #define DEVICE_NAME "karena"
 
+// Every arena gets its own window of the device's file offsets, see
+// KARENA_MMAP_SHIFT
+#define KARENA_PGOFF_SHIFT (KARENA_MMAP_SHIFT - PAGE_SHIFT)
+#define KARENA_PGOFF_MASK ((1UL << KARENA_PGOFF_SHIFT) - 1)
+
+// NOTE: (isa): Messages on the control path are only built into the module
+// with KARENA_DEBUG, use the debugfs stats or the tracepoints instead
+#ifdef KARENA_DEBUG
+#define karena_dbg(fmt, ...) pr_info(fmt, ##__VA_ARGS__)
+#else
+#define karena_dbg(fmt, ...) no_printk(fmt, ##__VA_ARGS__)
+#endif
+
 struct karena_device_data {
 	struct cdev cdev;
 	struct mutex lock;
 	unsigned long current_arena_index;
 };
 
+// Per open file of the device
+struct karena_file {
+	struct karena_device_data *dev_data;
+	// Arenas imported through this file. Their references are dropped on
+	// release, which happens after all mappings made through the file are
+	// gone.
+	DECLARE_BITMAP(imported, KARENA_MAX_ARENAS);
+};
+
 struct KArena {
 	size_t size;
 	size_t cur;
 	unsigned long uaddr;
+	unsigned long flags;
 	bool bootstrapped;
-	void *kaddr;
 	pid_t owner_pid;
+	// NOTE: (isa): Bootstrapped arenas point to the arena that owns the
+	// backing pages. Non-bootstrapped arenas point to themselves.
+	struct KArena *root;
+	// Backing pages are allocated lazily on first touch, and can be given
+	// back to the kernel with KARENA_DECOMMIT. Protected by lock.
+	struct mutex lock;
+	struct page **pages;
+	unsigned long nr_pages;
+	// NUMA node the backing pages (and the page table) are allocated on,
+	// NUMA_NO_NODE to use the node of the faulting CPU
+	int node;
+	// The device file mapping the arena is mapped through. Used to unmap
+	// decommitted pages from every mapping of the arena.
+	struct address_space *mapping;
+	// The address space of the owner's mapping, so that mremaps of
+	// imported mappings do not move the owner's view of the arena
+	struct mm_struct *mm;
+	// Sharing. The owner and every file that imported the arena hold a
+	// reference, and the arena is torn down when the last one is dropped.
+	// Protected by the device lock.
+	unsigned long token;
+	int refs;
+	// Statistics shown in debugfs. Updated without locking, like cur.
+	// faults is only counted on the arena that owns the pages.
+	u64 allocs;
+	u64 alloc_bytes;
+	u64 faults;
+	size_t peak_cur;
 };
 
-static struct KArena karenas[100];
+static struct KArena karenas[KARENA_MAX_ARENAS];
+
+static unsigned long karena_index(struct KArena *arena)
+{
+	return (unsigned long)(arena - karenas);
+}
 
 static struct class *class;
 static dev_t dev;
+static struct dentry *karena_debugfs;
 
 static struct karena_device_data karena;
 
@@ -51,6 +120,75 @@ static struct file_operations fops = {
 	.mmap = karena_mmap,
 };
 
+// Counts the resident backing pages, and how many of them are not on the
+// arena's node
+static unsigned long karena_resident_pages(struct KArena *root,
+					   unsigned long *remote)
+{
+	unsigned long i;
+	unsigned long resident = 0;
+
+	*remote = 0;
+	for (i = 0; i < root->nr_pages; i++) {
+		if (!root->pages[i])
+			continue;
+
+		resident++;
+		if (root->node != NUMA_NO_NODE &&
+		    page_to_nid(root->pages[i]) != root->node)
+			(*remote)++;
+	}
+
+	return resident;
+}
+
+// /sys/kernel/debug/karena/arenas, one line per live arena
+static int karena_stats_show(struct seq_file *m, void *unused)
+{
+	struct KArena *arena;
+	struct KArena *root;
+	unsigned long resident;
+	unsigned long remote;
+	int i;
+
+	seq_printf(m,
+		   "%5s %8s %14s %14s %14s %12s %14s %10s %10s %10s %5s %8s %5s %5s\n",
+		   "arena", "pid", "size", "cur", "peak_cur", "allocs",
+		   "alloc_bytes", "faults", "resident", "remote", "node",
+		   "flags", "root", "refs");
+
+	for (i = 0; i < KARENA_MAX_ARENAS; i++) {
+		arena = &karenas[i];
+		// NOTE: (isa): A concurrent destroy clears root without holding
+		// the arena's lock, so it is read once and only the local is
+		// used. A stale root still points into karenas[], and the other
+		// fields are only statistics, so a row racing a destroy can be
+		// off but never faults.
+		root = READ_ONCE(arena->root);
+		if (!root)
+			continue;
+
+		resident = 0;
+		remote = 0;
+		if (root == arena) {
+			mutex_lock(&arena->lock);
+			resident = karena_resident_pages(arena, &remote);
+			mutex_unlock(&arena->lock);
+		}
+
+		seq_printf(m,
+			   "%5d %8d %14zu %14zu %14zu %12llu %14llu %10llu %10lu %10lu %5d %8lx %5lu %5d\n",
+			   i, READ_ONCE(arena->owner_pid), READ_ONCE(arena->size),
+			   READ_ONCE(arena->cur), arena->peak_cur, arena->allocs,
+			   arena->alloc_bytes, arena->faults, resident, remote,
+			   READ_ONCE(root->node), READ_ONCE(arena->flags),
+			   karena_index(root), READ_ONCE(root->refs));
+	}
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(karena_stats);
+
 static int __init karena_init(void)
 {
 	if (alloc_chrdev_region(&dev, 0, 1, DEVICE_NAME) < 0)
@@ -76,6 +214,13 @@ static int __init karena_init(void)
 		return -1;
 	}
 
+	mutex_init(&karena.lock);
+
+	// Failing to set up debugfs is not fatal
+	karena_debugfs = debugfs_create_dir(DEVICE_NAME, NULL);
+	debugfs_create_file("arenas", 0444, karena_debugfs, NULL,
+			    &karena_stats_fops);
+
 	pr_info("Device has been inserted!\n");
 
 	return 0;
@@ -83,6 +228,7 @@ static int __init karena_init(void)
 
 static void __exit karena_exit(void)
 {
+	debugfs_remove_recursive(karena_debugfs);
 	cdev_del(&karena.cdev);
 	device_destroy(class, dev);
 	class_destroy(class);
@@ -102,7 +248,7 @@ static unsigned int find_open_slot(void)
 	while (info->uaddr != 0) {
 		index++;
 		info = &karenas[index];
-		if (index > 99) {
+		if (index > KARENA_MAX_ARENAS - 1) {
 			mutex_unlock(&karena.lock);
 			return -1;
 		}
@@ -116,12 +262,14 @@ static unsigned int find_open_slot(void)
 
 static long handle_arena_create(struct file *file, struct ka_data *alloc)
 {
-	pr_info("Creating arena\n");
-	struct karena_device_data *dev_data = file->private_data;
+	karena_dbg("Creating arena\n");
+	struct karena_file *kf = file->private_data;
+	struct karena_device_data *dev_data = kf->dev_data;
 	struct KArena *info;
+	long ret;
 
 	unsigned int index = find_open_slot();
-	pr_info("Found slot for arena @ index %u\n", index);
+	karena_dbg("Found slot for arena @ index %u\n", index);
 
 	if (index == -1) {
 		pr_err("Did not find open slot");
@@ -132,34 +280,179 @@ static long handle_arena_create(struct file *file, struct ka_data *alloc)
 	if (!info)
 		return -ENOMEM;
 
-	info->uaddr = 0;
+	// NOTE: (isa): The arena is only published (root and refs) once its size
+	// and node are checked and its page array exists, so a failed create
+	// doesn't leave a slot that karena_mmap or debugfs take for a live arena.
+	// Until then the slot is held by find_open_slot's placeholder uaddr,
+	// which is cleared again on failure.
+	karena_dbg("Reqested arena size: %lu\n", alloc->size);
+
+	size_t size = PAGE_ALIGN(alloc->size);
+	if (size == 0 || size > KARENA_MAX_SIZE) {
+		ret = -EINVAL;
+		goto err_release_slot;
+	}
+
+	karena_dbg("Aligned size: %lu\n", size);
+
+	int node = NUMA_NO_NODE;
+	if (alloc->flags & KA_NODE_LOCAL) {
+		node = numa_node_id();
+	} else if (alloc->flags & KA_NODE_MASK) {
+		node = KA_NODE_OF(alloc->flags);
+		if (node >= MAX_NUMNODES || !node_online(node)) {
+			pr_err("NUMA node %d is not online\n", node);
+			ret = -EINVAL;
+			goto err_release_slot;
+		}
+	}
+
+	size_t nr_pages = size >> PAGE_SHIFT;
+	struct page **pages = kvzalloc_node(
+		array_size(nr_pages, sizeof(struct page *)), GFP_KERNEL, node);
+	if (!pages) {
+		ret = -ENOMEM;
+		goto err_release_slot;
+	}
+
 	info->bootstrapped = false;
 	info->owner_pid = task_pid_nr(current);
 	info->cur = 0;
+	info->flags = alloc->flags;
+	info->mm = NULL;
+	info->token = 0;
+	info->allocs = 0;
+	info->alloc_bytes = 0;
+	info->faults = 0;
+	info->peak_cur = 0;
+	info->size = size;
+	info->node = node;
+	info->nr_pages = nr_pages;
+	info->pages = pages;
+	mutex_init(&info->lock);
+	info->refs = 1;
+	WRITE_ONCE(info->root, info);
+	info->uaddr = 0;
 
 	dev_data->current_arena_index = index;
 	alloc->arena = index;
+	alloc->size = size;
 
-	pr_info("Reqested arena size: %lu\n", alloc->size);
+	trace_karena_create(index, info->size, info->flags, info->owner_pid);
 
-	info->size = PAGE_ALIGN(alloc->size);
-	if (info->size == 0) {
-		kfree(info);
-		return -EINVAL;
+	return 0;
+
+err_release_slot:
+	mutex_lock(&karena.lock);
+	info->uaddr = 0;
+	mutex_unlock(&karena.lock);
+	return ret;
+}
+
+// Gives the backing pages in [start, end) of a root arena back to the kernel,
+// so that the next touch faults in a fresh zeroed page. start and end are page
+// aligned offsets into the root arena. Returns the number of bytes given back.
+static size_t karena_release_pages(struct KArena *root, unsigned long start,
+				   unsigned long end)
+{
+	loff_t base = (loff_t)karena_index(root) << KARENA_MMAP_SHIFT;
+	struct page *page;
+	unsigned long i;
+	size_t released = 0;
+
+	if (start >= end || !root->pages)
+		return 0;
+
+	mutex_lock(&root->lock);
+
+	if (root->mapping)
+		unmap_mapping_range(root->mapping, base + start, end - start,
+				    1);
+
+	for (i = start >> PAGE_SHIFT; i < (end >> PAGE_SHIFT); i++) {
+		page = root->pages[i];
+		if (!page)
+			continue;
+
+		root->pages[i] = NULL;
+
+		// A fault that found the page before we took the lock keeps it
+		// locked until the pte is installed, so wait for it and zap
+		// the pte it left behind
+		lock_page(page);
+		if (page_mapped(page) && root->mapping)
+			unmap_mapping_range(root->mapping,
+					    base + ((loff_t)i << PAGE_SHIFT),
+					    PAGE_SIZE, 1);
+		unlock_page(page);
+
+		put_page(page);
+		released += PAGE_SIZE;
 	}
 
-	alloc->size = info->size;
+	mutex_unlock(&root->lock);
 
-	pr_info("Aligned size: %lu\n", info->size);
+	return released;
+}
 
-	info->kaddr = vmalloc(info->size);
-	if (!info->kaddr) {
-		kfree(info);
-		info = NULL;
-		return -ENOMEM;
+static void karena_free_pages(struct KArena *root)
+{
+	unsigned long i;
+
+	if (!root->pages)
+		return;
+
+	// Pages that are still mapped are kept alive by their mappings
+	for (i = 0; i < root->nr_pages; i++) {
+		if (root->pages[i])
+			put_page(root->pages[i]);
 	}
 
-	return 0;
+	kvfree(root->pages);
+	root->pages = NULL;
+	root->nr_pages = 0;
+}
+
+// Zeroes [from, to) of an arena for KA_ZERO_ON_REUSE. Whole pages are given
+// back to the kernel, and only the partial pages at the edges are memset,
+// since they might be shared with a neighbouring bootstrapped arena.
+static void karena_scrub(struct KArena *arena, size_t from, size_t to)
+{
+	struct KArena *root = arena->root;
+	unsigned long base = arena->uaddr - root->uaddr;
+	unsigned long start = base + from;
+	unsigned long end = base + to;
+	unsigned long full_start = PAGE_ALIGN(start);
+	unsigned long full_end = end & PAGE_MASK;
+	struct page *page;
+
+	if (start >= end || !root->pages)
+		return;
+
+	mutex_lock(&root->lock);
+	if (full_start > full_end) {
+		page = root->pages[start >> PAGE_SHIFT];
+		if (page)
+			memzero_page(page, offset_in_page(start), end - start);
+		mutex_unlock(&root->lock);
+		return;
+	}
+
+	if (start < full_start) {
+		page = root->pages[start >> PAGE_SHIFT];
+		if (page)
+			memzero_page(page, offset_in_page(start),
+				     full_start - start);
+	}
+
+	if (full_end < end) {
+		page = root->pages[full_end >> PAGE_SHIFT];
+		if (page)
+			memzero_page(page, 0, end - full_end);
+	}
+	mutex_unlock(&root->lock);
+
+	karena_release_pages(root, full_start, full_end);
 }
 
 static long handle_arena_alloc(struct KArena *arena, struct ka_data *alloc)
@@ -167,6 +460,12 @@ static long handle_arena_alloc(struct KArena *arena, struct ka_data *alloc)
 	if (__builtin_expect(!!(arena->cur + alloc->size <= arena->size), 1)) {
 		alloc->arena = arena->uaddr + arena->cur;
 		arena->cur += alloc->size;
+		arena->allocs++;
+		arena->alloc_bytes += alloc->size;
+		if (arena->cur > arena->peak_cur)
+			arena->peak_cur = arena->cur;
+		trace_karena_alloc(karena_index(arena), alloc->size,
+				   arena->cur);
 		return 0;
 	}
 	return -ENOMEM;
@@ -180,6 +479,9 @@ static long handle_arena_alloc(struct KArena *arena, struct ka_data *alloc)
 
 static long handle_arena_seek(struct KArena *arena, struct ka_data *alloc)
 {
+	if ((arena->flags & KA_ZERO_ON_REUSE) && alloc->size < arena->cur)
+		karena_scrub(arena, alloc->size, arena->cur);
+
 	arena->cur = alloc->size;
 	alloc->arena = arena->uaddr + arena->cur;
 
@@ -193,6 +495,9 @@ static long handle_arena_pop(struct KArena *arena, struct ka_data *alloc)
 		return -EFAULT;
 	}
 
+	if (arena->flags & KA_ZERO_ON_REUSE)
+		karena_scrub(arena, arena->cur - alloc->size, arena->cur);
+
 	arena->cur -= alloc->size;
 
 	return 0;
@@ -209,27 +514,69 @@ static long handle_arena_reserve(struct KArena *arena, struct ka_data *alloc)
 		alloc->size = arena->size - arena->cur;
 	} else {
 		arena->cur += alloc->size;
+		if (arena->cur > arena->peak_cur)
+			arena->peak_cur = arena->cur;
 	}
 
 	return 0;
 }
 
-static long handle_arena_destroy(struct KArena *arena, struct ka_data *alloc)
+// Frees the pages of a root arena and gives its slot back
+static void karena_teardown(struct KArena *arena)
 {
-	pr_info("destroying arena %lu", alloc->arena);
-	alloc->size = arena->size;
-	arena->uaddr = 0;
+	mutex_lock(&arena->lock);
+	karena_free_pages(arena);
+	mutex_unlock(&arena->lock);
+
 	arena->cur = 0;
 	arena->size = 0;
 	arena->owner_pid = 0;
+	arena->flags = 0;
+	WRITE_ONCE(arena->root, NULL);
+	arena->mapping = NULL;
+	arena->mm = NULL;
+	arena->token = 0;
+	// Frees the slot, so it has to be last
+	arena->uaddr = 0;
+}
+
+static void karena_put(struct KArena *arena)
+{
+	bool last;
+
+	mutex_lock(&karena.lock);
+	last = --arena->refs == 0;
+	mutex_unlock(&karena.lock);
+
+	if (last)
+		karena_teardown(arena);
+}
+
+static long handle_arena_destroy(struct KArena *arena, struct ka_data *alloc)
+{
+	karena_dbg("destroying arena %lu", alloc->arena);
+	trace_karena_destroy(alloc->arena, arena->size, arena->allocs,
+			     arena->peak_cur);
+	alloc->size = arena->size;
 	if (arena->bootstrapped) {
+		arena->uaddr = 0;
+		arena->cur = 0;
+		arena->size = 0;
+		arena->owner_pid = 0;
+		arena->flags = 0;
 		arena->bootstrapped = false;
+		WRITE_ONCE(arena->root, NULL);
 		alloc->size = 0;
 		return 0;
 	}
 
-	if (arena->kaddr)
-		vfree(arena->kaddr);
+	// The owner's reference was already dropped, and the arena is only
+	// kept alive by importers
+	if (arena->root != arena || arena->owner_pid == 0)
+		return -EINVAL;
+
+	arena->owner_pid = 0;
+	karena_put(arena);
 
 	return 0;
 }
@@ -253,6 +600,8 @@ static long handle_arena_bootstrap(struct KArena *arena, struct ka_data *alloc)
 
 	addr = arena->uaddr + arena->cur;
 	arena->cur += alloc->size;
+	if (arena->cur > arena->peak_cur)
+		arena->peak_cur = arena->cur;
 
 	index = find_open_slot();
 	if (index == -1) {
@@ -260,44 +609,241 @@ static long handle_arena_bootstrap(struct KArena *arena, struct ka_data *alloc)
 		return -EFAULT;
 	}
 
-	pr_info("Found slot for arena @ index %u, addr %lx, size %lx, made from arena %lu\n",
-		index, addr, alloc->size, alloc->arena);
+	karena_dbg("Found slot for arena @ index %u, addr %lx, size %lx, made from arena %lu\n",
+		   index, addr, alloc->size, alloc->arena);
 
 	karenas[index].uaddr = addr;
 	karenas[index].cur = 0;
 	karenas[index].size = alloc->size;
 	karenas[index].bootstrapped = true;
 	karenas[index].owner_pid = arena->owner_pid;
-	karenas[index].kaddr = arena->kaddr;
+	karenas[index].flags = arena->flags;
+	karenas[index].root = arena->root;
+	karenas[index].pages = NULL;
+	karenas[index].nr_pages = 0;
+	karenas[index].node = arena->root->node;
+	karenas[index].mapping = NULL;
+	karenas[index].allocs = 0;
+	karenas[index].alloc_bytes = 0;
+	karenas[index].faults = 0;
+	karenas[index].peak_cur = 0;
+
+	trace_karena_create(index, alloc->size, karenas[index].flags,
+			    karenas[index].owner_pid);
 
 	alloc->arena = index;
 	return 0;
 }
 
+static long handle_arena_decommit(struct KArena *arena, struct ka_data *alloc)
+{
+	struct KArena *root = arena->root;
+	unsigned long base = arena->uaddr - root->uaddr;
+	size_t watermark = max(alloc->size, arena->cur);
+
+	if (watermark > arena->size)
+		return -EINVAL;
+
+	// Only whole pages above the watermark that lie inside this arena can
+	// be given back, since partial pages may be in use by a neighbour
+	alloc->size = karena_release_pages(root, PAGE_ALIGN(base + watermark),
+					   (base + arena->size) & PAGE_MASK);
+
+	return 0;
+}
+
+// Grows the backing store of a (non-bootstrapped) arena. Backing pages are
+// allocated on first touch, so only the page table has to grow. The user
+// mapping is grown with mremap by the user library, see ka_grow.
+static long handle_arena_grow(struct KArena *arena, struct ka_data *alloc)
+{
+	size_t new_size = PAGE_ALIGN(alloc->size);
+	unsigned long new_nr_pages;
+	struct page **new_pages;
+	struct page **old_pages;
+
+	if (arena->bootstrapped || arena->root != arena) {
+		pr_err("Only arenas made with ka_create can grow\n");
+		return -EINVAL;
+	}
+
+	if (new_size > KARENA_MAX_SIZE)
+		return -EINVAL;
+
+	if (new_size <= arena->size) {
+		alloc->size = arena->size;
+		alloc->arena = arena->uaddr;
+		return 0;
+	}
+
+	new_nr_pages = new_size >> PAGE_SHIFT;
+	new_pages = kvzalloc_node(array_size(new_nr_pages,
+					     sizeof(struct page *)),
+				  GFP_KERNEL, arena->node);
+	if (!new_pages)
+		return -ENOMEM;
+
+	mutex_lock(&arena->lock);
+	memcpy(new_pages, arena->pages,
+	       arena->nr_pages * sizeof(struct page *));
+	old_pages = arena->pages;
+	arena->pages = new_pages;
+	arena->nr_pages = new_nr_pages;
+	arena->size = new_size;
+	mutex_unlock(&arena->lock);
+
+	kvfree(old_pages);
+
+	alloc->size = new_size;
+	alloc->arena = arena->uaddr;
+
+	return 0;
+}
+
+static long handle_arena_export(struct KArena *arena, struct ka_data *alloc)
+{
+	if (arena->bootstrapped || arena->root != arena ||
+	    arena->owner_pid != task_pid_nr(current)) {
+		pr_err("Only the owner of an arena made with ka_create can export it\n");
+		return -EINVAL;
+	}
+
+	mutex_lock(&karena.lock);
+	while (!arena->token)
+		arena->token = get_random_u64();
+	alloc->token = arena->token;
+	mutex_unlock(&karena.lock);
+
+	return 0;
+}
+
+static long handle_arena_import(struct file *file, struct ka_data *alloc)
+{
+	struct karena_file *kf = file->private_data;
+	struct KArena *arena;
+	int i;
+
+	if (!alloc->token)
+		return -EINVAL;
+
+	mutex_lock(&karena.lock);
+	for (i = 0; i < KARENA_MAX_ARENAS; i++) {
+		arena = &karenas[i];
+		if (arena->root == arena && arena->token == alloc->token)
+			break;
+	}
+
+	if (i == KARENA_MAX_ARENAS) {
+		mutex_unlock(&karena.lock);
+		return -ENOENT;
+	}
+
+	// Importing twice through the same file only holds one reference
+	if (!test_and_set_bit(i, kf->imported))
+		arena->refs++;
+	mutex_unlock(&karena.lock);
+
+	alloc->arena = i;
+	alloc->size = arena->size;
+	alloc->flags = arena->flags;
+
+	return 0;
+}
+
+// The importer has to unmap the arena before dropping its reference, since
+// the pages of the arena are given back with the last one
+static long handle_arena_unimport(struct file *file, struct KArena *arena)
+{
+	struct karena_file *kf = file->private_data;
+
+	if (!test_and_clear_bit(karena_index(arena), kf->imported))
+		return -EINVAL;
+
+	karena_put(arena);
+
+	return 0;
+}
+
 static long handle_arena_base(struct KArena *arena, struct ka_data *alloc)
 {
 	unsigned long index = alloc->arena;
 	alloc->arena = arena->uaddr;
-	pr_info("Base: %lx for arena %lu", alloc->arena, index);
+	karena_dbg("Base: %lx for arena %lu", alloc->arena, index);
+	return 0;
+}
+
+// Ordered, so the stamps don't drift into the work they're around
+static inline u64 karena_tsc(void)
+{
+#ifdef CONFIG_X86
+	return rdtsc_ordered();
+#else
+	return get_cycles();
+#endif
+}
+
+// NOTE: (isa): The same steps as a KARENA_ALLOC through karena_ioctl, with a
+// stamp after each. The lookup reads the arena's position, so the miss on its
+// entry is counted there rather than in the bump. The exit and copy_to_user
+// are left for user space to measure up to its own stamp after the call
+static long karena_alloc_stamped(unsigned long arg)
+{
+	struct ka_stamped_data stamped;
+	struct KArena *info;
+	u64 entry = karena_tsc();
+	long ret;
+
+	if (copy_from_user(&stamped, (void __user *)arg, sizeof(stamped)))
+		return -EFAULT;
+	stamped.tsc[KA_STAMP_ENTRY] = entry;
+	stamped.tsc[KA_STAMP_COPIED_IN] = karena_tsc();
+
+	if (stamped.data.arena >= KARENA_MAX_ARENAS)
+		return -EINVAL;
+	info = &karenas[stamped.data.arena];
+	(void)READ_ONCE(info->cur);
+	stamped.tsc[KA_STAMP_LOOKED_UP] = karena_tsc();
+
+	ret = handle_arena_alloc(info, &stamped.data);
+	stamped.tsc[KA_STAMP_BUMPED] = karena_tsc();
+	if (ret)
+		return ret;
+
+	if (copy_to_user((void __user *)arg, &stamped, sizeof(stamped)))
+		return -EFAULT;
 	return 0;
 }
 
 static long karena_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 {
+	struct karena_file *kf = file->private_data;
 	struct KArena *info;
 	struct ka_data alloc;
 	long ret;
 
+	// Handled before the common copy, NOP so it costs the ioctl alone
+	// and the stamped alloc since it carries a larger struct
+	if (cmd == KARENA_NOP)
+		return 0;
+	if (cmd == KARENA_ALLOC_STAMPED)
+		return karena_alloc_stamped(arg);
+
 	if (copy_from_user(&alloc, (void __user *)arg, sizeof(alloc))) {
 		pr_err("Could not copy data from user\n");
 		return -EFAULT;
 	}
 
-	if (cmd != KARENA_CREATE) {
+	if (cmd != KARENA_CREATE && cmd != KARENA_IMPORT &&
+	    cmd != KARENA_ECHO) {
+		if (alloc.arena >= KARENA_MAX_ARENAS)
+			return -EINVAL;
 		info = &karenas[alloc.arena];
 	}
 
 	switch (cmd) {
+	case KARENA_ECHO:
+		ret = 0;
+		break;
 	case KARENA_CREATE:
 		ret = handle_arena_create(file, &alloc);
 		break;
@@ -317,7 +863,11 @@ static long karena_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 		ret = handle_arena_reserve(info, &alloc);
 		break;
 	case KARENA_DESTROY:
-		ret = handle_arena_destroy(info, &alloc);
+		// Importers drop their reference with KARENA_UNIMPORT
+		if (test_bit(alloc.arena, kf->imported))
+			ret = -EINVAL;
+		else
+			ret = handle_arena_destroy(info, &alloc);
 		break;
 	case KARENA_SIZE:
 		ret = handle_arena_size(info, &alloc);
@@ -328,6 +878,25 @@ static long karena_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 	case KARENA_BASE:
 		ret = handle_arena_base(info, &alloc);
 		break;
+	case KARENA_DECOMMIT:
+		ret = handle_arena_decommit(info, &alloc);
+		break;
+	case KARENA_GROW:
+		// Only the owner's mapping follows the arena when it grows
+		if (test_bit(alloc.arena, kf->imported))
+			ret = -EINVAL;
+		else
+			ret = handle_arena_grow(info, &alloc);
+		break;
+	case KARENA_EXPORT:
+		ret = handle_arena_export(info, &alloc);
+		break;
+	case KARENA_IMPORT:
+		ret = handle_arena_import(file, &alloc);
+		break;
+	case KARENA_UNIMPORT:
+		ret = handle_arena_unimport(file, info);
+		break;
 	default:
 		ret = -ENOTTY;
 		pr_info("Unknown ioctl command: %u\n", cmd);
@@ -336,7 +905,8 @@ static long karena_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 	if (ret)
 		return ret;
 
-	if (cmd != KARENA_POP && cmd != KARENA_DESTROY) {
+	if (cmd != KARENA_POP && cmd != KARENA_DESTROY &&
+	    cmd != KARENA_UNIMPORT) {
 		if (copy_to_user((void __user *)arg, &alloc, sizeof(alloc))) {
 			pr_err("Could not copy to user");
 			return -EFAULT;
@@ -352,6 +922,7 @@ static vm_fault_t karena_vm_fault(struct vm_fault *vmf)
 
 	struct vm_area_struct *vma = vmf->vma;
 	struct KArena *arena;
+	unsigned long pgoff;
 	unsigned long offset;
 	struct page *page;
 
@@ -361,36 +932,95 @@ static vm_fault_t karena_vm_fault(struct vm_fault *vmf)
 		return VM_FAULT_SIGBUS;
 	}
 
-	offset = vmf->pgoff << PAGE_SHIFT;
+	pgoff = vmf->pgoff & KARENA_PGOFF_MASK;
+	offset = pgoff << PAGE_SHIFT;
+
+	mutex_lock(&arena->lock);
 	if (offset >= arena->size) {
+		mutex_unlock(&arena->lock);
 		pr_err("Offset out of bounds: %lu >= %lu\n", offset,
 		       arena->size);
 		return VM_FAULT_SIGBUS;
 	}
 
-	page = vmalloc_to_page(arena->kaddr + offset);
+	arena->faults++;
+	page = arena->pages[pgoff];
+	trace_karena_fault(karena_index(arena), pgoff, !page);
 	if (!page) {
-		pr_err("Failed to get page for offset %lu\n", offset);
-		return VM_FAULT_SIGBUS;
+		// NOTE: (isa): The node is preferred, not required, so a full
+		// node spills over instead of OOMing. The remote column in
+		// debugfs shows when that happens.
+		page = alloc_pages_node(arena->node,
+					GFP_HIGHUSER | __GFP_ZERO, 0);
+		if (!page) {
+			mutex_unlock(&arena->lock);
+			pr_err("Failed to allocate page for offset %lu\n",
+			       offset);
+			return VM_FAULT_OOM;
+		}
+		arena->pages[pgoff] = page;
 	}
 
+	// NOTE: (isa): The page is handed out locked so that a concurrent
+	// decommit can wait for the pte to be installed before zapping it.
+	// Pages are mapped with their refcount (and not as raw pfns, which
+	// zap_vma_ptes needs) because mremap refuses to grow VM_PFNMAP vmas.
 	get_page(page);
+	lock_page(page);
+	mutex_unlock(&arena->lock);
+
 	vmf->page = page;
+	return VM_FAULT_LOCKED;
+}
+
+// Called when mremap moves the arena's mapping. The arenas bootstrapped from
+// it live inside the same mapping, so they are moved along with it.
+static int karena_vm_mremap(struct vm_area_struct *vma)
+{
+	struct KArena *root = vma->vm_private_data;
+	unsigned long new_uaddr;
+	unsigned long old_uaddr;
+	int i;
+
+	if (!root || vma->vm_mm != root->mm)
+		return 0;
+
+	new_uaddr = vma->vm_start -
+		    ((vma->vm_pgoff & KARENA_PGOFF_MASK) << PAGE_SHIFT);
+	old_uaddr = root->uaddr;
+	if (new_uaddr == old_uaddr)
+		return 0;
+
+	for (i = 0; i < KARENA_MAX_ARENAS; i++) {
+		if (karenas[i].root == root)
+			karenas[i].uaddr = karenas[i].uaddr - old_uaddr +
+					   new_uaddr;
+	}
 
 	return 0;
 }
 
 static const struct vm_operations_struct vm_ops = {
 	.fault = karena_vm_fault,
+	.mremap = karena_vm_mremap,
 };
 
 static int karena_mmap(struct file *file, struct vm_area_struct *vma)
 {
-	struct karena_device_data *dev_data = file->private_data;
-	unsigned long arena_index = dev_data->current_arena_index;
-	struct KArena *arena = &karenas[arena_index];
+	struct karena_file *kf = file->private_data;
+	unsigned long arena_index = vma->vm_pgoff >> KARENA_PGOFF_SHIFT;
+	struct KArena *arena;
+	bool imported;
 
-	if (!arena || arena->uaddr != 0) {
+	if (arena_index >= KARENA_MAX_ARENAS) {
+		pr_err("Invalid arena index %lu\n", arena_index);
+		return -EINVAL;
+	}
+
+	arena = &karenas[arena_index];
+	imported = test_bit(arena_index, kf->imported);
+	if (arena->root != arena || !arena->pages ||
+	    (!imported && arena->uaddr != 0)) {
 		pr_err("Invalid arena or arena already mapped\n");
 		return -EINVAL;
 	}
@@ -400,19 +1030,27 @@ static int karena_mmap(struct file *file, struct vm_area_struct *vma)
 		return -EINVAL;
 	}
 
-	if (vma->vm_pgoff != 0) {
-		pr_err("Non-zero offset not supported\n");
+	if ((vma->vm_pgoff & KARENA_PGOFF_MASK) != 0) {
+		pr_err("Mapping must start at the beginning of the arena\n");
 		return -EINVAL;
 	}
 
-	arena->uaddr = vma->vm_start;
+	// Every open of the device shares the inode's mapping, so decommit
+	// reaches the importers' mappings as well
+	arena->mapping = file->f_mapping;
+	if (!imported) {
+		arena->uaddr = vma->vm_start;
+		arena->mm = vma->vm_mm;
+	}
 
+	// NOTE: (isa): The vma is not VM_DONTEXPAND, so that ka_grow can
+	// mremap it
 	vma->vm_ops = &vm_ops;
 	vma->vm_private_data = arena;
-	vm_flags_set(vma, VM_DONTEXPAND);
+	vm_flags_set(vma, VM_DONTDUMP);
 
-	pr_info("Memory mapped for arena %lu @ %lx with size %lu\n",
-		arena_index, vma->vm_start, arena->size);
+	karena_dbg("Memory mapped for arena %lu @ %lx with size %lu\n",
+		   arena_index, vma->vm_start, arena->size);
 
 	return 0;
 }
@@ -421,7 +1059,13 @@ static int dev_open(struct inode *inode, struct file *file)
 {
 	struct karena_device_data *dev_data =
 		container_of(inode->i_cdev, struct karena_device_data, cdev);
-	file->private_data = dev_data;
+	struct karena_file *kf = kzalloc(sizeof(*kf), GFP_KERNEL);
+
+	if (!kf)
+		return -ENOMEM;
+
+	kf->dev_data = dev_data;
+	file->private_data = kf;
 
 	dev_data->current_arena_index = -1;
 	return 0;
@@ -429,27 +1073,33 @@ static int dev_open(struct inode *inode, struct file *file)
 
 static int dev_release(struct inode *inode, struct file *file)
 {
-	pr_info("release called");
+	karena_dbg("release called");
 	int i;
 	pid_t pid = task_pid_nr(current);
 
-	for (i = 0; i < 100; i++) {
+	struct karena_file *kf = file->private_data;
+
+	for (i = 0; i < KARENA_MAX_ARENAS; i++) {
 		if (karenas[i].uaddr != 0 && karenas[i].owner_pid == pid) {
-			pr_info("cleaning up arena %d", i);
-			karenas[i].uaddr = 0;
-			karenas[i].cur = 0;
-			karenas[i].size = 0;
+			karena_dbg("cleaning up arena %d", i);
 			karenas[i].owner_pid = 0;
 			if (karenas[i].bootstrapped) {
+				karenas[i].uaddr = 0;
+				karenas[i].cur = 0;
+				karenas[i].size = 0;
+				karenas[i].flags = 0;
+				karenas[i].root = NULL;
 				karenas[i].bootstrapped = false;
-				return 0;
+				continue;
 			}
 
-			if (karenas[i].kaddr) {
-				vfree(karenas[i].kaddr);
-				karenas[i].kaddr = NULL;
-			}
+			karena_put(&karenas[i]);
 		}
 	}
+
+	for_each_set_bit(i, kf->imported, KARENA_MAX_ARENAS)
+		karena_put(&karenas[i]);
+
+	kfree(kf);
 	return 0;
 }
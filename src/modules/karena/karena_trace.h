@@ -0,0 +1,67 @@
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM karena
+
+#if !defined(_KARENA_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _KARENA_TRACE_H
+
+#include <linux/tracepoint.h>
+
+// Available as karena:* in perf and under events/karena in tracefs
+
+TRACE_EVENT(karena_create,
+	    TP_PROTO(unsigned long index, size_t size, unsigned long flags,
+		     pid_t pid),
+	    TP_ARGS(index, size, flags, pid),
+	    TP_STRUCT__entry(__field(unsigned long, index)
+			     __field(size_t, size)
+			     __field(unsigned long, flags)
+			     __field(pid_t, pid)),
+	    TP_fast_assign(__entry->index = index; __entry->size = size;
+			   __entry->flags = flags; __entry->pid = pid;),
+	    TP_printk("arena=%lu size=%zu flags=0x%lx pid=%d", __entry->index,
+		      __entry->size, __entry->flags, __entry->pid));
+
+TRACE_EVENT(karena_destroy,
+	    TP_PROTO(unsigned long index, size_t size, u64 allocs,
+		     size_t peak_cur),
+	    TP_ARGS(index, size, allocs, peak_cur),
+	    TP_STRUCT__entry(__field(unsigned long, index)
+			     __field(size_t, size)
+			     __field(u64, allocs)
+			     __field(size_t, peak_cur)),
+	    TP_fast_assign(__entry->index = index; __entry->size = size;
+			   __entry->allocs = allocs;
+			   __entry->peak_cur = peak_cur;),
+	    TP_printk("arena=%lu size=%zu allocs=%llu peak_cur=%zu",
+		      __entry->index, __entry->size, __entry->allocs,
+		      __entry->peak_cur));
+
+TRACE_EVENT(karena_alloc,
+	    TP_PROTO(unsigned long index, size_t size, size_t cur),
+	    TP_ARGS(index, size, cur),
+	    TP_STRUCT__entry(__field(unsigned long, index)
+			     __field(size_t, size)
+			     __field(size_t, cur)),
+	    TP_fast_assign(__entry->index = index; __entry->size = size;
+			   __entry->cur = cur;),
+	    TP_printk("arena=%lu size=%zu cur=%zu", __entry->index,
+		      __entry->size, __entry->cur));
+
+TRACE_EVENT(karena_fault,
+	    TP_PROTO(unsigned long index, unsigned long pgoff, bool new_page),
+	    TP_ARGS(index, pgoff, new_page),
+	    TP_STRUCT__entry(__field(unsigned long, index)
+			     __field(unsigned long, pgoff)
+			     __field(bool, new_page)),
+	    TP_fast_assign(__entry->index = index; __entry->pgoff = pgoff;
+			   __entry->new_page = new_page;),
+	    TP_printk("arena=%lu pgoff=%lu new_page=%d", __entry->index,
+		      __entry->pgoff, __entry->new_page));
+
+#endif /* _KARENA_TRACE_H */
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE karena_trace
+#include <trace/define_trace.h>
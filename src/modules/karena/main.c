@@ -12,10 +12,10 @@ KA_THREAD_ARENAS_REGISTER(threadkas, 2);
 int main(void)
 {
 	KaThreadArenasInit(threadkas);
-	KArena *thread = ka_create(1024);
+	KArena *thread = ka_create(1024, 0);
 	KaThreadArenasAdd(thread);
 
-	KArena *arena = ka_create(1024);
+	KArena *arena = ka_create(1024, 0);
 	if ((unsigned long)arena == -1) {
 		perror("Arena allocation failed");
 		fflush(stdout);
@@ -69,7 +69,7 @@ int main(void)
 	unsigned long *foo = ka_alloc(arena3, sizeof(unsigned long));
 	printf("foo: %lu @ %p\n", *foo, foo);
 
-	KArena *arena2 = ka_create(2048);
+	KArena *arena2 = ka_create(2048, 0);
 	unsigned long *blah = ka_alloc(arena2, sizeof(unsigned long));
 	*blah = 55;
 	printf("blah from second arena: %lu\n", *blah);
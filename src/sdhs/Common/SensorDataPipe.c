@@ -56,8 +56,11 @@ SdpCreate(u64 BufCount, u64 BufSize, SdhsArena *Arena)
         Pipe->Buffers[b]  = Buffer;
     }
 
-    Pipe->ReadEventFd  = eventfd(0, 0 /*EFD_NONBLOCK*/);
-    Pipe->WriteEventFd = eventfd(0, 0 /*EFD_NONBLOCK*/);
+    // NOTE(isa): Both are counters of buffers, so a read must only take one
+    // of them. Without EFD_SEMAPHORE a read empties the counter, and a buffer
+    // flushed while another was waiting is never read
+    Pipe->ReadEventFd  = eventfd(0, EFD_SEMAPHORE /*EFD_NONBLOCK*/);
+    Pipe->WriteEventFd = eventfd(0, EFD_SEMAPHORE /*EFD_NONBLOCK*/);
     // TODO(ingar): Is it correct to use non-block?
 
     if(Pipe->ReadEventFd == -1 || Pipe->WriteEventFd == -1) {
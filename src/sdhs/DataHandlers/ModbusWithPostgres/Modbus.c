@@ -14,6 +14,7 @@ THREAD_ARENAS_EXTERN(Modbus);
 #include <src/sdhs/Common/Socket.h>
 #include <src/sdhs/Common/Thread.h>
 #include <src/sdhs/DataHandlers/ModbusWithPostgres/ModbusWithPostgres.h>
+#include <src/sdhs/DevUtils/PipelineBench.h>
 #include <src/sdhs/DevUtils/TestConstants.h>
 #include <src/sdhs/Signals.h>
 
@@ -121,6 +122,7 @@ MbRun(void *Arg)
 
     sensor_data_pipe *Pipe   = Ctx->SdPipe;
     SdhsArena        *CurBuf = Pipe->Buffers[atomic_load(&Pipe->WriteBufIdx)];
+    pipeline_bench   *Bench  = Ctx->Bench;
 
     /**<  Only wait at barrier first time */
     if(FirstRun) {
@@ -196,9 +198,26 @@ MbRun(void *Arg)
                 goto reconnect;
             }
 
+            const pb_step *Step = NULL;
+            i64            PacketId;
+            if(Bench) {
+                SdbMemcpy(&PacketId, Data, sizeof(PacketId));
+                Step = PbStepOf(Bench, (u64)PacketId);
+                if(Step) {
+                    Bench->Received[PacketId] = PbNow();
+                }
+            }
+
             u8 *Ptr = ArenaAlloc(CurBuf, DataLength);
             SdbMemcpy(Ptr, Data, DataLength);
 
+            /**< Hand the last packets of a benchmark step over right away rather than letting them
+             * wait for the next step to fill the buffer */
+            if(Step && (u64)PacketId + 1 == Step->FirstPacket + Step->PacketCount) {
+                SdPipeFlush(Pipe);
+                CurBuf = Pipe->Buffers[atomic_load(&Pipe->WriteBufIdx)];
+            }
+
             static int counter = 0;
             if(++counter % 10000 == 0) {
                 SdbLogInfo("Received %d packets", counter);
@@ -207,6 +226,7 @@ MbRun(void *Arg)
 
 reconnect:
         SdPipeFlush(Pipe);
+        CurBuf = Pipe->Buffers[atomic_load(&Pipe->WriteBufIdx)];
         /**< Clean up current connection before retry */
         for(u64 i = 0; i < MbCtx->ConnCount; ++i) {
             if(MbCtx->Conns[i].SockFd != -1) {
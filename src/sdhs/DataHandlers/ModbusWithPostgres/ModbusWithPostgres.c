@@ -88,7 +88,7 @@ MbPgTestServer(void *Arg)
     pthread_setname_np(pthread_self(), "modbus-test-server-thread");
     mbpg_ctx *Ctx = Arg;
 
-    RunModbusTestServer(&Ctx->Barrier);
+    RunModbusTestServer(&Ctx->Barrier, Ctx->Bench);
 
     SdbLogInfo("Modbus test server thread shutting down");
     return NULL;
@@ -189,7 +189,8 @@ static tg_task MbPgTestTasks[] = {
  * 1. Parses Modbus and PostgreSQL configurations
  * 2. Allocates and initializes context
  * 3. Sets up data pipe
- * 4. Configures thread tasks based on mode (test/normal)
+ * 4. Sets up the pipeline benchmark if it's enabled in "testing"
+ * 5. Configures thread tasks based on mode (test/normal)
  *
  * @param Conf JSON configuration
  * @param GroupId Thread group identifier
@@ -223,6 +224,23 @@ MbPgCreateTg(cJSON *Conf, u64 GroupId, SdhsArena *A)
         return NULL;
     }
 
+    // NOTE(isa): The benchmark decides how many packets are sent, otherwise
+    // the run stops after "item_count" items
+    cJSON *ItemCountObj = cJSON_GetObjectItem(TestConf, "item_count");
+    cJSON *BenchConf    = cJSON_GetObjectItem(TestConf, "benchmark");
+    Ctx->ItemCount      = cJSON_IsNumber(ItemCountObj) ? (u64)cJSON_GetNumberValue(ItemCountObj)
+                                                       : (u64)1e4;
+    Ctx->Bench          = NULL;
+    if(cJSON_IsTrue(cJSON_GetObjectItem(BenchConf, "enabled"))) {
+        Ctx->Bench = PbCreate(BenchConf);
+        if(Ctx->Bench == NULL) {
+            SdpDestroy(Ctx->SdPipe, true);
+            free(Ctx);
+            return NULL;
+        }
+        Ctx->ItemCount = Ctx->Bench->TotalPackets;
+    }
+
     tg_group *Group;
     cJSON    *TestingEnabled = cJSON_GetObjectItem(TestConf, "enabled");
     if(cJSON_IsTrue(TestingEnabled)) {
@@ -14,6 +14,7 @@
 
 #include <src/sdhs/Common/SensorDataPipe.h>
 #include <src/sdhs/Common/ThreadGroup.h>
+#include <src/sdhs/DevUtils/PipelineBench.h>
 
 #include <src/cJSON/cJSON.h>
 
@@ -27,8 +28,10 @@ typedef struct
     u64 ModbusScratchSize;
     u64 PgMemSize;
     u64 PgScratchSize;
+    u64 ItemCount; /**< The Postgres thread stops after inserting this many items */
 
     sensor_data_pipe *SdPipe;
+    pipeline_bench   *Bench; /**< NULL unless the pipeline benchmark is running */
     sdb_barrier       Barrier;
 
 } mbpg_ctx;
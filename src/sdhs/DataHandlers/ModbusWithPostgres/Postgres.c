@@ -20,6 +20,7 @@ THREAD_ARENAS_EXTERN(Postgres);
 #include <src/sdhs/DataHandlers/ModbusWithPostgres/ModbusWithPostgres.h>
 #include <src/sdhs/DatabaseSystems/DatabaseInitializer.h>
 #include <src/sdhs/DatabaseSystems/Postgres.h>
+#include <src/sdhs/DevUtils/PipelineBench.h>
 #include <src/sdhs/Signals.h>
 
 #include "Postgres.h"
@@ -109,14 +110,14 @@ PgRun(void *Arg)
     SdbBarrierWait(&Ctx->Barrier);
     SdbLogInfo("Exited barrier. Starting main loop");
 
-    u64        PgFailCounter      = 0;
-    u64        TimeoutCounter     = 0;
-    static u64 TotalInsertedItems = 0;
-    const u64  break_on_count     = 1e4;
-    SdhsArena *Buf                = NULL;
+    u64             PgFailCounter      = 0;
+    u64             TimeoutCounter     = 0;
+    static u64      TotalInsertedItems = 0;
+    SdhsArena      *Buf                = NULL;
+    pipeline_bench *Bench              = Ctx->Bench;
     SdbLogDebug("Item count/buf: %lu\n", Pipe->ItemMaxCount);
 
-    while(!SdbShouldShutdown() && TotalInsertedItems < break_on_count) {
+    while(!SdbShouldShutdown() && TotalInsertedItems < Ctx->ItemCount) {
         struct epoll_event Events[1];
         int                EpollRet = epoll_wait(EpollFd, Events, 1, SDB_TIME_MS(100));
         if(EpollRet == -1) {
@@ -133,6 +134,7 @@ PgRun(void *Arg)
             if(TimeoutCounter >= 5) {
                 SdbLogError("Epoll has timed out more than threshold. Stopping main loop");
                 Ret = -ETIMEDOUT;
+                break;
             } else {
                 continue;
             }
@@ -145,10 +147,13 @@ PgRun(void *Arg)
         }
 
         if(Events[0].events & EPOLLIN) {
+            TimeoutCounter = 0;
             while((Buf = SdPipeGetReadBuffer(Pipe)) != NULL) {
                 SdbAssert(ArenaPos(Buf) % Pipe->PacketSize == 0,
                           "Pipe does not contain a multiple of the packet size");
 
+                u64 HandedOff = Bench ? PbNow() : 0;
+
                 // u64 ItemCount = Buf->cur / Pipe->PacketSize;
                 u64 ItemCount = ArenaPos(Buf) / Pipe->PacketSize;
                 SdbLogDebug("Inserting %lu items into db. Total is %lu", ItemCount,
@@ -158,7 +163,12 @@ PgRun(void *Arg)
                 sdb_errno InsertRet
                     = PgInsertData(Conn, TableInfo, (const char *)ArenaBase(Buf), ItemCount);
 
-                if(TotalInsertedItems >= break_on_count) {
+                if(Bench && InsertRet == 0) {
+                    PbStampBuffer(Bench, (const u8 *)ArenaBase(Buf), ItemCount, Pipe->PacketSize,
+                                  HandedOff, PbNow());
+                }
+
+                if(TotalInsertedItems >= Ctx->ItemCount) {
                     break;
                 }
 
@@ -36,8 +36,10 @@ SDB_LOG_REGISTER(ModbusTestServer);
 #include <src/sdhs/Common/Thread.h>
 #include <src/sdhs/Common/Time.h>
 #include <src/sdhs/DatabaseSystems/Postgres.h>
+#include <src/sdhs/DevUtils/PipelineBench.h>
 #include <src/sdhs/DevUtils/TestConstants.h>
 #include <src/sdhs/Signals.h>
+#include <src/utils/system_info.h>
 
 #include "ModbusTestServer.h"
 
@@ -133,6 +135,37 @@ GenerateModbusTcpFrame(u8 *Buffer, u16 TransactionId, u16 ProtocolId, u16 Length
 }
 
 
+/**
+ * @brief Sends a whole buffer over a non-blocking socket
+ *
+ * Retries while the socket's buffer is full, since a dropped or partially sent
+ * frame would desynchronize the receiver.
+ *
+ * @param Fd Socket file descriptor
+ * @param Buf Data to send
+ * @param Size Number of bytes to send
+ * @return sdb_errno 0 on success, -1 on error or shutdown
+ */
+static sdb_errno
+SendAll(int Fd, const u8 *Buf, size_t Size)
+{
+    while(Size > 0) {
+        ssize_t SendResult = send(Fd, Buf, Size, 0);
+        if(SendResult == -1) {
+            if((errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+               && !SdbShouldShutdown()) {
+                usleep(100);
+                continue;
+            }
+            return -1;
+        }
+        Buf += SendResult;
+        Size -= (size_t)SendResult;
+    }
+    return 0;
+}
+
+
 /**
  * @brief Sends Modbus data over a socket
  *
@@ -142,13 +175,15 @@ GenerateModbusTcpFrame(u8 *Buffer, u16 TransactionId, u16 ProtocolId, u16 Length
  * Features:
  * - Random data generation
  * - Modbus TCP frame construction
+ * - Generation stamps for the pipeline benchmark
  * - Periodic logging of sent packets
  *
  * @param NewFd Socket file descriptor to send data
- * @return sdb_errno Status of send operation
+ * @param Bench Pipeline benchmark to stamp the packet in, or NULL
+ * @return sdb_errno 0 on success, -1 on error
  */
-static inline sdb_errno
-SendModbusData(int NewFd)
+static sdb_errno
+SendModbusData(int NewFd, pipeline_bench *Bench)
 {
     static u8        ModbusFrame[MODBUS_TCP_FRAME_MAX_SIZE] = { 0 };
     static const u16 DataLength                             = sizeof(shaft_power_data);
@@ -164,6 +199,9 @@ SendModbusData(int NewFd)
 
     memset(ModbusFrame, 0, MODBUS_TCP_FRAME_MAX_SIZE);
     GenerateShaftPowerDataRandom(&SpData);
+    if(Bench && PbStepOf(Bench, (u64)SpData.PacketId)) {
+        Bench->Generated[SpData.PacketId] = PbNow();
+    }
 
     u16 Pos = 0;
     // Fixed header construction
@@ -189,15 +227,76 @@ SendModbusData(int NewFd)
     SdbLogDebug("Sending frame - Length: %u, DataLength: %u, TotalSize: %zu", Length, DataLength,
                 TotalSize);
 
-    ssize_t SendResult = send(NewFd, ModbusFrame, TotalSize, 0);
-    if(SendResult > 0) {
+    sdb_errno SendResult = SendAll(NewFd, ModbusFrame, TotalSize);
+    if(SendResult == 0) {
         SendCount++;
         if(SendCount % 10000 == 0) {
             SdbLogInfo("Sent %lu packets", SendCount);
         }
     }
 
-    return (sdb_errno)SendResult;
+    return SendResult;
+}
+
+
+/**
+ * @brief Waits until the TSC reaches a deadline
+ *
+ * Sleeps through most of a long wait and spins the rest, since waking up from
+ * a sleep can be late by tens of microseconds.
+ *
+ * @param Deadline TSC to wait for
+ * @param TscFreq TSC frequency in Hz
+ */
+static void
+WaitUntilTsc(u64 Deadline, double TscFreq)
+{
+    for(u64 Now = PbNow(); Now < Deadline; Now = PbNow()) {
+        double LeftUs = (double)(Deadline - Now) * 1e6 / TscFreq;
+        if(LeftUs > 200.0) {
+            usleep((useconds_t)(LeftUs - 100.0));
+        }
+    }
+}
+
+
+/**
+ * @brief Sends the pipeline benchmark's offered loads
+ *
+ * Each step sends its packets on a fixed schedule, so a server that falls
+ * behind catches up in a burst rather than lowering the offered rate. The
+ * next step starts once every packet of the previous one has been committed.
+ *
+ * @param NewFd Socket file descriptor to send data
+ * @param Bench Pipeline benchmark instance
+ * @return sdb_errno 0 on success, -1 on error
+ */
+static sdb_errno
+SendOfferedLoads(int NewFd, pipeline_bench *Bench)
+{
+    double TscFreq = get_tsc_freq();
+
+    for(u64 s = 0; s < Bench->StepCount && !SdbShouldShutdown(); ++s) {
+        const pb_step *Step     = &Bench->Steps[s];
+        u64            Interval = Step->OfferedRate ? (u64)(TscFreq / (double)Step->OfferedRate) : 0;
+        SdbLogInfo("Offering %lu packets/s", Step->OfferedRate);
+
+        u64 Next = PbNow();
+        for(u64 p = 0; p < Step->PacketCount && !SdbShouldShutdown(); ++p) {
+            WaitUntilTsc(Next, TscFreq);
+            if(SendModbusData(NewFd, Bench) != 0) {
+                return -1;
+            }
+            Next += Interval;
+        }
+
+        u64 StepEnd = Step->FirstPacket + Step->PacketCount;
+        while(!SdbShouldShutdown() && atomic_load(&Bench->CommittedCount) < StepEnd) {
+            usleep(1000);
+        }
+    }
+
+    return 0;
 }
 
 
@@ -212,9 +311,10 @@ SendModbusData(int NewFd)
  * - Graceful shutdown handling
  *
  * @param Barrier Synchronization barrier to coordinate server startup
+ * @param Bench Pipeline benchmark to drive, or NULL to send at a fixed rate
  */
 void
-RunModbusTestServer(sdb_barrier *Barrier)
+RunModbusTestServer(sdb_barrier *Barrier, pipeline_bench *Bench)
 {
     SdbLogInfo("Running Modbus Test Server");
 
@@ -296,6 +396,19 @@ RunModbusTestServer(sdb_barrier *Barrier)
         struct timespec LastSend, Now;
         clock_gettime(CLOCK_MONOTONIC, &LastSend);
 
+        if(Bench) {
+            if(SendOfferedLoads(NewFd, Bench) != 0) {
+                SdbLogError("Failed to send to %s:%d: %s", ClientIp, ntohs(ClientAddr.sin_port),
+                            strerror(errno));
+            }
+
+            // Keep the connection open so the Modbus thread doesn't reconnect
+            // while the last packets are committed
+            while(!SdbShouldShutdown()) {
+                usleep(10000);
+            }
+        }
+
         while(!SdbShouldShutdown()) {
             clock_gettime(CLOCK_MONOTONIC, &Now);
 
@@ -305,18 +418,13 @@ RunModbusTestServer(sdb_barrier *Barrier)
                 continue;
             }
 
-            sdb_errno SendResult = SendModbusData(NewFd);
-            if(SendResult == -1) {
-                if(errno == EAGAIN || errno == EWOULDBLOCK) {
-                    usleep(1000); // Wait if buffer is full
-                    continue;
-                }
+            if(SendModbusData(NewFd, NULL) != 0) {
                 SdbLogError("Failed to send to %s:%d: %s", ClientIp, ntohs(ClientAddr.sin_port),
                             strerror(errno));
                 break;
             }
 
-
+            ++PacketsSent;
             LastSend = Now;
         }
 
@@ -17,6 +17,7 @@
 #define MODBUS_TEST_SERVER_H
 
 #include <src/sdhs/Common/Thread.h>
+#include <src/sdhs/DevUtils/PipelineBench.h>
 #include <src/sdhs/Sdb.h>
 
 /**
@@ -35,11 +36,12 @@
  * shaft power data. The server:
  * - Listens for incoming connections
  * - Creates non-blocking sockets
- * - Sends data at a controlled frequency
+ * - Sends data at a controlled frequency, or the offered loads of a pipeline benchmark
  * - Handles connection and shutdown gracefully
  *
  * @param Barrier Synchronization barrier to coordinate server startup
+ * @param Bench Pipeline benchmark to drive, or NULL to send at a fixed rate
  */
-void RunModbusTestServer(sdb_barrier *Barrier);
+void RunModbusTestServer(sdb_barrier *Barrier, pipeline_bench *Bench);
 
 #endif
@@ -0,0 +1,291 @@
+/**
+ * @file PipelineBench.c
+ * @brief Implementation of the Modbus to Postgres pipeline benchmark
+ *
+ * Main Responsibilities:
+ * - Parse the offered loads from the configuration
+ * - Own the per packet stamp tables
+ * - Summarize throughput, saturation and latency percentiles per step
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <src/sdhs/Sdb.h>
+SDB_LOG_REGISTER(PipelineBench);
+
+#include <src/lm.h>
+LM_LOG_REGISTER(pipeline_bench);
+
+#include <src/allocators/u_arena.h>
+#include <src/metrics/hdr_histogram.h>
+#include <src/metrics/result_file.h>
+#include <src/metrics/timing.h>
+#include <src/utils/system_info.h>
+
+#include "PipelineBench.h"
+
+extern UArena *main_ua;
+
+static pipeline_bench *ActiveBench;
+
+static const char *StageNames[PbStage_Count] = { "receive", "handoff", "commit", "end-to-end" };
+
+/**< The last percentile is replaced by the max */
+static const double Percentiles[PB_PERCENTILE_COUNT] = { 50.0, 90.0, 99.0, 99.9, 100.0 };
+
+
+pipeline_bench *
+PbCreate(cJSON *Conf)
+{
+    cJSON *RatesObj     = cJSON_GetObjectItem(Conf, "offered_rates");
+    cJSON *PacketsObj   = cJSON_GetObjectItem(Conf, "packets_per_step");
+    cJSON *ThresholdObj = cJSON_GetObjectItem(Conf, "saturation_threshold");
+    if(!cJSON_IsArray(RatesObj) || !cJSON_IsNumber(PacketsObj)) {
+        SdbLogError("The pipeline benchmark needs offered_rates and packets_per_step");
+        return NULL;
+    }
+
+    u64 StepCount = (u64)cJSON_GetArraySize(RatesObj);
+    if(StepCount == 0 || StepCount > PB_MAX_STEPS) {
+        SdbLogError("The pipeline benchmark takes 1 to %d offered rates, got %lu", PB_MAX_STEPS,
+                    StepCount);
+        return NULL;
+    }
+
+    u64 PacketsPerStep = (u64)cJSON_GetNumberValue(PacketsObj);
+    if(PacketsPerStep == 0) {
+        SdbLogError("packets_per_step must be larger than 0");
+        return NULL;
+    }
+
+    pipeline_bench *Bench = malloc(sizeof(pipeline_bench));
+    if(Bench == NULL) {
+        return NULL;
+    }
+    SdbMemset(Bench, 0, sizeof(pipeline_bench));
+
+    Bench->StepCount           = StepCount;
+    Bench->TotalPackets        = StepCount * PacketsPerStep;
+    Bench->SaturationThreshold = cJSON_IsNumber(ThresholdObj) ? cJSON_GetNumberValue(ThresholdObj)
+                                                              : 0.95;
+    atomic_init(&Bench->CommittedCount, 0);
+
+    u64    s       = 0;
+    cJSON *RateObj = NULL;
+    cJSON_ArrayForEach(RateObj, RatesObj)
+    {
+        Bench->Steps[s].OfferedRate = (u64)cJSON_GetNumberValue(RateObj);
+        Bench->Steps[s].FirstPacket = s * PacketsPerStep;
+        Bench->Steps[s].PacketCount = PacketsPerStep;
+        ++s;
+    }
+
+    // NOTE(isa): One allocation for all four tables, written to here so the
+    // pages are resident before the first packet is stamped
+    u64  TableSize = Bench->TotalPackets * sizeof(u64);
+    u64 *Tables    = malloc(4 * TableSize);
+    if(Tables == NULL) {
+        SdbLogError("Unable to allocate stamp tables for %lu packets", Bench->TotalPackets);
+        free(Bench);
+        return NULL;
+    }
+    SdbMemset(Tables, 0, 4 * TableSize);
+
+    Bench->Generated = Tables;
+    Bench->Received  = Tables + Bench->TotalPackets;
+    Bench->HandedOff = Tables + 2 * Bench->TotalPackets;
+    Bench->Committed = Tables + 3 * Bench->TotalPackets;
+
+    ActiveBench = Bench;
+    return Bench;
+}
+
+
+void
+PbDestroy(pipeline_bench *Bench)
+{
+    if(Bench == NULL) {
+        return;
+    }
+    if(ActiveBench == Bench) {
+        ActiveBench = NULL;
+    }
+    free(Bench->Generated);
+    free(Bench);
+}
+
+
+pipeline_bench *
+PbGetActive(void)
+{
+    return ActiveBench;
+}
+
+
+const pb_step *
+PbStepOf(const pipeline_bench *Bench, u64 PacketId)
+{
+    if(PacketId >= Bench->TotalPackets) {
+        return NULL;
+    }
+    return &Bench->Steps[PacketId / Bench->Steps[0].PacketCount];
+}
+
+
+void
+PbStampBuffer(pipeline_bench *Bench, const u8 *Items, u64 ItemCount, u64 PacketSize,
+              u64 HandedOff, u64 Committed)
+{
+    for(u64 i = 0; i < ItemCount; ++i) {
+        i64 PacketId;
+        SdbMemcpy(&PacketId, Items + i * PacketSize, sizeof(PacketId));
+        if(PacketId < 0 || (u64)PacketId >= Bench->TotalPackets) {
+            continue;
+        }
+        Bench->HandedOff[PacketId] = HandedOff;
+        Bench->Committed[PacketId] = Committed;
+    }
+    atomic_fetch_add(&Bench->CommittedCount, ItemCount);
+}
+
+
+/**
+ * @brief Summarizes one step
+ *
+ * Packets that never made it through the pipeline, e.g. because the run was
+ * interrupted, are left out of the counts and the rates.
+ *
+ * @param Bench Benchmark instance
+ * @param Step Step to summarize
+ * @param Hists One histogram per stage, reset before use, or NULL to leave the
+ *              latencies at 0
+ * @param Res Filled with the step's results
+ */
+static void
+SummarizeStep(pipeline_bench *Bench, const pb_step *Step, struct hdr_histogram *Hists,
+              pb_step_result *Res)
+{
+    double TscFreq = get_tsc_freq();
+
+    for(u64 st = 0; Hists && st < PbStage_Count; ++st) {
+        hdr_reset(&Hists[st]);
+    }
+
+    u64 FirstGen = UINT64_MAX, LastGen = 0, LastCommit = 0, Completed = 0;
+    for(u64 p = Step->FirstPacket; p < Step->FirstPacket + Step->PacketCount; ++p) {
+        u64 Gen = Bench->Generated[p];
+        u64 Commit = Bench->Committed[p];
+        if(Gen == 0 || Commit == 0) {
+            continue;
+        }
+
+        if(Hists) {
+            hdr_record(&Hists[PbStage_Receive], Bench->Received[p] - Gen);
+            hdr_record(&Hists[PbStage_Handoff], Bench->HandedOff[p] - Bench->Received[p]);
+            hdr_record(&Hists[PbStage_Commit], Commit - Bench->HandedOff[p]);
+            hdr_record(&Hists[PbStage_EndToEnd], Commit - Gen);
+        }
+
+        FirstGen   = SdbMin(FirstGen, Gen);
+        LastGen    = SdbMax(LastGen, Gen);
+        LastCommit = SdbMax(LastCommit, Commit);
+        ++Completed;
+    }
+
+    SdbMemset(Res, 0, sizeof(*Res));
+    Res->OfferedRate = Step->OfferedRate;
+    Res->PacketCount = Completed;
+    if(Completed > 1) {
+        Res->SentRate      = (double)(Completed - 1) * TscFreq / (double)(LastGen - FirstGen);
+        Res->CommittedRate = (double)Completed * TscFreq / (double)(LastCommit - FirstGen);
+    }
+    Res->Saturated = Step->OfferedRate > 0
+                     && Res->CommittedRate < Bench->SaturationThreshold * (double)Step->OfferedRate;
+
+    for(u64 st = 0; Hists && st < PbStage_Count; ++st) {
+        for(u64 i = 0; i < PB_PERCENTILE_COUNT; ++i) {
+            u64 Tsc = (i == PB_PERCENTILE_COUNT - 1)
+                        ? Hists[st].max
+                        : hdr_value_at_percentile(&Hists[st], Percentiles[i]);
+            Res->LatencyNs[st][i] = Completed ? TscToNs(Tsc, TscFreq) : 0;
+        }
+    }
+}
+
+
+sdb_errno
+PbReport(pipeline_bench *Bench, const char *Filename)
+{
+    sdb_errno      Ret     = 0;
+    UAScratch      uas     = ua_scratch_begin(main_ua);
+    pb_step_result Results[PB_MAX_STEPS];
+
+    struct hdr_histogram Hists[PbStage_Count];
+    bool                 HasHists = true;
+    for(u64 st = 0; st < PbStage_Count; ++st) {
+        HasHists = HasHists && hdr_init(&Hists[st], 3, uas.ua) == 0;
+    }
+    if(!HasHists) {
+        LmLogWarning("No latency histograms, the latencies are reported as 0");
+    }
+
+    // NOTE(isa): The pipeline is saturated at the first load it can't keep up
+    // with, which is what we report even if a later, higher load happens to
+    // squeeze through
+    u64    SaturatedAt = 0;
+    double PeakRate    = 0.0;
+
+    LmLogInfoR("\nPipeline benchmark, %lu steps of %lu packets:\n", Bench->StepCount,
+               Bench->Steps[0].PacketCount);
+    for(u64 s = 0; s < Bench->StepCount; ++s) {
+        const pb_step  *Step = &Bench->Steps[s];
+        pb_step_result *Res  = &Results[s];
+        SummarizeStep(Bench, Step, HasHists ? Hists : NULL, Res);
+
+        if(Step->OfferedRate) {
+            LmLogInfoR("\toffered %lu packets/s: ", Step->OfferedRate);
+        } else {
+            LmLogInfoR("\tunthrottled: ");
+        }
+        LmLogInfoR("sent %.0f, committed %.0f packets/s%s (%lu of %lu packets)\n", Res->SentRate,
+                   Res->CommittedRate, Res->Saturated ? ", saturated" : "", Res->PacketCount,
+                   Step->PacketCount);
+
+        char Description[32];
+        for(u64 st = 0; HasHists && st < PbStage_Count; ++st) {
+            snprintf(Description, sizeof(Description), "\t\t%-10s ", StageNames[st]);
+            hdr_log_percentiles(&Hists[st], Description, LM_LOG_MODULE_LOCAL);
+        }
+
+        if(Res->Saturated && SaturatedAt == 0) {
+            SaturatedAt = Step->OfferedRate;
+        }
+        PeakRate = SdbMax(PeakRate, Res->CommittedRate);
+    }
+
+    LmLogInfoR("\tsustained at most %.0f packets/s, ", PeakRate);
+    if(SaturatedAt) {
+        LmLogInfoR("saturated at an offered %lu packets/s\n", SaturatedAt);
+    } else {
+        LmLogInfoR("did not saturate\n");
+    }
+
+    struct result_section_writer w;
+    if(result_section_begin(&w, Filename, RESULT_SECTION_PIPELINE) != 0) {
+        Ret = -1;
+        goto out;
+    }
+    if(lm_write_bytes_to_file((u8 *)Results, Bench->StepCount * sizeof(pb_step_result), w.file)
+       != 0) {
+        lm_close_file(w.file);
+        Ret = -1;
+        goto out;
+    }
+    Ret = result_section_end(&w, sizeof(pb_step_result), Bench->StepCount);
+
+out:
+    ua_scratch_release(uas);
+    return Ret;
+}
@@ -0,0 +1,162 @@
+/**
+ * @file PipelineBench.h
+ * @brief End-to-end throughput and latency benchmark of the Modbus to Postgres pipeline
+ *
+ * Drives the test server through a series of offered loads and follows every
+ * packet through the pipeline:
+ * - Generated by the Modbus test server
+ * - Received and parsed by the Modbus thread
+ * - Handed over to the Postgres thread through the sensor data pipe
+ * - Committed to the database
+ *
+ * Each stage is stamped with the TSC in a table indexed by the packet id, so
+ * the packets themselves, and the table they're inserted into, are unchanged.
+ * Every table is written by a single thread and only read once the thread
+ * group has been joined.
+ *
+ */
+
+#ifndef PIPELINE_BENCH_H
+#define PIPELINE_BENCH_H
+
+#include <stdatomic.h>
+
+#include <src/sdhs/Sdb.h>
+
+#include <src/cJSON/cJSON.h>
+
+#define PB_MAX_STEPS 16
+
+/**
+ * @brief Stages a packet's latency is split into
+ */
+typedef enum
+{
+    PbStage_Receive,  /**< Generated -> parsed by the Modbus thread */
+    PbStage_Handoff,  /**< Parsed -> read from the pipe by the Postgres thread */
+    PbStage_Commit,   /**< Read from the pipe -> inserted into the database */
+    PbStage_EndToEnd, /**< Generated -> inserted into the database */
+    PbStage_Count
+} pb_stage;
+
+/**
+ * @brief Percentiles recorded for every stage of a step, the last is the max
+ */
+#define PB_PERCENTILE_COUNT 5
+
+/**
+ * @brief One offered load
+ */
+typedef struct
+{
+    u64 OfferedRate; /**< Packets/s, 0 sends as fast as the socket allows */
+    u64 FirstPacket;
+    u64 PacketCount;
+} pb_step;
+
+/**
+ * @brief A step's results, the RESULT_SECTION_PIPELINE rows of the result file
+ */
+typedef struct
+{
+    u64    OfferedRate;
+    u64    PacketCount;
+    double SentRate;      /**< What the server managed to send, packets/s */
+    double CommittedRate; /**< Sustained rate through the whole pipeline, packets/s */
+    u64    Saturated;
+    u64    LatencyNs[PbStage_Count][PB_PERCENTILE_COUNT];
+} pb_step_result;
+
+typedef struct
+{
+    u64     StepCount;
+    pb_step Steps[PB_MAX_STEPS];
+    u64     TotalPackets;
+
+    /**< A step is saturated if it commits less than this fraction of the offered rate */
+    double SaturationThreshold;
+
+    u64 *Generated;
+    u64 *Received;
+    u64 *HandedOff;
+    u64 *Committed;
+
+    /**< Lets the server wait for a step to drain before offering the next load */
+    atomic_ullong CommittedCount;
+
+} pipeline_bench;
+
+/**
+ * @brief Reads the current TSC
+ *
+ * @return u64 TSC value
+ */
+static inline u64
+PbNow(void)
+{
+    u32 Low, High;
+    __asm__ volatile("lfence");
+    __asm__ volatile("rdtsc" : "=a"(Low), "=d"(High));
+    __asm__ volatile("lfence");
+    return ((u64)High << 32) | Low;
+}
+
+/**
+ * @brief Creates the benchmark from the "benchmark" object in a handler's "testing" configuration
+ *
+ * The stamp tables are touched up front so page faults on them don't end up
+ * in the measurements. The benchmark becomes the active one, see PbGetActive.
+ *
+ * @param Conf JSON configuration of the benchmark
+ * @return pipeline_bench* Benchmark or NULL if the configuration is malformed or allocation fails
+ */
+pipeline_bench *PbCreate(cJSON *Conf);
+
+/**
+ * @brief Frees the benchmark and clears the active one
+ *
+ * @param Bench Benchmark to free
+ */
+void PbDestroy(pipeline_bench *Bench);
+
+/**
+ * @brief The benchmark created by the last call to PbCreate
+ *
+ * @return pipeline_bench* Benchmark or NULL if none is running
+ */
+pipeline_bench *PbGetActive(void);
+
+/**
+ * @brief Finds the step a packet belongs to
+ *
+ * @param Bench Benchmark instance
+ * @param PacketId Id of the packet
+ * @return const pb_step* Step or NULL if the packet is not part of the benchmark
+ */
+const pb_step *PbStepOf(const pipeline_bench *Bench, u64 PacketId);
+
+/**
+ * @brief Stamps the packets of a pipe buffer as handed off and committed
+ *
+ * Expects the packets to start with their id, as the test server's do.
+ *
+ * @param Bench Benchmark instance
+ * @param Items Start of the buffer
+ * @param ItemCount Number of packets in the buffer
+ * @param PacketSize Size of each packet
+ * @param HandedOff TSC when the buffer was read from the pipe
+ * @param Committed TSC when the packets were inserted
+ */
+void PbStampBuffer(pipeline_bench *Bench, const u8 *Items, u64 ItemCount, u64 PacketSize,
+                   u64 HandedOff, u64 Committed);
+
+/**
+ * @brief Summarizes each step, logs it and appends the results to a result file
+ *
+ * @param Bench Benchmark instance
+ * @param Filename Result file to append the RESULT_SECTION_PIPELINE section to
+ * @return sdb_errno 0 on success, -1 on failure
+ */
+sdb_errno PbReport(pipeline_bench *Bench, const char *Filename);
+
+#endif
@@ -29,6 +29,7 @@ SDB_LOG_REGISTER(Sdhs);
 #include <src/sdhs/Common/Thread.h>
 #include <src/sdhs/Common/ThreadGroup.h>
 #include <src/sdhs/DataHandlers/DataHandlers.h>
+#include <src/sdhs/DevUtils/PipelineBench.h>
 #include <src/sdhs/Signals.h>
 
 #include "Sdhs.h"
@@ -38,6 +39,7 @@ LM_LOG_REGISTER(sdhs);
 
 #include <src/allocators/allocator_wrappers.h>
 #include <src/allocators/u_arena.h>
+#include <src/metrics/mem_footprint.h>
 
 #include <dirent.h>
 #include <sys/stat.h>
@@ -209,6 +211,14 @@ SdhsMain(LmString log_dir)
 
     init_alloc_tcoll_dynamic(LmMebiByte(16));
 
+    // NOTE: (isa): What the arenas consumed is how far the allocations pushed
+    // them, so reusing memory after a seek or free shows up as a negative
+    // overhead against the bytes requested
+    struct mem_footprint      mem = { 0 };
+    struct mem_request_totals requests_at_start;
+    mem_requests_sum(&requests_at_start);
+    mem_snapshot_take(&mem.begin, requests_at_start.consumed);
+
     SdbLogInfo("Starting all thread groups");
     sdb_errno TgStartRet = TgManagerStartAll(Manager);
     if(TgStartRet != 0) {
@@ -220,6 +230,11 @@ SdhsMain(LmString log_dir)
 
 
     TgManagerWaitForAll(Manager);
+    struct mem_request_totals requests_at_end;
+    mem_requests_sum(&requests_at_end);
+    mem_snapshot_take(&mem.end, requests_at_end.consumed);
+    mem.allocs    = requests_at_end.allocs - requests_at_start.allocs;
+    mem.requested = requests_at_end.bytes - requests_at_start.bytes;
     TgDestroyManager(Manager);
 
     UAScratch            uas    = ua_scratch_begin(main_ua);
@@ -240,15 +255,30 @@ SdhsMain(LmString log_dir)
         lm_string_append_fmt(log_dir, "%d.bin", run_nr);
     }
 
-    if(write_alloc_timing_data_to_file(log_dir, atype) != 0) {
+    struct result_info info = { alloct_string(atype), "sdhs", 1 };
+    if(write_alloc_timing_data_to_file(log_dir, &info) != 0) {
         LmLogError("Failed to write data to file %s", log_dir);
         return EXIT_FAILURE;
     }
 
+    if(mem_footprint_append_to_file(log_dir, &mem) != 0) {
+        LmLogError("Failed to write memory footprint to %s", log_dir);
+    }
+
+    pipeline_bench *Bench = PbGetActive();
+    if(Bench) {
+        if(PbReport(Bench, log_dir) != 0) {
+            LmLogError("Failed to write the pipeline benchmark's results to %s", log_dir);
+        }
+        PbDestroy(Bench);
+    }
+
     LmString log_string = lm_string_make(alloct_string(atype), uas.ua);
     lm_string_append_c(log_string, " avg: ");
     lm_log_tsc_timing_avg(tstats->total_tsc, tstats->iter, log_string, NS, false, INF,
                           LM_LOG_MODULE_LOCAL);
+    LmLogInfoR("\n");
+    mem_footprint_log(&mem, LM_LOG_MODULE_LOCAL);
 
     ua_scratch_release(uas);
 
@@ -0,0 +1,291 @@
+#include <src/lm.h>
+LM_LOG_REGISTER(batch_test);
+
+#include <src/allocators/u_arena.h>
+#include <src/allocators/karena.h>
+#include <src/allocators/allocator_wrappers.h>
+#include <src/metrics/timing.h>
+#include <src/metrics/result_file.h>
+#include <src/utils/system_info.h>
+
+#include "batch_test.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+extern UArena *main_ua;
+
+typedef uint64_t (*batch_fn_t)(UArena *ua, KArena *ka, size_t size,
+			       void **ptrs);
+
+#define REP4(x) x x x x
+#define REP16(x) REP4(REP4(x))
+#define REP64(x) REP4(REP16(x))
+
+// Each call's size depends on the pointer returned by the previous one, so the
+// calls can't overlap the way independent ones would in an out-of-order core.
+// The top bit of a user space pointer is always 0, so the size is unchanged
+#define CHAINED_SIZE (size + (size_t)(dep >> 63))
+
+// NOTE: (isa): The calls are direct rather than through the *_timed wrappers
+// or a function pointer, so what is measured is the allocator's own fast path
+#define DEFINE_BATCH(name, rep, alloc_expr, keep)                              \
+	static uint64_t name(UArena *ua, KArena *ka, size_t size, void **ptrs) \
+	{                                                                      \
+		uintptr_t dep = 0;                                             \
+		size_t k = 0;                                                  \
+		START_TSC_TIMING_LFENCE(batch);                                \
+		rep({                                                          \
+			void *p = alloc_expr;                                  \
+			dep = (uintptr_t)p;                                    \
+			if (keep)                                              \
+				ptrs[k] = p;                                   \
+			++k;                                                   \
+		})                                                             \
+		END_TSC_TIMING_LFENCE(batch);                                  \
+		__asm__ volatile("" : : "r"(dep));                             \
+		return batch_end - batch_start;                                \
+	}
+
+DEFINE_BATCH(ua_alloc_small, REP16, ua_alloc(ua, CHAINED_SIZE), false)
+DEFINE_BATCH(ua_alloc_large, REP64, ua_alloc(ua, CHAINED_SIZE), false)
+DEFINE_BATCH(ua_falloc_small, REP16, ua_falloc(ua, CHAINED_SIZE), false)
+DEFINE_BATCH(ua_falloc_large, REP64, ua_falloc(ua, CHAINED_SIZE), false)
+DEFINE_BATCH(ka_alloc_small, REP16, ka_alloc(ka, CHAINED_SIZE), false)
+DEFINE_BATCH(ka_alloc_large, REP64, ka_alloc(ka, CHAINED_SIZE), false)
+DEFINE_BATCH(malloc_small, REP16, malloc(CHAINED_SIZE), true)
+DEFINE_BATCH(malloc_large, REP64, malloc(CHAINED_SIZE), true)
+
+static const struct {
+	batch_fn_t small;
+	batch_fn_t large;
+} batch_fns[BATCH_BACKEND_COUNT] = {
+	[BATCH_UA_ALLOC] = { ua_alloc_small, ua_alloc_large },
+	[BATCH_UA_FALLOC] = { ua_falloc_small, ua_falloc_large },
+	[BATCH_KA_ALLOC] = { ka_alloc_small, ka_alloc_large },
+	[BATCH_MALLOC] = { malloc_small, malloc_large },
+};
+
+const char *batch_backend_string(enum batch_backend backend)
+{
+	switch (backend) {
+	case BATCH_UA_ALLOC:
+		return "ua_alloc";
+	case BATCH_UA_FALLOC:
+		return "ua_falloc";
+	case BATCH_KA_ALLOC:
+		return "ka_alloc";
+	case BATCH_MALLOC:
+		return "malloc";
+	default:
+		return "unknown";
+	}
+}
+
+enum batch_backend batch_backend_from_string(const char *string)
+{
+	for (int i = 0; i < BATCH_BACKEND_COUNT; ++i) {
+		if (strcmp(string, batch_backend_string((enum batch_backend)i)) ==
+		    0)
+			return (enum batch_backend)i;
+	}
+
+	return BATCH_BACKEND_COUNT;
+}
+
+static void reset_batch(enum batch_backend backend, UArena *ua, KArena *ka,
+			void **ptrs, size_t count)
+{
+	switch (backend) {
+	case BATCH_UA_ALLOC:
+	case BATCH_UA_FALLOC:
+		ua_free(ua);
+		break;
+	case BATCH_KA_ALLOC:
+		ka_free(ka);
+		break;
+	case BATCH_MALLOC:
+		for (size_t i = 0; i < count; ++i)
+			free(ptrs[i]);
+		break;
+	default:
+		break;
+	}
+}
+
+static uint64_t run_batch(enum batch_backend backend, batch_fn_t fn,
+			  size_t count, UArena *ua, KArena *ka, size_t size,
+			  void **ptrs)
+{
+	uint64_t tsc = fn(ua, ka, size, ptrs);
+	reset_batch(backend, ua, ka, ptrs, count);
+	return tsc;
+}
+
+static int compare_double(const void *a, const void *b)
+{
+	double x = *(const double *)a;
+	double y = *(const double *)b;
+	return (x > y) - (x < y);
+}
+
+static void log_estimates(const char *description, double *estimates,
+			  uint64_t n, double tsc_freq)
+{
+	double sum = 0.0;
+	for (uint64_t i = 0; i < n; ++i)
+		sum += estimates[i];
+	double mean = sum / (double)n;
+
+	double sq = 0.0;
+	for (uint64_t i = 0; i < n; ++i)
+		sq += (estimates[i] - mean) * (estimates[i] - mean);
+	double stddev = (n > 1) ? sqrt(sq / (double)(n - 1)) : 0.0;
+	// Normal approximation, the sample counts used here are in the
+	// thousands
+	double ci95 = 1.96 * stddev / sqrt((double)n);
+
+	qsort(estimates, n, sizeof(double), compare_double);
+	double median = estimates[n / 2];
+
+	double ns_per_tsc = 1e9 / tsc_freq;
+	LmLogInfoR(
+		"\t%-10s %8.2f TSC +- %.2f (95%% CI), median %8.2f, stddev %8.2f"
+		" | %7.2f ns +- %.2f\n",
+		description, mean, ci95, median, stddev, mean * ns_per_tsc,
+		ci95 * ns_per_tsc);
+}
+
+// One file per batch size with the batch's whole TSC as the samples. They're
+// raw, the timer is what the difference between the two cancels
+static void write_batches(const char *log_directory, int run_nr,
+			  enum batch_backend backend, size_t size, int unroll,
+			  uint64_t *samples, uint64_t n)
+{
+	const char *name = batch_backend_string(backend);
+	char size_class[64];
+	snprintf(size_class, sizeof(size_class), "%zdB-x%d", size, unroll);
+
+	uint64_t total_tsc = 0;
+	for (uint64_t i = 0; i < n; ++i)
+		total_tsc += samples[i];
+
+	UAScratch uas = ua_scratch_begin(main_ua);
+	LmString filename = lm_string_make(log_directory, uas.ua);
+	lm_string_append_fmt(filename, "%d-%s-%s.bin", run_nr, name,
+			     size_class);
+	struct result_info info = { name, size_class, 1 };
+	if (result_file_write(filename, &info, total_tsc, n, samples, n,
+			      true) != 0)
+		LmLogError("Failed to write data to file %s", filename);
+	ua_scratch_release(uas);
+}
+
+static void run_backend(struct batch_params *params,
+			enum batch_backend backend, double tsc_freq,
+			const char *log_directory, int run_nr)
+{
+	size_t arena_sz = BATCH_LARGE_UNROLL * (params->alloc_size + 64) +
+			  get_page_size();
+	UArena *ua = NULL;
+	KArena *ka = NULL;
+	if (backend == BATCH_UA_ALLOC || backend == BATCH_UA_FALLOC)
+		ua = ua_create(arena_sz, UA_CONTIGUOUS, UA_MMAPD);
+	else if (backend == BATCH_KA_ALLOC)
+		ka = ka_create(arena_sz, 0);
+
+	if ((backend != BATCH_MALLOC) && !ua && !ka) {
+		LmLogWarning("Unable to create the arena for %s, skipping it",
+			     batch_backend_string(backend));
+		return;
+	}
+
+	UAScratch uas = ua_scratch_begin(main_ua);
+	void **ptrs = UaPushArray(uas.ua, void *, BATCH_LARGE_UNROLL);
+	double *diff = UaPushArray(uas.ua, double, params->samples);
+	double *naive = UaPushArray(uas.ua, double, params->samples);
+	uint64_t *small_arr = UaPushArray(uas.ua, uint64_t, params->samples);
+	uint64_t *large_arr = UaPushArray(uas.ua, uint64_t, params->samples);
+	batch_fn_t small = batch_fns[backend].small;
+	batch_fn_t large = batch_fns[backend].large;
+	size_t size = params->alloc_size;
+
+	for (uint64_t i = 0; i < params->warmup; ++i) {
+		run_batch(backend, small, BATCH_SMALL_UNROLL, ua, ka, size,
+			  ptrs);
+		run_batch(backend, large, BATCH_LARGE_UNROLL, ua, ka, size,
+			  ptrs);
+	}
+
+	// The order alternates so neither batch size always runs with the
+	// caches and predictors left behind by the other
+	uint64_t overhead = get_tsc_timer_overhead();
+	for (uint64_t i = 0; i < params->samples; ++i) {
+		uint64_t small_tsc, large_tsc;
+		if (i & 1) {
+			large_tsc = run_batch(backend, large,
+					      BATCH_LARGE_UNROLL, ua, ka, size,
+					      ptrs);
+			small_tsc = run_batch(backend, small,
+					      BATCH_SMALL_UNROLL, ua, ka, size,
+					      ptrs);
+		} else {
+			small_tsc = run_batch(backend, small,
+					      BATCH_SMALL_UNROLL, ua, ka, size,
+					      ptrs);
+			large_tsc = run_batch(backend, large,
+					      BATCH_LARGE_UNROLL, ua, ka, size,
+					      ptrs);
+		}
+
+		small_arr[i] = small_tsc;
+		large_arr[i] = large_tsc;
+		diff[i] = ((double)large_tsc - (double)small_tsc) /
+			  (BATCH_LARGE_UNROLL - BATCH_SMALL_UNROLL);
+		naive[i] = ((double)large_tsc - (double)overhead) /
+			   BATCH_LARGE_UNROLL;
+	}
+
+	LmLogInfoR("\n%s, %zd bytes:\n", batch_backend_string(backend), size);
+	log_estimates("difference", diff, params->samples, tsc_freq);
+	log_estimates("batch", naive, params->samples, tsc_freq);
+	write_batches(log_directory, run_nr, backend, size, BATCH_SMALL_UNROLL,
+		      small_arr, params->samples);
+	write_batches(log_directory, run_nr, backend, size, BATCH_LARGE_UNROLL,
+		      large_arr, params->samples);
+
+	ua_scratch_release(uas);
+	if (ua)
+		ua_destroy(&ua);
+	if (ka)
+		ka_destroy(ka);
+}
+
+void unrolled_batch_test(struct batch_params *params, LmString log_filename,
+			 const char *log_directory, int run_nr)
+{
+	FILE *log_file = lm_open_file_by_name(log_filename, "w");
+	LmSetLogFileLocal(log_file);
+
+	double tsc_freq = get_tsc_freq();
+	uint64_t overhead = get_tsc_timer_overhead();
+	LmLogInfoR(
+		"Unrolled batches of %d and %d dependent calls, %lu samples after %lu warmup rounds\n"
+		"Empty timer: %lu TSC (%.1f ns)\n"
+		"'difference' is (T%d - T%d) / %d, 'batch' is (T%d - timer) / %d\n",
+		BATCH_SMALL_UNROLL, BATCH_LARGE_UNROLL, params->samples,
+		params->warmup, overhead, (double)overhead / tsc_freq * 1e9,
+		BATCH_LARGE_UNROLL, BATCH_SMALL_UNROLL,
+		BATCH_LARGE_UNROLL - BATCH_SMALL_UNROLL, BATCH_LARGE_UNROLL,
+		BATCH_LARGE_UNROLL);
+
+	for (int i = 0; i < BATCH_BACKEND_COUNT; ++i) {
+		if (params->backends[i])
+			run_backend(params, (enum batch_backend)i, tsc_freq,
+				    log_directory, run_nr);
+	}
+
+	LmRemoveLogFileLocal();
+	lm_close_file(log_file);
+}
@@ -0,0 +1,35 @@
+#ifndef BATCH_TEST_H
+#define BATCH_TEST_H
+
+#include <src/lm.h>
+
+// Calls per timed batch. The per call cost is the difference between the two
+// divided by the difference in calls, which cancels the timer and the batch
+// setup the same way nanoBench does
+#define BATCH_SMALL_UNROLL 16
+#define BATCH_LARGE_UNROLL 64
+
+enum batch_backend {
+	BATCH_UA_ALLOC,
+	BATCH_UA_FALLOC,
+	BATCH_KA_ALLOC,
+	BATCH_MALLOC,
+	BATCH_BACKEND_COUNT
+};
+
+struct batch_params {
+	size_t alloc_size;
+	uint64_t samples;
+	uint64_t warmup;
+	bool backends[BATCH_BACKEND_COUNT];
+};
+
+const char *batch_backend_string(enum batch_backend backend);
+enum batch_backend batch_backend_from_string(const char *string);
+
+// The batches' TSC are written to <run_nr>-<backend>-<size>B-x<unroll>.bin in
+// log_directory, the estimates only go to the log
+void unrolled_batch_test(struct batch_params *params, LmString log_filename,
+			 const char *log_directory, int run_nr);
+
+#endif
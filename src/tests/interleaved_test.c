@@ -0,0 +1,485 @@
+#include <src/lm.h>
+LM_LOG_REGISTER(interleaved_test);
+
+#include <src/allocators/allocator_wrappers.h>
+#include <src/metrics/timing.h>
+#include <src/metrics/hdr_histogram.h>
+#include <src/metrics/result_file.h>
+#include <src/utils/random.h>
+#include <src/utils/system_info.h>
+
+#include "interleaved_test.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+extern UArena *main_ua;
+
+// The tuples of an allocator share its arena, which every trial starts from
+// empty. The heap allocators have none and get their blocks back instead
+struct interleaved_allocator {
+	alloc_fn_t alloc_fn;
+	UArena *ua;
+	KArena *ka;
+};
+
+struct interleaved_tuple {
+	struct interleaved_allocator *allocator;
+	const struct workload *workload;
+	size_t size; // 0 when the sizes are drawn from seq
+	const size_t *seq;
+	uint64_t seq_len;
+	char size_class[64];
+	uint64_t *samples; // Of every trial, NULL unless raw samples are kept
+	struct hdr_histogram hist;
+	bool has_hist;
+	struct alloc_tstats tstats;
+	struct schedule_trial *trials;
+	uint64_t trials_run;
+};
+
+struct interleaved_run {
+	struct interleaved_params *params;
+	struct interleaved_allocator allocators[INTERLEAVED_MAX_ALLOCATORS];
+	int allocators_len;
+	struct interleaved_tuple *tuples;
+	uint64_t tuples_len;
+	uint32_t *schedule; // Tuple indices, trials of each, shuffled
+	uint64_t schedule_len;
+	void **blocks; // The current trial's, given back to the heap allocators
+	UArena *ua;
+};
+
+static bool is_ka_alloc_fn(alloc_fn_t alloc_fn)
+{
+	return alloc_fn == ka_alloc_timed || alloc_fn == ka_zalloc_timed ||
+	       alloc_fn == ka_talloc_timed;
+}
+
+static bool is_ua_alloc_fn(alloc_fn_t alloc_fn)
+{
+	return alloc_fn == ua_alloc_timed || alloc_fn == ua_zalloc_timed ||
+	       alloc_fn == ua_talloc_timed;
+}
+
+// The userfaultfd arena is left out, since resetting it after every trial
+// would have it fault the pages in again
+bool interleaved_supports(alloc_fn_t alloc_fn)
+{
+	return alloc_fn == malloc_timed || alloc_plugin_of(alloc_fn) ||
+	       is_ua_alloc_fn(alloc_fn) || is_ka_alloc_fn(alloc_fn) ||
+	       alloc_fn == oka_alloc_timed;
+}
+
+static bool create_allocator(struct interleaved_allocator *a,
+			     const struct ua_params *ua_params)
+{
+	size_t arena_sz = ua_params->arena_sz;
+	if (is_ua_alloc_fn(a->alloc_fn))
+		a->ua = ua_create(arena_sz, ua_params->contiguous,
+				  ua_params->mallocd);
+	else if (a->alloc_fn == ka_zalloc_timed)
+		a->ka = ka_create(arena_sz, KA_ZERO_ON_REUSE);
+	else if (is_ka_alloc_fn(a->alloc_fn))
+		a->ka = ka_create(arena_sz, 0);
+	else if (a->alloc_fn == oka_alloc_timed)
+		a->ka = oka_create(arena_sz);
+	else
+		return true;
+	return a->ua || a->ka;
+}
+
+static void destroy_allocator(struct interleaved_allocator *a)
+{
+	if (a->ua)
+		ua_destroy(&a->ua);
+	if (a->ka && is_ka_alloc_fn(a->alloc_fn))
+		ka_destroy(a->ka);
+	else if (a->ka)
+		oka_destroy(a->ka);
+}
+
+// NOTE: (isa): Untimed, between two trials. The arenas give their pages back
+// too, since otherwise whichever trial first reaches a page pays its fault,
+// and with a shuffled schedule that's a different tuple every run. The
+// u_arena's first page holds the arena itself, so only whole pages after it
+// are dropped.
+static void decommit_ua(UArena *ua)
+{
+	if (UaIsMallocd(ua->flags))
+		return;
+	size_t page_sz = get_page_size();
+	uintptr_t start = ((uintptr_t)ua->mem + page_sz - 1) & ~(page_sz - 1);
+	uintptr_t end = (uintptr_t)ua->mem + ua->cur;
+	if (end > start)
+		madvise((void *)start, end - start, MADV_DONTNEED);
+}
+
+static void reset_allocator(struct interleaved_run *run,
+			    struct interleaved_allocator *a, uint64_t allocs)
+{
+	if (a->ua) {
+		decommit_ua(a->ua);
+		ua_free(a->ua);
+	} else if (a->ka && is_ka_alloc_fn(a->alloc_fn)) {
+		ka_free(a->ka);
+		ka_decommit(a->ka, 0);
+	} else if (a->ka)
+		oka_free(a->ka);
+	else
+		for (uint64_t i = 0; i < allocs; ++i)
+			alloc_fn_free(a->alloc_fn, run->blocks[i]);
+}
+
+static uint64_t workload_tuple_count(const struct workload *workload)
+{
+	return workload->dist.kind == SIZE_DIST_LIST ? workload->dist.sizes_len :
+						       1;
+}
+
+static size_t run_memory_size(struct interleaved_params *params,
+			      uint64_t tuples_len)
+{
+	uint64_t trials = params->trials;
+	size_t size = tuples_len * sizeof(struct interleaved_tuple) +
+		      tuples_len * trials * sizeof(struct schedule_trial) +
+		      tuples_len * trials * sizeof(uint32_t) +
+		      params->trial_allocs * sizeof(void *) +
+		      (tuples_len + 8) * get_page_size();
+	if (params->timing.raw_samples)
+		size += tuples_len * trials * params->trial_allocs *
+			sizeof(uint64_t);
+	if (params->timing.histogram)
+		size += tuples_len *
+			hdr_mem_size(params->timing.significant_digits);
+	for (int w = 0; w < params->workloads_len; ++w)
+		if (params->workloads[w].dist.kind != SIZE_DIST_LIST)
+			size += workload_sequence_len(&params->workloads[w]) *
+				sizeof(size_t);
+	return size;
+}
+
+static void init_tuple(struct interleaved_run *run,
+		       struct interleaved_tuple *t,
+		       struct interleaved_allocator *a,
+		       const struct workload *workload, size_t size,
+		       const size_t *seq, uint64_t seq_len)
+{
+	struct interleaved_params *params = run->params;
+	*t = (struct interleaved_tuple){ 0 };
+	t->allocator = a;
+	t->workload = workload;
+	t->size = size;
+	t->seq = seq;
+	t->seq_len = seq_len;
+	if (seq)
+		snprintf(t->size_class, sizeof(t->size_class), "%s",
+			 workload->name);
+	else
+		snprintf(t->size_class, sizeof(t->size_class), "%s-%zdB",
+			 workload->name, size);
+
+	if (params->timing.raw_samples)
+		t->samples = UaPushArrayZero(run->ua, uint64_t,
+					     params->trials *
+						     params->trial_allocs);
+	t->has_hist = params->timing.histogram &&
+		      hdr_init(&t->hist, params->timing.significant_digits,
+			       run->ua) == 0;
+	t->trials = UaPushArray(run->ua, struct schedule_trial,
+				params->trials);
+}
+
+static void build_tuples(struct interleaved_run *run)
+{
+	struct interleaved_params *params = run->params;
+	for (int w = 0; w < params->workloads_len; ++w) {
+		const struct workload *workload = &params->workloads[w];
+		const size_t *seq = NULL;
+		uint64_t seq_len = 0;
+		if (workload->dist.kind != SIZE_DIST_LIST) {
+			uint64_t requested;
+			seq_len = workload_sequence_len(workload);
+			seq = workload_generate(workload, 0, run->ua,
+						&requested);
+			if (!seq) {
+				LmLogWarning("Unable to generate the %s "
+					     "workload, skipping it",
+					     workload->name);
+				continue;
+			}
+		}
+
+		for (int i = 0; i < run->allocators_len; ++i) {
+			struct interleaved_allocator *a = &run->allocators[i];
+			if (seq) {
+				init_tuple(run, &run->tuples[run->tuples_len++],
+					   a, workload, 0, seq, seq_len);
+				continue;
+			}
+			for (size_t s = 0; s < workload->dist.sizes_len; ++s)
+				init_tuple(run, &run->tuples[run->tuples_len++],
+					   a, workload, workload->dist.sizes[s],
+					   NULL, 0);
+		}
+	}
+}
+
+// Every tuple appears trials times, in an order drawn from the seed
+static void build_schedule(struct interleaved_run *run)
+{
+	uint64_t trials = run->params->trials;
+	run->schedule_len = run->tuples_len * trials;
+	run->schedule = UaPushArray(run->ua, uint32_t, run->schedule_len);
+	for (uint64_t i = 0; i < run->schedule_len; ++i)
+		run->schedule[i] = (uint32_t)(i / trials);
+
+	struct rng rng;
+	rng_seed(&rng, run->params->seed);
+	for (uint64_t i = run->schedule_len - 1; i > 0; --i) {
+		uint64_t j = rng_below(&rng, i + 1);
+		uint32_t tmp = run->schedule[i];
+		run->schedule[i] = run->schedule[j];
+		run->schedule[j] = tmp;
+	}
+}
+
+// NOTE: (isa): The wrappers record into the calling thread's collection and
+// histogram, which are pointed at the tuple's before every trial. Its stats
+// are summed here, since the wrappers only ever add to the current ones
+static void run_trial(struct interleaved_run *run, struct interleaved_tuple *t,
+		      uint64_t position)
+{
+	uint64_t n = run->params->trial_allocs;
+	uint64_t offset = t->trials_run * n;
+	struct interleaved_allocator *a = t->allocator;
+
+	init_alloc_tcoll(t->samples ? n : 0,
+			 t->samples ? t->samples + offset : NULL);
+	init_alloc_hist(t->has_hist ? &t->hist : NULL);
+	*get_alloc_tstats() = (struct alloc_tstats){ 0 };
+
+	START_TSC_TIMING_LFENCE(trial);
+	for (uint64_t i = 0; i < n; ++i) {
+		size_t size = t->seq ? t->seq[(offset + i) % t->seq_len] :
+				       t->size;
+		uint8_t *ptr = a->alloc_fn(a->ua, a->ka, size);
+		*ptr = 1;
+		run->blocks[i] = ptr;
+	}
+
+	struct alloc_tstats *tstats = get_alloc_tstats();
+	uint64_t trial = t->trials_run++;
+	t->trials[trial] = (struct schedule_trial){
+		.trial = trial,
+		.position = position,
+		.start_tsc = trial_start,
+		.total_tsc = tstats->total_tsc,
+		.allocs = tstats->iter,
+	};
+	t->tstats.total_tsc += tstats->total_tsc;
+	t->tstats.iter += tstats->iter;
+
+	reset_allocator(run, a, n);
+}
+
+static int append_schedule(struct interleaved_run *run, const char *filename,
+			   struct interleaved_tuple *t)
+{
+	struct result_section_writer w;
+	if (result_section_begin(&w, filename, RESULT_SECTION_SCHEDULE) != 0)
+		return -1;
+
+	struct schedule_header header = { .seed = run->params->seed };
+	if (lm_write_bytes_to_file((uint8_t *)&header, sizeof(header),
+				   w.file) != 0 ||
+	    lm_write_bytes_to_file((uint8_t *)t->trials,
+				   t->trials_run * sizeof(struct schedule_trial),
+				   w.file) != 0) {
+		lm_close_file(w.file);
+		return -1;
+	}
+	return result_section_end(&w, 0, t->trials_run);
+}
+
+static void write_tuple(struct interleaved_run *run,
+			struct interleaved_tuple *t, const char *log_directory,
+			int run_nr)
+{
+	const char *alloc_name = alloc_fn_string(t->allocator->alloc_fn);
+	UAScratch uas = ua_scratch_begin(main_ua);
+	LmString filename = lm_string_make(log_directory, uas.ua);
+	lm_string_append_fmt(filename, "%d-%s-%s.bin", run_nr, alloc_name,
+			     t->size_class);
+
+	uint64_t count = t->trials_run * run->params->trial_allocs;
+	struct alloc_tcoll coll = { .cap = t->samples ? count : 0,
+				    .cur = t->samples ? count : 0,
+				    .arr = t->samples };
+	struct result_info info = { alloc_name, t->size_class, 1 };
+	if (write_timing_data_to_file(filename, &info, &t->tstats, &coll) != 0)
+		LmLogError("Failed to write data to file %s", filename);
+	else if ((t->has_hist && hdr_append_to_file(&t->hist, filename) != 0) ||
+		 append_schedule(run, filename, t) != 0)
+		LmLogError("Failed to write the histogram and schedule to %s",
+			   filename);
+	ua_scratch_release(uas);
+}
+
+// NOTE: (isa): Drift compares the trials in the second half of the schedule
+// to those in the first. With a fixed order it would be the difference
+// between whatever ran early and late, interleaved it should be close to 0
+static void log_tuple(struct interleaved_run *run, struct interleaved_tuple *t)
+{
+	double ns_per_tsc = 1e9 / get_tsc_freq();
+	double trial_min = 0.0;
+	double trial_max = 0.0;
+	double early[2] = { 0 }; // Cycles, allocations
+	double late[2] = { 0 };
+	for (uint64_t i = 0; i < t->trials_run; ++i) {
+		struct schedule_trial *trial = &t->trials[i];
+		double mean = (double)trial->total_tsc /
+			      (double)LmMax(trial->allocs, 1);
+		trial_min = i == 0 ? mean : LmMin(trial_min, mean);
+		trial_max = i == 0 ? mean : LmMax(trial_max, mean);
+		double *half = trial->position < run->schedule_len / 2 ? early :
+									 late;
+		half[0] += (double)trial->total_tsc;
+		half[1] += (double)trial->allocs;
+	}
+
+	double mean = (double)t->tstats.total_tsc /
+		      (double)LmMax(t->tstats.iter, 1);
+	double drift = 0.0;
+	if (early[1] > 0 && late[1] > 0 && mean > 0)
+		drift = (late[0] / late[1] - early[0] / early[1]) / mean * 100;
+
+	char tuple_name[96];
+	snprintf(tuple_name, sizeof(tuple_name), "%s %s",
+		 alloc_fn_string(t->allocator->alloc_fn), t->size_class);
+	LmLogInfoR("%-32s%10.1f", tuple_name, mean * ns_per_tsc);
+	if (t->has_hist)
+		LmLogInfoR(
+			"%10.1f%10.1f",
+			(double)hdr_value_at_percentile(&t->hist, 50.0) *
+				ns_per_tsc,
+			(double)hdr_value_at_percentile(&t->hist, 99.0) *
+				ns_per_tsc);
+	else
+		LmLogInfoR("%10s%10s", "-", "-");
+	LmLogInfoR("%12.1f%12.1f%9.1f%%\n", trial_min * ns_per_tsc,
+		   trial_max * ns_per_tsc, drift);
+}
+
+static void run_interleaved(struct interleaved_params *params,
+			    LmString log_filename, const char *log_directory,
+			    int run_nr)
+{
+	FILE *log_file = lm_open_file_by_name(log_filename, "a");
+	LmSetLogFileLocal(log_file);
+
+	struct interleaved_run run = { 0 };
+	run.params = params;
+	for (int i = 0; i < params->allocators_len; ++i) {
+		struct interleaved_allocator *a =
+			&run.allocators[run.allocators_len];
+		*a = (struct interleaved_allocator){ params->allocators[i],
+						     NULL, NULL };
+		if (create_allocator(a, &params->ua))
+			++run.allocators_len;
+		else
+			LmLogWarning("Unable to create the %s arena, skipping it",
+				     alloc_fn_string(a->alloc_fn));
+	}
+
+	uint64_t tuples_len = 0;
+	for (int w = 0; w < params->workloads_len; ++w)
+		tuples_len += workload_tuple_count(&params->workloads[w]) *
+			      (uint64_t)run.allocators_len;
+	if (tuples_len == 0) {
+		LmLogWarning("Nothing to schedule");
+		goto out;
+	}
+
+	run.ua = ua_create(run_memory_size(params, tuples_len), UA_CONTIGUOUS,
+			   UA_MMAPD);
+	run.tuples = UaPushArray(run.ua, struct interleaved_tuple, tuples_len);
+	run.blocks = UaPushArray(run.ua, void *, params->trial_allocs);
+	build_tuples(&run);
+	build_schedule(&run);
+	LmLogInfoR("\n%lu tuples, %lu trials in total\n", run.tuples_len,
+		   run.schedule_len);
+
+	START_TSC_TIMING_LFENCE(schedule);
+	for (uint64_t i = 0; i < run.schedule_len; ++i)
+		run_trial(&run, &run.tuples[run.schedule[i]], i);
+	END_TSC_TIMING_LFENCE(schedule);
+	init_alloc_tcoll(0, NULL);
+	init_alloc_hist(NULL);
+	lm_log_tsc_timing(schedule_end - schedule_start, "Schedule", NS, true,
+			  INF, LM_LOG_MODULE_LOCAL);
+
+	LmLogInfoR("\n%-32s%10s%10s%10s%12s%12s%10s\n", "Tuple (ns)", "mean",
+		   "p50", "p99", "trial min", "trial max", "drift");
+	for (uint64_t i = 0; i < run.tuples_len; ++i) {
+		log_tuple(&run, &run.tuples[i]);
+		write_tuple(&run, &run.tuples[i], log_directory, run_nr);
+	}
+	ua_destroy(&run.ua);
+
+out:
+	for (int i = 0; i < run.allocators_len; ++i)
+		destroy_allocator(&run.allocators[i]);
+	LmRemoveLogFileLocal();
+	lm_close_file(log_file);
+}
+
+// NOTE: (isa): Unlike the arena and malloc tests, every allocator runs in the
+// same process, so none of them gets a fresher heap, cooler CPU or emptier
+// page cache by running first. The schedule runs in a process of its own so
+// the suite's heap is left as it was
+void interleaved_test(struct interleaved_params *params,
+		      bool running_in_debugger, LmString log_filename,
+		      const char *log_directory, int run_nr)
+{
+	if (params->seed == 0) {
+		START_TSC_TIMING(seed);
+		params->seed = seed_start;
+	}
+
+	FILE *log_file = lm_open_file_by_name(log_filename, "w");
+	LmSetLogFileLocal(log_file);
+	LmLogInfoR("Interleaved: %lu trials of %lu allocations per tuple, "
+		   "seed %lu\nAllocators:",
+		   params->trials, params->trial_allocs, params->seed);
+	for (int i = 0; i < params->allocators_len; ++i)
+		LmLogInfoR(" %s", alloc_fn_string(params->allocators[i]));
+	LmLogInfoR("\nTSC freq: %.0f\n", get_tsc_freq());
+	LmLogInfoR("The u_arena (unless malloc'd) and karena arenas are "
+		   "decommitted after every trial, so each trial pays its own "
+		   "first-touch faults. oka_alloc and malloc keep their pages, "
+		   "so their faults land in the first trials to reach them.\n");
+	LmLogInfoR("\nWorkloads:\n");
+	for (int i = 0; i < params->workloads_len; ++i)
+		workload_log(&params->workloads[i], LM_LOG_MODULE_LOCAL);
+	LmRemoveLogFileLocal();
+	lm_close_file(log_file);
+
+	if (running_in_debugger) {
+		run_interleaved(params, log_filename, log_directory, run_nr);
+		return;
+	}
+
+	pid_t pid = fork();
+	if (pid == -1) {
+		LmLogError("Fork failed: %s", strerror(errno));
+	} else if (pid == 0) {
+		run_interleaved(params, log_filename, log_directory, run_nr);
+		exit(EXIT_SUCCESS);
+	} else {
+		int status;
+		waitpid(pid, &status, 0);
+	}
+}
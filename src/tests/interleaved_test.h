@@ -0,0 +1,49 @@
+#ifndef INTERLEAVED_TEST_H
+#define INTERLEAVED_TEST_H
+
+#include <src/lm.h>
+#include <src/allocators/allocator_wrappers.h>
+
+#include "tests.h"
+#include "workload.h"
+
+#define INTERLEAVED_MAX_ALLOCATORS 16
+
+// NOTE: (isa): Every tuple's result file has a RESULT_SECTION_SCHEDULE, a
+// schedule_header followed by one schedule_trial per trial the tuple ran. The
+// header's seed is the schedule's, so a run can be reproduced from any of its
+// result files
+struct schedule_header {
+	uint64_t seed;
+};
+
+struct schedule_trial {
+	// Of the tuple, which picks the trial's slice of a sampled workload
+	uint64_t trial;
+	uint64_t position; // In the schedule, over all tuples
+	uint64_t start_tsc;
+	uint64_t total_tsc; // Summed over the trial's allocations
+	uint64_t allocs;
+};
+
+struct interleaved_params {
+	uint64_t trials; // Per tuple
+	uint64_t trial_allocs;
+	uint64_t seed; // 0 takes one from the TSC, it's recorded either way
+	struct ua_params ua; // For the arena allocators, reset after every trial
+	alloc_fn_t allocators[INTERLEAVED_MAX_ALLOCATORS];
+	int allocators_len;
+	// Lists give one tuple per size, sampled distributions one tuple that
+	// draws from the workload's sequence
+	struct workload *workloads;
+	int workloads_len;
+	struct alloc_timing_params timing;
+};
+
+bool interleaved_supports(alloc_fn_t alloc_fn);
+
+void interleaved_test(struct interleaved_params *params,
+		      bool running_in_debugger, LmString log_filename,
+		      const char *log_directory, int run_nr);
+
+#endif
@@ -0,0 +1,340 @@
+#define _GNU_SOURCE
+#include <src/lm.h>
+LM_LOG_REGISTER(ipc_test);
+
+#include <src/allocators/allocator_wrappers.h>
+#include <src/metrics/timing.h>
+#include <src/utils/system_info.h>
+
+#include "ipc_test.h"
+
+#include <sched.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern UArena *main_ua;
+
+// Single producer, single consumer ring of fixed size messages. It lives at
+// the start of the shared arena, and the slots follow it.
+struct ipc_ring {
+	_Atomic uint64_t head;
+	char pad0[64 - sizeof(uint64_t)];
+	_Atomic uint64_t tail;
+	char pad1[64 - sizeof(uint64_t)];
+	uint64_t slots_offset;
+	uint64_t slot_count;
+	size_t msg_sz;
+};
+
+enum ipc_transport { IPC_KARENA, IPC_PIPE };
+
+static const char *ipc_transport_string(enum ipc_transport transport)
+{
+	return (transport == IPC_KARENA) ? "karena" : "pipe";
+}
+
+static void pin_to_cpu(int cpu)
+{
+	if (cpu < 0)
+		return;
+
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET((size_t)cpu, &set);
+	if (sched_setaffinity(0, sizeof(set), &set) != 0)
+		LmLogWarning("Unable to pin to CPU %d: %s", cpu,
+			     strerror(errno));
+}
+
+// NOTE: (isa): Yields now and then, so the test still makes progress when
+// both processes end up on the same CPU
+static inline void ipc_spin(uint64_t *spins)
+{
+	__asm__ volatile("pause");
+	if ((++(*spins) & 1023) == 0)
+		sched_yield();
+}
+
+static uint64_t consume_msg(const uint8_t *msg, size_t msg_sz)
+{
+	uint64_t sum = 0;
+	for (size_t i = 0; i < msg_sz; ++i)
+		sum += msg[i];
+	return sum;
+}
+
+static bool write_all(int fd, const void *buf, size_t sz)
+{
+	const uint8_t *p = buf;
+	while (sz > 0) {
+		ssize_t n = write(fd, p, sz);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return false;
+		p += n;
+		sz -= (size_t)n;
+	}
+	return true;
+}
+
+static bool read_all(int fd, void *buf, size_t sz)
+{
+	uint8_t *p = buf;
+	while (sz > 0) {
+		ssize_t n = read(fd, p, sz);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return false;
+		p += n;
+		sz -= (size_t)n;
+	}
+	return true;
+}
+
+static void karena_producer(struct ipc_params *params, int token_fd)
+{
+	size_t slots_sz = params->slot_count * params->msg_sz;
+	KArena *ka = ka_create(sizeof(struct ipc_ring) + slots_sz, 0);
+	LmAssert(ka, "Unable to create the shared arena");
+
+	struct ipc_ring *ring = ka_alloc(ka, sizeof(struct ipc_ring));
+	uint8_t *slots = ka_alloc(ka, slots_sz);
+	LmAssert(ring && slots, "Unable to allocate the ring");
+
+	atomic_init(&ring->head, 0);
+	atomic_init(&ring->tail, 0);
+	ring->slots_offset = (uint64_t)(slots - (uint8_t *)ring);
+	ring->slot_count = params->slot_count;
+	ring->msg_sz = params->msg_sz;
+
+	unsigned long token = ka_export(ka);
+	LmAssert(token, "Unable to export the shared arena");
+	write_all(token_fd, &token, sizeof(token));
+
+	uint64_t spins = 0;
+	for (uint64_t i = 0; i < params->msg_count; ++i) {
+		while (i - atomic_load_explicit(&ring->tail,
+						memory_order_acquire) >=
+		       ring->slot_count)
+			ipc_spin(&spins);
+
+		uint8_t *msg = slots + (i % ring->slot_count) * ring->msg_sz;
+		memset(msg, (int)(i & 0xff), ring->msg_sz);
+		atomic_store_explicit(&ring->head, i + 1, memory_order_release);
+	}
+
+	// The consumer holds its own reference, but wait for it so the arena
+	// is not torn down under an import that has not happened yet
+	while (atomic_load_explicit(&ring->tail, memory_order_acquire) <
+	       params->msg_count)
+		ipc_spin(&spins);
+
+	ka_destroy(ka);
+}
+
+static void karena_consumer(struct ipc_params *params, int token_fd,
+			    uint64_t *total_tsc)
+{
+	unsigned long token;
+	LmAssert(read_all(token_fd, &token, sizeof(token)),
+		 "Unable to read the arena token");
+
+	KArena *ka = ka_import(token);
+	LmAssert(ka, "Unable to import the shared arena");
+
+	struct ipc_ring *ring = ka_base(ka);
+	const uint8_t *slots = (uint8_t *)ring + ring->slots_offset;
+
+	uint64_t sum = 0;
+	uint64_t spins = 0;
+	uint64_t prev = 0;
+	for (uint64_t i = 0; i < params->msg_count; ++i) {
+		while (atomic_load_explicit(&ring->head,
+					    memory_order_acquire) <= i)
+			ipc_spin(&spins);
+
+		START_TSC_TIMING_LFENCE(msg);
+		if (i == 0)
+			prev = msg_start;
+
+		sum += consume_msg(slots + (i % ring->slot_count) *
+						   ring->msg_sz,
+				   ring->msg_sz);
+		atomic_store_explicit(&ring->tail, i + 1, memory_order_release);
+		END_TSC_TIMING_LFENCE(msg);
+
+		add_alloc_timing_raw(msg_end - prev);
+		prev = msg_end;
+	}
+	__asm__ volatile("" : : "r"(sum));
+
+	*total_tsc = get_alloc_tstats()->total_tsc;
+	ka_unimport(ka);
+}
+
+static void pipe_producer(struct ipc_params *params, int data_fd)
+{
+	uint8_t *msg = malloc(params->msg_sz);
+	LmAssert(msg, "Unable to allocate the message buffer");
+
+	for (uint64_t i = 0; i < params->msg_count; ++i) {
+		memset(msg, (int)(i & 0xff), params->msg_sz);
+		if (!write_all(data_fd, msg, params->msg_sz))
+			break;
+	}
+
+	free(msg);
+}
+
+static void pipe_consumer(struct ipc_params *params, int data_fd,
+			  uint64_t *total_tsc)
+{
+	uint8_t *msg = malloc(params->msg_sz);
+	LmAssert(msg, "Unable to allocate the message buffer");
+
+	uint64_t sum = 0;
+	uint64_t prev = 0;
+	for (uint64_t i = 0; i < params->msg_count; ++i) {
+		// The first read also waits for the producer to start
+		if (!read_all(data_fd, msg, params->msg_sz))
+			break;
+
+		START_TSC_TIMING_LFENCE(msg);
+		if (i == 0)
+			prev = msg_start;
+
+		sum += consume_msg(msg, params->msg_sz);
+		END_TSC_TIMING_LFENCE(msg);
+
+		add_alloc_timing_raw(msg_end - prev);
+		prev = msg_end;
+	}
+	__asm__ volatile("" : : "r"(sum));
+
+	*total_tsc = get_alloc_tstats()->total_tsc;
+	free(msg);
+}
+
+// Runs in the consumer process. The time of each message is measured from
+// the end of the previous one, so the samples add up to the throughput.
+static void run_consumer(struct ipc_params *params,
+			 enum ipc_transport transport, int fd,
+			 LmString log_filename, const char *log_directory,
+			 int run_nr)
+{
+	pin_to_cpu(params->consumer_cpu);
+
+	FILE *log_file = lm_open_file_by_name(log_filename, "a");
+	LmSetLogFileLocal(log_file);
+
+	UArena *timings_ua = ua_create(params->msg_count * sizeof(uint64_t),
+				       UA_CONTIGUOUS, UA_MMAPD);
+	uint64_t *timing_arr =
+		UaPushArray(timings_ua, uint64_t, params->msg_count);
+	*get_alloc_tstats() = (struct alloc_tstats){ 0 };
+	init_alloc_tcoll(params->msg_count, timing_arr);
+
+	uint64_t total_tsc = 0;
+	if (transport == IPC_KARENA)
+		karena_consumer(params, fd, &total_tsc);
+	else
+		pipe_consumer(params, fd, &total_tsc);
+
+	double sec = (double)total_tsc / get_tsc_freq();
+	double bytes = (double)params->msg_sz * (double)params->msg_count;
+	LmLogInfoR("\t%6s: %8.2f GB/s, %12.0f msgs/s\n",
+		   ipc_transport_string(transport), bytes / sec / 1e9,
+		   (double)params->msg_count / sec);
+
+	UAScratch uas = ua_scratch_begin(main_ua);
+	LmString filename = lm_string_make(log_directory, uas.ua);
+	lm_string_append_fmt(filename, "%d-ipc-%s-%zdB.bin", run_nr,
+			     ipc_transport_string(transport), params->msg_sz);
+	char size_class[32];
+	snprintf(size_class, sizeof(size_class), "%zdB", params->msg_sz);
+	struct result_info info = { ipc_transport_string(transport),
+				    size_class, 1 };
+	if (write_alloc_timing_data_to_file(filename, &info) != 0)
+		LmLogError("Failed to write data to file %s", filename);
+	ua_scratch_release(uas);
+
+	ua_destroy(&timings_ua);
+	LmRemoveLogFileLocal();
+	lm_close_file(log_file);
+}
+
+static void run_transport(struct ipc_params *params,
+			  enum ipc_transport transport, LmString log_filename,
+			  const char *log_directory, int run_nr)
+{
+	// For karena the pipe only carries the export token
+	int fds[2];
+	if (pipe(fds) != 0) {
+		LmLogError("pipe failed: %s", strerror(errno));
+		return;
+	}
+
+	pid_t consumer = fork();
+	if (consumer == -1) {
+		LmLogError("Fork failed: %s", strerror(errno));
+		return;
+	} else if (consumer == 0) {
+		close(fds[1]);
+		run_consumer(params, transport, fds[0], log_filename,
+			     log_directory, run_nr);
+		exit(EXIT_SUCCESS);
+	}
+
+	pid_t producer = fork();
+	if (producer == -1) {
+		LmLogError("Fork failed: %s", strerror(errno));
+		kill(consumer, SIGKILL);
+	} else if (producer == 0) {
+		close(fds[0]);
+		pin_to_cpu(params->producer_cpu);
+		if (transport == IPC_KARENA)
+			karena_producer(params, fds[1]);
+		else
+			pipe_producer(params, fds[1]);
+		exit(EXIT_SUCCESS);
+	}
+
+	close(fds[0]);
+	close(fds[1]);
+
+	// The producer waits for the consumer, so it would spin forever if the
+	// consumer died
+	int status;
+	waitpid(consumer, &status, 0);
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS) {
+		LmLogError("%s consumer failed",
+			   ipc_transport_string(transport));
+		if (producer > 0)
+			kill(producer, SIGKILL);
+	}
+
+	if (producer > 0)
+		waitpid(producer, &status, 0);
+}
+
+void ipc_throughput_test(struct ipc_params *params, LmString log_filename,
+			 const char *log_directory, int run_nr)
+{
+	FILE *log_file = lm_open_file_by_name(log_filename, "a");
+	LmSetLogFileLocal(log_file);
+	LmLogInfoR("\nTwo process throughput, %lu messages of %zd bytes, %lu "
+		   "slots, producer on CPU %d, consumer on CPU %d\n",
+		   params->msg_count, params->msg_sz, params->slot_count,
+		   params->producer_cpu, params->consumer_cpu);
+	LmRemoveLogFileLocal();
+	lm_close_file(log_file);
+
+	run_transport(params, IPC_KARENA, log_filename, log_directory, run_nr);
+	run_transport(params, IPC_PIPE, log_filename, log_directory, run_nr);
+}
@@ -0,0 +1,17 @@
+#ifndef IPC_TEST_H
+#define IPC_TEST_H
+
+#include <src/lm.h>
+
+struct ipc_params {
+	size_t msg_sz;
+	uint64_t msg_count;
+	uint64_t slot_count;
+	int producer_cpu;
+	int consumer_cpu;
+};
+
+void ipc_throughput_test(struct ipc_params *params, LmString log_filename,
+			 const char *log_directory, int run_nr);
+
+#endif
@@ -0,0 +1,414 @@
+#include <src/lm.h>
+LM_LOG_REGISTER(ka_cost_test);
+
+#include <src/allocators/allocator_wrappers.h>
+#include <src/allocators/karena.h>
+#include <src/allocators/oldkarena.h>
+#include <src/metrics/hdr_histogram.h>
+#include <src/metrics/result_file.h>
+#include <src/metrics/timing.h>
+#include <src/utils/system_info.h>
+
+#include "ka_cost_test.h"
+
+#include <string.h>
+
+extern UArena *main_ua;
+
+struct ka_cost_series {
+	const char *allocator;
+	const char *name;
+	uint64_t *samples;
+	struct hdr_histogram hist;
+	bool has_hist;
+	struct alloc_tstats tstats;
+	bool ran;
+};
+
+struct ka_cost_state {
+	struct ka_cost_params *params;
+	struct ka_cost_series steps[KA_COST_STEP_COUNT];
+	struct ka_cost_series stages[KA_STAGE_COUNT];
+	const char *log_directory;
+	int run_nr;
+};
+
+const char *ka_cost_step_string(enum ka_cost_step step)
+{
+	switch (step) {
+	case KA_COST_NOP:
+		return "nop";
+	case KA_COST_ECHO:
+		return "echo";
+	case KA_COST_POS:
+		return "pos";
+	case KA_COST_ALLOC:
+		return "alloc";
+	case KA_COST_TOUCH:
+		return "touch";
+	case KA_COST_OKA_ALLOC:
+		return "alloc";
+	case KA_COST_OKA_TOUCH:
+		return "touch";
+	default:
+		return "unknown";
+	}
+}
+
+const char *ka_cost_stage_string(enum ka_cost_stage stage)
+{
+	switch (stage) {
+	case KA_STAGE_ENTRY:
+		return "stamped-entry";
+	case KA_STAGE_COPY_IN:
+		return "stamped-copy_in";
+	case KA_STAGE_LOOKUP:
+		return "stamped-lookup";
+	case KA_STAGE_BUMP:
+		return "stamped-bump";
+	case KA_STAGE_EXIT:
+		return "stamped-exit";
+	default:
+		return "unknown";
+	}
+}
+
+static void init_series(struct ka_cost_series *s, const char *allocator,
+			const char *name, uint64_t iterations, UArena *ua)
+{
+	*s = (struct ka_cost_series){ .allocator = allocator, .name = name };
+	s->samples = UaPushArrayZero(ua, uint64_t, iterations);
+	s->has_hist = hdr_init(&s->hist, 3, ua) == 0;
+	if (!s->has_hist)
+		LmLogWarning("No histogram for %s %s, its percentiles are "
+			     "skipped",
+			     allocator, name);
+}
+
+// The steps record through add_alloc_timing, like the allocation wrappers,
+// so the timer overhead is subtracted from them
+static void begin_step(struct ka_cost_state *st, struct ka_cost_series *s)
+{
+	init_alloc_tcoll(st->params->iterations, s->samples);
+	init_alloc_hist(s->has_hist ? &s->hist : NULL);
+	*get_alloc_tstats() = (struct alloc_tstats){ 0 };
+}
+
+static void write_series(struct ka_cost_state *st, struct ka_cost_series *s)
+{
+	UAScratch uas = ua_scratch_begin(main_ua);
+	LmString filename = lm_string_make(st->log_directory, uas.ua);
+	lm_string_append_fmt(filename, "%d-%s-%s.bin", st->run_nr,
+			     s->allocator, s->name);
+
+	struct alloc_tcoll coll = { .cap = s->tstats.iter,
+				    .cur = s->tstats.iter,
+				    .arr = s->samples };
+	struct result_info info = { s->allocator, s->name, 1 };
+	if (write_timing_data_to_file(filename, &info, &s->tstats, &coll) !=
+		    0 ||
+	    (s->has_hist && hdr_append_to_file(&s->hist, filename) != 0))
+		LmLogError("Failed to write data to file %s", filename);
+	ua_scratch_release(uas);
+}
+
+static void finish_series(struct ka_cost_state *st, struct ka_cost_series *s)
+{
+	s->ran = s->tstats.iter > 0;
+	if (!s->ran)
+		return;
+
+	LmLogInfoR("%s %s: ", s->allocator, s->name);
+	lm_log_tsc_timing_avg(s->tstats.total_tsc, s->tstats.iter, "", NS,
+			      true, INF, LM_LOG_MODULE_LOCAL);
+	LmLogInfoR("\n");
+	if (s->has_hist)
+		hdr_log_percentiles(&s->hist, "\t", LM_LOG_MODULE_LOCAL);
+	write_series(st, s);
+}
+
+// A step fails as a whole, e.g. when the module predates KARENA_NOP, so its
+// samples aren't mixed with those of the error path
+static void end_step(struct ka_cost_state *st, struct ka_cost_series *s,
+		     bool failed)
+{
+	s->tstats = failed ? (struct alloc_tstats){ 0 } : *get_alloc_tstats();
+	init_alloc_tcoll(0, NULL);
+	init_alloc_hist(NULL);
+	if (failed)
+		LmLogWarning("The %s %s step failed, is the module too old?",
+			     s->allocator, s->name);
+	finish_series(st, s);
+}
+
+// The stage deltas are kept as they are, there's no timer overhead to take
+// off a difference between two stamps
+static void record_stage(struct ka_cost_series *s, uint64_t i, uint64_t from,
+			 uint64_t to)
+{
+	uint64_t tsc = to > from ? to - from : 0;
+	s->samples[i] = tsc;
+	if (s->has_hist)
+		hdr_record(&s->hist, tsc);
+	s->tstats.total_tsc += tsc;
+	s->tstats.iter += 1;
+	s->tstats.raw = true;
+}
+
+static void run_stamped(struct ka_cost_state *st, KArena *ka)
+{
+	uint64_t n = st->params->iterations;
+	struct ka_cost_series *stages = st->stages;
+	unsigned long long tsc[KA_STAMP_COUNT];
+
+	ka_free(ka);
+	for (uint64_t i = 0; i < n; ++i) {
+		START_TSC_TIMING_LFENCE(call);
+		void *ptr = ka_alloc_stamped(ka, st->params->alloc_sz, tsc);
+		END_TSC_TIMING_LFENCE(call);
+		if (!ptr) {
+			LmLogWarning("Stamped allocations failed, is the "
+				     "module too old?");
+			return;
+		}
+
+		record_stage(&stages[KA_STAGE_ENTRY], i, call_start,
+			     tsc[KA_STAMP_ENTRY]);
+		record_stage(&stages[KA_STAGE_COPY_IN], i, tsc[KA_STAMP_ENTRY],
+			     tsc[KA_STAMP_COPIED_IN]);
+		record_stage(&stages[KA_STAGE_LOOKUP], i,
+			     tsc[KA_STAMP_COPIED_IN], tsc[KA_STAMP_LOOKED_UP]);
+		record_stage(&stages[KA_STAGE_BUMP], i, tsc[KA_STAMP_LOOKED_UP],
+			     tsc[KA_STAMP_BUMPED]);
+		record_stage(&stages[KA_STAGE_EXIT], i, tsc[KA_STAMP_BUMPED],
+			     call_end);
+	}
+
+	for (int s = 0; s < KA_STAGE_COUNT; ++s)
+		finish_series(st, &stages[s]);
+}
+
+// NOTE: (isa): Each step adds one part of ka_alloc to the step before it, so
+// the parts are the differences between them. The allocations are never
+// touched, the first touch is its own step on an arena of its own, whose
+// blocks are a page each so that every write faults
+static void run_ka_steps(struct ka_cost_state *st)
+{
+	uint64_t n = st->params->iterations;
+	size_t alloc_sz = st->params->alloc_sz;
+	size_t page_sz = get_page_size();
+	struct ka_cost_series *steps = st->steps;
+
+	KArena *ka = ka_create(n * alloc_sz + page_sz, 0);
+	if (!ka) {
+		LmLogWarning("Unable to create a karena arena, is the module "
+			     "loaded?");
+		return;
+	}
+
+	bool failed = false;
+	begin_step(st, &steps[KA_COST_NOP]);
+	for (uint64_t i = 0; i < n && !failed; ++i) {
+		START_TSC_TIMING_LFENCE(nop);
+		int ret = ka_nop();
+		END_TSC_TIMING_LFENCE(nop);
+		add_alloc_timing(nop_end - nop_start);
+		failed = ret != 0;
+	}
+	end_step(st, &steps[KA_COST_NOP], failed);
+
+	failed = false;
+	begin_step(st, &steps[KA_COST_ECHO]);
+	for (uint64_t i = 0; i < n && !failed; ++i) {
+		START_TSC_TIMING_LFENCE(echo);
+		int ret = ka_echo(ka);
+		END_TSC_TIMING_LFENCE(echo);
+		add_alloc_timing(echo_end - echo_start);
+		failed = ret != 0;
+	}
+	end_step(st, &steps[KA_COST_ECHO], failed);
+
+	failed = false;
+	begin_step(st, &steps[KA_COST_POS]);
+	for (uint64_t i = 0; i < n && !failed; ++i) {
+		START_TSC_TIMING_LFENCE(pos);
+		size_t pos = ka_pos(ka);
+		END_TSC_TIMING_LFENCE(pos);
+		add_alloc_timing(pos_end - pos_start);
+		failed = pos == (size_t)-1;
+	}
+	end_step(st, &steps[KA_COST_POS], failed);
+
+	failed = false;
+	begin_step(st, &steps[KA_COST_ALLOC]);
+	for (uint64_t i = 0; i < n && !failed; ++i) {
+		START_TSC_TIMING_LFENCE(alloc);
+		void *ptr = ka_alloc(ka, alloc_sz);
+		END_TSC_TIMING_LFENCE(alloc);
+		add_alloc_timing(alloc_end - alloc_start);
+		failed = ptr == NULL;
+	}
+	end_step(st, &steps[KA_COST_ALLOC], failed);
+
+	if (st->params->stamps)
+		run_stamped(st, ka);
+	ka_destroy(ka);
+
+	KArena *touch_ka = ka_create(n * page_sz, 0);
+	if (!touch_ka)
+		return;
+	failed = false;
+	begin_step(st, &steps[KA_COST_TOUCH]);
+	for (uint64_t i = 0; i < n && !failed; ++i) {
+		volatile uint8_t *ptr = ka_alloc(touch_ka, page_sz);
+		if ((failed = ptr == NULL))
+			break;
+		START_TSC_TIMING_LFENCE(touch);
+		*ptr = 1;
+		END_TSC_TIMING_LFENCE(touch);
+		add_alloc_timing(touch_end - touch_start);
+	}
+	end_step(st, &steps[KA_COST_TOUCH], failed);
+	ka_destroy(touch_ka);
+}
+
+static void run_oka_steps(struct ka_cost_state *st)
+{
+	uint64_t n = st->params->iterations;
+	size_t alloc_sz = st->params->alloc_sz;
+	size_t page_sz = get_page_size();
+	struct ka_cost_series *steps = st->steps;
+
+	OKArena oka = oka_create(n * alloc_sz + page_sz);
+	if (!oka) {
+		LmLogWarning("Unable to create an okarena arena, is the module "
+			     "loaded?");
+		return;
+	}
+
+	bool failed = false;
+	begin_step(st, &steps[KA_COST_OKA_ALLOC]);
+	for (uint64_t i = 0; i < n && !failed; ++i) {
+		START_TSC_TIMING_LFENCE(alloc);
+		void *ptr = oka_alloc(oka, alloc_sz);
+		END_TSC_TIMING_LFENCE(alloc);
+		add_alloc_timing(alloc_end - alloc_start);
+		failed = ptr == NULL;
+	}
+	end_step(st, &steps[KA_COST_OKA_ALLOC], failed);
+	oka_destroy(oka);
+
+	OKArena touch_oka = oka_create(n * page_sz);
+	if (!touch_oka)
+		return;
+	failed = false;
+	begin_step(st, &steps[KA_COST_OKA_TOUCH]);
+	for (uint64_t i = 0; i < n && !failed; ++i) {
+		volatile uint8_t *ptr = oka_alloc(touch_oka, page_sz);
+		if ((failed = ptr == NULL))
+			break;
+		START_TSC_TIMING_LFENCE(touch);
+		*ptr = 1;
+		END_TSC_TIMING_LFENCE(touch);
+		add_alloc_timing(touch_end - touch_start);
+	}
+	end_step(st, &steps[KA_COST_OKA_TOUCH], failed);
+	oka_destroy(touch_oka);
+}
+
+static double series_p50_ns(const struct ka_cost_series *s)
+{
+	return (double)hdr_value_at_percentile(&s->hist, 50.0) * 1e9 /
+	       get_tsc_freq();
+}
+
+// Medians rather than means, so a stray interrupt in one step doesn't show up
+// as a cost of the next one
+static void log_difference(const char *component,
+			   const struct ka_cost_series *with,
+			   const struct ka_cost_series *without)
+{
+	if (!with->ran || !with->has_hist ||
+	    (without && (!without->ran || !without->has_hist)))
+		return;
+	double ns = series_p50_ns(with);
+	if (without)
+		ns -= series_p50_ns(without);
+	LmLogInfoR("\t%-28s%10.1f\n", component, ns);
+}
+
+static void log_summary(struct ka_cost_state *st)
+{
+	struct ka_cost_series *steps = st->steps;
+	if (steps[KA_COST_ALLOC].ran) {
+		LmLogInfoR("\nka_alloc by component, p50 in ns:\n");
+		log_difference("ioctl entry and exit", &steps[KA_COST_NOP],
+			       NULL);
+		log_difference("copy in and out", &steps[KA_COST_ECHO],
+			       &steps[KA_COST_NOP]);
+		log_difference("karenas[] lookup", &steps[KA_COST_POS],
+			       &steps[KA_COST_ECHO]);
+		log_difference("bump", &steps[KA_COST_ALLOC],
+			       &steps[KA_COST_POS]);
+		log_difference("ka_alloc", &steps[KA_COST_ALLOC], NULL);
+		log_difference("first touch fault", &steps[KA_COST_TOUCH],
+			       NULL);
+	}
+
+	if (st->stages[0].ran) {
+		LmLogInfoR("\nka_alloc by the module's stamps, p50 in ns:\n");
+		for (int s = 0; s < KA_STAGE_COUNT; ++s)
+			log_difference(ka_cost_stage_string(
+					       (enum ka_cost_stage)s),
+				       &st->stages[s], NULL);
+	}
+
+	if (steps[KA_COST_OKA_ALLOC].ran) {
+		LmLogInfoR("\nThe old module, p50 in ns:\n");
+		log_difference("oka_alloc", &steps[KA_COST_OKA_ALLOC], NULL);
+		log_difference("first touch fault", &steps[KA_COST_OKA_TOUCH],
+			       NULL);
+		log_difference("ka_alloc - oka_alloc", &steps[KA_COST_ALLOC],
+			       &steps[KA_COST_OKA_ALLOC]);
+	}
+}
+
+void ka_cost_test(struct ka_cost_params *params, LmString log_filename,
+		  const char *log_directory, int run_nr)
+{
+	FILE *log_file = lm_open_file_by_name(log_filename, "w");
+	LmSetLogFileLocal(log_file);
+	LmLogInfoR("karena cost breakdown: %lu iterations per step, %zd byte "
+		   "allocations%s%s\n",
+		   params->iterations, params->alloc_sz,
+		   params->stamps ? ", stamped" : "",
+		   params->oka ? ", compared with oka_alloc" : "");
+	LmLogInfoR("TSC freq: %.0f\n", get_tsc_freq());
+	LmLogInfoR("Timer overhead subtracted from the steps: %lu TSC\n\n",
+		   get_alloc_timer_overhead());
+
+	struct ka_cost_state st = { .params = params,
+				    .log_directory = log_directory,
+				    .run_nr = run_nr };
+	uint64_t n = params->iterations;
+	UArena *ua = ua_create((KA_COST_STEP_COUNT + KA_STAGE_COUNT) *
+				       (n * sizeof(uint64_t) +
+					hdr_mem_size(3) + get_page_size()),
+			       UA_CONTIGUOUS, UA_MMAPD);
+	for (int s = 0; s < KA_COST_STEP_COUNT; ++s)
+		init_series(&st.steps[s],
+			    s >= KA_COST_OKA_ALLOC ? "oka_alloc" : "ka_alloc",
+			    ka_cost_step_string((enum ka_cost_step)s), n, ua);
+	for (int s = 0; s < KA_STAGE_COUNT; ++s)
+		init_series(&st.stages[s], "ka_alloc",
+			    ka_cost_stage_string((enum ka_cost_stage)s), n, ua);
+
+	run_ka_steps(&st);
+	if (params->oka)
+		run_oka_steps(&st);
+	log_summary(&st);
+
+	ua_destroy(&ua);
+	LmRemoveLogFileLocal();
+	lm_close_file(log_file);
+}
@@ -0,0 +1,41 @@
+#ifndef KA_COST_TEST_H
+#define KA_COST_TEST_H
+
+#include <src/lm.h>
+
+// What's timed, each adding one part of ka_alloc to the one before it
+enum ka_cost_step {
+	KA_COST_NOP, // KARENA_NOP, the ioctl's entry and exit
+	KA_COST_ECHO, // KARENA_ECHO, plus copying struct ka_data in and out
+	KA_COST_POS, // ka_pos, plus finding the arena in karenas[]
+	KA_COST_ALLOC, // ka_alloc, plus the bump
+	KA_COST_TOUCH, // The first write to a page the arena handed out
+	KA_COST_OKA_ALLOC, // The old module's allocation, for comparison
+	KA_COST_OKA_TOUCH,
+	KA_COST_STEP_COUNT
+};
+
+// ka_alloc split up by the module's own TSC stamps, see enum ka_stamp
+enum ka_cost_stage {
+	KA_STAGE_ENTRY, // From user space into the handler
+	KA_STAGE_COPY_IN,
+	KA_STAGE_LOOKUP,
+	KA_STAGE_BUMP,
+	KA_STAGE_EXIT, // copy_to_user and back to user space
+	KA_STAGE_COUNT
+};
+
+struct ka_cost_params {
+	uint64_t iterations; // Per step
+	size_t alloc_sz;
+	bool stamps; // Needs a module with KARENA_ALLOC_STAMPED
+	bool oka;
+};
+
+const char *ka_cost_step_string(enum ka_cost_step step);
+const char *ka_cost_stage_string(enum ka_cost_stage stage);
+
+void ka_cost_test(struct ka_cost_params *params, LmString log_filename,
+		  const char *log_directory, int run_nr);
+
+#endif
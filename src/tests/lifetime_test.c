@@ -0,0 +1,541 @@
+#include <src/lm.h>
+LM_LOG_REGISTER(lifetime_test);
+
+#include <src/allocators/allocator_wrappers.h>
+#include <src/metrics/timing.h>
+#include <src/metrics/mem_footprint.h>
+#include <src/utils/random.h>
+#include <src/utils/system_info.h>
+
+#include "lifetime_test.h"
+
+#include <malloc.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+
+// One point of the fragmentation time series
+struct lifetime_sample {
+	uint64_t allocs;
+	uint64_t live;
+	uint64_t footprint;
+	uint64_t rss;
+};
+
+// NOTE: (isa): The arenas can't free single objects, so a free only updates
+// the live bytes, and the arena is reset once nothing in it is live, which is
+// how they would be used with these lifetimes. The workloads that never get
+// there are exactly the ones arenas are bad at, and they run until the arena
+// is exhausted.
+struct lifetime_state {
+	enum lifetime_backend backend;
+	struct lifetime_params *params;
+	UArena *ua;
+	KArena *ka;
+	struct rng rng;
+
+	void **ptrs;
+	uint64_t *sizes;
+	uint64_t live_count;
+	uint64_t live_bytes;
+
+	uint64_t allocs;
+	uint64_t frees;
+	uint64_t resets;
+	bool exhausted;
+
+	struct lifetime_sample *samples;
+	uint64_t sample_count;
+	uint64_t sample_cap;
+	uint64_t peak_footprint;
+	uint64_t live_at_peak;
+	uint64_t peak_rss;
+};
+
+const char *lifetime_workload_string(enum lifetime_workload workload)
+{
+	switch (workload) {
+	case LIFETIME_QUEUE:
+		return "queue";
+	case LIFETIME_REQUESTS:
+		return "requests";
+	case LIFETIME_CACHE:
+		return "cache";
+	case LIFETIME_SAWTOOTH:
+		return "sawtooth";
+	default:
+		return "unknown";
+	}
+}
+
+enum lifetime_workload lifetime_workload_from_string(const char *string)
+{
+	for (int i = 0; i < LIFETIME_WORKLOAD_COUNT; ++i) {
+		if (strcmp(string, lifetime_workload_string(
+					   (enum lifetime_workload)i)) == 0)
+			return (enum lifetime_workload)i;
+	}
+
+	return LIFETIME_WORKLOAD_COUNT;
+}
+
+const char *lifetime_backend_string(enum lifetime_backend backend)
+{
+	switch (backend) {
+	case LIFETIME_MALLOC:
+		return "malloc";
+	case LIFETIME_UA:
+		return "ua";
+	case LIFETIME_KA:
+		return "ka";
+	default:
+		return "unknown";
+	}
+}
+
+enum lifetime_backend lifetime_backend_from_string(const char *string)
+{
+	for (int i = 0; i < LIFETIME_BACKEND_COUNT; ++i) {
+		if (strcmp(string, lifetime_backend_string(
+					   (enum lifetime_backend)i)) == 0)
+			return (enum lifetime_backend)i;
+	}
+
+	return LIFETIME_BACKEND_COUNT;
+}
+
+static uint64_t lifetime_footprint(struct lifetime_state *st)
+{
+	switch (st->backend) {
+	case LIFETIME_MALLOC: {
+		// What the heap holds from the system, as in the replay test
+		struct mallinfo2 mi = mallinfo2();
+		return mi.arena + mi.hblkhd;
+	}
+	case LIFETIME_UA:
+		return ua_pos(st->ua);
+	case LIFETIME_KA:
+		return ka_pos(st->ka);
+	default:
+		return 0;
+	}
+}
+
+static void lifetime_sample(struct lifetime_state *st)
+{
+	uint64_t footprint = lifetime_footprint(st);
+	uint64_t rss = mem_current_rss();
+	if (footprint > st->peak_footprint) {
+		st->peak_footprint = footprint;
+		st->live_at_peak = st->live_bytes;
+	}
+	st->peak_rss = LmMax(st->peak_rss, rss);
+
+	if (st->sample_count < st->sample_cap)
+		st->samples[st->sample_count++] = (struct lifetime_sample){
+			st->allocs, st->live_bytes, footprint, rss
+		};
+}
+
+static size_t lifetime_size(struct lifetime_state *st)
+{
+	struct lifetime_params *params = st->params;
+	return params->min_size +
+	       (size_t)rng_below(&st->rng,
+				 params->max_size - params->min_size + 1);
+}
+
+static bool lifetime_done(struct lifetime_state *st)
+{
+	return st->exhausted || st->allocs >= st->params->allocations;
+}
+
+static void lifetime_reset(struct lifetime_state *st)
+{
+	if (st->backend == LIFETIME_UA)
+		ua_free(st->ua);
+	else if (st->backend == LIFETIME_KA)
+		ka_free(st->ka);
+	st->resets += 1;
+}
+
+// Allocates into slot, which must be empty. Returns false once the backend is
+// out of memory
+static bool lifetime_alloc(struct lifetime_state *st, uint64_t slot)
+{
+	size_t size = lifetime_size(st);
+	void *ptr = NULL;
+	START_TSC_TIMING_LFENCE(op);
+	switch (st->backend) {
+	case LIFETIME_MALLOC:
+		ptr = malloc(size);
+		break;
+	case LIFETIME_UA:
+		ptr = ua_alloc(st->ua, size);
+		break;
+	case LIFETIME_KA:
+		ptr = ka_alloc(st->ka, size);
+		break;
+	default:
+		break;
+	}
+	END_TSC_TIMING_LFENCE(op);
+
+	if (!ptr) {
+		st->exhausted = true;
+		return false;
+	}
+
+	add_alloc_timing(op_end - op_start);
+	// Written like a real object would be, so the RSS follows the live data
+	memset(ptr, 1, size);
+
+	st->ptrs[slot] = ptr;
+	st->sizes[slot] = size;
+	st->live_count += 1;
+	st->live_bytes += size;
+	st->allocs += 1;
+	if (st->allocs % st->params->sample_interval == 0)
+		lifetime_sample(st);
+	return true;
+}
+
+static void lifetime_free(struct lifetime_state *st, uint64_t slot)
+{
+	void *ptr = st->ptrs[slot];
+	if (!ptr)
+		return;
+
+	bool reset = (st->backend != LIFETIME_MALLOC) && st->live_count == 1;
+	START_TSC_TIMING_LFENCE(op);
+	if (st->backend == LIFETIME_MALLOC)
+		free(ptr);
+	else if (reset)
+		lifetime_reset(st);
+	END_TSC_TIMING_LFENCE(op);
+	add_alloc_timing(op_end - op_start);
+
+	st->ptrs[slot] = NULL;
+	st->live_count -= 1;
+	st->live_bytes -= st->sizes[slot];
+	st->frees += 1;
+}
+
+// Ends the lifetime of everything in slots [0, count), e.g. at the end of a
+// request or a phase, or when a workload is done
+static void lifetime_release(struct lifetime_state *st, uint64_t count)
+{
+	if (st->backend == LIFETIME_MALLOC) {
+		for (uint64_t i = 0; i < count; ++i)
+			lifetime_free(st, i);
+		return;
+	}
+
+	START_TSC_TIMING_LFENCE(op);
+	lifetime_reset(st);
+	END_TSC_TIMING_LFENCE(op);
+	add_alloc_timing(op_end - op_start);
+
+	for (uint64_t i = 0; i < count; ++i) {
+		if (st->ptrs[i]) {
+			st->ptrs[i] = NULL;
+			st->frees += 1;
+		}
+	}
+	st->live_count = 0;
+	st->live_bytes = 0;
+}
+
+// The consumer keeps up on average, so the depth is a random walk between
+// empty and live_objects
+static void queue_workload(struct lifetime_state *st)
+{
+	uint64_t cap = st->params->live_objects;
+	uint64_t head = 0;
+	uint64_t count = 0;
+	while (!lifetime_done(st)) {
+		bool produce = count == 0 ||
+			       (count < cap && rng_below(&st->rng, 2) == 0);
+		if (produce) {
+			if (!lifetime_alloc(st, (head + count) % cap))
+				break;
+			count += 1;
+		} else {
+			lifetime_free(st, head);
+			head = (head + 1) % cap;
+			count -= 1;
+		}
+	}
+}
+
+// Each request allocates a burst of up to live_objects objects, frees about a
+// quarter of them at random while it runs, and drops the rest when it's done
+static void requests_workload(struct lifetime_state *st)
+{
+	uint64_t max_burst = st->params->live_objects;
+	while (!lifetime_done(st)) {
+		uint64_t burst = 1 + rng_below(&st->rng, max_burst);
+		uint64_t i = 0;
+		for (; i < burst && !lifetime_done(st); ++i) {
+			if (!lifetime_alloc(st, i))
+				break;
+			if (rng_below(&st->rng, 4) == 0)
+				lifetime_free(st, rng_below(&st->rng, i + 1));
+		}
+		lifetime_release(st, burst);
+	}
+}
+
+// Fills live_objects entries and then replaces a random one per allocation
+static void cache_workload(struct lifetime_state *st)
+{
+	uint64_t entries = st->params->live_objects;
+	for (uint64_t i = 0; i < entries && !lifetime_done(st); ++i)
+		if (!lifetime_alloc(st, i))
+			break;
+
+	while (!lifetime_done(st)) {
+		uint64_t slot = rng_below(&st->rng, entries);
+		lifetime_free(st, slot);
+		if (!lifetime_alloc(st, slot))
+			break;
+	}
+}
+
+static void sawtooth_workload(struct lifetime_state *st)
+{
+	uint64_t phase = st->params->live_objects;
+	while (!lifetime_done(st)) {
+		for (uint64_t i = 0; i < phase && !lifetime_done(st); ++i)
+			if (!lifetime_alloc(st, i))
+				break;
+		lifetime_release(st, phase);
+	}
+}
+
+static bool create_lifetime_backend(struct lifetime_state *st)
+{
+	if (st->backend == LIFETIME_UA)
+		st->ua = ua_create(st->params->arena_sz, UA_CONTIGUOUS,
+				   UA_MMAPD);
+	else if (st->backend == LIFETIME_KA)
+		st->ka = ka_create(st->params->arena_sz, 0);
+	return st->backend == LIFETIME_MALLOC || st->ua || st->ka;
+}
+
+static void destroy_lifetime_backend(struct lifetime_state *st)
+{
+	if (st->ua)
+		ua_destroy(&st->ua);
+	if (st->ka)
+		ka_destroy(st->ka);
+}
+
+static double fragmentation(uint64_t live, uint64_t footprint)
+{
+	return footprint ? 1.0 - (double)live / (double)footprint : 0.0;
+}
+
+static void log_lifetime_results(struct lifetime_state *st,
+				 enum lifetime_workload workload,
+				 struct mem_footprint *mem)
+{
+	struct alloc_tstats *tstats = get_alloc_tstats();
+	double tsc_freq = get_tsc_freq();
+	double seconds = (double)tstats->total_tsc / tsc_freq;
+
+	double frag_sum = 0.0;
+	for (uint64_t i = 0; i < st->sample_count; ++i)
+		frag_sum += fragmentation(st->samples[i].live,
+					  st->samples[i].footprint);
+	double frag_mean =
+		st->sample_count ? frag_sum / (double)st->sample_count : 0.0;
+
+	LmLogInfoR(
+		"\n%s, %s:\n"
+		"\tops:           %lu allocations, %lu frees, %lu resets%s\n"
+		"\ttime:          %.3f ms (%.1f ns/op, %.2f Mops/s)\n"
+		"\tpeak rss:      %.1f KiB\n"
+		"\tpeak memory:   %lu B, %lu B live\n"
+		"\tfragmentation: %.1f%% at peak memory, %.1f%% mean over %lu samples\n",
+		lifetime_workload_string(workload),
+		lifetime_backend_string(st->backend), st->allocs, st->frees,
+		st->resets, st->exhausted ? ", ran out of memory" : "",
+		seconds * 1e3, seconds * 1e9 / (double)LmMax(tstats->iter, 1),
+		seconds > 0 ? (double)tstats->iter / seconds / 1e6 : 0.0,
+		(double)st->peak_rss / 1024.0, st->peak_footprint,
+		st->live_at_peak,
+		fragmentation(st->live_at_peak, st->peak_footprint) * 100,
+		frag_mean * 100, st->sample_count);
+	mem_footprint_log(mem, LM_LOG_MODULE_LOCAL);
+}
+
+// Layout: the number of samples, and then an { allocations, live, footprint,
+// rss } row for each of them
+static int write_lifetime_samples(const char *filename,
+				  struct lifetime_state *st)
+{
+	FILE *file = lm_open_file_by_name(filename, "wb");
+	if (!file)
+		return -1;
+
+	int res = lm_write_bytes_to_file((uint8_t *)&st->sample_count,
+					 sizeof(st->sample_count), file);
+	if (res == 0 && st->sample_count > 0)
+		res = lm_write_bytes_to_file(
+			(uint8_t *)st->samples,
+			st->sample_count * sizeof(struct lifetime_sample),
+			file);
+	lm_close_file(file);
+	return res;
+}
+
+static void write_lifetime_results(struct lifetime_state *st,
+				   enum lifetime_workload workload,
+				   struct mem_footprint *mem,
+				   const char *log_directory, int run_nr,
+				   UArena *ua)
+{
+	UAScratch uas = ua_scratch_begin(ua);
+	LmString filename = lm_string_make(log_directory, uas.ua);
+	lm_string_append_fmt(filename, "%d-%s-%s.bin", run_nr,
+			     lifetime_workload_string(workload),
+			     lifetime_backend_string(st->backend));
+	struct result_info info = { lifetime_backend_string(st->backend),
+				    lifetime_workload_string(workload), 1 };
+	if (write_alloc_timing_data_to_file(filename, &info) != 0 ||
+	    mem_footprint_append_to_file(filename, mem) != 0)
+		LmLogError("Failed to write data to file %s", filename);
+
+	LmString samples_filename = lm_string_make(log_directory, uas.ua);
+	lm_string_append_fmt(samples_filename, "%d-%s-%s-frag.bin", run_nr,
+			     lifetime_workload_string(workload),
+			     lifetime_backend_string(st->backend));
+	if (write_lifetime_samples(samples_filename, st) != 0)
+		LmLogError("Failed to write data to file %s",
+			   samples_filename);
+
+	ua_scratch_release(uas);
+}
+
+static void run_lifetime(struct lifetime_params *params,
+			 enum lifetime_workload workload,
+			 enum lifetime_backend backend, LmString log_filename,
+			 const char *log_directory, int run_nr)
+{
+	FILE *log_file = lm_open_file_by_name(log_filename, "a");
+	LmSetLogFileLocal(log_file);
+
+	struct lifetime_state st = { 0 };
+	st.backend = backend;
+	st.params = params;
+	rng_seed(&st.rng, params->seed);
+	if (!create_lifetime_backend(&st)) {
+		LmLogWarning("Unable to create the %s arena, skipping it",
+			     lifetime_backend_string(backend));
+		goto out;
+	}
+
+	// Every allocation can be followed by at most one timed free or reset
+	uint64_t timing_cap = 2 * params->allocations;
+	st.sample_cap = params->allocations / params->sample_interval + 1;
+	size_t bookkeeping_sz =
+		params->live_objects * (sizeof(void *) + sizeof(uint64_t)) +
+		timing_cap * sizeof(uint64_t) +
+		st.sample_cap * sizeof(struct lifetime_sample) +
+		LmMebiByte(1);
+	UArena *ua = ua_create(bookkeeping_sz, UA_CONTIGUOUS, UA_MMAPD);
+	st.ptrs = UaPushArrayZero(ua, void *, params->live_objects);
+	st.sizes = UaPushArrayZero(ua, uint64_t, params->live_objects);
+	st.samples = UaPushArray(ua, struct lifetime_sample, st.sample_cap);
+	uint64_t *timing_arr = UaPushArray(ua, uint64_t, timing_cap);
+	init_alloc_tcoll(timing_cap, timing_arr);
+	*get_alloc_tstats() = (struct alloc_tstats){ 0 };
+
+	struct mem_footprint mem = { 0 };
+	mem_snapshot_take(&mem.begin, lifetime_footprint(&st));
+	lifetime_sample(&st);
+
+	switch (workload) {
+	case LIFETIME_QUEUE:
+		queue_workload(&st);
+		break;
+	case LIFETIME_REQUESTS:
+		requests_workload(&st);
+		break;
+	case LIFETIME_CACHE:
+		cache_workload(&st);
+		break;
+	case LIFETIME_SAWTOOTH:
+		sawtooth_workload(&st);
+		break;
+	default:
+		break;
+	}
+
+	// NOTE: (isa): The end snapshot is taken while whatever the workload left
+	// live is still live, so the overhead per allocation is per live object.
+	// For the arenas that includes the dead objects they can't reuse
+	mem_snapshot_take(&mem.end, lifetime_footprint(&st));
+	mem.allocs = st.live_count;
+	mem.requested = st.live_bytes;
+	lifetime_release(&st, params->live_objects);
+
+	log_lifetime_results(&st, workload, &mem);
+	write_lifetime_results(&st, workload, &mem, log_directory, run_nr, ua);
+
+	init_alloc_tcoll(0, NULL);
+	ua_destroy(&ua);
+	destroy_lifetime_backend(&st);
+out:
+	LmRemoveLogFileLocal();
+	lm_close_file(log_file);
+}
+
+void lifetime_test(struct lifetime_params *params, bool running_in_debugger,
+		   LmString log_filename, const char *log_directory,
+		   int run_nr)
+{
+	FILE *log_file = lm_open_file_by_name(log_filename, "w");
+	LmSetLogFileLocal(log_file);
+	LmLogInfoR(
+		"Lifetime workloads: %lu allocations of %zd to %zd bytes, %lu live objects, seed %lu\n",
+		params->allocations, params->min_size, params->max_size,
+		params->live_objects, params->seed);
+	LmRemoveLogFileLocal();
+	lm_close_file(log_file);
+
+	// NOTE: (isa): Each run gets its own process unless running in a
+	// debugger, so the RSS and the malloc heap start out the same for every
+	// allocator
+	for (int w = 0; w < LIFETIME_WORKLOAD_COUNT; ++w) {
+		if (!params->workloads[w])
+			continue;
+		for (int b = 0; b < LIFETIME_BACKEND_COUNT; ++b) {
+			if (!params->backends[b])
+				continue;
+
+			if (running_in_debugger) {
+				run_lifetime(params, (enum lifetime_workload)w,
+					     (enum lifetime_backend)b,
+					     log_filename, log_directory,
+					     run_nr);
+				continue;
+			}
+
+			pid_t pid = fork();
+			if (pid == -1) {
+				LmLogError("Fork failed: %s", strerror(errno));
+			} else if (pid == 0) {
+				run_lifetime(params, (enum lifetime_workload)w,
+					     (enum lifetime_backend)b,
+					     log_filename, log_directory,
+					     run_nr);
+				exit(EXIT_SUCCESS);
+			} else {
+				int status;
+				waitpid(pid, &status, 0);
+			}
+		}
+	}
+}
@@ -0,0 +1,42 @@
+#ifndef LIFETIME_TEST_H
+#define LIFETIME_TEST_H
+
+#include <src/lm.h>
+
+enum lifetime_workload {
+	LIFETIME_QUEUE, // Producer/consumer FIFO whose depth drifts randomly
+	LIFETIME_REQUESTS, // Request scoped bursts with random frees
+	LIFETIME_CACHE, // Long lived cache where random entries are replaced
+	LIFETIME_SAWTOOTH, // Phases that build up and end with a reset
+	LIFETIME_WORKLOAD_COUNT
+};
+
+enum lifetime_backend {
+	LIFETIME_MALLOC,
+	LIFETIME_UA,
+	LIFETIME_KA,
+	LIFETIME_BACKEND_COUNT
+};
+
+struct lifetime_params {
+	uint64_t allocations; // Per workload
+	uint64_t live_objects; // Queue depth, burst, cache or phase size
+	size_t min_size;
+	size_t max_size;
+	size_t arena_sz;
+	uint64_t sample_interval; // Allocations between fragmentation samples
+	uint64_t seed;
+	bool workloads[LIFETIME_WORKLOAD_COUNT];
+	bool backends[LIFETIME_BACKEND_COUNT];
+};
+
+const char *lifetime_workload_string(enum lifetime_workload workload);
+enum lifetime_workload lifetime_workload_from_string(const char *string);
+const char *lifetime_backend_string(enum lifetime_backend backend);
+enum lifetime_backend lifetime_backend_from_string(const char *string);
+
+void lifetime_test(struct lifetime_params *params, bool running_in_debugger,
+		   LmString log_filename, const char *log_directory,
+		   int run_nr);
+
+#endif
@@ -0,0 +1,615 @@
+#include <src/lm.h>
+LM_LOG_REGISTER(locality_test);
+
+#include <src/allocators/allocator_wrappers.h>
+#include <src/metrics/timing.h>
+#include <src/metrics/hdr_histogram.h>
+#include <src/metrics/perf_counters.h>
+#include <src/metrics/result_file.h>
+#include <src/utils/random.h>
+#include <src/utils/system_info.h>
+
+#include "locality_test.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+
+extern UArena *main_ua;
+
+// NOTE: (isa): The list and the hash map chains share a node layout. The
+// payload stands in for the rest of the object, e.g. a sensor reading, and is
+// written when the node is built so it's resident like a real object would be
+struct chain_node {
+	struct chain_node *next;
+	uint64_t key;
+	uint8_t payload[];
+};
+
+struct tree_node {
+	struct tree_node *left;
+	struct tree_node *right;
+	uint64_t key;
+	uint8_t payload[];
+};
+
+#define AGING_MIN_SIZE 16
+#define AGING_MAX_SIZE 512
+
+struct locality_state {
+	struct locality_params *params;
+	enum locality_structure structure;
+	const char *name; // The backend's or the plugin's
+	alloc_fn_t alloc_fn;
+	UArena *ua;
+	KArena *ka;
+	struct rng rng;
+
+	// Bookkeeping, kept outside the allocator under test
+	uint64_t *keys; // In insertion order, so lookups hit existing nodes
+	void **node_ptrs;
+	void **stack; // For the in-order tree walk
+	void **aging;
+	uint64_t aging_count;
+
+	struct chain_node *list_head;
+	struct tree_node *tree_root;
+	struct chain_node **buckets;
+	uint64_t bucket_mask;
+	uint64_t built;
+	bool exhausted;
+
+	// Summed over everything that's read, so the walks can't be optimized
+	// out
+	uint64_t checksum;
+
+	uint64_t *timing_arr;
+	uint64_t timing_cap;
+	struct hdr_histogram hist;
+	bool has_hist;
+	struct perf_group *group; // NULL when counters are disabled
+	struct perf_group group_storage;
+	struct perf_sample sample;
+};
+
+const char *locality_structure_string(enum locality_structure structure)
+{
+	switch (structure) {
+	case LOCALITY_LIST:
+		return "list";
+	case LOCALITY_TREE:
+		return "tree";
+	case LOCALITY_HASH:
+		return "hash";
+	default:
+		return "unknown";
+	}
+}
+
+enum locality_structure locality_structure_from_string(const char *string)
+{
+	for (int i = 0; i < LOCALITY_STRUCTURE_COUNT; ++i) {
+		if (strcmp(string, locality_structure_string(
+					   (enum locality_structure)i)) == 0)
+			return (enum locality_structure)i;
+	}
+
+	return LOCALITY_STRUCTURE_COUNT;
+}
+
+const char *locality_backend_string(enum locality_backend backend)
+{
+	switch (backend) {
+	case LOCALITY_MALLOC:
+		return "malloc";
+	case LOCALITY_UA:
+		return "ua";
+	case LOCALITY_KA:
+		return "ka";
+	default:
+		return "unknown";
+	}
+}
+
+enum locality_backend locality_backend_from_string(const char *string)
+{
+	for (int i = 0; i < LOCALITY_BACKEND_COUNT; ++i) {
+		if (strcmp(string, locality_backend_string(
+					   (enum locality_backend)i)) == 0)
+			return (enum locality_backend)i;
+	}
+
+	return LOCALITY_BACKEND_COUNT;
+}
+
+const char *locality_phase_string(enum locality_phase phase)
+{
+	switch (phase) {
+	case LOCALITY_BUILD:
+		return "build";
+	case LOCALITY_TRAVERSE:
+		return "traverse";
+	case LOCALITY_SEARCH:
+		return "search";
+	case LOCALITY_UPDATE:
+		return "update";
+	default:
+		return "unknown";
+	}
+}
+
+static uint64_t hash_key(uint64_t key)
+{
+	key ^= key >> 33;
+	key *= 0xff51afd7ed558ccdULL;
+	key ^= key >> 33;
+	return key;
+}
+
+static bool is_heap(struct locality_state *st)
+{
+	return !st->ua && !st->ka;
+}
+
+// Goes through the allocator's timed wrapper, so the build phase's samples
+// are the allocations and nothing else
+static void *locality_alloc(struct locality_state *st, size_t size)
+{
+	void *ptr = st->alloc_fn(st->ua, st->ka, size);
+	if (!ptr)
+		st->exhausted = true;
+	return ptr;
+}
+
+static void age_heap(struct locality_state *st)
+{
+	uint64_t count = st->params->nodes;
+	for (uint64_t i = 0; i < count; ++i) {
+		size_t size = AGING_MIN_SIZE +
+			      (size_t)rng_below(&st->rng, AGING_MAX_SIZE -
+								  AGING_MIN_SIZE + 1);
+		if (!(st->aging[i] = locality_alloc(st, size)))
+			return;
+		memset(st->aging[i], 1, size);
+		st->aging_count = i + 1;
+	}
+
+	// The arenas can't free single blocks, so theirs stay where they are.
+	// The coin is still flipped for them, so every backend ends up with the
+	// same keys
+	for (uint64_t i = 0; i < st->aging_count; ++i) {
+		if (rng_below(&st->rng, 2) == 0 && is_heap(st)) {
+			alloc_fn_free(st->alloc_fn, st->aging[i]);
+			st->aging[i] = NULL;
+		}
+	}
+}
+
+static void *new_node(struct locality_state *st, size_t header_sz,
+		      uint64_t key)
+{
+	void *node = locality_alloc(st, header_sz + st->params->payload_sz);
+	if (!node)
+		return NULL;
+	memset(node, 0, header_sz);
+	memset((uint8_t *)node + header_sz, (uint8_t)key,
+	       st->params->payload_sz);
+	st->keys[st->built] = key;
+	st->node_ptrs[st->built] = node;
+	return node;
+}
+
+static void build_list(struct locality_state *st)
+{
+	struct chain_node **tail = &st->list_head;
+	for (; st->built < st->params->nodes; ++st->built) {
+		struct chain_node *node = new_node(st, sizeof(*node),
+						   rng_next(&st->rng));
+		if (!node)
+			return;
+		node->key = st->keys[st->built];
+		*tail = node;
+		tail = &node->next;
+	}
+}
+
+static void build_tree(struct locality_state *st)
+{
+	for (; st->built < st->params->nodes; ++st->built) {
+		struct tree_node *node = new_node(st, sizeof(*node),
+						  rng_next(&st->rng));
+		if (!node)
+			return;
+		node->key = st->keys[st->built];
+
+		struct tree_node **link = &st->tree_root;
+		while (*link)
+			link = (node->key < (*link)->key) ? &(*link)->left :
+							    &(*link)->right;
+		*link = node;
+	}
+}
+
+static void build_hash(struct locality_state *st)
+{
+	uint64_t bucket_count = 16;
+	while (bucket_count * 2 < st->params->nodes)
+		bucket_count <<= 1;
+	st->buckets = locality_alloc(st, bucket_count * sizeof(*st->buckets));
+	if (!st->buckets)
+		return;
+	memset(st->buckets, 0, bucket_count * sizeof(*st->buckets));
+	st->bucket_mask = bucket_count - 1;
+
+	for (; st->built < st->params->nodes; ++st->built) {
+		struct chain_node *node = new_node(st, sizeof(*node),
+						   rng_next(&st->rng));
+		if (!node)
+			return;
+		node->key = st->keys[st->built];
+
+		struct chain_node **bucket =
+			&st->buckets[hash_key(node->key) & st->bucket_mask];
+		node->next = *bucket;
+		*bucket = node;
+	}
+}
+
+static void traverse(struct locality_state *st)
+{
+	uint64_t sum = 0;
+	switch (st->structure) {
+	case LOCALITY_LIST:
+		for (struct chain_node *n = st->list_head; n; n = n->next)
+			sum += n->key + n->payload[0];
+		break;
+	case LOCALITY_TREE: {
+		uint64_t depth = 0;
+		struct tree_node *n = st->tree_root;
+		while (n || depth > 0) {
+			if (n) {
+				st->stack[depth++] = n;
+				n = n->left;
+				continue;
+			}
+			n = st->stack[--depth];
+			sum += n->key + n->payload[0];
+			n = n->right;
+		}
+		break;
+	}
+	case LOCALITY_HASH:
+		for (uint64_t b = 0; b <= st->bucket_mask; ++b)
+			for (struct chain_node *n = st->buckets[b]; n;
+			     n = n->next)
+				sum += n->key + n->payload[0];
+		break;
+	default:
+		break;
+	}
+	st->checksum += sum;
+}
+
+// Returns the payload of the node with key, or NULL if there is none
+static uint8_t *find(struct locality_state *st, uint64_t key)
+{
+	switch (st->structure) {
+	case LOCALITY_LIST:
+		for (struct chain_node *n = st->list_head; n; n = n->next)
+			if (n->key == key)
+				return n->payload;
+		return NULL;
+	case LOCALITY_TREE:
+		for (struct tree_node *n = st->tree_root; n;
+		     n = (key < n->key) ? n->left : n->right)
+			if (n->key == key)
+				return n->payload;
+		return NULL;
+	case LOCALITY_HASH:
+		for (struct chain_node *n =
+			     st->buckets[hash_key(key) & st->bucket_mask];
+		     n; n = n->next)
+			if (n->key == key)
+				return n->payload;
+		return NULL;
+	default:
+		return NULL;
+	}
+}
+
+static void begin_phase(struct locality_state *st)
+{
+	init_alloc_tcoll(st->timing_cap, st->timing_arr);
+	if (st->has_hist)
+		hdr_reset(&st->hist);
+	init_alloc_hist(st->has_hist ? &st->hist : NULL);
+	*get_alloc_tstats() = (struct alloc_tstats){ 0 };
+	if (st->group)
+		perf_group_start(st->group);
+}
+
+static void end_phase(struct locality_state *st)
+{
+	if (st->group)
+		perf_group_stop(st->group, &st->sample);
+}
+
+static void run_passes(struct locality_state *st)
+{
+	for (uint64_t i = 0; i < st->params->passes; ++i) {
+		START_TSC_TIMING_LFENCE(pass);
+		traverse(st);
+		END_TSC_TIMING_LFENCE(pass);
+		add_alloc_timing_raw(pass_end - pass_start);
+	}
+}
+
+static void run_lookups(struct locality_state *st, bool update)
+{
+	size_t payload_sz = st->params->payload_sz;
+	for (uint64_t i = 0; i < st->params->lookups; ++i) {
+		uint64_t key = st->keys[rng_below(&st->rng, st->built)];
+		START_TSC_TIMING_LFENCE(lookup);
+		uint8_t *payload = find(st, key);
+		if (update && payload)
+			memset(payload, (uint8_t)i, payload_sz);
+		END_TSC_TIMING_LFENCE(lookup);
+		add_alloc_timing(lookup_end - lookup_start);
+		st->checksum += payload ? payload[0] : 0;
+	}
+}
+
+static int append_perf_data(const char *filename, struct perf_sample *sample)
+{
+	struct result_section_writer w;
+	if (result_section_begin(&w, filename, RESULT_SECTION_PERF) != 0)
+		return -1;
+
+	if (perf_write_to_file(w.file, sample, NULL, 0) != 0) {
+		lm_close_file(w.file);
+		return -1;
+	}
+	return result_section_end(&w, 0, 0);
+}
+
+static const char *phase_unit(enum locality_phase phase)
+{
+	switch (phase) {
+	case LOCALITY_BUILD:
+		return "allocation";
+	case LOCALITY_TRAVERSE:
+		return "pass";
+	default:
+		return "lookup";
+	}
+}
+
+// ops is what the counters are divided by: nodes for the build, node visits
+// for the traversal and lookups for the search and update
+static void finish_phase(struct locality_state *st, enum locality_phase phase,
+			 uint64_t ops, const char *log_directory, int run_nr)
+{
+	struct alloc_tstats *tstats = get_alloc_tstats();
+	double ns = (double)tstats->total_tsc / get_tsc_freq() * 1e9;
+	LmLogInfoR("    %s: %.1f ns per %s", locality_phase_string(phase),
+		   ns / (double)LmMax(tstats->iter, 1), phase_unit(phase));
+	if (phase == LOCALITY_TRAVERSE)
+		LmLogInfoR(", %.2f ns per node", ns / (double)LmMax(ops, 1));
+	LmLogInfoR("\n");
+	if (st->has_hist)
+		hdr_log_percentiles(&st->hist, "\t", LM_LOG_MODULE_LOCAL);
+	if (st->group)
+		perf_log_sample(&st->sample, ops, LM_LOG_MODULE_LOCAL);
+
+	UAScratch uas = ua_scratch_begin(main_ua);
+	char size_class[64];
+	snprintf(size_class, sizeof(size_class), "%s-%s",
+		 locality_structure_string(st->structure),
+		 locality_phase_string(phase));
+	LmString filename = lm_string_make(log_directory, uas.ua);
+	lm_string_append_fmt(filename, "%d-%s-%s.bin", run_nr, size_class,
+			     st->name);
+	struct result_info info = { st->name, size_class, 1 };
+	if (write_alloc_timing_data_to_file(filename, &info) != 0 ||
+	    (st->has_hist && hdr_append_to_file(&st->hist, filename) != 0))
+		LmLogError("Failed to write data to file %s", filename);
+	else if (st->group && st->sample.available &&
+		 append_perf_data(filename, &st->sample) != 0)
+		LmLogError("Failed to write performance counters to %s",
+			   filename);
+	ua_scratch_release(uas);
+}
+
+static bool create_locality_backend(struct locality_state *st,
+				    enum locality_backend backend)
+{
+	size_t arena_sz = st->params->arena_sz;
+	if (backend == LOCALITY_UA) {
+		st->ua = ua_create(arena_sz, UA_CONTIGUOUS, UA_MMAPD);
+		st->alloc_fn = ua_alloc_timed;
+		return st->ua != NULL;
+	}
+	if (backend == LOCALITY_KA) {
+		st->ka = ka_create(arena_sz, 0);
+		st->alloc_fn = ka_alloc_timed;
+		return st->ka != NULL;
+	}
+	return true;
+}
+
+static void destroy_locality_backend(struct locality_state *st)
+{
+	if (is_heap(st)) {
+		for (uint64_t i = 0; i < st->built; ++i)
+			alloc_fn_free(st->alloc_fn, st->node_ptrs[i]);
+		for (uint64_t i = 0; i < st->aging_count; ++i)
+			if (st->aging[i])
+				alloc_fn_free(st->alloc_fn, st->aging[i]);
+		if (st->buckets)
+			alloc_fn_free(st->alloc_fn, st->buckets);
+	}
+	if (st->ua)
+		ua_destroy(&st->ua);
+	if (st->ka)
+		ka_destroy(st->ka);
+}
+
+// plugin is NULL unless backend is LOCALITY_MALLOC and a plugin replaces glibc
+static void run_locality(struct locality_params *params,
+			 enum locality_structure structure,
+			 enum locality_backend backend,
+			 const struct alloc_plugin *plugin,
+			 LmString log_filename, const char *log_directory,
+			 int run_nr)
+{
+	FILE *log_file = lm_open_file_by_name(log_filename, "a");
+	LmSetLogFileLocal(log_file);
+
+	struct locality_state st = { 0 };
+	st.params = params;
+	st.structure = structure;
+	st.name = plugin ? plugin->name : locality_backend_string(backend);
+	st.alloc_fn = plugin ? plugin->alloc_fn : malloc_timed;
+	rng_seed(&st.rng, params->seed);
+	if (!create_locality_backend(&st, backend)) {
+		LmLogWarning("Unable to create the %s arena, skipping it",
+			     st.name);
+		goto out;
+	}
+
+	st.timing_cap = LmMax(LmMax(params->nodes + 1, params->passes),
+			      params->lookups);
+	size_t bookkeeping_sz = params->nodes * 4 * sizeof(uint64_t) +
+				st.timing_cap * sizeof(uint64_t) +
+				hdr_mem_size(3) + LmMebiByte(1);
+	UArena *ua = ua_create(bookkeeping_sz, UA_CONTIGUOUS, UA_MMAPD);
+	st.keys = UaPushArray(ua, uint64_t, params->nodes);
+	st.node_ptrs = UaPushArray(ua, void *, params->nodes);
+	st.stack = UaPushArray(ua, void *, params->nodes);
+	st.aging = UaPushArrayZero(ua, void *, params->nodes);
+	st.timing_arr = UaPushArray(ua, uint64_t, st.timing_cap);
+	memset(st.timing_arr, 0, st.timing_cap * sizeof(uint64_t));
+	st.has_hist = hdr_init(&st.hist, 3, ua) == 0;
+
+	// NOTE: (isa): Opened here rather than by the parent, since they count
+	// the calling thread only and aren't inherited across the fork
+	if (params->perf.enabled &&
+	    perf_group_open(&st.group_storage, false))
+		st.group = &st.group_storage;
+
+	LmLogInfoR("\n%s, %s:\n", locality_structure_string(structure),
+		   st.name);
+	if (params->age_heap) {
+		init_alloc_tcoll(0, NULL);
+		init_alloc_hist(NULL);
+		age_heap(&st);
+	}
+
+	begin_phase(&st);
+	if (structure == LOCALITY_LIST)
+		build_list(&st);
+	else if (structure == LOCALITY_TREE)
+		build_tree(&st);
+	else
+		build_hash(&st);
+	end_phase(&st);
+	if (st.exhausted)
+		LmLogWarning("%s ran out of memory after %lu of %lu nodes",
+			     st.name, st.built, params->nodes);
+	if (st.built == 0)
+		goto done;
+	finish_phase(&st, LOCALITY_BUILD, st.built, log_directory, run_nr);
+
+	begin_phase(&st);
+	run_passes(&st);
+	end_phase(&st);
+	finish_phase(&st, LOCALITY_TRAVERSE, params->passes * st.built,
+		     log_directory, run_nr);
+
+	begin_phase(&st);
+	run_lookups(&st, false);
+	end_phase(&st);
+	finish_phase(&st, LOCALITY_SEARCH, params->lookups, log_directory,
+		     run_nr);
+
+	begin_phase(&st);
+	run_lookups(&st, true);
+	end_phase(&st);
+	finish_phase(&st, LOCALITY_UPDATE, params->lookups, log_directory,
+		     run_nr);
+	LmLogInfoR("    checksum %lu\n", st.checksum);
+
+done:
+	init_alloc_tcoll(0, NULL);
+	init_alloc_hist(NULL);
+	if (st.group)
+		perf_group_close(st.group);
+	destroy_locality_backend(&st);
+	ua_destroy(&ua);
+out:
+	LmRemoveLogFileLocal();
+	lm_close_file(log_file);
+}
+
+// Each run gets its own process unless running in a debugger, so every
+// allocator starts from the same heap
+static void fork_locality(struct locality_params *params,
+			  enum locality_structure structure,
+			  enum locality_backend backend,
+			  const struct alloc_plugin *plugin,
+			  bool running_in_debugger, LmString log_filename,
+			  const char *log_directory, int run_nr)
+{
+	if (running_in_debugger) {
+		run_locality(params, structure, backend, plugin, log_filename,
+			     log_directory, run_nr);
+		return;
+	}
+
+	pid_t pid = fork();
+	if (pid == -1) {
+		LmLogError("Fork failed: %s", strerror(errno));
+	} else if (pid == 0) {
+		run_locality(params, structure, backend, plugin, log_filename,
+			     log_directory, run_nr);
+		exit(EXIT_SUCCESS);
+	} else {
+		int status;
+		waitpid(pid, &status, 0);
+	}
+}
+
+void locality_test(struct locality_params *params, bool running_in_debugger,
+		   LmString log_filename, const char *log_directory,
+		   int run_nr)
+{
+	FILE *log_file = lm_open_file_by_name(log_filename, "w");
+	LmSetLogFileLocal(log_file);
+	LmLogInfoR(
+		"Locality: %lu nodes with %zd byte payloads, %lu passes, %lu lookups, seed %lu%s\n",
+		params->nodes, params->payload_sz, params->passes,
+		params->lookups, params->seed,
+		params->age_heap ? ", aged heap" : "");
+	LmRemoveLogFileLocal();
+	lm_close_file(log_file);
+
+	for (int s = 0; s < LOCALITY_STRUCTURE_COUNT; ++s) {
+		if (!params->structures[s])
+			continue;
+		for (int b = 0; b < LOCALITY_BACKEND_COUNT; ++b)
+			if (params->backends[b])
+				fork_locality(params,
+					      (enum locality_structure)s,
+					      (enum locality_backend)b, NULL,
+					      running_in_debugger, log_filename,
+					      log_directory, run_nr);
+		for (int p = 0; p < alloc_plugin_count(); ++p)
+			if (params->plugins[p])
+				fork_locality(params,
+					      (enum locality_structure)s,
+					      LOCALITY_MALLOC,
+					      alloc_plugin_get(p),
+					      running_in_debugger, log_filename,
+					      log_directory, run_nr);
+	}
+}
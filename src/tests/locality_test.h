@@ -0,0 +1,58 @@
+#ifndef LOCALITY_TEST_H
+#define LOCALITY_TEST_H
+
+#include <src/lm.h>
+#include <src/allocators/allocator_wrappers.h>
+#include <src/metrics/perf_counters.h>
+
+enum locality_structure {
+	LOCALITY_LIST, // Singly linked, built by appending
+	LOCALITY_TREE, // Unbalanced binary search tree of random keys
+	LOCALITY_HASH, // Hash map with chaining, two nodes per bucket on average
+	LOCALITY_STRUCTURE_COUNT
+};
+
+enum locality_backend {
+	LOCALITY_MALLOC,
+	LOCALITY_UA,
+	LOCALITY_KA,
+	LOCALITY_BACKEND_COUNT
+};
+
+// What's timed, each phase gets its own result file
+enum locality_phase {
+	LOCALITY_BUILD, // One sample per node allocation
+	LOCALITY_TRAVERSE, // One sample per pass over every node
+	LOCALITY_SEARCH, // One sample per lookup
+	LOCALITY_UPDATE, // One sample per lookup and payload write
+	LOCALITY_PHASE_COUNT
+};
+
+struct locality_params {
+	uint64_t nodes;
+	size_t payload_sz; // Bytes carried by every node besides its links
+	uint64_t passes;
+	uint64_t lookups; // Per search and update phase
+	size_t arena_sz;
+	uint64_t seed;
+	// Allocates and frees a random half of nodes blocks of random sizes
+	// before building, so malloc hands out chunks scattered over an aged
+	// heap rather than a fresh one
+	bool age_heap;
+	bool structures[LOCALITY_STRUCTURE_COUNT];
+	bool backends[LOCALITY_BACKEND_COUNT];
+	bool plugins[ALLOC_PLUGIN_MAX]; // Run like LOCALITY_MALLOC
+	struct perf_params perf;
+};
+
+const char *locality_structure_string(enum locality_structure structure);
+enum locality_structure locality_structure_from_string(const char *string);
+const char *locality_backend_string(enum locality_backend backend);
+enum locality_backend locality_backend_from_string(const char *string);
+const char *locality_phase_string(enum locality_phase phase);
+
+void locality_test(struct locality_params *params, bool running_in_debugger,
+		   LmString log_filename, const char *log_directory,
+		   int run_nr);
+
+#endif
@@ -0,0 +1,125 @@
+#include <src/lm.h>
+LM_LOG_REGISTER(numa_test);
+
+#include <src/allocators/allocator_wrappers.h>
+#include <src/metrics/timing.h>
+#include <src/utils/system_info.h>
+
+#include "numa_test.h"
+
+#include <string.h>
+
+extern UArena *main_ua;
+
+enum bandwidth_pass { BW_WRITE, BW_READ };
+
+static const char *bandwidth_pass_string(enum bandwidth_pass pass)
+{
+	return (pass == BW_WRITE) ? "write" : "read";
+}
+
+static void write_pass(uint64_t *buf, size_t buf_sz, uint64_t iter)
+{
+	memset(buf, (int)(iter & 0xff), buf_sz);
+	// Keeps the compiler from dropping stores nobody reads
+	__asm__ volatile("" : : "r"(buf) : "memory");
+}
+
+static void read_pass(const uint64_t *buf, size_t buf_sz)
+{
+	uint64_t sum = 0;
+	for (size_t i = 0; i < buf_sz / sizeof(uint64_t); ++i)
+		sum += buf[i];
+	__asm__ volatile("" : : "r"(sum));
+}
+
+static void time_passes(uint64_t *buf, size_t buf_sz, uint64_t iterations,
+			enum bandwidth_pass pass, uint64_t *timing_arr)
+{
+	struct alloc_tstats *tstats = get_alloc_tstats();
+	*tstats = (struct alloc_tstats){ 0 };
+	init_alloc_tcoll(iterations, timing_arr);
+
+	for (uint64_t i = 0; i < iterations; ++i) {
+		START_TSC_TIMING_LFENCE(pass);
+		if (pass == BW_WRITE)
+			write_pass(buf, buf_sz, i);
+		else
+			read_pass(buf, buf_sz);
+		END_TSC_TIMING_LFENCE(pass);
+		add_alloc_timing_raw(pass_end - pass_start);
+	}
+}
+
+static void log_and_write_bandwidth(int node, bool local, size_t buf_sz,
+				    enum bandwidth_pass pass,
+				    const char *log_directory, int run_nr)
+{
+	struct alloc_tstats *tstats = get_alloc_tstats();
+	double avg_sec = ((double)tstats->total_tsc / (double)tstats->iter) /
+			 get_tsc_freq();
+	LmLogInfoR("\tnode %d (%s) %5s: %8.2f GB/s\n", node,
+		   local ? "local" : "remote", bandwidth_pass_string(pass),
+		   (double)buf_sz / avg_sec / 1e9);
+
+	UAScratch uas = ua_scratch_begin(main_ua);
+	LmString filename = lm_string_make(log_directory, uas.ua);
+	lm_string_append_fmt(filename, "%d-ka-node%d-%s.bin", run_nr, node,
+			     bandwidth_pass_string(pass));
+	struct result_info info = { "ka", bandwidth_pass_string(pass), 1 };
+	if (write_alloc_timing_data_to_file(filename, &info) != 0)
+		LmLogError("Failed to write data to file %s", filename);
+	ua_scratch_release(uas);
+}
+
+// NOTE: (isa): The local node is the node of the CPU we are running on, so
+// this is only meaningful when the benchmark is pinned (see make run)
+void numa_bandwidth_test(size_t buf_sz, uint64_t iterations,
+			 LmString log_filename, const char *log_directory,
+			 int run_nr)
+{
+	FILE *log_file = lm_open_file_by_name(log_filename, "w");
+	LmSetLogFileLocal(log_file);
+
+	int max_node = get_numa_max_node();
+	int local_node = get_current_numa_node();
+
+	LmLogInfoR("\nNUMA bandwidth, %zd bytes, %lu passes, running on node %d"
+		   " of %d\n",
+		   buf_sz, iterations, local_node, max_node + 1);
+
+	UArena *timings_ua = ua_create(iterations * sizeof(uint64_t),
+				       UA_CONTIGUOUS, UA_MMAPD);
+	uint64_t *timing_arr = UaPushArray(timings_ua, uint64_t, iterations);
+
+	for (int node = 0; node <= max_node; ++node) {
+		KArena *ka = ka_create(buf_sz, KA_NODE(node));
+		if (!ka) {
+			LmLogWarning("Could not create an arena on node %d",
+				     node);
+			continue;
+		}
+
+		uint64_t *buf = ka_alloc(ka, buf_sz);
+		LmAssert(buf, "Failed to allocate %zd bytes from the arena",
+			 buf_sz);
+
+		// Faults the backing pages in, so only access is measured
+		write_pass(buf, buf_sz, 0);
+
+		bool local = (node == local_node);
+		time_passes(buf, buf_sz, iterations, BW_WRITE, timing_arr);
+		log_and_write_bandwidth(node, local, buf_sz, BW_WRITE,
+					log_directory, run_nr);
+
+		time_passes(buf, buf_sz, iterations, BW_READ, timing_arr);
+		log_and_write_bandwidth(node, local, buf_sz, BW_READ,
+					log_directory, run_nr);
+
+		ka_destroy(ka);
+	}
+
+	ua_destroy(&timings_ua);
+	LmRemoveLogFileLocal();
+	lm_close_file(log_file);
+}
@@ -0,0 +1,10 @@
+#ifndef NUMA_TEST_H
+#define NUMA_TEST_H
+
+#include <src/lm.h>
+
+void numa_bandwidth_test(size_t buf_sz, uint64_t iterations,
+			 LmString log_filename, const char *log_directory,
+			 int run_nr);
+
+#endif
@@ -0,0 +1,280 @@
+#include <src/lm.h>
+LM_LOG_REGISTER(page_fault_test);
+
+#include <src/allocators/allocator_wrappers.h>
+#include <src/allocators/karena.h>
+#include <src/metrics/hdr_histogram.h>
+#include <src/metrics/mem_footprint.h>
+#include <src/metrics/timing.h>
+#include <src/utils/system_info.h>
+
+#include "page_fault_test.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+// Added in Linux 5.14
+#ifndef MADV_POPULATE_WRITE
+#define MADV_POPULATE_WRITE 23
+#endif
+
+// NOTE: (isa): The default huge page size on x86-64. THP and hugetlbfs
+// mappings are aligned and sized to it
+#define HUGE_PAGE_SZ LmMebiByte(2)
+
+extern UArena *main_ua;
+
+struct backing_buf {
+	uint8_t *mem; // Page aligned start of the buffer that's touched
+	void *map; // What's given back to munmap or free
+	size_t map_sz;
+	KArena *ka;
+};
+
+const char *page_backing_string(enum page_backing backing)
+{
+	switch (backing) {
+	case BACKING_MALLOC:
+		return "malloc";
+	case BACKING_MMAP:
+		return "mmap";
+	case BACKING_POPULATE:
+		return "populate";
+	case BACKING_THP:
+		return "thp";
+	case BACKING_HUGETLB:
+		return "hugetlb";
+	case BACKING_KA_LAZY:
+		return "ka_lazy";
+	case BACKING_KA_EAGER:
+		return "ka_eager";
+	case BACKING_DONTNEED:
+		return "dontneed";
+	default:
+		return "unknown";
+	}
+}
+
+enum page_backing page_backing_from_string(const char *string)
+{
+	for (int i = 0; i < BACKING_COUNT; ++i) {
+		if (strcmp(string, page_backing_string((enum page_backing)i)) ==
+		    0)
+			return (enum page_backing)i;
+	}
+
+	return BACKING_COUNT;
+}
+
+static uint8_t *map_anonymous(struct backing_buf *buf, size_t sz, int flags)
+{
+	buf->map = mmap(NULL, sz, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS | flags, -1, 0);
+	if (buf->map == MAP_FAILED) {
+		buf->map = NULL;
+		return NULL;
+	}
+	buf->map_sz = sz;
+	return buf->map;
+}
+
+// Untimed work that has to happen before the buffer is set up. Only the
+// recycled backing needs any: its pages have to be resident before they're
+// given back
+static bool backing_prepare(enum page_backing backing, struct backing_buf *buf,
+			    size_t sz)
+{
+	*buf = (struct backing_buf){ 0 };
+	if (backing != BACKING_DONTNEED)
+		return true;
+
+	buf->mem = map_anonymous(buf, sz, 0);
+	if (!buf->mem)
+		return false;
+	memset(buf->mem, 0xab, sz);
+	return true;
+}
+
+// Makes sz bytes of the backing ready to be touched. This is timed, since it's
+// where the eager backings pay for their pages
+static bool backing_setup(enum page_backing backing, struct backing_buf *buf,
+			  size_t sz)
+{
+	size_t page_sz = get_page_size();
+	switch (backing) {
+	case BACKING_MALLOC:
+		buf->map = malloc(sz + page_sz);
+		if (!buf->map)
+			return false;
+		buf->mem = (uint8_t *)buf->map +
+			   LmPaddingToAlign((uintptr_t)buf->map, page_sz);
+		return true;
+	case BACKING_MMAP:
+		buf->mem = map_anonymous(buf, sz, 0);
+		return buf->mem != NULL;
+	case BACKING_POPULATE:
+		buf->mem = map_anonymous(buf, sz, MAP_POPULATE);
+		return buf->mem != NULL;
+	case BACKING_THP: {
+		uint8_t *map = map_anonymous(buf, sz + HUGE_PAGE_SZ, 0);
+		if (!map)
+			return false;
+		buf->mem = map + LmPaddingToAlign((uintptr_t)map, HUGE_PAGE_SZ);
+		return madvise(buf->mem, sz, MADV_HUGEPAGE) == 0;
+	}
+	case BACKING_HUGETLB:
+		buf->mem = map_anonymous(buf, sz, MAP_HUGETLB);
+		return buf->mem != NULL;
+	case BACKING_KA_LAZY:
+	case BACKING_KA_EAGER:
+		buf->ka = ka_create(sz, 0);
+		if (!buf->ka)
+			return false;
+		buf->mem = ka_alloc(buf->ka, sz);
+		if (!buf->mem)
+			return false;
+		return backing == BACKING_KA_LAZY ||
+		       madvise(buf->mem, sz, MADV_POPULATE_WRITE) == 0;
+	case BACKING_DONTNEED:
+		return madvise(buf->mem, sz, MADV_DONTNEED) == 0;
+	default:
+		return false;
+	}
+}
+
+static void backing_release(enum page_backing backing, struct backing_buf *buf)
+{
+	if (buf->ka)
+		ka_destroy(buf->ka);
+	else if (backing == BACKING_MALLOC)
+		free(buf->map);
+	else if (buf->map)
+		munmap(buf->map, buf->map_sz);
+	*buf = (struct backing_buf){ 0 };
+}
+
+// One write per page, each timed on its own, so the first touch of every page
+// is a sample whether it faults or not. The huge page backings are touched
+// once per huge page, so each of their samples is one fault
+static void touch_pages(uint8_t *mem, size_t sz, size_t page_sz)
+{
+	for (size_t off = 0; off < sz; off += page_sz) {
+		START_TSC_TIMING_LFENCE(touch);
+		*(volatile uint8_t *)(mem + off) = (uint8_t)off;
+		END_TSC_TIMING_LFENCE(touch);
+		add_alloc_timing(touch_end - touch_start);
+	}
+}
+
+static void log_backing(enum page_backing backing, uint64_t pages,
+			size_t page_sz, uint64_t setup_tsc,
+			const struct hdr_histogram *hist,
+			const struct mem_footprint *fp)
+{
+	struct alloc_tstats *tstats = get_alloc_tstats();
+	double ns_per_tsc = 1e9 / get_tsc_freq();
+	double touch_ns = (double)tstats->total_tsc * ns_per_tsc;
+	double setup_ns = (double)setup_tsc * ns_per_tsc;
+	double page_count = (double)LmMax(pages, 1);
+
+	LmLogInfoR("\n%s, %zd byte pages:\n", page_backing_string(backing),
+		   page_sz);
+	LmLogInfoR("\tsetup %.1f ns, touch %.1f ns, total %.1f ns per page,"
+		   " %.2f GB/s first touch, %.2f GB/s with setup\n",
+		   setup_ns / page_count, touch_ns / page_count,
+		   (setup_ns + touch_ns) / page_count,
+		   page_count * (double)page_sz / touch_ns,
+		   page_count * (double)page_sz / (setup_ns + touch_ns));
+	if (hist)
+		hdr_log_percentiles(hist, "\tper page: ", LM_LOG_MODULE_LOCAL);
+	LmLogInfoR("\tlast buffer:\n");
+	mem_footprint_log(fp, LM_LOG_MODULE_LOCAL);
+}
+
+static void run_backing(struct page_fault_params *params,
+			enum page_backing backing, const char *log_directory,
+			int run_nr)
+{
+	size_t page_sz = get_page_size();
+	if (backing == BACKING_THP || backing == BACKING_HUGETLB)
+		page_sz = HUGE_PAGE_SZ;
+	size_t sz = LmMax(params->buf_sz, page_sz);
+	sz += LmPaddingToAlign(sz, page_sz);
+	uint64_t pages = sz / page_sz;
+
+	UAScratch uas = ua_scratch_begin(main_ua);
+	uint64_t timing_cap = pages * params->iterations;
+	uint64_t *timing_arr = UaPushArray(uas.ua, uint64_t, timing_cap);
+	struct hdr_histogram hist;
+	bool has_hist = hdr_init(&hist, 3, uas.ua) == 0;
+	init_alloc_tcoll(timing_arr ? timing_cap : 0, timing_arr);
+	init_alloc_hist(has_hist ? &hist : NULL);
+	*get_alloc_tstats() = (struct alloc_tstats){ 0 };
+
+	// NOTE: (isa): The footprint is the last buffer's, from before it's set
+	// up until it's been touched, since they're released between iterations
+	struct mem_footprint fp = { .allocs = 1, .requested = sz };
+	uint64_t setup_tsc = 0;
+	bool ok = true;
+	for (uint64_t i = 0; i < params->iterations && ok; ++i) {
+		struct backing_buf buf;
+		ok = backing_prepare(backing, &buf, sz);
+		if (ok) {
+			mem_snapshot_take(&fp.begin, 0);
+			START_TSC_TIMING_LFENCE(setup);
+			ok = backing_setup(backing, &buf, sz);
+			END_TSC_TIMING_LFENCE(setup);
+			setup_tsc += setup_end - setup_start;
+		}
+
+		if (!ok) {
+			LmLogWarning("Unable to set up %zd bytes of %s memory: %s,"
+				     " skipping it",
+				     sz, page_backing_string(backing),
+				     strerror(errno));
+		} else {
+			touch_pages(buf.mem, sz, page_sz);
+			mem_snapshot_take(&fp.end, sz);
+		}
+		backing_release(backing, &buf);
+	}
+
+	if (ok) {
+		log_backing(backing, get_alloc_tstats()->iter, page_sz, setup_tsc,
+			    has_hist ? &hist : NULL, &fp);
+
+		LmString filename = lm_string_make(log_directory, uas.ua);
+		lm_string_append_fmt(filename, "%d-%s.bin", run_nr,
+				     page_backing_string(backing));
+		struct result_info info = { page_backing_string(backing),
+					    "page", 1 };
+		if (write_alloc_timing_data_to_file(filename, &info) != 0 ||
+		    mem_footprint_append_to_file(filename, &fp) != 0 ||
+		    (has_hist && hdr_append_to_file(&hist, filename) != 0))
+			LmLogError("Failed to write data to file %s", filename);
+	}
+
+	init_alloc_tcoll(0, NULL);
+	init_alloc_hist(NULL);
+	ua_scratch_release(uas);
+}
+
+void first_touch_test(struct page_fault_params *params, LmString log_filename,
+		      const char *log_directory, int run_nr)
+{
+	FILE *log_file = lm_open_file_by_name(log_filename, "w");
+	LmSetLogFileLocal(log_file);
+
+	LmLogInfoR("First touch latency, %zd byte buffers, %lu iterations\n",
+		   params->buf_sz, params->iterations);
+
+	for (int i = 0; i < BACKING_COUNT; ++i)
+		if (params->backings[i])
+			run_backing(params, (enum page_backing)i, log_directory,
+				    run_nr);
+
+	LmRemoveLogFileLocal();
+	lm_close_file(log_file);
+}
@@ -0,0 +1,31 @@
+#ifndef PAGE_FAULT_TEST_H
+#define PAGE_FAULT_TEST_H
+
+#include <src/lm.h>
+
+// What the pages being touched come from
+enum page_backing {
+	BACKING_MALLOC,
+	BACKING_MMAP, // Anonymous, faulted in on first touch
+	BACKING_POPULATE, // MAP_POPULATE, faulted in by mmap
+	BACKING_THP, // Aligned to and advised for transparent huge pages
+	BACKING_HUGETLB, // MAP_HUGETLB, needs reserved huge pages
+	BACKING_KA_LAZY, // karena, faulted in by the module on first touch
+	BACKING_KA_EAGER, // karena, populated up front with MADV_POPULATE_WRITE
+	BACKING_DONTNEED, // Touched once, then given back with MADV_DONTNEED
+	BACKING_COUNT
+};
+
+struct page_fault_params {
+	size_t buf_sz;
+	uint64_t iterations; // Fresh buffers per backing
+	bool backings[BACKING_COUNT];
+};
+
+const char *page_backing_string(enum page_backing backing);
+enum page_backing page_backing_from_string(const char *string);
+
+void first_touch_test(struct page_fault_params *params, LmString log_filename,
+		      const char *log_directory, int run_nr);
+
+#endif
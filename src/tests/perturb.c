@@ -0,0 +1,206 @@
+#define _GNU_SOURCE
+#include <src/lm.h>
+LM_LOG_REGISTER(perturb);
+
+#include <src/utils/noise_control.h>
+#include <src/utils/system_info.h>
+
+#include "perturb.h"
+
+#include <errno.h>
+#include <sched.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#define CACHE_LINE_SZ 64
+
+// NOTE: (isa): glibc keeps a chunk's size right before the pointer it hands
+// out, so the line in front of every recent block is flushed as well
+#define BLOCK_HEADER_SZ 16
+
+const char *perturb_mode_string(enum perturb_mode mode)
+{
+	switch (mode) {
+	case PERTURB_FLUSH:
+		return "flush";
+	case PERTURB_TLB:
+		return "tlb";
+	case PERTURB_INTERFERE:
+		return "interfere";
+	default:
+		return "unknown";
+	}
+}
+
+enum perturb_mode perturb_mode_from_string(const char *string)
+{
+	for (int i = 0; i < PERTURB_MODE_COUNT; ++i) {
+		if (strcmp(string, perturb_mode_string((enum perturb_mode)i)) ==
+		    0)
+			return (enum perturb_mode)i;
+	}
+
+	return PERTURB_MODE_COUNT;
+}
+
+// Mapped directly rather than through any of the allocators, so setting up a
+// perturbation doesn't change the state of the one being measured
+static void *map_buffer(size_t sz, bool small_pages)
+{
+	void *buf = mmap(NULL, sz, PROT_READ | PROT_WRITE,
+			 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (buf == MAP_FAILED) {
+		LmLogWarning("Unable to map a %zd byte perturbation buffer: %s",
+			     sz, strerror(errno));
+		return NULL;
+	}
+
+	// NOTE: (isa): The walk needs one TLB entry per page to thrash the TLB.
+	// MAP_POPULATE would fault the buffer in before the advice, as huge
+	// pages when THP is "always", so it's advised first and touched after
+	if (small_pages && madvise(buf, sz, MADV_NOHUGEPAGE) != 0)
+		LmLogWarning("MADV_NOHUGEPAGE failed, the TLB walk may be "
+			     "backed by huge pages: %s",
+			     strerror(errno));
+	size_t page_sz = get_page_size();
+	for (size_t i = 0; i < sz; i += page_sz)
+		((volatile uint8_t *)buf)[i] = 0;
+	return buf;
+}
+
+static void flush_range(const void *start, size_t sz)
+{
+	uintptr_t line = (uintptr_t)start & ~(uintptr_t)(CACHE_LINE_SZ - 1);
+	for (; line < (uintptr_t)start + sz; line += CACHE_LINE_SZ)
+		__builtin_ia32_clflush((const void *)line);
+}
+
+static void *interfere_main(void *arg)
+{
+	struct perturb *p = arg;
+	pin_thread_to_cpu(p->cpu);
+	volatile uint8_t *buf = p->buf;
+	while (!__atomic_load_n(&p->stop, __ATOMIC_RELAXED))
+		for (size_t i = 0; i < p->buf_sz; i += CACHE_LINE_SZ)
+			buf[i] = (uint8_t)(buf[i] + 1);
+	return NULL;
+}
+
+static bool start_interfering(struct perturb *p)
+{
+	p->cpu = p->params->interfere_cpu;
+	if (p->cpu < 0) {
+		int cpu = sched_getcpu();
+		p->cpu = noise_smt_sibling(cpu);
+		if (p->cpu < 0) {
+			LmLogWarning("CPU %d has no SMT sibling to interfere "
+				     "from, set interfere_cpu to use another "
+				     "one",
+				     cpu);
+			return false;
+		}
+	}
+
+	p->buf_sz = p->params->interfere_sz;
+	if (!(p->buf = map_buffer(p->buf_sz, false)))
+		return false;
+	int err = pthread_create(&p->thread, NULL, interfere_main, p);
+	if (err != 0) {
+		LmLogWarning("Unable to start the interfering thread: %s",
+			     strerror(err));
+		p->thread = 0;
+		return false;
+	}
+	return true;
+}
+
+// meta is what the allocator keeps in user space, e.g. the arena struct, and
+// may be NULL. Returns false, with a warning, if the mode can't be set up
+bool perturb_begin(struct perturb *p, enum perturb_mode mode,
+		   const struct cold_params *params, const void *meta,
+		   size_t meta_sz)
+{
+	*p = (struct perturb){ 0 };
+	p->mode = mode;
+	p->params = params;
+	p->meta = meta;
+	p->meta_sz = meta_sz;
+
+	bool ok = true;
+	switch (mode) {
+	case PERTURB_FLUSH:
+		p->recent_sz = LmMax(params->recent_blocks, 1) * sizeof(void *);
+		ok = (p->recent = map_buffer(p->recent_sz, false)) != NULL;
+		break;
+	case PERTURB_TLB:
+		p->buf_sz = params->tlb_walk_sz;
+		ok = (p->buf = map_buffer(p->buf_sz, true)) != NULL;
+		break;
+	case PERTURB_INTERFERE:
+		ok = start_interfering(p);
+		break;
+	default:
+		ok = false;
+		break;
+	}
+
+	if (!ok) {
+		LmLogWarning("Skipping the %s cold run",
+			     perturb_mode_string(mode));
+		perturb_end(p);
+	}
+	return ok;
+}
+
+void perturb_end(struct perturb *p)
+{
+	if (p->thread) {
+		__atomic_store_n(&p->stop, 1, __ATOMIC_RELAXED);
+		pthread_join(p->thread, NULL);
+		p->thread = 0;
+	}
+	if (p->recent)
+		munmap(p->recent, p->recent_sz);
+	if (p->buf)
+		munmap(p->buf, p->buf_sz);
+	p->recent = NULL;
+	p->buf = NULL;
+}
+
+// Runs between two timed allocations. The interfering thread runs the whole
+// phase, so there's nothing to do for it here
+void perturb_before_alloc(struct perturb *p)
+{
+	if (p->allocs++ % LmMax(p->params->every, 1) != 0)
+		return;
+
+	size_t page_sz = get_page_size();
+	switch (p->mode) {
+	case PERTURB_FLUSH: {
+		if (p->meta)
+			flush_range(p->meta, p->meta_sz);
+		uint64_t count = p->recent_sz / sizeof(void *);
+		for (uint64_t i = 0; i < count; ++i)
+			if (p->recent[i])
+				flush_range((uint8_t *)p->recent[i] -
+						    BLOCK_HEADER_SZ,
+					    BLOCK_HEADER_SZ + 1);
+		__builtin_ia32_mfence();
+		break;
+	}
+	case PERTURB_TLB: {
+		volatile uint8_t *buf = p->buf;
+		for (size_t off = 0; off < p->buf_sz; off += page_sz)
+			(void)buf[off];
+		break;
+	}
+	default:
+		break;
+	}
+}
+
+void perturb_note_block(struct perturb *p, void *ptr)
+{
+	if (p->recent)
+		p->recent[p->allocs % (p->recent_sz / sizeof(void *))] = ptr;
+}
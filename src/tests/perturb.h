@@ -0,0 +1,53 @@
+#ifndef PERTURB_H
+#define PERTURB_H
+
+#include <src/lm.h>
+
+#include <pthread.h>
+
+// How a cold run disturbs the allocator between allocations, so the timed
+// allocations don't all find their metadata in L1 and their pages in the TLB
+enum perturb_mode {
+	PERTURB_FLUSH, // clflush the arena struct (u_arena) and the recent blocks
+	PERTURB_TLB, // Touch one byte per page of a buffer larger than the TLB
+	PERTURB_INTERFERE, // Stream over a large buffer on a sibling hardware thread
+	PERTURB_MODE_COUNT
+};
+
+struct cold_params {
+	bool modes[PERTURB_MODE_COUNT];
+	uint64_t every; // Allocations between perturbations
+	uint64_t recent_blocks; // Blocks flushed by PERTURB_FLUSH
+	size_t tlb_walk_sz;
+	size_t interfere_sz;
+	int interfere_cpu; // -1 for a sibling of the CPU the test runs on
+};
+
+struct perturb {
+	enum perturb_mode mode;
+	const struct cold_params *params;
+	uint64_t allocs;
+
+	const void *meta; // The allocator's own state, if it's in user space
+	size_t meta_sz;
+	void **recent; // Ring of the last recent_blocks blocks
+	size_t recent_sz;
+
+	uint8_t *buf; // Walked by PERTURB_TLB, streamed over by PERTURB_INTERFERE
+	size_t buf_sz;
+	pthread_t thread;
+	int cpu;
+	int stop;
+};
+
+const char *perturb_mode_string(enum perturb_mode mode);
+enum perturb_mode perturb_mode_from_string(const char *string);
+
+bool perturb_begin(struct perturb *p, enum perturb_mode mode,
+		   const struct cold_params *params, const void *meta,
+		   size_t meta_sz);
+void perturb_end(struct perturb *p);
+void perturb_before_alloc(struct perturb *p);
+void perturb_note_block(struct perturb *p, void *ptr);
+
+#endif
@@ -0,0 +1,264 @@
+#include <src/lm.h>
+LM_LOG_REGISTER(realloc_test);
+
+#include <src/allocators/allocator_wrappers.h>
+#include <src/metrics/timing.h>
+#include <src/metrics/mem_footprint.h>
+#include <src/utils/system_info.h>
+
+#include "realloc_test.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+extern UArena *main_ua;
+
+#define INTERLEAVED_ALLOC_SZ 64
+
+// Totals over all repetitions of one pattern
+struct growth_result {
+	uint64_t builds;
+	uint64_t elements;
+	uint64_t bytes;
+	uint64_t reallocs;
+	uint64_t bytes_copied;
+	uint64_t waste;
+	uint64_t build_tsc;
+	bool exhausted;
+};
+
+const char *growth_pattern_string(enum growth_pattern pattern)
+{
+	switch (pattern) {
+	case GROWTH_DOUBLING:
+		return "doubling";
+	case GROWTH_FIXED:
+		return "fixed";
+	case GROWTH_STRING:
+		return "string";
+	default:
+		return "unknown";
+	}
+}
+
+enum growth_pattern growth_pattern_from_string(const char *string)
+{
+	for (int i = 0; i < GROWTH_PATTERN_COUNT; ++i) {
+		if (strcmp(string,
+			   growth_pattern_string((enum growth_pattern)i)) == 0)
+			return (enum growth_pattern)i;
+	}
+
+	return GROWTH_PATTERN_COUNT;
+}
+
+static uint64_t growth_consumed(UArena *ua)
+{
+	return ua ? ua_pos(ua) : malloc_consumed_bytes();
+}
+
+static size_t next_capacity(struct growth_params *params,
+			    enum growth_pattern pattern, size_t cap,
+			    size_t needed)
+{
+	switch (pattern) {
+	case GROWTH_DOUBLING:
+		return LmMax(cap * 2, needed);
+	case GROWTH_FIXED:
+		return LmMax(cap + params->increment * params->elem_size,
+			     needed);
+	default:
+		return needed;
+	}
+}
+
+// Builds one vector or string. The unrelated allocations are chained through
+// their first word, so the malloc ones can be freed afterwards
+static void growth_build(struct growth_params *params,
+			 enum growth_pattern pattern, realloc_fn_t realloc_fn,
+			 UArena *ua, struct growth_result *res)
+{
+	uint8_t *buf = NULL;
+	size_t len = 0;
+	size_t cap = 0;
+	uint64_t reallocs = 0;
+	void *interleaved = NULL;
+	uint64_t interleaved_bytes = 0;
+	uint64_t consumed = growth_consumed(ua);
+
+	uint8_t elem[64] = { 0 };
+	size_t elem_size = LmMin(params->elem_size, sizeof(elem));
+	char piece[32];
+
+	uint64_t i = 0;
+	START_TSC_TIMING_LFENCE(build);
+	for (; i < params->elements; ++i) {
+		const void *src = elem;
+		size_t piece_len = elem_size;
+		if (pattern == GROWTH_STRING) {
+			piece_len = (size_t)snprintf(piece, sizeof(piece),
+						     "%lu,", i);
+			src = piece;
+		} else {
+			memcpy(elem, &i, LmMin(sizeof(i), elem_size));
+		}
+
+		if (len + piece_len > cap) {
+			size_t new_cap = next_capacity(params, pattern, cap,
+						       len + piece_len);
+			uint8_t *new = realloc_fn(ua, NULL, buf, cap, new_cap);
+			if (!new) {
+				res->exhausted = true;
+				break;
+			}
+			if (buf && new != buf)
+				res->bytes_copied += cap;
+			buf = new;
+			cap = new_cap;
+			reallocs += 1;
+
+			if (params->interleave_every &&
+			    reallocs % params->interleave_every == 0) {
+				void **other =
+					ua ? ua_alloc(ua, INTERLEAVED_ALLOC_SZ) :
+					     malloc(INTERLEAVED_ALLOC_SZ);
+				if (other) {
+					*other = interleaved;
+					interleaved = other;
+					interleaved_bytes +=
+						INTERLEAVED_ALLOC_SZ;
+				}
+			}
+		}
+
+		memcpy(buf + len, src, piece_len);
+		len += piece_len;
+	}
+	END_TSC_TIMING_LFENCE(build);
+
+	// Everything the allocator holds beyond the live bytes, i.e. the unused
+	// capacity, and for the copying arena the abandoned old buffers
+	uint64_t used = growth_consumed(ua) - consumed;
+	res->waste += used - LmMin(used, len + interleaved_bytes);
+	res->build_tsc += build_end - build_start;
+	res->builds += 1;
+	res->elements += i;
+	res->bytes += len;
+	res->reallocs += reallocs;
+
+	if (ua) {
+		ua_free(ua);
+		return;
+	}
+
+	free(buf);
+	while (interleaved) {
+		void *next = *(void **)interleaved;
+		free(interleaved);
+		interleaved = next;
+	}
+}
+
+static void log_growth_result(struct growth_result *res,
+			      enum growth_pattern pattern,
+			      const char *realloc_fn_name)
+{
+	double ns_per_tsc = 1e9 / get_tsc_freq();
+	struct alloc_tstats *tstats = get_alloc_tstats();
+	double builds = (double)LmMax(res->builds, 1);
+	LmLogInfoR(
+		"\n%s, %s%s:\n"
+		"\tper build:    %.0f elements, %.0f bytes, %.1f reallocs\n"
+		"\tbytes copied: %.0f per build (%.2f per byte built)\n"
+		"\ttime:         %.2f ns per element, %.1f ns per realloc\n"
+		"\tmemory waste: %.0f B per build (%.1f%% of the final size)\n",
+		realloc_fn_name, growth_pattern_string(pattern),
+		res->exhausted ? ", ran out of memory" : "",
+		(double)res->elements / builds, (double)res->bytes / builds,
+		(double)res->reallocs / builds,
+		(double)res->bytes_copied / builds,
+		res->bytes ? (double)res->bytes_copied / (double)res->bytes :
+			     0.0,
+		res->elements ? (double)res->build_tsc * ns_per_tsc /
+					(double)res->elements :
+				0.0,
+		tstats->iter ? (double)tstats->total_tsc * ns_per_tsc /
+				       (double)tstats->iter :
+			       0.0,
+		(double)res->waste / builds,
+		res->bytes ? (double)res->waste / (double)res->bytes * 100 :
+			     0.0);
+}
+
+static uint64_t growth_max_reallocs(struct growth_params *params,
+				    enum growth_pattern pattern)
+{
+	switch (pattern) {
+	case GROWTH_DOUBLING:
+		return 64;
+	case GROWTH_FIXED:
+		return params->elements / LmMax(params->increment, 1) + 1;
+	default:
+		return params->elements;
+	}
+}
+
+static void run_pattern(struct growth_params *params,
+			enum growth_pattern pattern, realloc_fn_t realloc_fn,
+			const char *realloc_fn_name, UArena *ua,
+			const char *log_directory, int run_nr)
+{
+	UAScratch uas = ua_scratch_begin(main_ua);
+	uint64_t timing_cap =
+		growth_max_reallocs(params, pattern) * params->repetitions;
+	uint64_t *timing_arr = UaPushArray(uas.ua, uint64_t, timing_cap);
+	init_alloc_tcoll(timing_arr ? timing_cap : 0, timing_arr);
+	*get_alloc_tstats() = (struct alloc_tstats){ 0 };
+
+	struct growth_result res = { 0 };
+	for (uint64_t i = 0; i < params->repetitions && !res.exhausted; ++i)
+		growth_build(params, pattern, realloc_fn, ua, &res);
+
+	log_growth_result(&res, pattern, realloc_fn_name);
+
+	LmString filename = lm_string_make(log_directory, uas.ua);
+	lm_string_append_fmt(filename, "%d-%s-%s.bin", run_nr,
+			     growth_pattern_string(pattern), realloc_fn_name);
+	struct result_info info = { realloc_fn_name,
+				    growth_pattern_string(pattern), 1 };
+	if (write_alloc_timing_data_to_file(filename, &info) != 0)
+		LmLogError("Failed to write data to file %s", filename);
+
+	init_alloc_tcoll(0, NULL);
+	ua_scratch_release(uas);
+}
+
+void realloc_growth_test(struct growth_params *params, realloc_fn_t realloc_fn,
+			 const char *realloc_fn_name, bool is_arena,
+			 LmString log_filename, const char *log_directory,
+			 int run_nr)
+{
+	FILE *log_file = lm_open_file_by_name(log_filename, "a");
+	LmSetLogFileLocal(log_file);
+
+	UArena *ua = NULL;
+	if (is_arena) {
+		ua = ua_create(params->arena_sz, UA_CONTIGUOUS, UA_MMAPD);
+		if (!ua) {
+			LmLogWarning("Unable to create the arena for %s, skipping it",
+				     realloc_fn_name);
+			goto out;
+		}
+	}
+
+	for (int i = 0; i < GROWTH_PATTERN_COUNT; ++i)
+		if (params->patterns[i])
+			run_pattern(params, (enum growth_pattern)i, realloc_fn,
+				    realloc_fn_name, ua, log_directory, run_nr);
+
+	if (ua)
+		ua_destroy(&ua);
+out:
+	LmRemoveLogFileLocal();
+	lm_close_file(log_file);
+}
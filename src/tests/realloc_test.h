@@ -0,0 +1,34 @@
+#ifndef REALLOC_TEST_H
+#define REALLOC_TEST_H
+
+#include <src/lm.h>
+#include <src/allocators/allocator_wrappers.h>
+
+enum growth_pattern {
+	GROWTH_DOUBLING, // Vector push back that doubles its capacity
+	GROWTH_FIXED, // Vector that grows by a fixed number of elements
+	GROWTH_STRING, // Exact fit appends, like lm_string_append_fmt
+	GROWTH_PATTERN_COUNT
+};
+
+struct growth_params {
+	uint64_t elements; // Pushes or appends per build
+	size_t elem_size;
+	uint64_t increment; // Elements added per growth for GROWTH_FIXED
+	uint64_t repetitions;
+	// Makes an unrelated allocation after every this many reallocs, so the
+	// buffer isn't always at the top of the arena. 0 to never do it
+	uint64_t interleave_every;
+	size_t arena_sz;
+	bool patterns[GROWTH_PATTERN_COUNT];
+};
+
+const char *growth_pattern_string(enum growth_pattern pattern);
+enum growth_pattern growth_pattern_from_string(const char *string);
+
+void realloc_growth_test(struct growth_params *params, realloc_fn_t realloc_fn,
+			 const char *realloc_fn_name, bool is_arena,
+			 LmString log_filename, const char *log_directory,
+			 int run_nr);
+
+#endif
@@ -0,0 +1,545 @@
+#include <src/lm.h>
+LM_LOG_REGISTER(replay_test);
+
+#include <src/allocators/allocator_wrappers.h>
+#include <src/metrics/alloc_trace.h>
+#include <src/metrics/mem_footprint.h>
+#include <src/metrics/timing.h>
+#include <src/utils/system_info.h>
+
+#include "replay_test.h"
+
+#include <malloc.h>
+#include <string.h>
+#include <sys/stat.h>
+
+// Addresses in the trace are turned into dense ids before replaying, so the
+// replay itself only does array lookups
+struct replay_op {
+	uint32_t op;
+	uint32_t arena; // 0 is the heap, traced arenas start at 1
+	uint64_t id;
+	uint64_t arg; // Old id for realloc, offset for arena allocs, seek pos
+	uint64_t size;
+};
+
+struct replay_trace {
+	struct replay_op *ops;
+	uint64_t count;
+	uint64_t id_count;
+	uint32_t arena_count;
+	uint64_t *arena_allocs;
+	uint64_t unmatched;
+};
+
+struct replay_state {
+	enum replay_backend backend;
+	const char *name;
+	struct replay_trace *trace;
+
+	// glibc's or a plugin's, for REPLAY_MALLOC
+	const struct alloc_plugin *plugin;
+	void *(*malloc)(size_t sz);
+	void (*free)(void *ptr);
+	void *(*realloc)(void *ptr, size_t sz);
+
+	void **ptrs;
+	uint64_t *sizes;
+	UArena **uas;
+	KArena **kas;
+	uint64_t *arena_pos;
+
+	// Live arena allocations in allocation order, so a seek knows what it
+	// releases. Arena i's stack starts at stack_base[i]
+	uint64_t *stack_ids;
+	uint64_t *stack_offsets;
+	uint64_t *stack_base;
+	uint64_t *stack_top;
+
+	uint64_t live;
+	uint64_t peak_live;
+	uint64_t footprint;
+	uint64_t peak_footprint;
+	uint64_t live_at_peak;
+};
+
+#define MAP_EMPTY 0
+#define MAP_TOMBSTONE 1
+
+// NOTE: (isa): Allocated addresses are never 0 or 1, so they can be used to
+// mark empty and deleted slots
+struct addr_map {
+	uint64_t *keys;
+	uint64_t *vals;
+	uint64_t mask;
+};
+
+#define MALLOC_SAMPLE_INTERVAL 1024
+
+const char *replay_backend_string(enum replay_backend backend)
+{
+	switch (backend) {
+	case REPLAY_MALLOC:
+		return "malloc";
+	case REPLAY_UA:
+		return "ua";
+	case REPLAY_KA:
+		return "ka";
+	default:
+		return "unknown";
+	}
+}
+
+enum replay_backend replay_backend_from_string(const char *string)
+{
+	for (int i = 0; i < REPLAY_BACKEND_COUNT; ++i) {
+		if (strcmp(string,
+			   replay_backend_string((enum replay_backend)i)) == 0)
+			return (enum replay_backend)i;
+	}
+
+	return REPLAY_BACKEND_COUNT;
+}
+
+static uint64_t hash_addr(uint64_t addr)
+{
+	addr ^= addr >> 33;
+	addr *= 0xff51afd7ed558ccdULL;
+	addr ^= addr >> 33;
+	return addr;
+}
+
+static struct addr_map addr_map_create(uint64_t entries, UArena *ua)
+{
+	uint64_t cap = 16;
+	while (cap < entries * 2)
+		cap <<= 1;
+
+	struct addr_map map;
+	map.keys = UaPushArrayZero(ua, uint64_t, cap);
+	map.vals = UaPushArray(ua, uint64_t, cap);
+	map.mask = cap - 1;
+	return map;
+}
+
+static uint64_t *addr_map_find(struct addr_map *map, uint64_t key)
+{
+	for (uint64_t i = hash_addr(key) & map->mask;; i = (i + 1) & map->mask) {
+		if (map->keys[i] == MAP_EMPTY)
+			return NULL;
+		if (map->keys[i] == key)
+			return &map->vals[i];
+	}
+}
+
+static void addr_map_put(struct addr_map *map, uint64_t key, uint64_t val)
+{
+	uint64_t *existing = addr_map_find(map, key);
+	if (existing) {
+		*existing = val;
+		return;
+	}
+
+	for (uint64_t i = hash_addr(key) & map->mask;; i = (i + 1) & map->mask) {
+		if (map->keys[i] == MAP_EMPTY || map->keys[i] == MAP_TOMBSTONE) {
+			map->keys[i] = key;
+			map->vals[i] = val;
+			return;
+		}
+	}
+}
+
+static void addr_map_remove(struct addr_map *map, uint64_t *val)
+{
+	map->keys[val - map->vals] = MAP_TOMBSTONE;
+}
+
+static uint32_t arena_index(struct addr_map *arenas, struct replay_trace *rt,
+			    uint64_t arena)
+{
+	uint64_t *idx = addr_map_find(arenas, arena);
+	if (idx)
+		return (uint32_t)*idx;
+
+	addr_map_put(arenas, arena, rt->arena_count);
+	return rt->arena_count++;
+}
+
+static void prepare_trace(struct alloc_trace_event *events, uint64_t count,
+			  struct replay_trace *rt, UArena *ua)
+{
+	UAScratch uas = ua_scratch_begin(ua);
+	struct addr_map ptrs = addr_map_create(count, uas.ua);
+	struct addr_map arenas = addr_map_create(count, uas.ua);
+
+	*rt = (struct replay_trace){ 0 };
+	rt->ops = UaPushArray(ua, struct replay_op, count);
+	rt->arena_count = 1;
+
+	// Counted in a scratch array first since the arena count isn't known
+	uint64_t *arena_allocs = UaPushArrayZero(uas.ua, uint64_t, count + 1);
+
+	for (uint64_t i = 0; i < count; ++i) {
+		struct alloc_trace_event *e = &events[i];
+		struct replay_op op = { .op = e->op, .size = e->size };
+		uint64_t *val;
+
+		switch (e->op) {
+		case TRACE_ALLOC:
+			op.id = rt->id_count++;
+			addr_map_put(&ptrs, e->addr, op.id);
+			break;
+		case TRACE_FREE:
+			if (!(val = addr_map_find(&ptrs, e->addr))) {
+				// Allocated before the trace started
+				++rt->unmatched;
+				continue;
+			}
+			op.id = *val;
+			addr_map_remove(&ptrs, val);
+			break;
+		case TRACE_REALLOC:
+			// realloc(NULL, n) is an allocation, not a pointer the
+			// trace missed
+			if (e->arg == 0) {
+				op.op = TRACE_ALLOC;
+			} else if (!(val = addr_map_find(&ptrs, e->arg))) {
+				++rt->unmatched;
+				op.op = TRACE_ALLOC;
+			} else {
+				op.arg = *val;
+				addr_map_remove(&ptrs, val);
+			}
+			op.id = rt->id_count++;
+			addr_map_put(&ptrs, e->addr, op.id);
+			break;
+		case TRACE_ARENA_ALLOC:
+			op.arena = arena_index(&arenas, rt, e->arg);
+			op.id = rt->id_count++;
+			op.arg = e->pos;
+			++arena_allocs[op.arena];
+			break;
+		case TRACE_ARENA_SEEK:
+			op.arena = arena_index(&arenas, rt, e->arg);
+			op.arg = e->pos;
+			break;
+		default:
+			LmLogWarning("Unknown trace op %u, skipping it", e->op);
+			continue;
+		}
+
+		rt->ops[rt->count++] = op;
+	}
+
+	rt->arena_allocs = UaPushArray(ua, uint64_t, rt->arena_count);
+	memcpy(rt->arena_allocs, arena_allocs,
+	       rt->arena_count * sizeof(uint64_t));
+	ua_scratch_release(uas);
+}
+
+static void *replay_alloc(struct replay_state *rs, uint32_t arena, size_t size)
+{
+	switch (rs->backend) {
+	case REPLAY_MALLOC:
+		return rs->malloc(size);
+	case REPLAY_UA:
+		return ua_alloc(rs->uas[arena], size);
+	case REPLAY_KA:
+		return ka_alloc(rs->kas[arena], size);
+	default:
+		return NULL;
+	}
+}
+
+// Releases the arena allocations at or past pos, freeing them if the backend
+// is malloc
+static void pop_arena_stack(struct replay_state *rs, uint32_t arena,
+			    uint64_t pos)
+{
+	uint64_t base = rs->stack_base[arena];
+	uint64_t *top = &rs->stack_top[arena];
+	while (*top > base && rs->stack_offsets[*top - 1] >= pos) {
+		uint64_t id = rs->stack_ids[--(*top)];
+		if (rs->backend == REPLAY_MALLOC)
+			rs->free(rs->ptrs[id]);
+		rs->ptrs[id] = NULL;
+		rs->live -= rs->sizes[id];
+		rs->sizes[id] = 0;
+	}
+}
+
+static void *replay_exec(struct replay_state *rs, struct replay_op *op)
+{
+	void *ptr = NULL;
+	switch (op->op) {
+	case TRACE_ALLOC:
+		ptr = replay_alloc(rs, 0, op->size);
+		break;
+	case TRACE_ARENA_ALLOC:
+		ptr = replay_alloc(rs, op->arena, op->size);
+		break;
+	case TRACE_FREE:
+		if (rs->backend == REPLAY_MALLOC)
+			rs->free(rs->ptrs[op->id]);
+		break;
+	case TRACE_REALLOC: {
+		void *old = rs->ptrs[op->arg];
+		if (rs->backend == REPLAY_MALLOC) {
+			ptr = rs->realloc(old, op->size);
+		} else {
+			ptr = replay_alloc(rs, 0, op->size);
+			if (ptr && old)
+				memcpy(ptr, old,
+				       LmMin(rs->sizes[op->arg], op->size));
+		}
+		break;
+	}
+	case TRACE_ARENA_SEEK:
+		if (rs->backend == REPLAY_MALLOC)
+			pop_arena_stack(rs, op->arena, op->arg);
+		else if (rs->backend == REPLAY_UA)
+			ua_seek(rs->uas[op->arena], op->arg);
+		else
+			ka_seek(rs->kas[op->arena], op->arg);
+		break;
+	}
+
+	return ptr;
+}
+
+// Everything that isn't the allocator's own work, so it stays out of the
+// timed section
+static void replay_account(struct replay_state *rs, struct replay_op *op,
+			   void *ptr, uint64_t op_nr)
+{
+	switch (op->op) {
+	case TRACE_ALLOC:
+	case TRACE_ARENA_ALLOC:
+	case TRACE_REALLOC:
+		if (op->op == TRACE_REALLOC) {
+			rs->live -= rs->sizes[op->arg];
+			rs->sizes[op->arg] = 0;
+			rs->ptrs[op->arg] = NULL;
+		}
+		if (ptr && op->size > 0)
+			*(uint8_t *)ptr = 1;
+		rs->ptrs[op->id] = ptr;
+		rs->sizes[op->id] = op->size;
+		rs->live += op->size;
+		if (op->op == TRACE_ARENA_ALLOC) {
+			uint64_t top = rs->stack_top[op->arena]++;
+			rs->stack_ids[top] = op->id;
+			rs->stack_offsets[top] = op->arg;
+		}
+		break;
+	case TRACE_FREE:
+		rs->live -= rs->sizes[op->id];
+		rs->sizes[op->id] = 0;
+		rs->ptrs[op->id] = NULL;
+		break;
+	case TRACE_ARENA_SEEK:
+		if (rs->backend != REPLAY_MALLOC)
+			pop_arena_stack(rs, op->arena, op->arg);
+		break;
+	}
+
+	if (rs->backend == REPLAY_MALLOC) {
+		// NOTE: (isa): Plugins have no common way to report their heap,
+		// so the RSS stands in for it
+		if (op_nr % MALLOC_SAMPLE_INTERVAL == 0 && rs->plugin) {
+			rs->footprint = mem_current_rss();
+		} else if (op_nr % MALLOC_SAMPLE_INTERVAL == 0) {
+			struct mallinfo2 mi = mallinfo2();
+			rs->footprint = mi.arena + mi.hblkhd;
+		}
+	} else if (op->op != TRACE_FREE) {
+		uint32_t arena = (op->op == TRACE_REALLOC) ? 0 : op->arena;
+		uint64_t pos = (rs->backend == REPLAY_UA) ?
+				       ua_pos(rs->uas[arena]) :
+				       ka_pos(rs->kas[arena]);
+		rs->footprint = rs->footprint - rs->arena_pos[arena] + pos;
+		rs->arena_pos[arena] = pos;
+	}
+
+	rs->peak_live = LmMax(rs->peak_live, rs->live);
+	if (rs->footprint > rs->peak_footprint) {
+		rs->peak_footprint = rs->footprint;
+		rs->live_at_peak = rs->live;
+	}
+}
+
+static bool create_replay_arenas(struct replay_state *rs, size_t arena_sz,
+				 UArena *ua)
+{
+	uint32_t count = rs->trace->arena_count;
+	if (rs->backend == REPLAY_UA) {
+		rs->uas = UaPushArrayZero(ua, UArena *, count);
+		for (uint32_t i = 0; i < count; ++i)
+			if (!(rs->uas[i] = ua_create(arena_sz, UA_CONTIGUOUS,
+						     UA_MMAPD)))
+				return false;
+	} else if (rs->backend == REPLAY_KA) {
+		rs->kas = UaPushArrayZero(ua, KArena *, count);
+		for (uint32_t i = 0; i < count; ++i)
+			if (!(rs->kas[i] = ka_create(arena_sz, 0)))
+				return false;
+	}
+
+	return true;
+}
+
+static void destroy_replay_arenas(struct replay_state *rs)
+{
+	for (uint32_t i = 0; i < rs->trace->arena_count; ++i) {
+		if (rs->uas && rs->uas[i])
+			ua_destroy(&rs->uas[i]);
+		if (rs->kas && rs->kas[i])
+			ka_destroy(rs->kas[i]);
+	}
+}
+
+// plugin is NULL unless backend is REPLAY_MALLOC and a plugin replaces glibc
+static void replay_backend(struct replay_trace *rt,
+			   enum replay_backend backend,
+			   const struct alloc_plugin *plugin, size_t arena_sz,
+			   UArena *ua, const char *log_directory, int run_nr)
+{
+	UAScratch uas = ua_scratch_begin(ua);
+	struct replay_state rs = { 0 };
+	rs.backend = backend;
+	rs.name = plugin ? plugin->name : replay_backend_string(backend);
+	rs.trace = rt;
+	rs.plugin = plugin;
+	rs.malloc = plugin ? plugin->malloc : malloc;
+	rs.free = plugin ? plugin->free : free;
+	rs.realloc = plugin ? plugin->realloc : realloc;
+	rs.ptrs = UaPushArrayZero(uas.ua, void *, rt->id_count);
+	rs.sizes = UaPushArrayZero(uas.ua, uint64_t, rt->id_count);
+	rs.arena_pos = UaPushArrayZero(uas.ua, uint64_t, rt->arena_count);
+	rs.stack_base = UaPushArray(uas.ua, uint64_t, rt->arena_count);
+	rs.stack_top = UaPushArray(uas.ua, uint64_t, rt->arena_count);
+
+	uint64_t stack_sz = 0;
+	for (uint32_t i = 0; i < rt->arena_count; ++i) {
+		rs.stack_base[i] = rs.stack_top[i] = stack_sz;
+		stack_sz += rt->arena_allocs[i];
+	}
+	rs.stack_ids = UaPushArray(uas.ua, uint64_t, stack_sz);
+	rs.stack_offsets = UaPushArray(uas.ua, uint64_t, stack_sz);
+
+	if (!create_replay_arenas(&rs, arena_sz, uas.ua)) {
+		LmLogWarning("Unable to create %u %s arenas, skipping it",
+			     rt->arena_count, rs.name);
+		destroy_replay_arenas(&rs);
+		ua_scratch_release(uas);
+		return;
+	}
+
+	uint64_t *timing_arr = UaPushArray(uas.ua, uint64_t, rt->count);
+	init_alloc_tcoll(rt->count, timing_arr);
+	*get_alloc_tstats() = (struct alloc_tstats){ 0 };
+
+	for (uint64_t i = 0; i < rt->count; ++i) {
+		struct replay_op *op = &rt->ops[i];
+		START_TSC_TIMING_LFENCE(op);
+		void *ptr = replay_exec(&rs, op);
+		END_TSC_TIMING_LFENCE(op);
+		add_alloc_timing_raw(op_end - op_start);
+		replay_account(&rs, op, ptr, i);
+	}
+
+	struct alloc_tstats *tstats = get_alloc_tstats();
+	double tsc_freq = get_tsc_freq();
+	double frag = rs.peak_footprint ?
+			      1.0 - (double)rs.live_at_peak /
+					    (double)rs.peak_footprint :
+			      0.0;
+	LmLogInfoR("\n%s:\n"
+		   "\ttime:          %.3f ms (%.1f ns/op)\n"
+		   "\tpeak memory:   %lu B\n"
+		   "\tpeak live:     %lu B\n"
+		   "\tfragmentation: %.1f%% at peak memory\n",
+		   rs.name, (double)tstats->total_tsc / tsc_freq * 1e3,
+		   (double)tstats->total_tsc / tsc_freq * 1e9 /
+			   (double)tstats->iter,
+		   rs.peak_footprint, rs.peak_live, frag * 100);
+
+	LmString filename = lm_string_make(log_directory, uas.ua);
+	lm_string_append_fmt(filename, "%d-replay-%s.bin", run_nr, rs.name);
+	struct result_info info = { rs.name, "replay", 1 };
+	if (write_alloc_timing_data_to_file(filename, &info) != 0)
+		LmLogError("Failed to write data to file %s", filename);
+	init_alloc_tcoll(0, NULL);
+
+	// The heap is shared with the rest of the benchmark, so anything the
+	// trace didn't free is freed here
+	if (backend == REPLAY_MALLOC) {
+		for (uint32_t i = 0; i < rt->arena_count; ++i)
+			pop_arena_stack(&rs, i, 0);
+		for (uint64_t i = 0; i < rt->id_count; ++i)
+			rs.free(rs.ptrs[i]);
+	}
+
+	destroy_replay_arenas(&rs);
+	ua_scratch_release(uas);
+}
+
+// NOTE: (isa): Rough upper bound on what loading, preparing and replaying a
+// trace needs per event. The arena is mmap'd, so only what's used is backed
+#define REPLAY_BYTES_PER_EVENT 384
+
+void trace_replay_test(struct replay_params *params, LmString log_filename,
+		       const char *log_directory, int run_nr)
+{
+	FILE *log_file = lm_open_file_by_name(log_filename, "w");
+	LmSetLogFileLocal(log_file);
+
+	struct stat st;
+	if (stat(params->trace_file, &st) != 0) {
+		LmLogError("Unable to stat trace %s: %s", params->trace_file,
+			   strerror(errno));
+		goto out;
+	}
+
+	size_t events_max = (size_t)st.st_size / sizeof(struct alloc_trace_event);
+	UArena *replay_ua =
+		ua_create((size_t)st.st_size +
+				  events_max * REPLAY_BYTES_PER_EVENT +
+				  LmMebiByte(1),
+			  UA_CONTIGUOUS, UA_MMAPD);
+
+	struct alloc_trace_header header;
+	struct alloc_trace_event *events =
+		alloc_trace_load(params->trace_file, &header, replay_ua);
+	if (!events) {
+		ua_destroy(&replay_ua);
+		goto out;
+	}
+
+	struct replay_trace rt;
+	prepare_trace(events, header.count, &rt, replay_ua);
+
+	LmLogInfoR("Replaying %s: %lu events from %u threads, %lu ops over %u "
+		   "arenas (%u traced), %lu frees of untraced memory "
+		   "skipped%s\n",
+		   params->trace_file, header.count, header.threads, rt.count,
+		   rt.arena_count, rt.arena_count - 1, rt.unmatched,
+		   header.dropped ? ", trace was truncated" : "");
+
+	for (int i = 0; i < REPLAY_BACKEND_COUNT; ++i)
+		if (params->backends[i])
+			replay_backend(&rt, (enum replay_backend)i, NULL,
+				       params->arena_sz, replay_ua,
+				       log_directory, run_nr);
+
+	for (int i = 0; i < alloc_plugin_count(); ++i)
+		if (params->plugins[i])
+			replay_backend(&rt, REPLAY_MALLOC, alloc_plugin_get(i),
+				       params->arena_sz, replay_ua,
+				       log_directory, run_nr);
+
+	ua_destroy(&replay_ua);
+out:
+	LmRemoveLogFileLocal();
+	lm_close_file(log_file);
+}
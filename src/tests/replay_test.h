@@ -0,0 +1,27 @@
+#ifndef REPLAY_TEST_H
+#define REPLAY_TEST_H
+
+#include <src/lm.h>
+#include <src/allocators/allocator_wrappers.h>
+
+enum replay_backend {
+	REPLAY_MALLOC,
+	REPLAY_UA,
+	REPLAY_KA,
+	REPLAY_BACKEND_COUNT
+};
+
+struct replay_params {
+	const char *trace_file;
+	size_t arena_sz; // Per traced arena, for the arena backends
+	bool backends[REPLAY_BACKEND_COUNT];
+	bool plugins[ALLOC_PLUGIN_MAX]; // Replayed like REPLAY_MALLOC
+};
+
+const char *replay_backend_string(enum replay_backend backend);
+enum replay_backend replay_backend_from_string(const char *string);
+
+void trace_replay_test(struct replay_params *params, LmString log_filename,
+		       const char *log_directory, int run_nr);
+
+#endif
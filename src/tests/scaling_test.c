@@ -0,0 +1,379 @@
+#define _GNU_SOURCE
+#include <src/lm.h>
+LM_LOG_REGISTER(scaling_test);
+
+#include <src/allocators/allocator_wrappers.h>
+#include <src/metrics/timing.h>
+#include <src/metrics/hdr_histogram.h>
+#include <src/utils/system_info.h>
+#include <src/utils/noise_control.h>
+
+#include "tests.h"
+#include "scaling_test.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+extern UArena *main_ua;
+
+struct scaling_thread {
+	pthread_t thread;
+	pthread_barrier_t *barrier;
+	enum scaling_mode mode;
+	alloc_fn_t alloc_fn;
+	int id;
+	int cpu;
+	uint64_t alloc_iterations;
+	size_t arena_sz;
+	UArena *shared_ua;
+	uint64_t *timing_arr; // NULL unless raw samples are kept
+	struct hdr_histogram *hist; // NULL unless a histogram is kept
+	uint64_t ops;
+	uint64_t start_tsc;
+	uint64_t end_tsc;
+	struct alloc_tstats tstats;
+};
+
+const char *scaling_mode_string(enum scaling_mode mode)
+{
+	switch (mode) {
+	case SCALING_UA:
+		return "ua";
+	case SCALING_MALLOC:
+		return "malloc";
+	case SCALING_ATOMIC_UA:
+		return "atomic_ua";
+	default:
+		return "unknown";
+	}
+}
+
+enum scaling_mode scaling_mode_from_string(const char *string)
+{
+	for (int i = 0; i < SCALING_MODE_COUNT; ++i) {
+		if (strcmp(string, scaling_mode_string((enum scaling_mode)i)) ==
+		    0)
+			return (enum scaling_mode)i;
+	}
+
+	return SCALING_MODE_COUNT;
+}
+
+static alloc_fn_t scaling_alloc_fn(enum scaling_mode mode)
+{
+	switch (mode) {
+	case SCALING_UA:
+		return ua_alloc_timed;
+	case SCALING_MALLOC:
+		return malloc_timed;
+	case SCALING_ATOMIC_UA:
+		return ua_atomic_alloc_timed;
+	default:
+		return NULL;
+	}
+}
+
+static size_t pattern_bytes(void)
+{
+	size_t bytes = 0;
+	for (int i = 0; i < (int)LmArrayLen(small_sizes); ++i)
+		bytes += small_sizes[i];
+	for (int i = 0; i < (int)LmArrayLen(medium_sizes); ++i)
+		bytes += medium_sizes[i];
+	return bytes;
+}
+
+static void *scaling_thread_main(void *arg)
+{
+	struct scaling_thread *st = arg;
+	pin_thread_to_cpu(st->cpu);
+
+	alloc_fn_t alloc_fn = st->alloc_fn;
+	UArena *ua = st->shared_ua;
+	if (st->mode == SCALING_UA)
+		ua = ua_create(st->arena_sz, UA_CONTIGUOUS, UA_MMAPD);
+
+	// NOTE: (isa): malloc'd pointers have to be kept around so they can be
+	// freed once the thread is done, otherwise the next thread count would
+	// start with a heap that's already been grown
+	UArena *ptrs_ua = NULL;
+	void **ptrs = NULL;
+	if (st->mode == SCALING_MALLOC) {
+		ptrs_ua = ua_create(st->ops * sizeof(void *), UA_CONTIGUOUS,
+				    UA_MMAPD);
+		ptrs = UaPushArray(ptrs_ua, void *, st->ops);
+		memset(ptrs, 0, st->ops * sizeof(void *));
+	}
+
+	// Fault in the timing array up front, so it doesn't show up in the
+	// samples. The histogram was zeroed when it was pushed
+	if (st->timing_arr)
+		memset(st->timing_arr, 0, st->ops * sizeof(uint64_t));
+	init_alloc_tcoll(st->timing_arr ? st->ops : 0, st->timing_arr);
+	init_alloc_hist(st->hist);
+	*get_alloc_tstats() = (struct alloc_tstats){ 0 };
+
+	pthread_barrier_wait(st->barrier);
+
+	uint64_t op = 0;
+	START_TSC_TIMING_LFENCE(run);
+	for (uint64_t i = 0; i < st->alloc_iterations; ++i) {
+		for (int j = 0; j < (int)LmArrayLen(small_sizes); ++j) {
+			uint8_t *ptr = alloc_fn(ua, NULL, small_sizes[j]);
+			*ptr = 1;
+			if (ptrs)
+				ptrs[op] = ptr;
+			++op;
+		}
+		for (int j = 0; j < (int)LmArrayLen(medium_sizes); ++j) {
+			uint8_t *ptr = alloc_fn(ua, NULL, medium_sizes[j]);
+			*ptr = 1;
+			if (ptrs)
+				ptrs[op] = ptr;
+			++op;
+		}
+	}
+	END_TSC_TIMING_LFENCE(run);
+	st->start_tsc = run_start;
+	st->end_tsc = run_end;
+
+	st->tstats = *get_alloc_tstats();
+	init_alloc_tcoll(0, NULL);
+	init_alloc_hist(NULL);
+
+	if (ptrs) {
+		for (uint64_t i = 0; i < st->ops; ++i)
+			alloc_fn_free(alloc_fn, ptrs[i]);
+		ua_destroy(&ptrs_ua);
+	}
+
+	if (st->mode == SCALING_UA)
+		ua_destroy(&ua);
+
+	return NULL;
+}
+
+static double tsc_to_ns(uint64_t tsc, double tsc_freq)
+{
+	return (double)tsc / tsc_freq * 1e9;
+}
+
+static void log_thread_timings(struct scaling_thread *st, double tsc_freq)
+{
+	LmLogInfoR("\tthread %3d (cpu %3d): ", st->id, st->cpu);
+	if (st->hist)
+		hdr_log_percentiles(st->hist, "", LM_LOG_MODULE_LOCAL);
+	else
+		LmLogInfoR("avg %7.1f ns\n",
+			   tsc_to_ns(st->tstats.total_tsc, tsc_freq) /
+				   (double)st->tstats.iter);
+}
+
+// Returns the aggregate throughput in ops/s
+static double run_thread_count(struct scaling_params *params,
+			       enum scaling_mode mode, alloc_fn_t alloc_fn,
+			       const char *name, int thread_count, int *cpus,
+			       int cpu_count, const char *log_directory,
+			       int run_nr)
+{
+	uint64_t ops_per_thread =
+		params->alloc_iterations *
+		(LmArrayLen(small_sizes) + LmArrayLen(medium_sizes));
+	size_t arena_sz = params->alloc_iterations * pattern_bytes();
+	uint64_t total_ops = ops_per_thread * (uint64_t)thread_count;
+
+	struct alloc_timing_params *timing = &params->timing;
+	size_t hist_sz = timing->histogram ?
+				 hdr_mem_size(timing->significant_digits) :
+				 0;
+	UArena *run_ua = ua_create(
+		(timing->raw_samples ? total_ops * sizeof(uint64_t) : 0) +
+			(size_t)(thread_count + 1) *
+				(hist_sz + sizeof(struct hdr_histogram)) +
+			(size_t)thread_count * sizeof(struct scaling_thread) +
+			get_page_size(),
+		UA_CONTIGUOUS, UA_MMAPD);
+	uint64_t *timing_arr = NULL;
+	if (timing->raw_samples)
+		timing_arr = UaPushArray(run_ua, uint64_t, total_ops);
+	struct scaling_thread *threads =
+		UaPushArray(run_ua, struct scaling_thread, (size_t)thread_count);
+	struct hdr_histogram *hists = NULL;
+	if (timing->histogram) {
+		hists = UaPushArray(run_ua, struct hdr_histogram,
+				    (size_t)thread_count + 1);
+		// The threads' histograms are merged, so a failed init drops
+		// them all
+		for (int i = 0; i <= thread_count && hists; ++i)
+			if (hdr_init(&hists[i], timing->significant_digits,
+				     run_ua) != 0)
+				hists = NULL;
+	}
+
+	UArena *shared_ua = NULL;
+	if (mode == SCALING_ATOMIC_UA)
+		shared_ua = ua_create(arena_sz * (size_t)thread_count,
+				      UA_CONTIGUOUS, UA_MMAPD);
+
+	pthread_barrier_t barrier;
+	pthread_barrier_init(&barrier, NULL, (unsigned)thread_count);
+
+	for (int i = 0; i < thread_count; ++i) {
+		struct scaling_thread *st = &threads[i];
+		*st = (struct scaling_thread){ 0 };
+		st->barrier = &barrier;
+		st->mode = mode;
+		st->alloc_fn = alloc_fn;
+		st->id = i;
+		// A pinned benchmark would otherwise have every thread
+		// inherit the main thread's single CPU
+		bool pin = params->pin_threads ||
+			   noise_env_get()->pinned_cpu >= 0;
+		st->cpu = (pin && cpu_count > 0) ? cpus[i % cpu_count] : -1;
+		st->alloc_iterations = params->alloc_iterations;
+		st->arena_sz = arena_sz;
+		st->shared_ua = shared_ua;
+		if (timing_arr)
+			st->timing_arr =
+				timing_arr + (uint64_t)i * ops_per_thread;
+		if (hists)
+			st->hist = &hists[i + 1];
+		st->ops = ops_per_thread;
+		int err = pthread_create(&st->thread, NULL, scaling_thread_main,
+					 st);
+		LmAssert(err == 0, "Failed to create scaling thread: %s",
+			 strerror(err));
+	}
+
+	for (int i = 0; i < thread_count; ++i)
+		pthread_join(threads[i].thread, NULL);
+	pthread_barrier_destroy(&barrier);
+
+	double tsc_freq = get_tsc_freq();
+	uint64_t min_start = UINT64_MAX;
+	uint64_t max_end = 0;
+	struct alloc_tstats merged_tstats = { 0 };
+	for (int i = 0; i < thread_count; ++i) {
+		struct scaling_thread *st = &threads[i];
+		min_start = LmMin(min_start, st->start_tsc);
+		max_end = LmMax(max_end, st->end_tsc);
+		merged_tstats.total_tsc += st->tstats.total_tsc;
+		merged_tstats.iter += st->tstats.iter;
+	}
+
+	double sec = (double)(max_end - min_start) / tsc_freq;
+	double ops_s = (double)total_ops / sec;
+	LmLogInfoR("\n%s with %d threads: %.0f ops/s\n", name, thread_count,
+		   ops_s);
+	for (int i = 0; i < thread_count; ++i)
+		log_thread_timings(&threads[i], tsc_freq);
+
+	// hists[0] holds all threads merged
+	if (hists) {
+		for (int i = 1; i <= thread_count; ++i)
+			hdr_merge(&hists[0], &hists[i]);
+		hdr_log_percentiles(&hists[0], "\tall threads: ",
+				    LM_LOG_MODULE_LOCAL);
+	}
+
+	uint64_t raw_count = timing_arr ? total_ops : 0;
+	struct alloc_tcoll merged_tcoll = { raw_count, raw_count, timing_arr };
+	UAScratch uas = ua_scratch_begin(main_ua);
+	LmString filename = lm_string_make(log_directory, uas.ua);
+	lm_string_append_fmt(filename, "%d-%s-%dt.bin", run_nr, name,
+			     thread_count);
+	struct result_info info = {
+		.allocator = name,
+		.size_class = "small+medium",
+		.thread_count = (uint32_t)thread_count,
+	};
+	if (write_timing_data_to_file(filename, &info, &merged_tstats,
+				      &merged_tcoll) != 0)
+		LmLogError("Failed to write data to file %s", filename);
+	else if (hists && hdr_append_to_file(&hists[0], filename) != 0)
+		LmLogError("Failed to write histogram to %s", filename);
+	ua_scratch_release(uas);
+
+	if (shared_ua)
+		ua_destroy(&shared_ua);
+	ua_destroy(&run_ua);
+
+	return ops_s;
+}
+
+// Runs every thread count in the config and logs how the throughput scales.
+// ops_s has room for one entry per thread count
+static void run_scaling_curve(struct scaling_params *params,
+			      enum scaling_mode mode, alloc_fn_t alloc_fn,
+			      const char *name, int *cpus, int cpu_count,
+			      double *ops_s, const char *log_directory,
+			      int run_nr)
+{
+	for (int i = 0; i < params->thread_counts_len; ++i) {
+		int thread_count = params->thread_counts[i];
+		if (thread_count > cpu_count)
+			LmLogWarning(
+				"%d threads on %d CPUs, the results will include time spent descheduled",
+				thread_count, cpu_count);
+		ops_s[i] = run_thread_count(params, mode, alloc_fn, name,
+					    thread_count, cpus, cpu_count,
+					    log_directory, run_nr);
+	}
+
+	// NOTE: (isa): Speedup is relative to the first thread count in the
+	// config, scaled as if it ran on a single thread
+	double base = ops_s[0] / params->thread_counts[0];
+	LmLogInfoR("\n%s scaling curve:\n", name);
+	for (int i = 0; i < params->thread_counts_len; ++i) {
+		double speedup = ops_s[i] / base;
+		LmLogInfoR(
+			"\t%3d threads: %14.0f ops/s, speedup %6.2fx, efficiency %5.1f%%\n",
+			params->thread_counts[i], ops_s[i], speedup,
+			speedup / params->thread_counts[i] * 100);
+	}
+}
+
+void allocator_scaling_test(struct scaling_params *params,
+			    LmString log_filename, const char *log_directory,
+			    int run_nr)
+{
+	FILE *log_file = lm_open_file_by_name(log_filename, "w");
+	LmSetLogFileLocal(log_file);
+
+	int cpu_count = (int)sysconf(_SC_NPROCESSORS_ONLN);
+	UAScratch uas = ua_scratch_begin(main_ua);
+	int *cpus = UaPushArray(uas.ua, int, (size_t)cpu_count);
+	cpu_count = noise_cpus(cpus, cpu_count);
+	double *ops_s = UaPushArray(uas.ua, double,
+				    (size_t)params->thread_counts_len);
+
+	LmLogInfoR("Allocator scaling, %lu iterations of all small and medium "
+		   "sizes per thread, %d CPUs available%s\n",
+		   params->alloc_iterations, cpu_count,
+		   params->pin_threads ? ", threads pinned" : "");
+
+	for (int m = 0; m < SCALING_MODE_COUNT; ++m) {
+		enum scaling_mode mode = (enum scaling_mode)m;
+		if (params->modes[m])
+			run_scaling_curve(params, mode, scaling_alloc_fn(mode),
+					  scaling_mode_string(mode), cpus,
+					  cpu_count, ops_s, log_directory,
+					  run_nr);
+	}
+
+	for (int p = 0; p < alloc_plugin_count(); ++p) {
+		const struct alloc_plugin *plugin = alloc_plugin_get(p);
+		if (params->plugins[p])
+			run_scaling_curve(params, SCALING_MALLOC,
+					  plugin->alloc_fn, plugin->name, cpus,
+					  cpu_count, ops_s, log_directory,
+					  run_nr);
+	}
+
+	ua_scratch_release(uas);
+	LmRemoveLogFileLocal();
+	lm_close_file(log_file);
+}
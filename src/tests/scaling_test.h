@@ -0,0 +1,31 @@
+#ifndef SCALING_TEST_H
+#define SCALING_TEST_H
+
+#include <src/lm.h>
+#include <src/allocators/allocator_wrappers.h>
+
+enum scaling_mode {
+	SCALING_UA, // One UArena per thread
+	SCALING_MALLOC, // All threads share the malloc heap
+	SCALING_ATOMIC_UA, // All threads share one UArena
+	SCALING_MODE_COUNT
+};
+
+struct scaling_params {
+	uint64_t alloc_iterations;
+	int *thread_counts;
+	int thread_counts_len;
+	bool modes[SCALING_MODE_COUNT];
+	bool plugins[ALLOC_PLUGIN_MAX]; // Run like SCALING_MALLOC
+	bool pin_threads;
+	struct alloc_timing_params timing;
+};
+
+const char *scaling_mode_string(enum scaling_mode mode);
+enum scaling_mode scaling_mode_from_string(const char *string);
+
+void allocator_scaling_test(struct scaling_params *params,
+			    LmString log_filename, const char *log_directory,
+			    int run_nr);
+
+#endif
@@ -4,12 +4,26 @@ LM_LOG_REGISTER(tests);
 #include <src/cJSON/cJSON.h>
 #include <src/allocators/allocator_wrappers.h>
 #include <src/sdhs/Sdhs.h>
+#include <src/metrics/alloc_trace.h>
 #include <src/utils/system_info.h>
+#include <src/utils/noise_control.h>
 
 // NOTE: (isa): Network test has been moved to "poc" for now,
 // since it's not that interesting for an arena example
 //#include "network_test.h"
 #include "tight_loop_test.h"
+#include "workload.h"
+#include "numa_test.h"
+#include "ipc_test.h"
+#include "scaling_test.h"
+#include "replay_test.h"
+#include "batch_test.h"
+#include "lifetime_test.h"
+#include "realloc_test.h"
+#include "page_fault_test.h"
+#include "locality_test.h"
+#include "interleaved_test.h"
+#include "ka_cost_test.h"
 
 #include <stddef.h>
 #include <sys/wait.h>
@@ -19,22 +33,28 @@ LM_LOG_REGISTER(tests);
 extern UArena *main_ua;
 
 static const alloc_fn_t a_alloc_functions[] = {
-	oka_alloc_timed, ka_alloc_timed, ua_alloc_timed,
-	// ua_zalloc_timed,
+	oka_alloc_timed, ka_alloc_timed,  ua_alloc_timed,  ua_zalloc_timed,
+	ka_zalloc_timed, ua_talloc_timed, ka_talloc_timed, uffd_talloc_timed,
 	//ua_falloc_timed
 	//ua_fzalloc_timed
 };
 
-static const realloc_fn_t a_realloc_functions[] = { ua_realloc_timed };
+static const realloc_fn_t a_realloc_functions[] = { ua_realloc_timed,
+						    ua_realloc_top_timed };
 
 static const alloc_fn_t malloc_and_fam[] = { malloc_timed };
 static const realloc_fn_t realloc_functions[] = { realloc_timed };
 
 static const char *a_alloc_function_names[] = {
-	"okalloc", "kalloc", "ualloc", "zalloc", "falloc", "fzalloc"
+	"okalloc", "kalloc",  "ualloc",     "zalloc", "kzalloc",
+	"utalloc", "ktalloc", "uffdtalloc", "falloc", "fzalloc"
 };
 static const char *malloc_and_fam_names[] = { "malloc" };
 
+static const char *a_realloc_function_names[] = { "ua_realloc",
+						  "ua_realloc_top" };
+static const char *realloc_function_names[] = { "realloc" };
+
 // NOTE: (isa): Claude
 static int get_next_run_nr(LmString directory)
 {
@@ -83,53 +103,270 @@ static int make_dir(LmString log_directory)
 	return 0;
 }
 
-static void tight_loop_test_all_sizes(struct ua_params *params,
+static void tight_loop_test_workloads(struct ua_params *params,
 				      bool running_in_debugger, bool is_karena,
-				      uint64_t iterations, alloc_fn_t alloc_fn,
+				      struct workload *workloads,
+				      int workloads_len, alloc_fn_t alloc_fn,
 				      const char *alloc_fn_name,
 				      LmString log_filename,
 				      const char *file_mode,
-				      const char *log_filename_base)
+				      const char *log_filename_base,
+				      struct alloc_timing_params *timing,
+				      struct perf_params *perf_params,
+				      const struct cold_params *cold)
 {
-	tight_loop_test(params, running_in_debugger, is_karena, iterations,
-			alloc_fn, alloc_fn_name, small_sizes,
-			LmArrayLen(small_sizes), "small", log_filename,
-			file_mode, log_filename_base);
-
-	tight_loop_test(params, running_in_debugger, is_karena, iterations,
-			alloc_fn, alloc_fn_name, medium_sizes,
-			LmArrayLen(medium_sizes), "medium", log_filename,
-			file_mode, log_filename_base);
-
-	tight_loop_test(params, running_in_debugger, is_karena, iterations,
-			alloc_fn, alloc_fn_name, large_sizes,
-			LmArrayLen(large_sizes), "large", log_filename,
-			file_mode, log_filename_base);
+	for (int i = 0; i < workloads_len; ++i)
+		tight_loop_test(params, running_in_debugger, is_karena,
+				alloc_fn, alloc_fn_name, &workloads[i],
+				log_filename, file_mode, log_filename_base,
+				timing, perf_params, cold);
 }
 
-static int write_tsc_freq_to_file(LmString log_dir, int run_nr)
+static size_t parse_size_number(cJSON *json, size_t default_value)
 {
-	UAScratch uas = ua_scratch_begin(main_ua);
-	LmString tsc_freq_filename = lm_string_make(log_dir, uas.ua);
-	lm_string_append_fmt(tsc_freq_filename, "%d-tsc_freq.bin", run_nr);
-	double tsc_freq = get_tsc_freq();
-	if (lm_write_bytes_to_file_by_name((uint8_t *)&tsc_freq,
-					   sizeof(tsc_freq),
-					   tsc_freq_filename) != 0)
-		return -1;
-	ua_scratch_release(uas);
-	return 0;
+	return json ? (size_t)cJSON_GetNumberValue(json) : default_value;
+}
+
+static struct size_dist parse_size_dist(cJSON *workload_json,
+					const char *test_name)
+{
+	struct size_dist dist = { 0 };
+	cJSON *type_json = cJSON_GetObjectItem(workload_json, "type");
+	cJSON *sizes_json = cJSON_GetObjectItem(workload_json, "sizes");
+	cJSON *file_json = cJSON_GetObjectItem(workload_json, "file");
+
+	// Optional, a workload with only sizes is a list
+	dist.kind = type_json ? size_dist_kind_from_string(
+					cJSON_GetStringValue(type_json)) :
+				SIZE_DIST_LIST;
+	LmAssert(dist.kind != SIZE_DIST_KIND_COUNT,
+		 "%s has a workload with an unknown type", test_name);
+
+	dist.seed = (uint64_t)parse_size_number(
+		cJSON_GetObjectItem(workload_json, "seed"), 1);
+	dist.min_size = parse_size_number(
+		cJSON_GetObjectItem(workload_json, "min_size"), 1);
+	dist.max_size = parse_size_number(
+		cJSON_GetObjectItem(workload_json, "max_size"), 0);
+	dist.step = parse_size_number(cJSON_GetObjectItem(workload_json, "step"),
+				      8);
+	cJSON *median_json = cJSON_GetObjectItem(workload_json, "median");
+	cJSON *sigma_json = cJSON_GetObjectItem(workload_json, "sigma");
+	cJSON *exponent_json = cJSON_GetObjectItem(workload_json, "exponent");
+	dist.median = median_json ? cJSON_GetNumberValue(median_json) : 0;
+	dist.sigma = sigma_json ? cJSON_GetNumberValue(sigma_json) : 1;
+	dist.exponent = exponent_json ? cJSON_GetNumberValue(exponent_json) :
+					1;
+	if (file_json)
+		dist.histogram_file = lm_string_make(
+			cJSON_GetStringValue(file_json), main_ua);
+
+	if (cJSON_IsArray(sizes_json)) {
+		dist.sizes_len = (size_t)cJSON_GetArraySize(sizes_json);
+		dist.sizes = UaPushArray(main_ua, size_t,
+					 LmMax(dist.sizes_len, 1));
+		for (size_t i = 0; i < dist.sizes_len; ++i)
+			dist.sizes[i] = (size_t)cJSON_GetNumberValue(
+				cJSON_GetArrayItem(sizes_json, (int)i));
+	}
+
+	LmAssert(size_dist_init(&dist, main_ua) == 0,
+		 "%s has a workload with an invalid size distribution",
+		 test_name);
+	return dist;
+}
+
+// Optional, without "workloads" the small, medium and large sizes from
+// tests.h are run alloc_iterations times each. A workload's iterations and
+// threads default to alloc_iterations and 1
+static struct workload *parse_workloads(cJSON *ctx_json,
+					uint64_t alloc_iterations,
+					const char *test_name, int *len)
+{
+	cJSON *workloads_json = cJSON_GetObjectItem(ctx_json, "workloads");
+	if (!workloads_json) {
+		static size_t *default_sizes[] = { small_sizes, medium_sizes,
+						   large_sizes };
+		static const size_t default_lens[] = {
+			LmArrayLen(small_sizes), LmArrayLen(medium_sizes),
+			LmArrayLen(large_sizes)
+		};
+		static const char *default_names[] = { "small", "medium",
+						       "large" };
+
+		*len = (int)LmArrayLen(default_sizes);
+		struct workload *workloads =
+			UaPushArray(main_ua, struct workload, (size_t)*len);
+		for (int i = 0; i < *len; ++i)
+			workloads[i] = (struct workload){
+				.name = default_names[i],
+				.dist = { .kind = SIZE_DIST_LIST,
+					  .sizes = default_sizes[i],
+					  .sizes_len = default_lens[i] },
+				.iterations = alloc_iterations,
+				.threads = 1,
+			};
+		return workloads;
+	}
+
+	LmAssert(cJSON_IsArray(workloads_json) &&
+			 cJSON_GetArraySize(workloads_json) > 0,
+		 "%s's workloads must be a non-empty array", test_name);
+	*len = cJSON_GetArraySize(workloads_json);
+	struct workload *workloads =
+		UaPushArray(main_ua, struct workload, (size_t)*len);
+
+	for (int i = 0; i < *len; ++i) {
+		cJSON *workload_json = cJSON_GetArrayItem(workloads_json, i);
+		cJSON *name_json = cJSON_GetObjectItem(workload_json, "name");
+		LmAssert(name_json, "%s has a workload without a name",
+			 test_name);
+
+		// The name picks the workload's result directory
+		for (int j = 0; j < i; ++j)
+			LmAssert(strcmp(workloads[j].name,
+					cJSON_GetStringValue(name_json)) != 0,
+				 "%s has two workloads named %s", test_name,
+				 workloads[j].name);
+
+		struct workload *w = &workloads[i];
+		w->name = lm_string_make(cJSON_GetStringValue(name_json),
+					 main_ua);
+		w->dist = parse_size_dist(workload_json, test_name);
+		w->iterations = (uint64_t)parse_size_number(
+			cJSON_GetObjectItem(workload_json, "iterations"),
+			alloc_iterations);
+		w->threads = (int)parse_size_number(
+			cJSON_GetObjectItem(workload_json, "threads"), 1);
+		LmAssert(w->iterations > 0 && w->threads > 0,
+			 "%s's workload %s needs iterations and threads > 0",
+			 test_name, w->name);
+	}
+
+	return workloads;
+}
+
+static void log_workloads(struct workload *workloads, int workloads_len)
+{
+	LmLogInfoR("\nWorkloads:\n");
+	for (int i = 0; i < workloads_len; ++i)
+		workload_log(&workloads[i], LM_LOG_MODULE_LOCAL);
+}
+
+// Optional, both raw samples and a histogram with 3 significant digits are
+// kept by default. Long runs can turn raw_samples off to avoid storing every
+// timing
+static struct alloc_timing_params parse_timing_params(cJSON *ctx_json)
+{
+	struct alloc_timing_params params = { .raw_samples = true,
+					      .histogram = true,
+					      .significant_digits = 3 };
+	cJSON *timing_json = cJSON_GetObjectItem(ctx_json, "timing");
+	if (!timing_json)
+		return params;
+
+	cJSON *raw_samples_json =
+		cJSON_GetObjectItem(timing_json, "raw_samples");
+	cJSON *histogram_json = cJSON_GetObjectItem(timing_json, "histogram");
+	cJSON *digits_json =
+		cJSON_GetObjectItem(timing_json, "significant_digits");
+	if (raw_samples_json)
+		params.raw_samples = cJSON_IsTrue(raw_samples_json);
+	if (histogram_json)
+		params.histogram = cJSON_IsTrue(histogram_json);
+	if (digits_json)
+		params.significant_digits =
+			(int)cJSON_GetNumberValue(digits_json);
+
+	LmAssert(params.raw_samples || params.histogram,
+		 "Timing context needs raw_samples or histogram enabled");
+	LmAssert(params.significant_digits >= HDR_MIN_DIGITS &&
+			 params.significant_digits <= HDR_MAX_DIGITS,
+		 "Histogram significant_digits must be %d to %d",
+		 HDR_MIN_DIGITS, HDR_MAX_DIGITS);
+	return params;
+}
+
+// Optional, the counters are off unless the context has "perf": { "enabled":
+// true }. They are probed once here so an unprivileged run warns a single time
+static struct perf_params parse_perf_params(cJSON *ctx_json)
+{
+	struct perf_params params = { 0 };
+	cJSON *perf_json = cJSON_GetObjectItem(ctx_json, "perf");
+	if (!perf_json)
+		return params;
+
+	params.enabled = cJSON_IsTrue(cJSON_GetObjectItem(perf_json, "enabled"));
+	params.per_alloc =
+		cJSON_IsTrue(cJSON_GetObjectItem(perf_json, "per_alloc"));
+	if (params.enabled && !perf_counters_probe())
+		params.enabled = false;
+	return params;
+}
+
+// Optional, every phase runs warm only unless the context has "cold": {
+// "modes": [...] }. Returns whether any cold mode is enabled
+static bool parse_cold_params(cJSON *ctx_json, struct cold_params *params)
+{
+	*params = (struct cold_params){ .every = 1,
+					.recent_blocks = 64,
+					.tlb_walk_sz = 16 * 1024 * 1024,
+					.interfere_sz = 64 * 1024 * 1024,
+					.interfere_cpu = -1 };
+	cJSON *cold_json = cJSON_GetObjectItem(ctx_json, "cold");
+	if (!cold_json)
+		return false;
+
+	bool enabled = false;
+	cJSON *mode_json;
+	cJSON_ArrayForEach(mode_json, cJSON_GetObjectItem(cold_json, "modes"))
+	{
+		LmAssert(cJSON_IsString(mode_json),
+			 "The cold modes have to be strings");
+		enum perturb_mode mode =
+			perturb_mode_from_string(cJSON_GetStringValue(mode_json));
+		LmAssert(mode != PERTURB_MODE_COUNT, "Unknown cold mode %s",
+			 cJSON_GetStringValue(mode_json));
+		params->modes[mode] = true;
+		enabled = true;
+	}
+
+	cJSON *every_json = cJSON_GetObjectItem(cold_json, "every");
+	cJSON *recent_blocks_json =
+		cJSON_GetObjectItem(cold_json, "recent_blocks");
+	cJSON *tlb_walk_sz_json = cJSON_GetObjectItem(cold_json, "tlb_walk_sz");
+	cJSON *interfere_sz_json =
+		cJSON_GetObjectItem(cold_json, "interfere_sz");
+	cJSON *interfere_cpu_json =
+		cJSON_GetObjectItem(cold_json, "interfere_cpu");
+	if (every_json)
+		params->every = (uint64_t)cJSON_GetNumberValue(every_json);
+	if (recent_blocks_json)
+		params->recent_blocks =
+			(uint64_t)cJSON_GetNumberValue(recent_blocks_json);
+	if (tlb_walk_sz_json)
+		params->tlb_walk_sz = lm_mem_sz_from_string(
+			cJSON_GetStringValue(tlb_walk_sz_json));
+	if (interfere_sz_json)
+		params->interfere_sz = lm_mem_sz_from_string(
+			cJSON_GetStringValue(interfere_sz_json));
+	if (interfere_cpu_json)
+		params->interfere_cpu =
+			(int)cJSON_GetNumberValue(interfere_cpu_json);
+
+	LmAssert(params->every > 0, "Cold context's every is 0");
+	return enabled;
 }
 
-static void prepare_logging(cJSON *log_dir_json, LmString *log_dir,
-			    LmString *log_filename)
+static int prepare_logging(cJSON *log_dir_json, LmString *log_dir,
+			   LmString *log_filename)
 {
 	*log_dir = lm_string_make(cJSON_GetStringValue(log_dir_json), main_ua);
 	make_dir(*log_dir);
 	*log_filename = lm_string_make(*log_dir, main_ua);
 	int run_nr = get_next_run_nr(*log_dir);
 	lm_string_append_fmt(*log_filename, "%d-log.txt", run_nr);
-	write_tsc_freq_to_file(*log_dir, run_nr);
+	return run_nr;
 }
 
 // TODO: (isa): Make the data directory just "./logs/arena/", since karena
@@ -155,9 +392,37 @@ static int arena_test(void *ctx, bool running_in_debugger)
 		lm_mem_sz_from_string(cJSON_GetStringValue(arena_sz_json));
 	params.mallocd = cJSON_IsTrue(mallocd_json);
 	params.contiguous = cJSON_IsTrue(contiguous_json);
+
+	// Optional, the userfaultfd arena populates one page per fault without
+	// it
+	params.uffd.prefetch = UA_UFFD_PREFETCH_NONE;
+	params.uffd.batch_pages = 1;
+	cJSON *uffd_json = cJSON_GetObjectItem(ctx_json, "uffd");
+	if (uffd_json) {
+		cJSON *prefetch_json =
+			cJSON_GetObjectItem(uffd_json, "prefetch");
+		cJSON *batch_pages_json =
+			cJSON_GetObjectItem(uffd_json, "batch_pages");
+		cJSON *zeropage_json =
+			cJSON_GetObjectItem(uffd_json, "zeropage");
+		if (prefetch_json)
+			params.uffd.prefetch = ua_uffd_prefetch_from_string(
+				cJSON_GetStringValue(prefetch_json));
+		if (batch_pages_json)
+			params.uffd.batch_pages = (size_t)cJSON_GetNumberValue(
+				batch_pages_json);
+		params.uffd.zeropage = cJSON_IsTrue(zeropage_json);
+	}
 	uint64_t alloc_iterations =
 		(uint64_t)cJSON_GetNumberValue(alloc_iterations_json);
 	LmAssert(alloc_iterations > 0, "u_arena_test's alloc_iterations is 0");
+	struct alloc_timing_params timing_params = parse_timing_params(ctx_json);
+	struct perf_params perf_params = parse_perf_params(ctx_json);
+	struct cold_params cold_params;
+	bool cold = parse_cold_params(ctx_json, &cold_params);
+	int workloads_len;
+	struct workload *workloads = parse_workloads(
+		ctx_json, alloc_iterations, "u_arena_test", &workloads_len);
 
 	LmString log_dir;
 	LmString log_filename;
@@ -168,10 +433,17 @@ static int arena_test(void *ctx, bool running_in_debugger)
 	LmLogInfoR("UArena info:\n"
 		   "\tContiguous:   %s\n"
 		   "\tMallocd:      %s\n"
-		   "\tCap:          %zd\n",
+		   "\tCap:          %zd\n"
+		   "\tuffd:         prefetch %s, batch %zd pages, %s\n",
 		   LmBoolToString(params.contiguous),
-		   LmBoolToString(params.mallocd), params.arena_sz);
+		   LmBoolToString(params.mallocd), params.arena_sz,
+		   ua_uffd_prefetch_string(params.uffd.prefetch),
+		   params.uffd.batch_pages,
+		   params.uffd.zeropage ? "zeropage" : "copy");
 	LmLogInfoR("\nTSC freq: %.0f\n", get_tsc_freq());
+	LmLogInfoR("Timer overhead subtracted: %lu TSC\n",
+		   get_alloc_timer_overhead());
+	log_workloads(workloads, workloads_len);
 	LmRemoveLogFileLocal();
 	lm_close_file(log_file);
 
@@ -182,12 +454,16 @@ static int arena_test(void *ctx, bool running_in_debugger)
 		realloc_fn_t realloc_fn = a_realloc_functions[0];
 
 		bool is_karena = (alloc_fn == ka_alloc_timed ||
+				  alloc_fn == ka_zalloc_timed ||
+				  alloc_fn == ka_talloc_timed ||
 				  alloc_fn == oka_alloc_timed);
 
-		tight_loop_test_all_sizes(&params, running_in_debugger,
-					  is_karena, alloc_iterations, alloc_fn,
-					  alloc_fn_name, log_filename,
-					  file_mode, log_dir);
+		tight_loop_test_workloads(&params, running_in_debugger,
+					  is_karena, workloads, workloads_len,
+					  alloc_fn, alloc_fn_name, log_filename,
+					  file_mode, log_dir, &timing_params,
+					  &perf_params,
+					  cold ? &cold_params : NULL);
 	}
 
 	return 0;
@@ -211,6 +487,20 @@ static int malloc_test(void *ctx, bool running_in_debugger)
 	prepare_logging(log_directory_json, &log_dir, &log_filename);
 
 	LmAssert(alloc_iterations > 0, "malloc_test's alloc_iterations is 0");
+	struct alloc_timing_params timing_params = parse_timing_params(ctx_json);
+	struct perf_params perf_params = parse_perf_params(ctx_json);
+	struct cold_params cold_params;
+	bool cold = parse_cold_params(ctx_json, &cold_params);
+	int workloads_len;
+	struct workload *workloads = parse_workloads(
+		ctx_json, alloc_iterations, "malloc_test", &workloads_len);
+
+	FILE *log_file = lm_open_file_by_name(log_filename, "w");
+	LmSetLogFileLocal(log_file);
+	LmLogInfoR("TSC freq: %.0f\n", get_tsc_freq());
+	log_workloads(workloads, workloads_len);
+	LmRemoveLogFileLocal();
+	lm_close_file(log_file);
 
 	const char *file_mode = "a";
 	for (int i = 0; i < (int)LmArrayLen(malloc_and_fam); ++i) {
@@ -218,10 +508,23 @@ static int malloc_test(void *ctx, bool running_in_debugger)
 		const char *alloc_fn_name = malloc_and_fam_names[i];
 		realloc_fn_t realloc_fn = realloc_functions[0];
 
-		tight_loop_test_all_sizes(NULL, running_in_debugger, false,
-					  alloc_iterations, alloc_fn,
+		tight_loop_test_workloads(NULL, running_in_debugger, false,
+					  workloads, workloads_len, alloc_fn,
 					  alloc_fn_name, log_filename,
-					  file_mode, log_dir);
+					  file_mode, log_dir, &timing_params,
+					  &perf_params,
+					  cold ? &cold_params : NULL);
+	}
+
+	// Loaded from the suite's allocator_plugins, see load_alloc_plugins
+	for (int i = 0; i < alloc_plugin_count(); ++i) {
+		const struct alloc_plugin *plugin = alloc_plugin_get(i);
+		tight_loop_test_workloads(NULL, running_in_debugger, false,
+					  workloads, workloads_len,
+					  plugin->alloc_fn, plugin->name,
+					  log_filename, file_mode, log_dir,
+					  &timing_params, &perf_params,
+					  cold ? &cold_params : NULL);
 	}
 	return 0;
 }
@@ -239,7 +542,24 @@ static int sdhs_test(void *ctx, bool running_in_debugger)
 
 	LmString log_dir;
 	LmString log_filename;
-	prepare_logging(log_directory_json, &log_dir, &log_filename);
+	int run_nr = prepare_logging(log_directory_json, &log_dir,
+				     &log_filename);
+
+	// Optionally records every allocation made during the run, so it can be
+	// replayed against the other allocators by the replay test
+	size_t trace_max_events = 0;
+	cJSON *trace_json = cJSON_GetObjectItem(ctx_json, "trace");
+	if (trace_json &&
+	    cJSON_IsTrue(cJSON_GetObjectItem(trace_json, "enabled"))) {
+		cJSON *max_events_json =
+			cJSON_GetObjectItem(trace_json, "max_events");
+		LmAssert(max_events_json,
+			 "sdhs_test's trace has no max_events entry");
+		trace_max_events = (size_t)cJSON_GetNumberValue(max_events_json);
+	}
+
+	LmString trace_filename = lm_string_make(log_dir, main_ua);
+	lm_string_append_fmt(trace_filename, "%d-alloc-trace.bin", run_nr);
 
 	if (!running_in_debugger) {
 		pid_t pid;
@@ -248,21 +568,638 @@ static int sdhs_test(void *ctx, bool running_in_debugger)
 			LmLogError("Fork failed: %s", strerror(errno));
 			return -1;
 		} else if (pid == 0) {
+			if (trace_max_events)
+				alloc_trace_start(trace_max_events);
 			SdhsMain(log_dir);
+			if (trace_max_events)
+				alloc_trace_stop(trace_filename);
 			exit(EXIT_SUCCESS);
 		} else {
 			waitpid(pid, &status, 0);
 		}
 	} else {
+		if (trace_max_events)
+			alloc_trace_start(trace_max_events);
 		SdhsMain(log_dir);
+		if (trace_max_events)
+			alloc_trace_stop(trace_filename);
+	}
+
+	return 0;
+}
+
+static int numa_test(void *ctx, bool running_in_debugger)
+{
+	cJSON *ctx_json = ctx;
+	cJSON *buf_sz_json = cJSON_GetObjectItem(ctx_json, "buf_sz");
+	cJSON *iterations_json = cJSON_GetObjectItem(ctx_json, "iterations");
+	cJSON *log_directory_json =
+		cJSON_GetObjectItem(ctx_json, "log_directory");
+	LmAssert(buf_sz_json && iterations_json && log_directory_json,
+		 "numa_test's context JSON is malformed");
+
+	size_t buf_sz =
+		lm_mem_sz_from_string(cJSON_GetStringValue(buf_sz_json));
+	uint64_t iterations = (uint64_t)cJSON_GetNumberValue(iterations_json);
+	LmAssert(buf_sz > 0 && iterations > 0,
+		 "numa_test's buf_sz or iterations is 0");
+
+	LmString log_dir;
+	LmString log_filename;
+	int run_nr = prepare_logging(log_directory_json, &log_dir,
+				     &log_filename);
+
+	numa_bandwidth_test(buf_sz, iterations, log_filename, log_dir, run_nr);
+
+	return 0;
+}
+
+static int ipc_test(void *ctx, bool running_in_debugger)
+{
+	cJSON *ctx_json = ctx;
+	cJSON *msg_sz_json = cJSON_GetObjectItem(ctx_json, "msg_sz");
+	cJSON *msg_count_json = cJSON_GetObjectItem(ctx_json, "msg_count");
+	cJSON *slot_count_json = cJSON_GetObjectItem(ctx_json, "slot_count");
+	cJSON *producer_cpu_json = cJSON_GetObjectItem(ctx_json, "producer_cpu");
+	cJSON *consumer_cpu_json = cJSON_GetObjectItem(ctx_json, "consumer_cpu");
+	cJSON *log_directory_json =
+		cJSON_GetObjectItem(ctx_json, "log_directory");
+	LmAssert(msg_sz_json && msg_count_json && slot_count_json &&
+			 producer_cpu_json && consumer_cpu_json &&
+			 log_directory_json,
+		 "ipc_test's context JSON is malformed");
+
+	struct ipc_params params = { 0 };
+	params.msg_sz =
+		lm_mem_sz_from_string(cJSON_GetStringValue(msg_sz_json));
+	params.msg_count = (uint64_t)cJSON_GetNumberValue(msg_count_json);
+	params.slot_count = (uint64_t)cJSON_GetNumberValue(slot_count_json);
+	params.producer_cpu = (int)cJSON_GetNumberValue(producer_cpu_json);
+	params.consumer_cpu = (int)cJSON_GetNumberValue(consumer_cpu_json);
+	LmAssert(params.msg_sz > 0 && params.msg_count > 0 &&
+			 params.slot_count > 0,
+		 "ipc_test's msg_sz, msg_count or slot_count is 0");
+
+	LmString log_dir;
+	LmString log_filename;
+	int run_nr = prepare_logging(log_directory_json, &log_dir,
+				     &log_filename);
+
+	ipc_throughput_test(&params, log_filename, log_dir, run_nr);
+
+	return 0;
+}
+
+static int scaling_test(void *ctx, bool running_in_debugger)
+{
+	cJSON *ctx_json = ctx;
+	cJSON *threads_json = cJSON_GetObjectItem(ctx_json, "threads");
+	cJSON *alloc_iterations_json =
+		cJSON_GetObjectItem(ctx_json, "alloc_iterations");
+	cJSON *modes_json = cJSON_GetObjectItem(ctx_json, "modes");
+	cJSON *pin_threads_json = cJSON_GetObjectItem(ctx_json, "pin_threads");
+	cJSON *log_directory_json =
+		cJSON_GetObjectItem(ctx_json, "log_directory");
+	LmAssert(cJSON_IsArray(threads_json) && alloc_iterations_json &&
+			 cJSON_IsArray(modes_json) && log_directory_json,
+		 "scaling_test's context JSON is malformed");
+
+	struct scaling_params params = { 0 };
+	params.alloc_iterations =
+		(uint64_t)cJSON_GetNumberValue(alloc_iterations_json);
+	params.pin_threads = cJSON_IsTrue(pin_threads_json);
+	params.timing = parse_timing_params(ctx_json);
+	params.thread_counts_len = cJSON_GetArraySize(threads_json);
+	LmAssert(params.alloc_iterations > 0 && params.thread_counts_len > 0,
+		 "scaling_test's alloc_iterations or threads is empty");
+
+	params.thread_counts =
+		UaPushArray(main_ua, int, (size_t)params.thread_counts_len);
+	for (int i = 0; i < params.thread_counts_len; ++i) {
+		params.thread_counts[i] = (int)cJSON_GetNumberValue(
+			cJSON_GetArrayItem(threads_json, i));
+		LmAssert(params.thread_counts[i] > 0,
+			 "scaling_test's thread counts must be positive");
+	}
+
+	cJSON *mode_json;
+	cJSON_ArrayForEach(mode_json, modes_json)
+	{
+		const char *mode_name = cJSON_GetStringValue(mode_json);
+		enum scaling_mode mode = scaling_mode_from_string(mode_name);
+		const struct alloc_plugin *plugin = alloc_plugin_find(mode_name);
+		if (mode != SCALING_MODE_COUNT)
+			params.modes[mode] = true;
+		else if (plugin)
+			params.plugins[plugin - alloc_plugin_get(0)] = true;
+		else
+			LmLogWarning("Unknown scaling mode %s", mode_name);
+	}
+
+	LmString log_dir;
+	LmString log_filename;
+	int run_nr = prepare_logging(log_directory_json, &log_dir,
+				     &log_filename);
+
+	allocator_scaling_test(&params, log_filename, log_dir, run_nr);
+
+	return 0;
+}
+
+static int replay_test(void *ctx, bool running_in_debugger)
+{
+	cJSON *ctx_json = ctx;
+	cJSON *trace_file_json = cJSON_GetObjectItem(ctx_json, "trace_file");
+	cJSON *arena_sz_json = cJSON_GetObjectItem(ctx_json, "arena_sz");
+	cJSON *backends_json = cJSON_GetObjectItem(ctx_json, "backends");
+	cJSON *log_directory_json =
+		cJSON_GetObjectItem(ctx_json, "log_directory");
+	LmAssert(trace_file_json && arena_sz_json &&
+			 cJSON_IsArray(backends_json) && log_directory_json,
+		 "replay_test's context JSON is malformed");
+
+	struct replay_params params = { 0 };
+	params.trace_file = cJSON_GetStringValue(trace_file_json);
+	params.arena_sz =
+		lm_mem_sz_from_string(cJSON_GetStringValue(arena_sz_json));
+	LmAssert(params.arena_sz > 0, "replay_test's arena_sz is 0");
+
+	cJSON *backend_json;
+	cJSON_ArrayForEach(backend_json, backends_json)
+	{
+		const char *backend_name = cJSON_GetStringValue(backend_json);
+		enum replay_backend backend =
+			replay_backend_from_string(backend_name);
+		const struct alloc_plugin *plugin =
+			alloc_plugin_find(backend_name);
+		if (backend != REPLAY_BACKEND_COUNT)
+			params.backends[backend] = true;
+		else if (plugin)
+			params.plugins[plugin - alloc_plugin_get(0)] = true;
+		else
+			LmLogWarning("Unknown replay backend %s", backend_name);
+	}
+
+	LmString log_dir;
+	LmString log_filename;
+	int run_nr = prepare_logging(log_directory_json, &log_dir,
+				     &log_filename);
+
+	trace_replay_test(&params, log_filename, log_dir, run_nr);
+
+	return 0;
+}
+
+static int batch_test(void *ctx, bool running_in_debugger)
+{
+	cJSON *ctx_json = ctx;
+	cJSON *alloc_size_json = cJSON_GetObjectItem(ctx_json, "alloc_size");
+	cJSON *samples_json = cJSON_GetObjectItem(ctx_json, "samples");
+	cJSON *warmup_json = cJSON_GetObjectItem(ctx_json, "warmup");
+	cJSON *backends_json = cJSON_GetObjectItem(ctx_json, "backends");
+	cJSON *log_directory_json =
+		cJSON_GetObjectItem(ctx_json, "log_directory");
+	LmAssert(alloc_size_json && samples_json &&
+			 cJSON_IsArray(backends_json) && log_directory_json,
+		 "batch_test's context JSON is malformed");
+
+	struct batch_params params = { 0 };
+	params.alloc_size = (size_t)cJSON_GetNumberValue(alloc_size_json);
+	params.samples = (uint64_t)cJSON_GetNumberValue(samples_json);
+	// Optional
+	params.warmup = warmup_json ?
+				(uint64_t)cJSON_GetNumberValue(warmup_json) :
+				params.samples / 10;
+	LmAssert(params.alloc_size > 0 && params.samples > 0,
+		 "batch_test's alloc_size or samples is 0");
+
+	cJSON *backend_json;
+	cJSON_ArrayForEach(backend_json, backends_json)
+	{
+		const char *backend_name = cJSON_GetStringValue(backend_json);
+		enum batch_backend backend =
+			batch_backend_from_string(backend_name);
+		if (backend == BATCH_BACKEND_COUNT) {
+			LmLogWarning("Unknown batch backend %s", backend_name);
+			continue;
+		}
+		params.backends[backend] = true;
 	}
 
+	LmString log_dir;
+	LmString log_filename;
+	int run_nr = prepare_logging(log_directory_json, &log_dir,
+				     &log_filename);
+
+	unrolled_batch_test(&params, log_filename, log_dir, run_nr);
+
+	return 0;
+}
+
+static int lifetime_workload_test(void *ctx, bool running_in_debugger)
+{
+	cJSON *ctx_json = ctx;
+	cJSON *allocations_json = cJSON_GetObjectItem(ctx_json, "allocations");
+	cJSON *live_objects_json = cJSON_GetObjectItem(ctx_json, "live_objects");
+	cJSON *min_size_json = cJSON_GetObjectItem(ctx_json, "min_size");
+	cJSON *max_size_json = cJSON_GetObjectItem(ctx_json, "max_size");
+	cJSON *arena_sz_json = cJSON_GetObjectItem(ctx_json, "arena_sz");
+	cJSON *sample_interval_json =
+		cJSON_GetObjectItem(ctx_json, "sample_interval");
+	cJSON *seed_json = cJSON_GetObjectItem(ctx_json, "seed");
+	cJSON *workloads_json = cJSON_GetObjectItem(ctx_json, "workloads");
+	cJSON *backends_json = cJSON_GetObjectItem(ctx_json, "backends");
+	cJSON *log_directory_json =
+		cJSON_GetObjectItem(ctx_json, "log_directory");
+	LmAssert(allocations_json && live_objects_json && min_size_json &&
+			 max_size_json && arena_sz_json &&
+			 cJSON_IsArray(workloads_json) &&
+			 cJSON_IsArray(backends_json) && log_directory_json,
+		 "lifetime_test's context JSON is malformed");
+
+	struct lifetime_params params = { 0 };
+	params.allocations = (uint64_t)cJSON_GetNumberValue(allocations_json);
+	params.live_objects =
+		(uint64_t)cJSON_GetNumberValue(live_objects_json);
+	params.min_size = (size_t)cJSON_GetNumberValue(min_size_json);
+	params.max_size = (size_t)cJSON_GetNumberValue(max_size_json);
+	params.arena_sz =
+		lm_mem_sz_from_string(cJSON_GetStringValue(arena_sz_json));
+	// Optional
+	params.sample_interval =
+		sample_interval_json ?
+			(uint64_t)cJSON_GetNumberValue(sample_interval_json) :
+			LmMax(params.allocations / 1000, 1);
+	params.seed = seed_json ? (uint64_t)cJSON_GetNumberValue(seed_json) :
+				  1;
+	LmAssert(params.allocations > 0 && params.live_objects > 0 &&
+			 params.sample_interval > 0 && params.arena_sz > 0,
+		 "lifetime_test's allocations, live_objects, sample_interval or arena_sz is 0");
+	LmAssert(params.min_size > 0 && params.min_size <= params.max_size,
+		 "lifetime_test's sizes must satisfy 0 < min_size <= max_size");
+
+	cJSON *workload_json;
+	cJSON_ArrayForEach(workload_json, workloads_json)
+	{
+		const char *workload_name = cJSON_GetStringValue(workload_json);
+		enum lifetime_workload workload =
+			lifetime_workload_from_string(workload_name);
+		if (workload == LIFETIME_WORKLOAD_COUNT) {
+			LmLogWarning("Unknown lifetime workload %s",
+				     workload_name);
+			continue;
+		}
+		params.workloads[workload] = true;
+	}
+
+	cJSON *backend_json;
+	cJSON_ArrayForEach(backend_json, backends_json)
+	{
+		const char *backend_name = cJSON_GetStringValue(backend_json);
+		enum lifetime_backend backend =
+			lifetime_backend_from_string(backend_name);
+		if (backend == LIFETIME_BACKEND_COUNT) {
+			LmLogWarning("Unknown lifetime backend %s",
+				     backend_name);
+			continue;
+		}
+		params.backends[backend] = true;
+	}
+
+	LmString log_dir;
+	LmString log_filename;
+	int run_nr = prepare_logging(log_directory_json, &log_dir,
+				     &log_filename);
+
+	lifetime_test(&params, running_in_debugger, log_filename, log_dir,
+		      run_nr);
+
+	return 0;
+}
+
+static int realloc_test(void *ctx, bool running_in_debugger)
+{
+	cJSON *ctx_json = ctx;
+	cJSON *elements_json = cJSON_GetObjectItem(ctx_json, "elements");
+	cJSON *elem_size_json = cJSON_GetObjectItem(ctx_json, "elem_size");
+	cJSON *increment_json = cJSON_GetObjectItem(ctx_json, "increment");
+	cJSON *repetitions_json = cJSON_GetObjectItem(ctx_json, "repetitions");
+	cJSON *interleave_json =
+		cJSON_GetObjectItem(ctx_json, "interleave_every");
+	cJSON *arena_sz_json = cJSON_GetObjectItem(ctx_json, "arena_sz");
+	cJSON *patterns_json = cJSON_GetObjectItem(ctx_json, "patterns");
+	cJSON *log_directory_json =
+		cJSON_GetObjectItem(ctx_json, "log_directory");
+	LmAssert(elements_json && elem_size_json && increment_json &&
+			 repetitions_json && arena_sz_json &&
+			 cJSON_IsArray(patterns_json) && log_directory_json,
+		 "realloc_test's context JSON is malformed");
+
+	struct growth_params params = { 0 };
+	params.elements = (uint64_t)cJSON_GetNumberValue(elements_json);
+	params.elem_size = (size_t)cJSON_GetNumberValue(elem_size_json);
+	params.increment = (uint64_t)cJSON_GetNumberValue(increment_json);
+	params.repetitions = (uint64_t)cJSON_GetNumberValue(repetitions_json);
+	// Optional
+	params.interleave_every =
+		interleave_json ?
+			(uint64_t)cJSON_GetNumberValue(interleave_json) :
+			0;
+	params.arena_sz =
+		lm_mem_sz_from_string(cJSON_GetStringValue(arena_sz_json));
+	LmAssert(params.elements > 0 && params.elem_size > 0 &&
+			 params.elem_size <= 64 && params.increment > 0 &&
+			 params.repetitions > 0 && params.arena_sz > 0,
+		 "realloc_test's elements, increment, repetitions or arena_sz is 0, or elem_size is not 1 to 64");
+
+	cJSON *pattern_json;
+	cJSON_ArrayForEach(pattern_json, patterns_json)
+	{
+		const char *pattern_name = cJSON_GetStringValue(pattern_json);
+		enum growth_pattern pattern =
+			growth_pattern_from_string(pattern_name);
+		if (pattern == GROWTH_PATTERN_COUNT) {
+			LmLogWarning("Unknown growth pattern %s", pattern_name);
+			continue;
+		}
+		params.patterns[pattern] = true;
+	}
+
+	LmString log_dir;
+	LmString log_filename;
+	int run_nr = prepare_logging(log_directory_json, &log_dir,
+				     &log_filename);
+
+	FILE *log_file = lm_open_file_by_name(log_filename, "w");
+	LmSetLogFileLocal(log_file);
+	LmLogInfoR(
+		"Realloc growth: %lu elements of %zd bytes, increment %lu, %lu repetitions, interleaved allocation every %lu reallocs\n",
+		params.elements, params.elem_size, params.increment,
+		params.repetitions, params.interleave_every);
+	LmRemoveLogFileLocal();
+	lm_close_file(log_file);
+
+	for (int i = 0; i < (int)LmArrayLen(a_realloc_functions); ++i)
+		realloc_growth_test(&params, a_realloc_functions[i],
+				    a_realloc_function_names[i], true,
+				    log_filename, log_dir, run_nr);
+
+	for (int i = 0; i < (int)LmArrayLen(realloc_functions); ++i)
+		realloc_growth_test(&params, realloc_functions[i],
+				    realloc_function_names[i], false,
+				    log_filename, log_dir, run_nr);
+
+	return 0;
+}
+
+static int page_fault_test(void *ctx, bool running_in_debugger)
+{
+	cJSON *ctx_json = ctx;
+	cJSON *buf_sz_json = cJSON_GetObjectItem(ctx_json, "buf_sz");
+	cJSON *iterations_json = cJSON_GetObjectItem(ctx_json, "iterations");
+	cJSON *backings_json = cJSON_GetObjectItem(ctx_json, "backings");
+	cJSON *log_directory_json =
+		cJSON_GetObjectItem(ctx_json, "log_directory");
+	LmAssert(buf_sz_json && iterations_json &&
+			 cJSON_IsArray(backings_json) && log_directory_json,
+		 "page_fault_test's context JSON is malformed");
+
+	struct page_fault_params params = { 0 };
+	params.buf_sz =
+		lm_mem_sz_from_string(cJSON_GetStringValue(buf_sz_json));
+	params.iterations = (uint64_t)cJSON_GetNumberValue(iterations_json);
+	LmAssert(params.buf_sz > 0 && params.iterations > 0,
+		 "page_fault_test's buf_sz or iterations is 0");
+
+	cJSON *backing_json;
+	cJSON_ArrayForEach(backing_json, backings_json)
+	{
+		const char *backing_name = cJSON_GetStringValue(backing_json);
+		enum page_backing backing =
+			page_backing_from_string(backing_name);
+		if (backing == BACKING_COUNT) {
+			LmLogWarning("Unknown page backing %s", backing_name);
+			continue;
+		}
+		params.backings[backing] = true;
+	}
+
+	LmString log_dir;
+	LmString log_filename;
+	int run_nr = prepare_logging(log_directory_json, &log_dir,
+				     &log_filename);
+
+	first_touch_test(&params, log_filename, log_dir, run_nr);
+
+	return 0;
+}
+
+static int locality_workload_test(void *ctx, bool running_in_debugger)
+{
+	cJSON *ctx_json = ctx;
+	cJSON *nodes_json = cJSON_GetObjectItem(ctx_json, "nodes");
+	cJSON *payload_sz_json = cJSON_GetObjectItem(ctx_json, "payload_sz");
+	cJSON *passes_json = cJSON_GetObjectItem(ctx_json, "passes");
+	cJSON *lookups_json = cJSON_GetObjectItem(ctx_json, "lookups");
+	cJSON *arena_sz_json = cJSON_GetObjectItem(ctx_json, "arena_sz");
+	cJSON *seed_json = cJSON_GetObjectItem(ctx_json, "seed");
+	cJSON *structures_json = cJSON_GetObjectItem(ctx_json, "structures");
+	cJSON *backends_json = cJSON_GetObjectItem(ctx_json, "backends");
+	cJSON *log_directory_json =
+		cJSON_GetObjectItem(ctx_json, "log_directory");
+	LmAssert(nodes_json && payload_sz_json && passes_json &&
+			 lookups_json && arena_sz_json &&
+			 cJSON_IsArray(structures_json) &&
+			 cJSON_IsArray(backends_json) && log_directory_json,
+		 "locality_test's context JSON is malformed");
+
+	struct locality_params params = { 0 };
+	params.nodes = (uint64_t)cJSON_GetNumberValue(nodes_json);
+	params.payload_sz = (size_t)cJSON_GetNumberValue(payload_sz_json);
+	params.passes = (uint64_t)cJSON_GetNumberValue(passes_json);
+	params.lookups = (uint64_t)cJSON_GetNumberValue(lookups_json);
+	params.arena_sz =
+		lm_mem_sz_from_string(cJSON_GetStringValue(arena_sz_json));
+	// Optional
+	params.seed = seed_json ? (uint64_t)cJSON_GetNumberValue(seed_json) :
+				  1;
+	params.age_heap =
+		cJSON_IsTrue(cJSON_GetObjectItem(ctx_json, "age_heap"));
+	params.perf = parse_perf_params(ctx_json);
+	LmAssert(params.nodes > 0 && params.passes > 0 && params.lookups > 0 &&
+			 params.arena_sz > 0,
+		 "locality_test's nodes, passes, lookups or arena_sz is 0");
+
+	cJSON *structure_json;
+	cJSON_ArrayForEach(structure_json, structures_json)
+	{
+		const char *structure_name =
+			cJSON_GetStringValue(structure_json);
+		enum locality_structure structure =
+			locality_structure_from_string(structure_name);
+		if (structure == LOCALITY_STRUCTURE_COUNT) {
+			LmLogWarning("Unknown locality structure %s",
+				     structure_name);
+			continue;
+		}
+		params.structures[structure] = true;
+	}
+
+	cJSON *backend_json;
+	cJSON_ArrayForEach(backend_json, backends_json)
+	{
+		const char *backend_name = cJSON_GetStringValue(backend_json);
+		enum locality_backend backend =
+			locality_backend_from_string(backend_name);
+		const struct alloc_plugin *plugin =
+			alloc_plugin_find(backend_name);
+		if (backend != LOCALITY_BACKEND_COUNT)
+			params.backends[backend] = true;
+		else if (plugin)
+			params.plugins[plugin - alloc_plugin_get(0)] = true;
+		else
+			LmLogWarning("Unknown locality backend %s",
+				     backend_name);
+	}
+
+	LmString log_dir;
+	LmString log_filename;
+	int run_nr = prepare_logging(log_directory_json, &log_dir,
+				     &log_filename);
+
+	locality_test(&params, running_in_debugger, log_filename, log_dir,
+		      run_nr);
+
+	return 0;
+}
+
+// Allocators are named like in the result files, e.g. "ua_alloc" or "malloc",
+// or by the name of a loaded plugin
+static alloc_fn_t alloc_fn_from_string(const char *name)
+{
+	for (int i = 0; i < (int)LmArrayLen(a_alloc_functions); ++i)
+		if (strcmp(name, alloc_fn_string(a_alloc_functions[i])) == 0)
+			return a_alloc_functions[i];
+	for (int i = 0; i < (int)LmArrayLen(malloc_and_fam); ++i)
+		if (strcmp(name, alloc_fn_string(malloc_and_fam[i])) == 0)
+			return malloc_and_fam[i];
+
+	const struct alloc_plugin *plugin = alloc_plugin_find(name);
+	return plugin ? plugin->alloc_fn : NULL;
+}
+
+static int interleaved_workload_test(void *ctx, bool running_in_debugger)
+{
+	cJSON *ctx_json = ctx;
+	cJSON *trials_json = cJSON_GetObjectItem(ctx_json, "trials");
+	cJSON *trial_allocs_json =
+		cJSON_GetObjectItem(ctx_json, "trial_allocs");
+	cJSON *arena_sz_json = cJSON_GetObjectItem(ctx_json, "arena_sz");
+	cJSON *allocators_json = cJSON_GetObjectItem(ctx_json, "allocators");
+	cJSON *log_directory_json =
+		cJSON_GetObjectItem(ctx_json, "log_directory");
+	LmAssert(trials_json && trial_allocs_json && arena_sz_json &&
+			 cJSON_IsArray(allocators_json) && log_directory_json,
+		 "interleaved_test's context JSON is malformed");
+
+	struct interleaved_params params = { 0 };
+	params.trials = (uint64_t)cJSON_GetNumberValue(trials_json);
+	params.trial_allocs = (uint64_t)cJSON_GetNumberValue(trial_allocs_json);
+	params.ua.arena_sz =
+		lm_mem_sz_from_string(cJSON_GetStringValue(arena_sz_json));
+	params.ua.contiguous = true;
+	// Optional, 0 takes the seed from the TSC
+	params.seed = parse_size_number(cJSON_GetObjectItem(ctx_json, "seed"),
+					0);
+	params.timing = parse_timing_params(ctx_json);
+	LmAssert(params.trials > 0 && params.trial_allocs > 0,
+		 "interleaved_test's trials or trial_allocs is 0");
+
+	cJSON *allocator_json;
+	cJSON_ArrayForEach(allocator_json, allocators_json)
+	{
+		const char *name = cJSON_GetStringValue(allocator_json);
+		alloc_fn_t alloc_fn = alloc_fn_from_string(name);
+		if (!alloc_fn || !interleaved_supports(alloc_fn)) {
+			LmLogWarning("Allocator %s can't be interleaved", name);
+			continue;
+		}
+		LmAssert(params.allocators_len < INTERLEAVED_MAX_ALLOCATORS,
+			 "interleaved_test takes at most %d allocators",
+			 INTERLEAVED_MAX_ALLOCATORS);
+		params.allocators[params.allocators_len++] = alloc_fn;
+	}
+
+	params.workloads =
+		parse_workloads(ctx_json, params.trial_allocs,
+				"interleaved_test", &params.workloads_len);
+	for (int i = 0; i < params.workloads_len; ++i) {
+		size_t needed = workload_max_size(&params.workloads[i]) *
+				params.trial_allocs;
+		LmAssert(
+			params.ua.arena_sz >= needed,
+			"Arena has insufficient memory for a trial of the %s workload. Arena size: %zd, needed size: %zd",
+			params.workloads[i].name, params.ua.arena_sz, needed);
+	}
+
+	LmString log_dir;
+	LmString log_filename;
+	int run_nr = prepare_logging(log_directory_json, &log_dir,
+				     &log_filename);
+
+	interleaved_test(&params, running_in_debugger, log_filename, log_dir,
+			 run_nr);
+	return 0;
+}
+
+static int ka_cost_workload_test(void *ctx, bool running_in_debugger)
+{
+	cJSON *ctx_json = ctx;
+	cJSON *iterations_json = cJSON_GetObjectItem(ctx_json, "iterations");
+	cJSON *alloc_sz_json = cJSON_GetObjectItem(ctx_json, "alloc_sz");
+	cJSON *stamps_json = cJSON_GetObjectItem(ctx_json, "stamps");
+	cJSON *oka_json = cJSON_GetObjectItem(ctx_json, "oka");
+	cJSON *log_directory_json =
+		cJSON_GetObjectItem(ctx_json, "log_directory");
+	LmAssert(iterations_json && alloc_sz_json && log_directory_json,
+		 "ka_cost_test's context JSON is malformed");
+
+	struct ka_cost_params params = { 0 };
+	params.iterations = (uint64_t)cJSON_GetNumberValue(iterations_json);
+	params.alloc_sz = (size_t)cJSON_GetNumberValue(alloc_sz_json);
+	params.stamps = cJSON_IsTrue(stamps_json);
+	params.oka = cJSON_IsTrue(oka_json);
+	LmAssert(params.iterations > 0 && params.alloc_sz > 0,
+		 "ka_cost_test's iterations or alloc_sz is 0");
+
+	LmString log_dir;
+	LmString log_filename;
+	int run_nr = prepare_logging(log_directory_json, &log_dir,
+				     &log_filename);
+
+	ka_cost_test(&params, log_filename, log_dir, run_nr);
 	return 0;
 }
 
 static struct test_definition test_definitions[] = { { arena_test, "arena" },
 						     { malloc_test, "malloc" },
 						     { sdhs_test, "sdhs" },
+						     { numa_test, "numa" },
+						     { ipc_test, "ipc" },
+						     { scaling_test, "scaling" },
+						     { replay_test, "replay" },
+						     { batch_test, "batch" },
+						     { lifetime_workload_test,
+						       "lifetime" },
+						     { realloc_test, "realloc" },
+						     { page_fault_test,
+						       "page_fault" },
+						     { locality_workload_test,
+						       "locality" },
+						     { interleaved_workload_test,
+						       "interleaved" },
+						     { ka_cost_workload_test,
+						       "karena_cost" },
 						     { 0 } };
 
 static struct test_definition *get_test_definition(cJSON *test_name_json)
@@ -283,6 +1220,65 @@ static struct test_definition *get_test_definition(cJSON *test_name_json)
 	return NULL;
 }
 
+// Optional, e.g. "noise_control": { "cpus": [2, 3], "sched_fifo": true,
+// "fifo_priority": 10, "mlockall": true, "warmup": 1000 }. Nothing is changed
+// unless the suite asks for it. The main thread runs on the first CPU and the
+// threaded tests spread over the rest
+static struct noise_params parse_noise_params(cJSON *conf)
+{
+	struct noise_params params = { .fifo_priority = 10 };
+	cJSON *noise_json = cJSON_GetObjectItem(conf, "noise_control");
+	if (!noise_json)
+		return params;
+
+	cJSON *cpu_json;
+	cJSON_ArrayForEach(cpu_json, cJSON_GetObjectItem(noise_json, "cpus"))
+	{
+		LmAssert(params.cpu_count < NOISE_MAX_CPUS,
+			 "noise_control takes at most %d cpus", NOISE_MAX_CPUS);
+		params.cpus[params.cpu_count] =
+			(int)cJSON_GetNumberValue(cpu_json);
+		LmAssert(params.cpus[params.cpu_count] >= 0,
+			 "noise_control cpus can't be negative");
+		++params.cpu_count;
+	}
+
+	cJSON *priority_json = cJSON_GetObjectItem(noise_json, "fifo_priority");
+	cJSON *warmup_json = cJSON_GetObjectItem(noise_json, "warmup");
+	params.sched_fifo =
+		cJSON_IsTrue(cJSON_GetObjectItem(noise_json, "sched_fifo"));
+	params.mlockall =
+		cJSON_IsTrue(cJSON_GetObjectItem(noise_json, "mlockall"));
+	if (priority_json)
+		params.fifo_priority = (int)cJSON_GetNumberValue(priority_json);
+	if (warmup_json)
+		params.warmup = (uint64_t)cJSON_GetNumberValue(warmup_json);
+	return params;
+}
+
+// Optional, e.g. "allocator_plugins": [{ "name": "jemalloc", "path":
+// "libjemalloc.so.2" }, { "name": "mimalloc", "path": "libmimalloc.so.2",
+// "prefix": "mi_" }]. The malloc test runs every plugin that loads after glibc,
+// and the scaling and replay tests take their names as modes and backends.
+// Plugins that fail to load are skipped with a warning
+static void load_alloc_plugins(cJSON *conf)
+{
+	cJSON *plugin_json;
+	cJSON_ArrayForEach(plugin_json,
+			   cJSON_GetObjectItem(conf, "allocator_plugins"))
+	{
+		const char *name = cJSON_GetStringValue(
+			cJSON_GetObjectItem(plugin_json, "name"));
+		const char *path = cJSON_GetStringValue(
+			cJSON_GetObjectItem(plugin_json, "path"));
+		LmAssert(name && path,
+			 "allocator_plugins entries need a name and a path");
+		alloc_plugin_load(name, path,
+				  cJSON_GetStringValue(cJSON_GetObjectItem(
+					  plugin_json, "prefix")));
+	}
+}
+
 int run_tests(cJSON *conf)
 {
 	if (!conf) {
@@ -300,9 +1296,28 @@ int run_tests(cJSON *conf)
 
 	if (cJSON_IsFalse(suite_enabled_json)) {
 		LmLogInfo("Tests are disabled");
-		return 1;
+		return RUN_TESTS_DISABLED;
 	}
 
+	// Before anything is measured, the timer overhead included
+	struct noise_params noise_params = parse_noise_params(conf);
+	noise_control_apply(&noise_params);
+	noise_env_log(noise_env_get());
+
+	load_alloc_plugins(conf);
+
+	// Optional, the empty timer cost is subtracted from every sample
+	// unless this is false
+	cJSON *subtract_overhead_json =
+		cJSON_GetObjectItem(conf, "subtract_timer_overhead");
+	uint64_t timer_overhead = get_tsc_timer_overhead();
+	if (!cJSON_IsFalse(subtract_overhead_json))
+		set_alloc_timer_overhead(timer_overhead);
+	LmLogInfo("Empty timer overhead is %lu TSC (%.1f ns), %s", timer_overhead,
+		  (double)timer_overhead / get_tsc_freq() * 1e9,
+		  get_alloc_timer_overhead() ? "subtracting it from every sample" :
+					       "not subtracting it");
+
 	cJSON *test_json;
 	cJSON_ArrayForEach(test_json, tests_json)
 	{
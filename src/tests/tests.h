@@ -3,41 +3,15 @@
 
 #include <src/lm.h>
 #include <src/allocators/u_arena.h>
+#include <src/allocators/u_arena_uffd.h>
 #include <src/metrics/timing.h>
 #include <src/allocators/allocator_wrappers.h>
 #include <src/cJSON/cJSON.h>
 
 // NOTE: (isa): Start arrays created by Claude
 
-// static size_t small_sizes[] = { 8,  13, 16, 27, 32,  45,  56,  64,
-// 				71, 80, 91, 96, 103, 112, 125, 128 };
-
-// static size_t medium_sizes[] = {
-// 	256,  300,  378,  512,	768,  818,  1000, 1024,
-// 	1359, 1700, 2000, 2048, 2222, 2918, 3875, 4096
-// };
-
-// static size_t large_sizes[] = {
-// 	LmKibiByte(5) + 35,
-// 	LmKibiByte(32),
-// 	LmKibiByte(128) + 133,
-// #if 0
-// 	LmKibiByte(64) + 127, /* ~64 KB (unaligned) */
-// 	LmKibiByte(256) + 511, /* ~256 KB (unaligned) */
-// 	LmKibiByte(512), /* 512 KB (aligned) */
-// 	LmKibiByte(1024) + 973, /* ~1 MB (unaligned) */
-// 	LmKibiByte(1536), /* 1.5 MB (aligned) */
-// 	LmKibiByte(2048) + 1523, /* ~2 MB (unaligned) */
-// 	LmKibiByte(2560), /* 2.5 MB (aligned) */
-// 	LmKibiByte(3072) + 2731, /* ~3 MB (unaligned) */
-// 	LmKibiByte(4096), /* 4 MB (aligned) */
-// 	LmKibiByte(5120) + 3567, /* ~5 MB (unaligned) */
-// 	LmKibiByte(6144), /* 6 MB (aligned) */
-// 	LmKibiByte(7168) + 4095, /* ~7 MB (unaligned) */
-// 	LmKibiByte(8192) /* 8 MB (aligned) */
-// #endif
-// };
-
+// NOTE: (isa): These are the default workloads of the arena and malloc tests,
+// other sizes and distributions go in the "workloads" of their contexts
 static size_t small_sizes[] = { 8, 27, 64, 125, 128 };
 static size_t medium_sizes[] = { 183, 512, 1359, 3875, 4096 };
 static size_t large_sizes[] = {
@@ -61,12 +35,18 @@ struct test_definition {
 	const char *test_name;
 };
 
+// Returned by run_tests when the suite is disabled in the config, apart from
+// the failures of the tests themselves
+#define RUN_TESTS_DISABLED -2
+
 int run_tests(cJSON *conf);
 
 struct ua_params {
 	size_t arena_sz;
 	bool contiguous;
 	bool mallocd;
+	// Only used by the userfaultfd backed arena
+	struct ua_uffd_params uffd;
 };
 
 #endif
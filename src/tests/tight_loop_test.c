@@ -3,12 +3,21 @@ LM_LOG_REGISTER(tight_loop_test);
 
 #include <src/allocators/allocator_wrappers.h>
 #include <src/metrics/timing.h>
+#include <src/metrics/perf_counters.h>
+#include <src/metrics/hdr_histogram.h>
+#include <src/metrics/mem_footprint.h>
+#include <src/metrics/result_file.h>
+#include <src/utils/system_info.h>
+#include <src/utils/noise_control.h>
 
 #include "tight_loop_test.h"
 #include "tests.h"
+#include "perturb.h"
 
+#include <pthread.h>
 #include <stddef.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/wait.h>
 #include <dirent.h>
 #include <sys/stat.h>
@@ -45,19 +54,61 @@ static int get_next_run_nr(LmString directory)
 	return (largest_num == 0) ? 1 : largest_num + 1;
 }
 
+// Counters for the phase currently running in a forked test. group is NULL
+// when counters are disabled or could not be opened
+struct tight_loop_perf {
+	struct perf_group *group;
+	struct perf_sample sample;
+	bool per_alloc;
+	uint64_t *deltas; // PERF_COUNTER_COUNT per allocation, if per_alloc
+};
+
+static int append_perf_data(const char *filename, struct tight_loop_perf *perf,
+			    uint64_t count)
+{
+	struct result_section_writer w;
+	if (result_section_begin(&w, filename, RESULT_SECTION_PERF) != 0)
+		return -1;
+
+	if (perf_write_to_file(w.file, &perf->sample,
+			       perf->per_alloc ? perf->deltas : NULL,
+			       count) != 0) {
+		lm_close_file(w.file);
+		return -1;
+	}
+	return result_section_end(&w, 0, count);
+}
+
+// Threaded runs get their own directory, <alloct>-<size_name>-<threads>t/,
+// so they aren't mixed up with the single threaded runs of the same sizes.
+// Variants of a phase, e.g. the cold runs, are named like an allocator of
+// their own, <alloct>-<variant>-<size_name>/
 static void write_data_to_file(const char *log_dir, alloc_fn_t alloc_fn,
-			       const char *size_name, size_t alloc_size)
+			       const char *size_name, size_t alloc_size,
+			       int thread_count, const char *variant,
+			       struct tight_loop_perf *perf,
+			       const struct mem_footprint *mem)
 {
 	UAScratch uas = ua_scratch_begin(main_ua);
 
-	enum alloc_type atype = get_alloc_type(alloc_fn);
-	LmString run_entry = lm_string_make(log_dir, uas.ua);
-	if (!size_name)
-		lm_string_append_fmt(run_entry, "%s-%zdB/",
-				     alloct_string(atype), alloc_size);
+	char alloc_name[64];
+	if (variant)
+		snprintf(alloc_name, sizeof(alloc_name), "%s-%s",
+			 alloc_fn_string(alloc_fn), variant);
+	else
+		snprintf(alloc_name, sizeof(alloc_name), "%s",
+			 alloc_fn_string(alloc_fn));
+	char size_class[64];
+	if (size_name)
+		snprintf(size_class, sizeof(size_class), "%s", size_name);
 	else
-		lm_string_append_fmt(run_entry, "%s-%s/", alloct_string(atype),
-				     size_name);
+		snprintf(size_class, sizeof(size_class), "%zdB", alloc_size);
+
+	LmString run_entry = lm_string_make(log_dir, uas.ua);
+	lm_string_append_fmt(run_entry, "%s-%s", alloc_name, size_class);
+	if (thread_count > 1)
+		lm_string_append_fmt(run_entry, "-%dt", thread_count);
+	lm_string_append_fmt(run_entry, "/");
 
 	int ret = mkdir(run_entry, S_IRWXU);
 	if (ret != 0 && errno != EEXIST) {
@@ -69,54 +120,496 @@ static void write_data_to_file(const char *log_dir, alloc_fn_t alloc_fn,
 	int run_nr = get_next_run_nr(run_entry);
 	if (run_nr <= 0)
 		return;
-	else
-		lm_string_append_fmt(run_entry, "%d.bin", run_nr);
 
-	if (write_alloc_timing_data_to_file(run_entry, atype) != 0) {
+	lm_string_append_fmt(run_entry, "%d.bin", run_nr);
+
+	struct result_info info = {
+		.allocator = alloc_name,
+		.size_class = size_class,
+		.thread_count = (uint32_t)thread_count,
+	};
+	if (write_alloc_timing_data_to_file(run_entry, &info) != 0) {
 		LmLogError("Failed to write data to file %s", run_entry);
 		return;
 	}
 
+	if (perf->group && perf->sample.available &&
+	    append_perf_data(run_entry, perf, get_alloc_tcoll()->cur) != 0)
+		LmLogError("Failed to write performance counters to %s",
+			   run_entry);
+
+	if (mem_footprint_append_to_file(run_entry, mem) != 0)
+		LmLogError("Failed to write memory footprint to %s", run_entry);
+
+	struct hdr_histogram *hist = get_alloc_hist();
+	if (hist && hdr_append_to_file(hist, run_entry) != 0)
+		LmLogError("Failed to write histogram to %s", run_entry);
+
 	ua_scratch_release(uas);
 }
 
+static bool is_ka_alloc_fn(alloc_fn_t alloc_fn)
+{
+	return alloc_fn == ka_alloc_timed || alloc_fn == ka_zalloc_timed ||
+	       alloc_fn == ka_talloc_timed;
+}
+
+// Returns false if the arena could not be created, e.g. when the karena
+// module is not loaded or userfaultfd is not permitted
+static bool create_test_arena(struct ua_params *ua_params, bool is_karena,
+			      alloc_fn_t alloc_fn, UArena **ua, KArena **ka)
+{
+	*ua = NULL;
+	*ka = NULL;
+	if (ua_params && alloc_fn == uffd_talloc_timed)
+		*ua = ua_create_uffd(ua_params->arena_sz, ua_params->uffd);
+	else if (ua_params && !is_karena)
+		*ua = ua_create(ua_params->arena_sz, ua_params->contiguous,
+				ua_params->mallocd);
+	else if (ua_params && is_karena && alloc_fn == ka_zalloc_timed)
+		*ka = ka_create(ua_params->arena_sz, KA_ZERO_ON_REUSE);
+	else if (ua_params && is_karena &&
+		 (alloc_fn == ka_alloc_timed || alloc_fn == ka_talloc_timed))
+		*ka = ka_create(ua_params->arena_sz, 0);
+	else if (alloc_fn == oka_alloc_timed)
+		*ka = oka_create(ua_params->arena_sz);
+
+	if (ua_params && !*ua && !*ka) {
+		LmLogError("Unable to create the arena for %s",
+			   alloc_fn_string(alloc_fn));
+		return false;
+	}
+
+	return true;
+}
+
+static void reset_arena(UArena *test_ua, KArena *test_ka, alloc_fn_t alloc_fn)
+{
+	if (test_ua)
+		ua_free(test_ua);
+
+	if (test_ka && is_ka_alloc_fn(alloc_fn))
+		ka_free(test_ka);
+	else if (test_ka && alloc_fn == oka_alloc_timed)
+		oka_free(test_ka);
+}
+
+// NOTE: (isa): The reset is timed by itself, since arenas created with
+// KA_ZERO_ON_REUSE move the cost of zeroing from ka_zalloc to the reset
+static void reset_test_arena(UArena *test_ua, KArena *test_ka,
+			     alloc_fn_t alloc_fn)
+{
+	if (!test_ua && !test_ka)
+		return;
+
+	START_TSC_TIMING_LFENCE(reset);
+	reset_arena(test_ua, test_ka, alloc_fn);
+	END_TSC_TIMING_LFENCE(reset);
+
+	lm_log_tsc_timing(reset_end - reset_start, "Arena reset", NS, true, INF,
+			  LM_LOG_MODULE_LOCAL);
+	LmLogInfoR("\n");
+}
+
+static void log_uffd_stats(UArena *ua)
+{
+	struct ua_uffd_stats stats = ua_uffd_get_stats(ua);
+	LmLogInfoR("\nuffd: %lu faults, %lu pages populated, %lu wakes\n",
+		   stats.faults, stats.pages, stats.wakes);
+	if (stats.faults > 0) {
+		lm_log_tsc_timing_avg(stats.total_tsc, stats.faults,
+				      "Handler time per fault: ", NS, true,
+				      INF, LM_LOG_MODULE_LOCAL);
+		LmLogInfoR("\n");
+		lm_log_tsc_timing(stats.max_tsc, "Max handler time", NS, true,
+				  INF, LM_LOG_MODULE_LOCAL);
+	}
+	LmLogInfoR("\n");
+}
+
+static void destroy_test_arena(UArena **ua, KArena *ka, alloc_fn_t alloc_fn)
+{
+	if (*ua && UaIsUffd((*ua)->flags))
+		log_uffd_stats(*ua);
+	if (*ua)
+		ua_destroy(ua);
+	if (ka && is_ka_alloc_fn(alloc_fn))
+		ka_destroy(ka);
+	else if (ka && alloc_fn == oka_alloc_timed)
+		oka_destroy(ka);
+}
+
+// NOTE: (isa): Counters are opened in the forked child that runs the phases,
+// since they count the calling thread only (pid 0) and are not inherited
+static void open_test_perf(struct perf_params *params,
+			   struct alloc_timing_params *timing,
+			   struct perf_group *group,
+			   struct tight_loop_perf *perf)
+{
+	*perf = (struct tight_loop_perf){ 0 };
+	if (!params || !params->enabled)
+		return;
+	if (!perf_group_open(group, params->per_alloc))
+		return;
+
+	perf->group = group;
+	// The per allocation rows line up with the raw samples in the file
+	perf->per_alloc = params->per_alloc && group->rdpmc_mask &&
+			  timing->raw_samples;
+}
+
+static void close_test_perf(struct tight_loop_perf *perf)
+{
+	if (perf->group)
+		perf_group_close(perf->group);
+}
+
+static size_t phase_timings_size(struct alloc_timing_params *timing,
+				 struct tight_loop_perf *perf,
+				 uint64_t iterations)
+{
+	size_t size = get_page_size();
+	if (timing->raw_samples)
+		size += iterations * sizeof(uint64_t);
+	if (timing->histogram)
+		size += hdr_mem_size(timing->significant_digits);
+	if (perf->per_alloc)
+		size += iterations * PERF_COUNTER_COUNT * sizeof(uint64_t);
+	return size;
+}
+
+// Pushes the raw sample array and the histogram for phases of up to
+// iterations allocations on ua. Either can be turned off through the timing
+// params, in which case it's left as NULL
+static void init_phase_timings(struct alloc_timing_params *timing, UArena *ua,
+			       uint64_t iterations, uint64_t **timing_arr,
+			       struct hdr_histogram **hist,
+			       struct hdr_histogram *hist_storage)
+{
+	*timing_arr = NULL;
+	*hist = NULL;
+	if (timing->raw_samples)
+		*timing_arr = UaPushArray(ua, uint64_t, iterations);
+	if (timing->histogram &&
+	    hdr_init(hist_storage, timing->significant_digits, ua) == 0)
+		*hist = hist_storage;
+}
+
+// Starts a phase with empty stats
+static void begin_phase_timings(uint64_t iterations, uint64_t *timing_arr,
+				struct hdr_histogram *hist)
+{
+	init_alloc_tcoll(timing_arr ? iterations : 0, timing_arr);
+	if (hist)
+		hdr_reset(hist);
+	init_alloc_hist(hist);
+	*get_alloc_tstats() = (struct alloc_tstats){ 0 };
+}
+
+// NOTE: (isa): Runs the start of a phase untimed and resets the arena, so
+// the timed phase doesn't pay for cold caches, TLB entries and branch
+// predictors. The pages it touches stay mapped, so a warmed up phase no
+// longer sees its first touch faults. Capped at the phase's length, which
+// the arena is already known to fit. The samples land in the phase's own
+// collection and are discarded when the phase begins
+static void warmup_phase(UArena *test_ua, KArena *test_ka, alloc_fn_t alloc_fn,
+			 const size_t *sizes, uint64_t sizes_len,
+			 uint64_t phase_len, uint64_t *timing_arr,
+			 struct hdr_histogram *hist)
+{
+	uint64_t warmup = LmMin(noise_env_get()->warmup, phase_len);
+	if (warmup == 0)
+		return;
+
+	begin_phase_timings(phase_len, timing_arr, hist);
+	for (uint64_t i = 0; i < warmup; ++i) {
+		uint8_t *ptr = alloc_fn(test_ua, test_ka, sizes[i % sizes_len]);
+		*ptr = 1;
+		// malloc has no arena to reset, so it gets its memory back here
+		if (!test_ua && !test_ka)
+			alloc_fn_free(alloc_fn, ptr);
+	}
+	reset_arena(test_ua, test_ka, alloc_fn);
+}
+
+static void log_phase_timings(void)
+{
+	struct alloc_tstats *tstats = get_alloc_tstats();
+	lm_log_tsc_timing_avg(tstats->total_tsc, tstats->iter, "", NS, true,
+			      INF, LM_LOG_MODULE_LOCAL);
+	LmLogInfoR("\n");
+
+	struct hdr_histogram *hist = get_alloc_hist();
+	if (hist)
+		hdr_log_percentiles(hist, "\t", LM_LOG_MODULE_LOCAL);
+}
+
+static void perf_phase_begin(struct tight_loop_perf *perf)
+{
+	if (perf->group)
+		perf_group_start(perf->group);
+}
+
+static void perf_phase_end(struct tight_loop_perf *perf, uint64_t ops)
+{
+	if (!perf->group)
+		return;
+
+	perf_group_stop(perf->group, &perf->sample);
+	perf_log_sample(&perf->sample, ops, LM_LOG_MODULE_LOCAL);
+}
+
+// What the allocator under test reports as handed out. The arenas are bump
+// allocators, so this is their position, while malloc includes its chunk
+// headers and rounding. Plugins have no common way to report it, so theirs is
+// the process' RSS
+static uint64_t test_arena_consumed(UArena *test_ua, KArena *test_ka,
+				    alloc_fn_t alloc_fn)
+{
+	if (test_ua)
+		return ua_pos(test_ua);
+	if (test_ka && is_ka_alloc_fn(alloc_fn))
+		return ka_pos(test_ka);
+	if (test_ka && alloc_fn == oka_alloc_timed)
+		return oka_pos(test_ka);
+	if (alloc_plugin_of(alloc_fn))
+		return mem_current_rss();
+	return malloc_consumed_bytes();
+}
+
+// NOTE: (isa): The snapshots are taken outside the counted region, since
+// reading smaps_rollup is a few syscalls and would show up in the counters
+static void mem_phase_begin(struct mem_footprint *mem, UArena *test_ua,
+			    KArena *test_ka, alloc_fn_t alloc_fn)
+{
+	*mem = (struct mem_footprint){ 0 };
+	mem_snapshot_take(&mem->begin,
+			  test_arena_consumed(test_ua, test_ka, alloc_fn));
+}
+
+// Must run before the arena is reset, so the allocator's position still
+// covers the phase
+static void mem_phase_end(struct mem_footprint *mem, UArena *test_ua,
+			  KArena *test_ka, alloc_fn_t alloc_fn, uint64_t allocs,
+			  uint64_t requested)
+{
+	mem_snapshot_take(&mem->end,
+			  test_arena_consumed(test_ua, test_ka, alloc_fn));
+	mem->allocs = allocs;
+	mem->requested = requested;
+}
+
+// Runs a single allocation, with the counters read through rdpmc right
+// around it when per allocation counters are enabled
+static inline uint8_t *perf_alloc(struct tight_loop_perf *perf,
+				  alloc_fn_t alloc_fn, UArena *test_ua,
+				  KArena *test_ka, size_t size, uint64_t i)
+{
+	if (LM_LIKELY(!perf->per_alloc))
+		return alloc_fn(test_ua, test_ka, size);
+
+	uint64_t before[PERF_COUNTER_COUNT] = { 0 };
+	uint64_t *row = perf->deltas + i * PERF_COUNTER_COUNT;
+	perf_read_all(perf->group, before);
+	uint8_t *ptr = alloc_fn(test_ua, test_ka, size);
+	perf_read_all(perf->group, row);
+	for (int k = 0; k < PERF_COUNTER_COUNT; ++k)
+		row[k] -= before[k];
+	return ptr;
+}
+
+static const double summary_percentiles[] = { 50.0, 90.0, 99.0, 99.9 };
+
+// A phase's latencies in TSC cycles, for the warm and cold summary. The last
+// value is the max
+struct latency_row {
+	const char *name;
+	uint64_t count;
+	uint64_t values[LmArrayLen(summary_percentiles) + 1];
+};
+
+static void latency_row_take(struct latency_row *row, const char *name)
+{
+	struct hdr_histogram *hist = get_alloc_hist();
+	*row = (struct latency_row){ .name = name };
+	if (!hist)
+		return;
+
+	row->count = hist->total_count;
+	for (size_t i = 0; i < LmArrayLen(summary_percentiles); ++i)
+		row->values[i] =
+			hdr_value_at_percentile(hist, summary_percentiles[i]);
+	row->values[LmArrayLen(summary_percentiles)] = hist->max;
+}
+
+// Logs the warm phase and its cold runs side by side, in ns
+static void log_latency_rows(const struct latency_row *rows, int row_count)
+{
+	if (row_count < 2 || rows[0].count == 0)
+		return;
+
+	double ns_per_tsc = 1e9 / get_tsc_freq();
+	LmLogInfoR("\n%-16s", "Latency (ns)");
+	for (size_t i = 0; i < LmArrayLen(summary_percentiles); ++i) {
+		char label[16];
+		snprintf(label, sizeof(label), "p%g", summary_percentiles[i]);
+		LmLogInfoR("%10s", label);
+	}
+	LmLogInfoR("%10s\n", "max");
+
+	for (int r = 0; r < row_count; ++r) {
+		LmLogInfoR("%-16s", rows[r].name);
+		for (size_t i = 0; i < LmArrayLen(rows[r].values); ++i)
+			LmLogInfoR("%10.1f",
+				   (double)rows[r].values[i] * ns_per_tsc);
+		LmLogInfoR("\n");
+	}
+}
+
+// NOTE: (isa): Repeats a phase with the perturbation run between the
+// allocations, outside the timed region. There's no warmup, since the state
+// it sets up is what's being taken away, and no counters, since they would
+// mostly count the perturbation
+static bool cold_phase(UArena *test_ua, KArena *test_ka, alloc_fn_t alloc_fn,
+		       const size_t *sizes, uint64_t sizes_len,
+		       uint64_t phase_len, uint64_t requested,
+		       const char *size_name, size_t alloc_size,
+		       const char *log_directory,
+		       const struct cold_params *cold, enum perturb_mode mode,
+		       uint64_t *timing_arr, struct hdr_histogram *hist,
+		       struct latency_row *row)
+{
+	// malloc's own state can't be reached, its chunk headers are flushed
+	// along with the recent blocks. karena's state lives in the kernel, and
+	// its handle is an index rather than a pointer, so only the recent
+	// blocks are flushed for it
+	const void *meta = NULL;
+	size_t meta_sz = 0;
+	if (test_ua) {
+		meta = test_ua;
+		meta_sz = sizeof(*test_ua);
+	}
+
+	struct perturb p;
+	if (!perturb_begin(&p, mode, cold, meta, meta_sz))
+		return false;
+
+	char variant[32];
+	snprintf(variant, sizeof(variant), "cold_%s",
+		 perturb_mode_string(mode));
+	LmLogInfoR("\nCold, %s: \n", perturb_mode_string(mode));
+	if (mode == PERTURB_FLUSH && !meta)
+		LmLogInfoR("\t%s, only the recent blocks are flushed\n",
+			   test_ka ? "karena's state is in the kernel" :
+				     "malloc's state can't be reached");
+
+	struct mem_footprint mem;
+	begin_phase_timings(phase_len, timing_arr, hist);
+	mem_phase_begin(&mem, test_ua, test_ka, alloc_fn);
+	for (uint64_t i = 0; i < phase_len; ++i) {
+		perturb_before_alloc(&p);
+		uint8_t *ptr = alloc_fn(test_ua, test_ka, sizes[i % sizes_len]);
+		*ptr = 1;
+		perturb_note_block(&p, ptr);
+	}
+	mem_phase_end(&mem, test_ua, test_ka, alloc_fn, phase_len, requested);
+	perturb_end(&p);
+
+	reset_test_arena(test_ua, test_ka, alloc_fn);
+
+	log_phase_timings();
+	mem_footprint_log(&mem, LM_LOG_MODULE_LOCAL);
+	struct tight_loop_perf no_perf = { 0 };
+	write_data_to_file(log_directory, alloc_fn, size_name, alloc_size, 1,
+			   variant, &no_perf, &mem);
+	latency_row_take(row, perturb_mode_string(mode));
+	return true;
+}
+
+// Runs the cold variants of the phase that just finished, which must still
+// be the one the histogram belongs to
+static void cold_phases(UArena *test_ua, KArena *test_ka, alloc_fn_t alloc_fn,
+			const size_t *sizes, uint64_t sizes_len,
+			uint64_t phase_len, uint64_t requested,
+			const char *size_name, size_t alloc_size,
+			const char *log_directory,
+			const struct cold_params *cold, uint64_t *timing_arr,
+			struct hdr_histogram *hist)
+{
+	if (!cold)
+		return;
+
+	struct latency_row rows[PERTURB_MODE_COUNT + 1];
+	int row_count = 0;
+	latency_row_take(&rows[row_count++], "warm");
+	for (int m = 0; m < PERTURB_MODE_COUNT; ++m) {
+		if (cold->modes[m] &&
+		    cold_phase(test_ua, test_ka, alloc_fn, sizes, sizes_len,
+			       phase_len, requested, size_name, alloc_size,
+			       log_directory, cold, (enum perturb_mode)m,
+			       timing_arr, hist, &rows[row_count]))
+			++row_count;
+	}
+	log_latency_rows(rows, row_count);
+}
+
 static void all_sizes_repeatedly(UArena *test_ua, KArena *test_ka,
 				 uint64_t alloc_iterations, alloc_fn_t alloc_fn,
 				 const char *alloc_fn_name, size_t *alloc_sizes,
 				 size_t alloc_sizes_len, const char *size_name,
-				 const char *log_directory)
+				 const char *log_directory,
+				 struct alloc_timing_params *timing,
+				 struct tight_loop_perf *perf,
+				 const struct cold_params *cold)
 {
 	LmLogInfoR("\n\n%s'ing all %s sizes repeatedly %lu times: \n",
 		   alloc_fn_name, size_name, alloc_iterations);
 	uint64_t total_iterations = alloc_iterations * alloc_sizes_len;
-	size_t timing_vals_sz = total_iterations * sizeof(uint64_t);
-	UArena *timings_ua = ua_create(timing_vals_sz, UA_CONTIGUOUS, UA_MMAPD);
-	uint64_t *timing_arr =
-		UaPushArray(timings_ua, uint64_t, total_iterations);
-	init_alloc_tcoll(total_iterations, timing_arr);
-	struct alloc_tcoll *tcoll = get_alloc_tcoll();
+	UArena *timings_ua =
+		ua_create(phase_timings_size(timing, perf, total_iterations),
+			  UA_CONTIGUOUS, UA_MMAPD);
+	uint64_t *timing_arr;
+	struct hdr_histogram hist_storage;
+	struct hdr_histogram *hist;
+	init_phase_timings(timing, timings_ua, total_iterations, &timing_arr,
+			   &hist, &hist_storage);
+	if (perf->per_alloc)
+		perf->deltas =
+			UaPushArray(timings_ua, uint64_t,
+				    total_iterations * PERF_COUNTER_COUNT);
+	uint64_t requested = 0;
+	for (size_t j = 0; j < alloc_sizes_len; ++j)
+		requested += alloc_sizes[j] * alloc_iterations;
+
+	struct mem_footprint mem;
+	warmup_phase(test_ua, test_ka, alloc_fn, alloc_sizes, alloc_sizes_len,
+		     total_iterations, timing_arr, hist);
+	begin_phase_timings(total_iterations, timing_arr, hist);
+	mem_phase_begin(&mem, test_ua, test_ka, alloc_fn);
+	perf_phase_begin(perf);
 	for (size_t i = 0; i < alloc_iterations; ++i) {
 		for (uint j = 0; j < alloc_sizes_len; ++j) {
-			uint8_t *ptr =
-				alloc_fn(test_ua, test_ka, alloc_sizes[j]);
+			uint8_t *ptr = perf_alloc(perf, alloc_fn, test_ua,
+						  test_ka, alloc_sizes[j],
+						  i * alloc_sizes_len + j);
 			*ptr = 1;
 		}
 	}
+	perf_phase_end(perf, total_iterations);
+	mem_phase_end(&mem, test_ua, test_ka, alloc_fn, total_iterations,
+		      requested);
 
-	if (test_ua)
-		ua_free(test_ua);
-
-	if (test_ka && alloc_fn == ka_alloc_timed)
-		ka_free(test_ka);
-	else if (test_ka && alloc_fn == oka_alloc_timed)
-		oka_free(test_ka);
+	reset_test_arena(test_ua, test_ka, alloc_fn);
 
-	struct alloc_tstats *tstats = get_alloc_tstats();
-	lm_log_tsc_timing_avg(tstats->total_tsc, tstats->iter, "", NS, true,
-			      INF, LM_LOG_MODULE_LOCAL);
-	LmLogInfoR("\n");
-	write_data_to_file(log_directory, alloc_fn, size_name, 0);
+	log_phase_timings();
+	mem_footprint_log(&mem, LM_LOG_MODULE_LOCAL);
+	write_data_to_file(log_directory, alloc_fn, size_name, 0, 1, NULL, perf,
+			   &mem);
+	cold_phases(test_ua, test_ka, alloc_fn, alloc_sizes, alloc_sizes_len,
+		    total_iterations, requested, size_name, 0, log_directory,
+		    cold, timing_arr, hist);
 
+	init_alloc_hist(NULL);
 	ua_destroy(&timings_ua);
 }
 
@@ -128,55 +621,449 @@ static void each_size_by_itself(UArena *test_ua, KArena *test_ka,
 				uint64_t alloc_iterations, alloc_fn_t alloc_fn,
 				const char *alloc_fn_name, size_t *alloc_sizes,
 				size_t alloc_sizes_len, const char *size_name,
-				const char *log_directory)
+				const char *log_directory,
+				struct alloc_timing_params *timing,
+				struct tight_loop_perf *perf,
+				const struct cold_params *cold)
 {
 	LmLogInfoR("\n%s'ing each %s size %lu times\n", alloc_fn_name,
 		   size_name, alloc_iterations);
 
-	size_t timing_vals_sz = alloc_iterations * sizeof(uint64_t);
-	UArena *timings_ua = ua_create(timing_vals_sz, UA_CONTIGUOUS, UA_MMAPD);
-	uint64_t *timing_arr =
-		UaPushArray(timings_ua, uint64_t, alloc_iterations);
-	struct alloc_tstats *tstats = get_alloc_tstats();
-	struct alloc_tcoll *timings = get_alloc_tcoll();
+	UArena *timings_ua =
+		ua_create(phase_timings_size(timing, perf, alloc_iterations),
+			  UA_CONTIGUOUS, UA_MMAPD);
+	uint64_t *timing_arr;
+	struct hdr_histogram hist_storage;
+	struct hdr_histogram *hist;
+	init_phase_timings(timing, timings_ua, alloc_iterations, &timing_arr,
+			   &hist, &hist_storage);
+	if (perf->per_alloc)
+		perf->deltas =
+			UaPushArray(timings_ua, uint64_t,
+				    alloc_iterations * PERF_COUNTER_COUNT);
 
 	for (size_t j = 0; j < alloc_sizes_len; ++j) {
 		LmLogInfoR("\n%zd bytes: \n", alloc_sizes[j]);
-		init_alloc_tcoll(alloc_iterations, timing_arr);
+		struct mem_footprint mem;
+		warmup_phase(test_ua, test_ka, alloc_fn, &alloc_sizes[j], 1,
+			     alloc_iterations, timing_arr, hist);
+		begin_phase_timings(alloc_iterations, timing_arr, hist);
+		mem_phase_begin(&mem, test_ua, test_ka, alloc_fn);
 
+		perf_phase_begin(perf);
 		for (uint64_t i = 0; i < alloc_iterations; ++i) {
-			uint8_t *ptr =
-				alloc_fn(test_ua, test_ka, alloc_sizes[j]);
+			uint8_t *ptr = perf_alloc(perf, alloc_fn, test_ua,
+						  test_ka, alloc_sizes[j], i);
 			*ptr = 1;
 		}
+		perf_phase_end(perf, alloc_iterations);
+		mem_phase_end(&mem, test_ua, test_ka, alloc_fn,
+			      alloc_iterations,
+			      alloc_sizes[j] * alloc_iterations);
 
-		if (test_ua)
-			ua_free(test_ua);
+		reset_test_arena(test_ua, test_ka, alloc_fn);
 
-		if (test_ka && alloc_fn == ka_alloc_timed)
-			ka_free(test_ka);
-		else if (test_ka && alloc_fn == oka_alloc_timed)
-			oka_free(test_ka);
-
-		lm_log_tsc_timing_avg(tstats->total_tsc, tstats->iter, "", NS,
-				      true, INF, LM_LOG_MODULE_LOCAL);
-		LmLogInfoR("\n");
+		log_phase_timings();
+		mem_footprint_log(&mem, LM_LOG_MODULE_LOCAL);
 		write_data_to_file(log_directory, alloc_fn, NULL,
-				   alloc_sizes[j]);
+				   alloc_sizes[j], 1, NULL, perf, &mem);
+		cold_phases(test_ua, test_ka, alloc_fn, &alloc_sizes[j], 1,
+			    alloc_iterations,
+			    alloc_sizes[j] * alloc_iterations, NULL,
+			    alloc_sizes[j], log_directory, cold, timing_arr,
+			    hist);
 	}
 
+	init_alloc_hist(NULL);
 	ua_destroy(&timings_ua);
 }
 
+// Allocates a precomputed size sequence in order. Used for the sampled
+// distributions, whose sizes only mean something together
+static void sequence_phase(struct ua_params *ua_params, UArena *test_ua,
+			   KArena *test_ka, alloc_fn_t alloc_fn,
+			   const char *alloc_fn_name,
+			   const struct workload *workload,
+			   const char *log_directory,
+			   struct alloc_timing_params *timing,
+			   struct tight_loop_perf *perf,
+			   const struct cold_params *cold)
+{
+	uint64_t len = workload_sequence_len(workload);
+	LmLogInfoR("\n\n%s'ing the %s workload, %lu allocations: \n",
+		   alloc_fn_name, workload->name, len);
+
+	UArena *timings_ua = ua_create(phase_timings_size(timing, perf, len) +
+					       len * sizeof(size_t),
+				       UA_CONTIGUOUS, UA_MMAPD);
+	uint64_t requested;
+	size_t *seq = workload_generate(workload, 0, timings_ua, &requested);
+	if (ua_params && requested > ua_params->arena_sz) {
+		LmLogError(
+			"Arena has insufficient memory for the %s workload. Arena size: %zd, needed size: %lu",
+			workload->name, ua_params->arena_sz, requested);
+		ua_destroy(&timings_ua);
+		return;
+	}
+
+	uint64_t *timing_arr;
+	struct hdr_histogram hist_storage;
+	struct hdr_histogram *hist;
+	init_phase_timings(timing, timings_ua, len, &timing_arr, &hist,
+			   &hist_storage);
+	if (perf->per_alloc)
+		perf->deltas = UaPushArray(timings_ua, uint64_t,
+					   len * PERF_COUNTER_COUNT);
+
+	struct mem_footprint mem;
+	warmup_phase(test_ua, test_ka, alloc_fn, seq, len, len, timing_arr,
+		     hist);
+	begin_phase_timings(len, timing_arr, hist);
+	mem_phase_begin(&mem, test_ua, test_ka, alloc_fn);
+	perf_phase_begin(perf);
+	for (uint64_t i = 0; i < len; ++i) {
+		uint8_t *ptr = perf_alloc(perf, alloc_fn, test_ua, test_ka,
+					  seq[i], i);
+		*ptr = 1;
+	}
+	perf_phase_end(perf, len);
+	mem_phase_end(&mem, test_ua, test_ka, alloc_fn, len, requested);
+
+	reset_test_arena(test_ua, test_ka, alloc_fn);
+
+	log_phase_timings();
+	mem_footprint_log(&mem, LM_LOG_MODULE_LOCAL);
+	write_data_to_file(log_directory, alloc_fn, workload->name, 0, 1, NULL,
+			   perf, &mem);
+	cold_phases(test_ua, test_ka, alloc_fn, seq, len, len, requested,
+		    workload->name, 0, log_directory, cold, timing_arr, hist);
+
+	init_alloc_hist(NULL);
+	ua_destroy(&timings_ua);
+}
+
+struct sequence_thread {
+	pthread_t thread;
+	pthread_barrier_t *barrier;
+	struct ua_params *ua_params;
+	bool is_karena;
+	alloc_fn_t alloc_fn;
+	const struct workload *workload;
+	int id;
+	uint64_t len;
+	uint64_t *timing_arr; // NULL unless raw samples are kept
+	struct hdr_histogram *hist; // NULL unless a histogram is kept
+	UArena *ua;
+	KArena *ka;
+	bool runnable;
+	uint64_t requested;
+	uint64_t start_tsc;
+	uint64_t end_tsc;
+	struct alloc_tstats tstats;
+};
+
+// NOTE: (isa): The main thread waits on the same barrier four times, so it
+// can take the memory snapshots while every thread is ready or done, without
+// the snapshots landing in any thread's timed region
+static void *sequence_thread_main(void *arg)
+{
+	struct sequence_thread *st = arg;
+	// A pinned benchmark would otherwise have every thread inherit the
+	// main thread's single CPU
+	if (noise_env_get()->pinned_cpu >= 0) {
+		int cpus[NOISE_MAX_CPUS];
+		int cpu_count = noise_cpus(cpus, NOISE_MAX_CPUS);
+		pin_thread_to_cpu(cpus[st->id % cpu_count]);
+	}
+
+	UArena *seq_ua = ua_create(st->len * sizeof(size_t) + get_page_size(),
+				   UA_CONTIGUOUS, UA_MMAPD);
+	size_t *seq = workload_generate(st->workload, st->id, seq_ua,
+					&st->requested);
+	st->runnable = seq && create_test_arena(st->ua_params, st->is_karena,
+						st->alloc_fn, &st->ua, &st->ka);
+	if (st->runnable && st->ua_params &&
+	    st->requested > st->ua_params->arena_sz) {
+		LmLogError(
+			"Arena has insufficient memory for the %s workload on thread %d",
+			st->workload->name, st->id);
+		st->runnable = false;
+	}
+
+	if (st->runnable)
+		warmup_phase(st->ua, st->ka, st->alloc_fn, seq, st->len,
+			     st->len, st->timing_arr, st->hist);
+	if (st->timing_arr)
+		memset(st->timing_arr, 0, st->len * sizeof(uint64_t));
+	begin_phase_timings(st->len, st->timing_arr, st->hist);
+
+	pthread_barrier_wait(st->barrier); // Ready
+	pthread_barrier_wait(st->barrier); // Go
+
+	START_TSC_TIMING_LFENCE(run);
+	for (uint64_t i = 0; st->runnable && i < st->len; ++i) {
+		uint8_t *ptr = st->alloc_fn(st->ua, st->ka, seq[i]);
+		*ptr = 1;
+	}
+	END_TSC_TIMING_LFENCE(run);
+	st->start_tsc = run_start;
+	st->end_tsc = run_end;
+	st->tstats = *get_alloc_tstats();
+
+	pthread_barrier_wait(st->barrier); // Done
+	pthread_barrier_wait(st->barrier); // Snapshot taken
+
+	init_alloc_tcoll(0, NULL);
+	init_alloc_hist(NULL);
+	destroy_test_arena(&st->ua, st->ka, st->alloc_fn);
+	ua_destroy(&seq_ua);
+	return NULL;
+}
+
+static uint64_t sequence_threads_consumed(struct sequence_thread *threads,
+					  int thread_count)
+{
+	if (!threads[0].ua_params)
+		return test_arena_consumed(NULL, NULL, threads[0].alloc_fn);
+
+	uint64_t consumed = 0;
+	for (int i = 0; i < thread_count; ++i)
+		if (threads[i].runnable)
+			consumed += test_arena_consumed(threads[i].ua,
+							threads[i].ka,
+							threads[i].alloc_fn);
+	return consumed;
+}
+
+// Runs the sequence on workload->threads threads at once, each with its own
+// arena, and writes the samples of all of them as one run
+static void sequence_phase_threaded(struct ua_params *ua_params, bool is_karena,
+				    alloc_fn_t alloc_fn,
+				    const char *alloc_fn_name,
+				    const struct workload *workload,
+				    const char *log_directory,
+				    struct alloc_timing_params *timing)
+{
+	int thread_count = workload->threads;
+	uint64_t len = workload_sequence_len(workload);
+	uint64_t total_ops = len * (uint64_t)thread_count;
+	LmLogInfoR("\n\n%s'ing the %s workload on %d threads, %lu allocations "
+		   "each: \n",
+		   alloc_fn_name, workload->name, thread_count, len);
+
+	size_t hist_sz = timing->histogram ?
+				 hdr_mem_size(timing->significant_digits) :
+				 0;
+	UArena *run_ua = ua_create(
+		(timing->raw_samples ? total_ops * sizeof(uint64_t) : 0) +
+			(size_t)(thread_count + 1) *
+				(hist_sz + sizeof(struct hdr_histogram)) +
+			(size_t)thread_count * sizeof(struct sequence_thread) +
+			get_page_size(),
+		UA_CONTIGUOUS, UA_MMAPD);
+	uint64_t *timing_arr = NULL;
+	if (timing->raw_samples)
+		timing_arr = UaPushArray(run_ua, uint64_t, total_ops);
+	struct sequence_thread *threads = UaPushArray(
+		run_ua, struct sequence_thread, (size_t)thread_count);
+	struct hdr_histogram *hists = NULL;
+	if (timing->histogram) {
+		hists = UaPushArray(run_ua, struct hdr_histogram,
+				    (size_t)thread_count + 1);
+		// Without every thread's histogram the merge is meaningless,
+		// so a failed init drops them all
+		for (int i = 0; i <= thread_count && hists; ++i)
+			if (hdr_init(&hists[i], timing->significant_digits,
+				     run_ua) != 0)
+				hists = NULL;
+	}
+
+	pthread_barrier_t barrier;
+	pthread_barrier_init(&barrier, NULL, (unsigned)thread_count + 1);
+	for (int i = 0; i < thread_count; ++i) {
+		struct sequence_thread *st = &threads[i];
+		*st = (struct sequence_thread){ 0 };
+		st->barrier = &barrier;
+		st->ua_params = ua_params;
+		st->is_karena = is_karena;
+		st->alloc_fn = alloc_fn;
+		st->workload = workload;
+		st->id = i;
+		st->len = len;
+		if (timing_arr)
+			st->timing_arr = timing_arr + (uint64_t)i * len;
+		if (hists)
+			st->hist = &hists[i + 1];
+		int err = pthread_create(&st->thread, NULL,
+					 sequence_thread_main, st);
+		LmAssert(err == 0, "Failed to create workload thread: %s",
+			 strerror(err));
+	}
+
+	struct mem_footprint mem = { 0 };
+	pthread_barrier_wait(&barrier); // Ready
+	mem_snapshot_take(&mem.begin,
+			  sequence_threads_consumed(threads, thread_count));
+	pthread_barrier_wait(&barrier); // Go
+	pthread_barrier_wait(&barrier); // Done
+	mem_snapshot_take(&mem.end,
+			  sequence_threads_consumed(threads, thread_count));
+	pthread_barrier_wait(&barrier); // Snapshot taken
+	for (int i = 0; i < thread_count; ++i)
+		pthread_join(threads[i].thread, NULL);
+	pthread_barrier_destroy(&barrier);
+
+	// The samples of every thread are written as one run, so a thread
+	// that couldn't run leaves nothing worth writing
+	for (int i = 0; i < thread_count; ++i) {
+		if (!threads[i].runnable) {
+			LmLogError("Thread %d couldn't run the %s workload, "
+				   "skipping it",
+				   i, workload->name);
+			ua_destroy(&run_ua);
+			return;
+		}
+	}
+
+	uint64_t min_start = UINT64_MAX;
+	uint64_t max_end = 0;
+	struct alloc_tstats merged_tstats = { 0 };
+	for (int i = 0; i < thread_count; ++i) {
+		struct sequence_thread *st = &threads[i];
+		min_start = LmMin(min_start, st->start_tsc);
+		max_end = LmMax(max_end, st->end_tsc);
+		merged_tstats.total_tsc += st->tstats.total_tsc;
+		merged_tstats.iter += st->tstats.iter;
+		mem.allocs += st->len;
+		mem.requested += st->requested;
+		if (hists)
+			hdr_merge(&hists[0], st->hist);
+	}
+
+	LmLogInfoR("%.0f allocations/s over all threads\n",
+		   (double)mem.allocs /
+			   ((double)(max_end - min_start) / get_tsc_freq()));
+
+	// The merged samples are handed to the calling thread's collection, so
+	// they're logged and written like a single threaded phase
+	init_alloc_tcoll(timing_arr ? total_ops : 0, timing_arr);
+	get_alloc_tcoll()->cur = timing_arr ? total_ops : 0;
+	init_alloc_hist(hists);
+	*get_alloc_tstats() = merged_tstats;
+
+	log_phase_timings();
+	mem_footprint_log(&mem, LM_LOG_MODULE_LOCAL);
+
+	struct tight_loop_perf no_perf = { 0 };
+	write_data_to_file(log_directory, alloc_fn, workload->name, 0,
+			   thread_count, NULL, &no_perf, &mem);
+
+	init_alloc_tcoll(0, NULL);
+	init_alloc_hist(NULL);
+	ua_destroy(&run_ua);
+}
+
+static void run_workload_sequence(struct ua_params *ua_params, bool is_karena,
+				  alloc_fn_t alloc_fn,
+				  const char *alloc_fn_name,
+				  const struct workload *workload,
+				  const char *log_directory,
+				  struct alloc_timing_params *timing,
+				  struct perf_params *perf_params,
+				  const struct cold_params *cold)
+{
+	LmLogInfoR("\n\n------------------------------\n");
+	LmLogInfo("%s -- %s", alloc_fn_name, workload->name);
+
+	if (workload->threads > 1) {
+		sequence_phase_threaded(ua_params, is_karena, alloc_fn,
+					alloc_fn_name, workload, log_directory,
+					timing);
+		return;
+	}
+
+	UArena *ua;
+	KArena *ka;
+	if (!create_test_arena(ua_params, is_karena, alloc_fn, &ua, &ka))
+		return;
+
+	struct perf_group group;
+	struct tight_loop_perf perf;
+	open_test_perf(perf_params, timing, &group, &perf);
+	sequence_phase(ua_params, ua, ka, alloc_fn, alloc_fn_name, workload,
+		       log_directory, timing, &perf, cold);
+	close_test_perf(&perf);
+	destroy_test_arena(&ua, ka, alloc_fn);
+}
+
+// NOTE: (isa): Sampled workloads, and lists spread over several threads, are
+// run as one sequence. Single threaded lists keep the two phases below, one
+// size at a time and then all of them interleaved
+static void workload_sequence_test(struct ua_params *ua_params,
+				   bool running_in_debugger, bool is_karena,
+				   alloc_fn_t alloc_fn,
+				   const char *alloc_fn_name,
+				   const struct workload *workload,
+				   LmString log_filename, const char *file_mode,
+				   const char *log_directory,
+				   struct alloc_timing_params *timing,
+				   struct perf_params *perf_params,
+				   const struct cold_params *cold)
+{
+	if (running_in_debugger) {
+		FILE *log_file = lm_open_file_by_name(log_filename, file_mode);
+		LmSetLogFileLocal(log_file);
+		run_workload_sequence(ua_params, is_karena, alloc_fn,
+				      alloc_fn_name, workload, log_directory,
+				      timing, perf_params, cold);
+		LmRemoveLogFileLocal();
+		lm_close_file(log_file);
+		return;
+	}
+
+	LmLogInfo("Running the %s workload in forked mode", workload->name);
+	pid_t pid;
+	int status;
+	if ((pid = fork()) == -1) {
+		LmLogError("Fork failed: %s", strerror(errno));
+	} else if (pid == 0) {
+		FILE *log_file = lm_open_file_by_name(log_filename, file_mode);
+		LmSetLogFileLocal(log_file);
+		run_workload_sequence(ua_params, is_karena, alloc_fn,
+				      alloc_fn_name, workload, log_directory,
+				      timing, perf_params, cold);
+		LmRemoveLogFileLocal();
+		lm_close_file(log_file);
+		exit(EXIT_SUCCESS);
+	} else {
+		waitpid(pid, &status, 0);
+	}
+}
+
 void tight_loop_test(struct ua_params *ua_params, bool running_in_debugger,
-		     bool is_karena, uint64_t alloc_iterations,
-		     alloc_fn_t alloc_fn, const char *alloc_fn_name,
-		     size_t *alloc_sizes, size_t alloc_sizes_len,
-		     const char *size_name, LmString log_filename,
-		     const char *file_mode, const char *log_directory)
+		     bool is_karena, alloc_fn_t alloc_fn,
+		     const char *alloc_fn_name, const struct workload *workload,
+		     LmString log_filename, const char *file_mode,
+		     const char *log_directory,
+		     struct alloc_timing_params *timing,
+		     struct perf_params *perf_params,
+		     const struct cold_params *cold)
 {
+	if (workload->dist.kind != SIZE_DIST_LIST || workload->threads > 1) {
+		workload_sequence_test(ua_params, running_in_debugger,
+				       is_karena, alloc_fn, alloc_fn_name,
+				       workload, log_filename, file_mode,
+				       log_directory, timing, perf_params,
+				       cold);
+		return;
+	}
+
+	uint64_t alloc_iterations = workload->iterations;
+	size_t *alloc_sizes = workload->dist.sizes;
+	size_t alloc_sizes_len = workload->dist.sizes_len;
+	const char *size_name = workload->name;
 	if (ua_params) {
-		size_t largest_sz = alloc_sizes[alloc_sizes_len - 1];
+		size_t largest_sz = workload_max_size(workload);
 		size_t mem_needed_for_largest_sz =
 			largest_sz * (size_t)alloc_iterations;
 		LmAssert(
@@ -186,6 +1073,9 @@ void tight_loop_test(struct ua_params *ua_params, bool running_in_debugger,
 			mem_needed_for_largest_sz);
 	}
 
+	struct perf_group group;
+	struct tight_loop_perf perf;
+
 	UAScratch uas = ua_scratch_begin(main_ua);
 	if (!running_in_debugger) {
 		LmLogInfo("Running tight loop tests in forked mode");
@@ -201,33 +1091,22 @@ void tight_loop_test(struct ua_params *ua_params, bool running_in_debugger,
 				lm_open_file_by_name(log_filename, file_mode);
 			LmSetLogFileLocal(log_file);
 
-			UArena *ua = NULL;
-			KArena *ka = NULL;
-			if (ua_params && !is_karena)
-				ua = ua_create(ua_params->arena_sz,
-					       ua_params->contiguous,
-					       ua_params->mallocd);
-			else if (ua_params && is_karena &&
-				 alloc_fn == ka_alloc_timed) {
-				ka = ka_create(ua_params->arena_sz);
-
-			} else if (alloc_fn == oka_alloc_timed) {
-				ka = oka_create(ua_params->arena_sz);
-			}
+			UArena *ua;
+			KArena *ka;
+			if (!create_test_arena(ua_params, is_karena, alloc_fn,
+					       &ua, &ka))
+				exit(EXIT_FAILURE);
 
 			LmLogInfoR("\n\n------------------------------\n");
 			LmLogInfo("%s -- %s", alloc_fn_name, size_name);
 
+			open_test_perf(perf_params, timing, &group, &perf);
 			each_size_by_itself(ua, ka, alloc_iterations, alloc_fn,
 					    alloc_fn_name, alloc_sizes,
 					    alloc_sizes_len, size_name,
-					    log_directory);
-			if (ua)
-				ua_destroy(&ua);
-			if (ka && alloc_fn == ka_alloc_timed)
-				ka_destroy(ka);
-			else if (ka && alloc_fn == oka_alloc_timed)
-				oka_destroy(ka);
+					    log_directory, timing, &perf, cold);
+			close_test_perf(&perf);
+			destroy_test_arena(&ua, ka, alloc_fn);
 
 			LmRemoveLogFileLocal();
 			lm_close_file(log_file);
@@ -245,30 +1124,20 @@ void tight_loop_test(struct ua_params *ua_params, bool running_in_debugger,
 				lm_open_file_by_name(log_filename, file_mode);
 			LmSetLogFileLocal(log_file);
 
-			UArena *ua = NULL;
-			KArena *ka = NULL;
-			if (ua_params && !is_karena)
-				ua = ua_create(ua_params->arena_sz,
-					       ua_params->contiguous,
-					       ua_params->mallocd);
-			else if (ua_params && is_karena &&
-				 alloc_fn == ka_alloc_timed) {
-				ka = ka_create(ua_params->arena_sz);
-			} else if (alloc_fn == oka_alloc_timed) {
-				ka = oka_create(ua_params->arena_sz);
-			}
+			UArena *ua;
+			KArena *ka;
+			if (!create_test_arena(ua_params, is_karena, alloc_fn,
+					       &ua, &ka))
+				exit(EXIT_FAILURE);
 
+			open_test_perf(perf_params, timing, &group, &perf);
 			all_sizes_repeatedly(ua, ka, alloc_iterations, alloc_fn,
 					     alloc_fn_name, alloc_sizes,
 					     alloc_sizes_len, size_name,
-					     log_directory);
-			if (ua)
-				ua_destroy(&ua);
-
-			if (ka && alloc_fn == ka_alloc_timed)
-				ka_destroy(ka);
-			else if (ka && alloc_fn == oka_alloc_timed)
-				oka_destroy(ka);
+					     log_directory, timing, &perf,
+					     cold);
+			close_test_perf(&perf);
+			destroy_test_arena(&ua, ka, alloc_fn);
 
 			LmRemoveLogFileLocal();
 			lm_close_file(log_file);
@@ -279,33 +1148,30 @@ void tight_loop_test(struct ua_params *ua_params, bool running_in_debugger,
 	} else {
 		FILE *log_file = lm_open_file_by_name(log_filename, file_mode);
 		LmSetLogFileLocal(log_file);
-		UArena *ua = NULL;
-		KArena *ka = NULL;
-		if (ua_params && !is_karena)
-			ua = ua_create(ua_params->arena_sz,
-				       ua_params->contiguous,
-				       ua_params->mallocd);
-		else if (ua_params && is_karena && alloc_fn == ka_alloc_timed) {
-			ka = ka_create(ua_params->arena_sz);
-		} else if (alloc_fn == oka_alloc_timed) {
-			ka = oka_create(ua_params->arena_sz);
+		UArena *ua;
+		KArena *ka;
+		if (!create_test_arena(ua_params, is_karena, alloc_fn, &ua,
+				       &ka)) {
+			LmRemoveLogFileLocal();
+			lm_close_file(log_file);
+			ua_scratch_release(uas);
+			return;
 		}
 		LmLogInfoR("\n\n------------------------------\n");
 		LmLogInfo("%s -- %s", alloc_fn_name, size_name);
 
+		open_test_perf(perf_params, timing, &group, &perf);
 		each_size_by_itself(ua, ka, alloc_iterations, alloc_fn,
 				    alloc_fn_name, alloc_sizes, alloc_sizes_len,
-				    size_name, log_directory);
+				    size_name, log_directory, timing, &perf,
+				    cold);
 
 		all_sizes_repeatedly(ua, ka, alloc_iterations, alloc_fn,
 				     alloc_fn_name, alloc_sizes,
-				     alloc_sizes_len, size_name, log_directory);
-		if (ua)
-			ua_destroy(&ua);
-		if (ka && alloc_fn == ka_alloc_timed)
-			ka_destroy(ka);
-		else if (ka && alloc_fn == oka_alloc_timed)
-			oka_destroy(ka);
+				     alloc_sizes_len, size_name, log_directory,
+				     timing, &perf, cold);
+		close_test_perf(&perf);
+		destroy_test_arena(&ua, ka, alloc_fn);
 
 		LmRemoveLogFileLocal();
 		lm_close_file(log_file);
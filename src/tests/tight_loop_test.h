@@ -5,14 +5,19 @@
 
 #include <src/allocators/u_arena.h>
 #include <src/allocators/allocator_wrappers.h>
+#include <src/metrics/perf_counters.h>
 
 #include "tests.h"
+#include "workload.h"
+#include "perturb.h"
 
 void tight_loop_test(struct ua_params *ua_params, bool running_in_debugger,
-		     bool is_karena, uint64_t alloc_iterations,
-		     alloc_fn_t alloc_fn, const char *alloc_fn_name,
-		     size_t *alloc_sizes, size_t alloc_sizes_len,
-		     const char *size_name, LmString log_filename,
-		     const char *file_mode, const char *log_filename_base);
+		     bool is_karena, alloc_fn_t alloc_fn,
+		     const char *alloc_fn_name, const struct workload *workload,
+		     LmString log_filename, const char *file_mode,
+		     const char *log_filename_base,
+		     struct alloc_timing_params *timing,
+		     struct perf_params *perf_params,
+		     const struct cold_params *cold);
 
 #endif
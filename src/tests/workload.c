@@ -0,0 +1,290 @@
+#include <src/lm.h>
+LM_LOG_REGISTER(workload);
+
+#include <src/utils/random.h>
+
+#include "workload.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+const char *size_dist_kind_string(enum size_dist_kind kind)
+{
+	switch (kind) {
+	case SIZE_DIST_LIST:
+		return "list";
+	case SIZE_DIST_UNIFORM:
+		return "uniform";
+	case SIZE_DIST_LOGNORMAL:
+		return "lognormal";
+	case SIZE_DIST_ZIPF:
+		return "zipf";
+	case SIZE_DIST_HISTOGRAM:
+		return "histogram";
+	default:
+		return "unknown";
+	}
+}
+
+enum size_dist_kind size_dist_kind_from_string(const char *string)
+{
+	for (int i = 0; i < SIZE_DIST_KIND_COUNT; ++i) {
+		if (strcmp(string, size_dist_kind_string((enum size_dist_kind)i)) ==
+		    0)
+			return (enum size_dist_kind)i;
+	}
+
+	return SIZE_DIST_KIND_COUNT;
+}
+
+// Reads the lines twice, once to count them so the buckets can be pushed as
+// one array. Empty lines and lines starting with # are skipped
+static int load_histogram(struct size_dist *dist, UArena *ua)
+{
+	FILE *file = fopen(dist->histogram_file, "r");
+	if (!file) {
+		LmLogError("Unable to open size histogram %s: %s",
+			   dist->histogram_file, strerror(errno));
+		return -1;
+	}
+
+	char line[256];
+	size_t count = 0;
+	while (fgets(line, sizeof(line), file))
+		if (line[0] != '#' && line[0] != '\n')
+			++count;
+
+	dist->sizes = UaPushArray(ua, size_t, LmMax(count, 1));
+	dist->cdf = UaPushArray(ua, double, LmMax(count, 1));
+	dist->sizes_len = 0;
+	rewind(file);
+
+	double total = 0;
+	while (fgets(line, sizeof(line), file) && dist->sizes_len < count) {
+		if (line[0] == '#' || line[0] == '\n')
+			continue;
+
+		size_t size;
+		double weight;
+		if (sscanf(line, "%zu %lf", &size, &weight) != 2 || size == 0 ||
+		    weight < 0) {
+			LmLogError("Malformed line in size histogram %s: %s",
+				   dist->histogram_file, line);
+			fclose(file);
+			return -1;
+		}
+		total += weight;
+		dist->sizes[dist->sizes_len] = size;
+		dist->cdf[dist->sizes_len] = total;
+		++dist->sizes_len;
+	}
+
+	fclose(file);
+	if (dist->sizes_len == 0 || total <= 0) {
+		LmLogError("Size histogram %s has no weighted sizes",
+			   dist->histogram_file);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int build_zipf(struct size_dist *dist, UArena *ua)
+{
+	if (!dist->sizes) {
+		dist->sizes_len = (dist->max_size - dist->min_size) /
+					  LmMax(dist->step, 1) +
+				  1;
+		dist->sizes = UaPushArray(ua, size_t, dist->sizes_len);
+		for (size_t i = 0; i < dist->sizes_len; ++i)
+			dist->sizes[i] = dist->min_size + i * dist->step;
+	}
+
+	dist->cdf = UaPushArray(ua, double, dist->sizes_len);
+	double total = 0;
+	for (size_t i = 0; i < dist->sizes_len; ++i) {
+		total += 1.0 / pow((double)(i + 1), dist->exponent);
+		dist->cdf[i] = total;
+	}
+
+	return 0;
+}
+
+// Checks the parameters parsed from the config and builds the tables the
+// sampling needs, so nothing but the RNG is left for workload_generate
+int size_dist_init(struct size_dist *dist, UArena *ua)
+{
+	switch (dist->kind) {
+	case SIZE_DIST_LIST:
+		if (!dist->sizes || dist->sizes_len == 0) {
+			LmLogError("A list size distribution needs sizes");
+			return -1;
+		}
+		return 0;
+	case SIZE_DIST_UNIFORM:
+	case SIZE_DIST_LOGNORMAL:
+		if (dist->min_size == 0 || dist->min_size > dist->max_size) {
+			LmLogError(
+				"%s size distribution needs 0 < min_size <= max_size",
+				size_dist_kind_string(dist->kind));
+			return -1;
+		}
+		if (dist->kind == SIZE_DIST_LOGNORMAL &&
+		    (dist->median <= 0 || dist->sigma < 0)) {
+			LmLogError(
+				"lognormal size distribution needs median > 0 and sigma >= 0");
+			return -1;
+		}
+		return 0;
+	case SIZE_DIST_ZIPF:
+		if (!dist->sizes &&
+		    (dist->min_size == 0 || dist->min_size > dist->max_size ||
+		     dist->step == 0)) {
+			LmLogError(
+				"zipf size distribution needs sizes, or 0 < min_size <= max_size and a step");
+			return -1;
+		}
+		if (dist->exponent <= 0) {
+			LmLogError("zipf size distribution needs exponent > 0");
+			return -1;
+		}
+		return build_zipf(dist, ua);
+	case SIZE_DIST_HISTOGRAM:
+		if (!dist->histogram_file) {
+			LmLogError("histogram size distribution needs a file");
+			return -1;
+		}
+		return load_histogram(dist, ua);
+	default:
+		LmLogError("Unknown size distribution");
+		return -1;
+	}
+}
+
+uint64_t workload_sequence_len(const struct workload *workload)
+{
+	if (workload->dist.kind == SIZE_DIST_LIST)
+		return workload->iterations * workload->dist.sizes_len;
+	return workload->iterations;
+}
+
+size_t workload_max_size(const struct workload *workload)
+{
+	const struct size_dist *dist = &workload->dist;
+	if (!dist->sizes)
+		return dist->max_size;
+
+	size_t max = 0;
+	for (size_t i = 0; i < dist->sizes_len; ++i)
+		max = LmMax(max, dist->sizes[i]);
+	return max;
+}
+
+static size_t sample_cdf(const struct size_dist *dist, struct rng *rng)
+{
+	double u = rng_double(rng) * dist->cdf[dist->sizes_len - 1];
+	size_t lo = 0;
+	size_t hi = dist->sizes_len - 1;
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		if (dist->cdf[mid] > u)
+			hi = mid;
+		else
+			lo = mid + 1;
+	}
+	return dist->sizes[lo];
+}
+
+// Box-Muller, using only the cosine half since the sequence is generated
+// up front and speed doesn't matter
+static size_t sample_lognormal(const struct size_dist *dist, struct rng *rng)
+{
+	double u1 = 1.0 - rng_double(rng);
+	double u2 = rng_double(rng);
+	double z = sqrt(-2.0 * log(u1)) * cos(2.0 * M_PI * u2);
+	double size = round(dist->median * exp(dist->sigma * z));
+	size = LmMax(size, (double)dist->min_size);
+	size = LmMin(size, (double)dist->max_size);
+	return (size_t)size;
+}
+
+// NOTE: (isa): The whole sequence is generated before any timing starts, so
+// the timed loop only loads the next size. Every thread gets its own stream,
+// seeded from the workload's seed and the thread number
+size_t *workload_generate(const struct workload *workload, int thread,
+			  UArena *ua, uint64_t *total_bytes)
+{
+	const struct size_dist *dist = &workload->dist;
+	uint64_t len = workload_sequence_len(workload);
+	size_t *seq = UaPushArray(ua, size_t, len);
+	if (!seq)
+		return NULL;
+
+	struct rng rng;
+	rng_seed(&rng, dist->seed + (uint64_t)thread);
+
+	uint64_t total = 0;
+	for (uint64_t i = 0; i < len; ++i) {
+		size_t size;
+		switch (dist->kind) {
+		case SIZE_DIST_LIST:
+			size = dist->sizes[i % dist->sizes_len];
+			break;
+		case SIZE_DIST_UNIFORM:
+			size = dist->min_size +
+			       rng_below(&rng,
+					 dist->max_size - dist->min_size + 1);
+			break;
+		case SIZE_DIST_LOGNORMAL:
+			size = sample_lognormal(dist, &rng);
+			break;
+		default:
+			size = sample_cdf(dist, &rng);
+			break;
+		}
+		seq[i] = size;
+		total += size;
+	}
+
+	*total_bytes = total;
+	return seq;
+}
+
+void workload_log(const struct workload *workload, lm_log_module *log_module)
+{
+	const struct size_dist *dist = &workload->dist;
+	LmLogManual(log_module, true, INF, "\t%-12s %s", workload->name,
+		    size_dist_kind_string(dist->kind));
+	switch (dist->kind) {
+	case SIZE_DIST_LIST:
+		LmLogManual(log_module, true, INF, " of %zd sizes",
+			    dist->sizes_len);
+		break;
+	case SIZE_DIST_UNIFORM:
+		LmLogManual(log_module, true, INF, " %zd-%zd B", dist->min_size,
+			    dist->max_size);
+		break;
+	case SIZE_DIST_LOGNORMAL:
+		LmLogManual(log_module, true, INF,
+			    " median %.0f B, sigma %.2f, %zd-%zd B", dist->median,
+			    dist->sigma, dist->min_size, dist->max_size);
+		break;
+	case SIZE_DIST_ZIPF:
+		LmLogManual(log_module, true, INF,
+			    " exponent %.2f over %zd sizes", dist->exponent,
+			    dist->sizes_len);
+		break;
+	case SIZE_DIST_HISTOGRAM:
+		LmLogManual(log_module, true, INF, " of %zd sizes from %s",
+			    dist->sizes_len, dist->histogram_file);
+		break;
+	default:
+		break;
+	}
+	if (dist->kind != SIZE_DIST_LIST)
+		LmLogManual(log_module, true, INF, ", seed %lu", dist->seed);
+	LmLogManual(log_module, true, INF, ", %lu iterations, %d thread%s\n",
+		    workload->iterations, workload->threads,
+		    workload->threads == 1 ? "" : "s");
+}
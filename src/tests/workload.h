@@ -0,0 +1,52 @@
+#ifndef WORKLOAD_H
+#define WORKLOAD_H
+
+#include <src/lm.h>
+#include <src/allocators/u_arena.h>
+
+enum size_dist_kind {
+	SIZE_DIST_LIST, // The sizes in order, cycled
+	SIZE_DIST_UNIFORM, // Uniform in [min_size, max_size]
+	SIZE_DIST_LOGNORMAL, // Around median, clamped to [min_size, max_size]
+	SIZE_DIST_ZIPF, // The k-th most common size has weight 1/k^exponent
+	SIZE_DIST_HISTOGRAM, // Weighted sizes loaded from a file
+	SIZE_DIST_KIND_COUNT
+};
+
+struct size_dist {
+	enum size_dist_kind kind;
+	uint64_t seed;
+	size_t min_size;
+	size_t max_size;
+	double median; // Lognormal
+	double sigma; // Lognormal, the standard deviation of ln(size)
+	double exponent; // Zipf
+	size_t step; // Zipf without sizes, the distance between ranks in bytes
+	const char *histogram_file; // One "size weight" pair per line
+	// The list, the zipf ranks from most to least common or the histogram
+	// buckets. Zipf ranks default to min_size, min_size + step, ...
+	size_t *sizes;
+	size_t sizes_len;
+	double *cdf; // Cumulative weights over sizes, for zipf and histograms
+};
+
+// One entry of the "workloads" array in the arena and malloc contexts
+struct workload {
+	const char *name;
+	struct size_dist dist;
+	uint64_t iterations; // Per size for lists, otherwise per thread
+	int threads;
+};
+
+const char *size_dist_kind_string(enum size_dist_kind kind);
+enum size_dist_kind size_dist_kind_from_string(const char *string);
+
+int size_dist_init(struct size_dist *dist, UArena *ua);
+
+uint64_t workload_sequence_len(const struct workload *workload);
+size_t workload_max_size(const struct workload *workload);
+size_t *workload_generate(const struct workload *workload, int thread,
+			  UArena *ua, uint64_t *total_bytes);
+void workload_log(const struct workload *workload, lm_log_module *log_module);
+
+#endif
@@ -0,0 +1,287 @@
+#define _GNU_SOURCE
+#include <src/lm.h>
+LM_LOG_REGISTER(noise_control);
+
+#include "noise_control.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+// Locks pages as they're faulted in rather than populating every mapping up
+// front, which would make the arenas' reservations resident and hide the
+// first touch faults the tests measure. Added in Linux 4.4
+#ifndef MCL_ONFAULT
+#define MCL_ONFAULT 4
+#endif
+
+static struct noise_params applied;
+static struct noise_env env;
+static bool env_captured;
+
+// Reads the first line of a sysfs file without the newline. Returns false if
+// the file doesn't exist, e.g. without cpufreq in a VM
+static bool read_sysfs(const char *path, char *buf, size_t len)
+{
+	FILE *file = fopen(path, "r");
+	if (!file)
+		return false;
+
+	bool res = fgets(buf, (int)len, file) != NULL;
+	fclose(file);
+	if (res)
+		buf[strcspn(buf, "\n")] = '\0';
+	return res;
+}
+
+static uint32_t read_sysfs_u32(const char *path)
+{
+	char buf[32];
+	return read_sysfs(path, buf, sizeof(buf)) ?
+		       (uint32_t)strtoul(buf, NULL, 10) :
+		       0;
+}
+
+// Walks a CPU list like "0-3,8", counting the CPUs in it and checking if cpu
+// is one of them
+static int cpulist_count(const char *list, int cpu, bool *contains)
+{
+	int count = 0;
+	*contains = false;
+	for (const char *p = list; *p;) {
+		if (*p < '0' || *p > '9') {
+			++p;
+			continue;
+		}
+
+		char *end;
+		long first = strtol(p, &end, 10);
+		long last = first;
+		if (*end == '-')
+			last = strtol(end + 1, &end, 10);
+		count += (int)(last - first + 1);
+		if (cpu >= first && cpu <= last)
+			*contains = true;
+		p = end;
+	}
+	return count;
+}
+
+static void capture_env(void)
+{
+	env = (struct noise_env){ 0 };
+	env.pinned_cpu = applied.cpu_count ? applied.cpus[0] : -1;
+	env.warmup = applied.warmup;
+
+	struct sched_param sp;
+	env.sched_policy = sched_getscheduler(0);
+	if (sched_getparam(0, &sp) == 0)
+		env.sched_priority = sp.sched_priority;
+	if (applied.mlockall)
+		env.flags |= NOISE_ENV_MLOCKED;
+
+	// Without pinning, the CPU we happen to be on stands in for the rest
+	int cpu = env.pinned_cpu >= 0 ? env.pinned_cpu : sched_getcpu();
+	cpu = LmMax(cpu, 0);
+
+	char path[128];
+	char buf[256];
+	snprintf(path, sizeof(path),
+		 "/sys/devices/system/cpu/cpu%d/cpufreq/scaling_governor", cpu);
+	if (read_sysfs(path, env.governor, sizeof(env.governor)) &&
+	    strcmp(env.governor, "performance") != 0)
+		env.flags |= NOISE_ENV_FREQ_SCALING;
+	snprintf(path, sizeof(path),
+		 "/sys/devices/system/cpu/cpu%d/cpufreq/scaling_min_freq", cpu);
+	env.freq_min_khz = read_sysfs_u32(path);
+	snprintf(path, sizeof(path),
+		 "/sys/devices/system/cpu/cpu%d/cpufreq/scaling_max_freq", cpu);
+	env.freq_max_khz = read_sysfs_u32(path);
+
+	// intel_pstate has its own knob, everything else uses the cpufreq one
+	if (read_sysfs("/sys/devices/system/cpu/intel_pstate/no_turbo", buf,
+		       sizeof(buf)))
+		env.flags |= NOISE_ENV_TURBO_KNOWN |
+			     (strcmp(buf, "0") == 0 ? NOISE_ENV_TURBO : 0);
+	else if (read_sysfs("/sys/devices/system/cpu/cpufreq/boost", buf,
+			    sizeof(buf)))
+		env.flags |= NOISE_ENV_TURBO_KNOWN |
+			     (strcmp(buf, "1") == 0 ? NOISE_ENV_TURBO : 0);
+
+	if (read_sysfs("/sys/devices/system/cpu/smt/active", buf,
+		       sizeof(buf)) &&
+	    strcmp(buf, "1") == 0)
+		env.flags |= NOISE_ENV_SMT_ACTIVE;
+	snprintf(path, sizeof(path),
+		 "/sys/devices/system/cpu/cpu%d/topology/thread_siblings_list",
+		 cpu);
+	bool contains;
+	if (read_sysfs(path, buf, sizeof(buf)))
+		env.smt_siblings =
+			(uint32_t)LmMax(cpulist_count(buf, cpu, &contains) - 1,
+					0);
+
+	if (read_sysfs("/sys/devices/system/cpu/isolated", env.isolated_cpus,
+		       sizeof(env.isolated_cpus))) {
+		cpulist_count(env.isolated_cpus, cpu, &contains);
+		if (contains && env.pinned_cpu >= 0)
+			env.flags |= NOISE_ENV_CPU_ISOLATED;
+	}
+
+	env_captured = true;
+}
+
+// NOTE: (isa): Everything here is best effort. An unprivileged run can't use
+// SCHED_FIFO or lock much memory, and it's still worth running, so failures
+// are warnings and the header records what actually took effect
+void noise_control_apply(const struct noise_params *params)
+{
+	applied = *params;
+	applied.cpu_count = LmMin(applied.cpu_count, NOISE_MAX_CPUS);
+
+	if (applied.cpu_count > 0) {
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET((size_t)applied.cpus[0], &set);
+		if (sched_setaffinity(0, sizeof(set), &set) != 0) {
+			LmLogWarning("Unable to pin to CPU %d: %s",
+				     applied.cpus[0], strerror(errno));
+			applied.cpu_count = 0;
+		}
+	}
+
+	if (applied.sched_fifo) {
+		struct sched_param sp = { .sched_priority =
+						  applied.fifo_priority };
+		if (sched_setscheduler(0, SCHED_FIFO, &sp) != 0)
+			LmLogWarning("Unable to use SCHED_FIFO at priority %d: %s",
+				     applied.fifo_priority, strerror(errno));
+	}
+
+	if (applied.mlockall &&
+	    mlockall(MCL_CURRENT | MCL_FUTURE | MCL_ONFAULT) != 0) {
+		LmLogWarning("Unable to lock the process' memory: %s",
+			     strerror(errno));
+		applied.mlockall = false;
+	}
+
+	capture_env();
+}
+
+const struct noise_env *noise_env_get(void)
+{
+	if (!env_captured)
+		capture_env();
+	return &env;
+}
+
+void noise_env_log(const struct noise_env *e)
+{
+	LmLogInfoR("\nBenchmark environment:\n");
+	if (e->pinned_cpu >= 0)
+		LmLogInfoR("\tpinned to CPU %d%s\n", e->pinned_cpu,
+			   e->flags & NOISE_ENV_CPU_ISOLATED ? " (isolated)" :
+							       "");
+	else
+		LmLogInfoR("\tnot pinned\n");
+	LmLogInfoR("\tscheduler %s, priority %d, memory %slocked\n",
+		   e->sched_policy == SCHED_FIFO ? "SCHED_FIFO" : "SCHED_OTHER",
+		   e->sched_priority, e->flags & NOISE_ENV_MLOCKED ? "" : "not ");
+	LmLogInfoR("\tgovernor %s, %u-%u MHz, turbo %s\n",
+		   e->governor[0] ? e->governor : "unknown",
+		   e->freq_min_khz / 1000, e->freq_max_khz / 1000,
+		   !(e->flags & NOISE_ENV_TURBO_KNOWN) ? "unknown" :
+		   e->flags & NOISE_ENV_TURBO	       ? "on" :
+							 "off");
+	LmLogInfoR("\tSMT %s, %u sibling%s, isolated CPUs: %s\n",
+		   e->flags & NOISE_ENV_SMT_ACTIVE ? "active" : "inactive",
+		   e->smt_siblings, e->smt_siblings == 1 ? "" : "s",
+		   e->isolated_cpus[0] ? e->isolated_cpus : "none");
+	LmLogInfoR("\t%lu warm-up allocations before each timed phase\n",
+		   e->warmup);
+
+	if (e->flags & NOISE_ENV_FREQ_SCALING)
+		LmLogWarning("The %s governor scales the CPU frequency",
+			     e->governor);
+	if (e->flags & NOISE_ENV_TURBO)
+		LmLogWarning("Turbo is on, the clock depends on the load");
+	if (e->pinned_cpu >= 0 && e->smt_siblings > 0)
+		LmLogWarning("CPU %d shares its core with %u other hardware "
+			     "thread%s",
+			     e->pinned_cpu, e->smt_siblings,
+			     e->smt_siblings == 1 ? "" : "s");
+}
+
+// The CPUs the test threads are spread over: the configured ones if the
+// benchmark is pinned, otherwise the ones we're allowed to run on, so thread
+// i can be pinned to the i-th of them even when restricted by taskset
+int noise_cpus(int *cpus, int max_cpus)
+{
+	if (applied.cpu_count > 0) {
+		int count = LmMin(applied.cpu_count, max_cpus);
+		memcpy(cpus, applied.cpus, (size_t)count * sizeof(int));
+		return count;
+	}
+
+	cpu_set_t set;
+	if (sched_getaffinity(0, sizeof(set), &set) != 0) {
+		LmLogWarning("Unable to get CPU affinity: %s", strerror(errno));
+		return 0;
+	}
+
+	int count = 0;
+	for (int cpu = 0; cpu < CPU_SETSIZE && count < max_cpus; ++cpu) {
+		if (CPU_ISSET((size_t)cpu, &set))
+			cpus[count++] = cpu;
+	}
+
+	return count;
+}
+
+void pin_thread_to_cpu(int cpu)
+{
+	if (cpu < 0)
+		return;
+
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET((size_t)cpu, &set);
+	int err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+	if (err != 0)
+		LmLogWarning("Unable to pin thread to CPU %d: %s", cpu,
+			     strerror(err));
+}
+
+// The first other hardware thread on cpu's core, or -1 if it has none
+int noise_smt_sibling(int cpu)
+{
+	char path[128];
+	char buf[64];
+	snprintf(path, sizeof(path),
+		 "/sys/devices/system/cpu/cpu%d/topology/thread_siblings_list",
+		 cpu);
+	if (!read_sysfs(path, buf, sizeof(buf)))
+		return -1;
+
+	for (const char *p = buf; *p;) {
+		if (*p < '0' || *p > '9') {
+			++p;
+			continue;
+		}
+
+		char *end;
+		long first = strtol(p, &end, 10);
+		long last = first;
+		if (*end == '-')
+			last = strtol(end + 1, &end, 10);
+		for (long c = first; c <= last; ++c)
+			if (c != cpu)
+				return (int)c;
+		p = end;
+	}
+	return -1;
+}
@@ -0,0 +1,50 @@
+#ifndef NOISE_CONTROL_H
+#define NOISE_CONTROL_H
+
+#include <src/lm.h>
+
+#define NOISE_MAX_CPUS 64
+
+// Set up in the benchmark process before any test runs, so the forked
+// children and the test threads inherit it
+struct noise_params {
+	int cpus[NOISE_MAX_CPUS]; // The main thread runs on cpus[0]
+	int cpu_count; // 0 leaves the affinity alone
+	bool sched_fifo;
+	int fifo_priority;
+	bool mlockall;
+	uint64_t warmup; // Untimed allocations before each timed phase
+};
+
+enum noise_env_flag {
+	NOISE_ENV_MLOCKED = 1u << 0,
+	NOISE_ENV_TURBO_KNOWN = 1u << 1,
+	NOISE_ENV_TURBO = 1u << 2,
+	NOISE_ENV_SMT_ACTIVE = 1u << 3,
+	NOISE_ENV_CPU_ISOLATED = 1u << 4, // The pinned CPU is in isolcpus
+	NOISE_ENV_FREQ_SCALING = 1u << 5, // The governor isn't "performance"
+};
+
+// What the run was measured under, recorded in every result header
+struct noise_env {
+	int pinned_cpu; // -1 if not pinned
+	int sched_policy;
+	int sched_priority;
+	uint32_t flags;
+	uint64_t warmup;
+	uint32_t smt_siblings; // Other hardware threads on the CPU's core
+	uint32_t freq_min_khz;
+	uint32_t freq_max_khz;
+	char governor[24];
+	char isolated_cpus[64];
+};
+
+void noise_control_apply(const struct noise_params *params);
+const struct noise_env *noise_env_get(void);
+void noise_env_log(const struct noise_env *env);
+
+int noise_cpus(int *cpus, int max_cpus);
+void pin_thread_to_cpu(int cpu);
+int noise_smt_sibling(int cpu);
+
+#endif
@@ -0,0 +1,47 @@
+#ifndef RANDOM_H
+#define RANDOM_H
+
+#include <stdint.h>
+
+__extension__ typedef unsigned __int128 rng_u128;
+
+// Small deterministic generator for the workloads, so a seed in the config
+// reproduces a run exactly. Not meant for anything but benchmarks
+struct rng {
+	uint64_t state;
+};
+
+// splitmix64, so seeds that differ by a bit still give unrelated streams
+static inline void rng_seed(struct rng *rng, uint64_t seed)
+{
+	uint64_t z = seed + 0x9e3779b97f4a7c15ULL;
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	rng->state = (z ^ (z >> 31)) | 1;
+}
+
+// xorshift64*
+static inline uint64_t rng_next(struct rng *rng)
+{
+	uint64_t x = rng->state;
+	x ^= x >> 12;
+	x ^= x << 25;
+	x ^= x >> 27;
+	rng->state = x;
+	return x * 0x2545f4914f6cdd1dULL;
+}
+
+// Uniform in [0, n), using the high half of a 64x64 multiply rather than a
+// modulo
+static inline uint64_t rng_below(struct rng *rng, uint64_t n)
+{
+	return (uint64_t)(((rng_u128)rng_next(rng) * n) >> 64);
+}
+
+// Uniform in [0, 1)
+static inline double rng_double(struct rng *rng)
+{
+	return (double)(rng_next(rng) >> 11) * 0x1.0p-53;
+}
+
+#endif
@@ -5,6 +5,11 @@ LM_LOG_REGISTER(system_info);
 
 #include <unistd.h>
 #include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <sys/utsname.h>
 
 #include <src/metrics/timing.h>
 
@@ -57,6 +62,39 @@ double get_tsc_freq(void)
 	return tsc_freq;
 }
 
+static int compare_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a;
+	uint64_t y = *(const uint64_t *)b;
+	return (x > y) - (x < y);
+}
+
+// The cost of an empty lfence/rdtsc/lfence pair, i.e. what every timing taken
+// with START/END_TSC_TIMING_LFENCE includes on top of the code it brackets.
+// The median is used since the minimum is a single lucky sample, and anything
+// above it includes interrupts
+uint64_t get_tsc_timer_overhead(void)
+{
+	static uint64_t overhead = 0;
+	static bool overhead_has_been_calibrated = false;
+	if (!overhead_has_been_calibrated) {
+		enum { WARMUP = 1024, SAMPLES = 8192 };
+		static uint64_t samples[SAMPLES];
+		for (int i = 0; i < WARMUP + SAMPLES; ++i) {
+			START_TSC_TIMING_LFENCE(empty);
+			END_TSC_TIMING_LFENCE(empty);
+			if (i >= WARMUP)
+				samples[i - WARMUP] = empty_end - empty_start;
+		}
+
+		qsort(samples, SAMPLES, sizeof(uint64_t), compare_u64);
+		overhead = samples[SAMPLES / 2];
+		overhead_has_been_calibrated = true;
+	}
+
+	return overhead;
+}
+
 // NOTE: Original written by claude
 size_t get_page_size(void)
 {
@@ -79,3 +117,81 @@ size_t get_l1d_cacheln_sz(void)
 		 "L1 cache line size returned from sysconf was <= 0");
 	return (size_t)l1d_cache_line;
 }
+
+// Highest online NUMA node, 0 if the kernel does not expose any
+int get_numa_max_node(void)
+{
+	// Format is a list of ranges, e.g. "0-1,3"
+	FILE *file = fopen("/sys/devices/system/node/online", "r");
+	if (!file)
+		return 0;
+
+	char buf[256] = { 0 };
+	size_t len = fread(buf, 1, sizeof(buf) - 1, file);
+	fclose(file);
+
+	int max_node = 0;
+	for (size_t i = 0; i < len;) {
+		if (buf[i] < '0' || buf[i] > '9') {
+			++i;
+			continue;
+		}
+
+		char *end;
+		long node = strtol(&buf[i], &end, 10);
+		if (node > max_node)
+			max_node = (int)node;
+		i = (size_t)(end - buf);
+	}
+
+	return max_node;
+}
+
+int get_current_numa_node(void)
+{
+	unsigned int cpu, node;
+	if (syscall(SYS_getcpu, &cpu, &node, NULL) != 0) {
+		LmLogWarning("getcpu failed (%s), assuming node 0",
+			     strerror(errno));
+		return 0;
+	}
+
+	return (int)node;
+}
+
+// The "model name" of the first CPU in /proc/cpuinfo, or "unknown"
+void get_cpu_model(char *buf, size_t len)
+{
+	snprintf(buf, len, "unknown");
+	FILE *file = fopen("/proc/cpuinfo", "r");
+	if (!file)
+		return;
+
+	char line[512];
+	while (fgets(line, sizeof(line), file)) {
+		if (strncmp(line, "model name", strlen("model name")) != 0)
+			continue;
+
+		char *value = strchr(line, ':');
+		if (!value)
+			break;
+		value += 1 + strspn(value + 1, " \t");
+		value[strcspn(value, "\n")] = '\0';
+		snprintf(buf, len, "%s", value);
+		break;
+	}
+
+	fclose(file);
+}
+
+// The kernel release and version as uname reports them
+void get_kernel_version(char *buf, size_t len)
+{
+	struct utsname uts;
+	if (uname(&uts) != 0) {
+		snprintf(buf, len, "unknown");
+		return;
+	}
+
+	snprintf(buf, len, "%s %s", uts.release, uts.version);
+}
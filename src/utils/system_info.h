@@ -3,12 +3,18 @@
 
 #include <unistd.h>
 #include <stdbool.h>
+#include <stdint.h>
 
 bool cpu_has_invariant_tsc(void);
 double get_tsc_freq(void);
+uint64_t get_tsc_timer_overhead(void);
 double get_cpu_freq_ghz(void);
 size_t get_page_size(void);
 size_t get_l1d_cacheln_sz(void);
+int get_numa_max_node(void);
+int get_current_numa_node(void);
+void get_cpu_model(char *buf, size_t len);
+void get_kernel_version(char *buf, size_t len);
 
 struct cache_info get_cpu_cache_info(void);
 void print_cache_info(struct cache_info info);